@@ -0,0 +1,965 @@
+// belvedere_bench.c - micro-benchmarks for the config, lookup and dispatch hot paths
+//
+// Usage: belvedere_bench [--json] [--min-time MS] [--filter NAME]
+//
+// Human-readable results go to stdout by default. With --json every result is printed as one
+// JSON object per line so runs can be archived and compared across releases.
+
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/actions.h"
+#include "../include/config.h"
+#include "../include/debug.h"
+#include "../include/dispatch.h"
+#include "../include/hid_manager.h"
+#include "../include/hid_uring.h"
+#include "../include/loop_monitor.h"
+#include "../include/metrics.h"
+#include "../include/timer_wheel.h"
+#include "../include/uinput.h"
+
+#ifndef BELVEDERE_VERSION
+#define BELVEDERE_VERSION "unknown"
+#endif
+
+#define BENCH_MAX_FAKE_DEVICES 64
+#define BENCH_KEY 100            // first key bound in every keyboard section
+#define BENCH_GROUP_KEY 150      // first key bound in the shared group
+#define BENCH_LEADERS 16         // leader sequences per keyboard
+#define BENCH_SHARED_SECTIONS 3  // the group, the vendor-wide and the any-device section
+
+// Global configuration (used by the HID manager)
+config_t config = {0};
+
+static bool json_output = false;
+static uint64_t min_time_ns = 200 * 1000000ULL;
+static const char* name_filter = NULL;
+static char temp_dir[] = "/tmp/belvedere_bench_XXXXXX";
+
+/*
+ * Allocation counting. On GNU toolchains the benchmark is linked with --wrap for the allocator
+ * entry points, so every allocation made by belvedere code is counted. Allocations made inside
+ * libc itself (e.g. stdio buffers) are not visible this way.
+ */
+static uint64_t alloc_count = 0;
+
+#ifdef BENCH_COUNT_ALLOCS
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+char* __real_strdup(const char* s);
+
+void* __wrap_malloc(size_t size)
+{
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+char* __wrap_strdup(const char* s)
+{
+    alloc_count++;
+    return __real_strdup(s);
+}
+#endif
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+typedef void (*bench_fn_t)(void* ctx);
+
+/**
+ * Run fn repeatedly, doubling the iteration count until the run lasts at least min_time_ns,
+ * then report the per-operation cost. ops_per_call scales results for functions that perform
+ * several logical operations per call (e.g. one poll pass over many devices).
+ */
+static void run_bench(const char* name, const char* params, bench_fn_t fn, void* ctx,
+                      uint64_t ops_per_call)
+{
+    if (name_filter && !strstr(name, name_filter))
+        return;
+
+    uint64_t iterations = 1;
+    for (;;)
+    {
+        uint64_t allocs_before = alloc_count;
+        uint64_t start = now_ns();
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            fn(ctx);
+        }
+        uint64_t elapsed = now_ns() - start;
+        uint64_t allocs = alloc_count - allocs_before;
+
+        if (elapsed < min_time_ns && iterations < (1ULL << 32))
+        {
+            iterations *= 2;
+            continue;
+        }
+
+        uint64_t ops = iterations * ops_per_call;
+        double ns_per_op = (double)elapsed / (double)ops;
+        double allocs_per_op = (double)allocs / (double)ops;
+
+        if (json_output)
+        {
+            printf("{\"version\":\"%s\",\"benchmark\":\"%s\",\"params\":\"%s\","
+                   "\"iterations\":%" PRIu64 ",\"ns_per_op\":%.2f,",
+                   BELVEDERE_VERSION, name, params, ops, ns_per_op);
+#ifdef BENCH_COUNT_ALLOCS
+            printf("\"allocs_per_op\":%.3f}\n", allocs_per_op);
+#else
+            (void)allocs_per_op;
+            printf("\"allocs_per_op\":null}\n");
+#endif
+        }
+        else
+        {
+#ifdef BENCH_COUNT_ALLOCS
+            printf("%-24s %-28s %12" PRIu64 " %12.1f ns/op %8.3f allocs/op\n", name, params, ops,
+                   ns_per_op, allocs_per_op);
+#else
+            printf("%-24s %-28s %12" PRIu64 " %12.1f ns/op %8s allocs/op\n", name, params, ops,
+                   ns_per_op, "n/a");
+#endif
+        }
+        fflush(stdout);
+        return;
+    }
+}
+
+/**
+ * Write a config shaped like a multi-keyboard setup: every keyboard has a base section that
+ * uses a shared group, a section in each further layer and a few leader sequences, with a
+ * vendor-wide and an any-device section behind them. Each section is filled to MAX_BINDINGS
+ * and the whole stays within MAX_SECTIONS, so the parser keeps all of it. An edited config
+ * differs only in one binding of the first keyboard's top layer section.
+ */
+static bool write_config(const char* path, int keyboards, int layers, bool edited)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+        return false;
+
+    static const char* leds[] = {"caps", "num", "scroll"};
+    static const char modes[] = {'^', '+', '-'};
+
+    fprintf(f, "[general]\n");
+    fprintf(f, "setleds = /usr/local/bin/setleds\n");
+    fprintf(f, "monitored_keycodes = 57,71,83,111,112\n\n");
+    fprintf(f, "[group:shared]\n");
+    for (int b = 0; b < MAX_BINDINGS; b++)
+    {
+        fprintf(f, "%d = %c%s\n", BENCH_GROUP_KEY + b, modes[b % 3], leds[b % 3]);
+    }
+    for (int k = 0; k < keyboards; k++)
+    {
+        for (int l = 0; l < layers; l++)
+        {
+            if (l == 0)
+                fprintf(f, "\n[0x%04x/0x%04x]\ngroup = shared\n", 0x1000 + k, 0x2000 + k);
+            else
+                fprintf(f, "\n[0x%04x/0x%04x:layer%d]\n", 0x1000 + k, 0x2000 + k, l);
+            for (int b = 0; b < MAX_BINDINGS; b++)
+            {
+                char mode = edited && k == 0 && l == layers - 1 && b == 0 ? '-' : modes[b % 3];
+                fprintf(f, "%d = %c%s\n", BENCH_KEY + b, mode, leds[b % 3]);
+            }
+            for (int i = 0; l == 0 && i < BENCH_LEADERS; i++)
+            {
+                fprintf(f, "200,%d,%d = ^caps\n", 210 + i / 4, 220 + i % 4);
+            }
+        }
+    }
+    fprintf(f, "\n[0x1000/*]\n");
+    fprintf(f, "%d = ^num\n", BENCH_KEY);
+    fprintf(f, "\n[*/*]\n");
+    fprintf(f, "%d = ^scroll\n", BENCH_KEY);
+    fclose(f);
+    return true;
+}
+
+// Sections write_config() produces; anything the parser drops would skew the numbers
+static size_t config_sections(int keyboards, int layers)
+{
+    return (size_t)(keyboards * layers) + BENCH_SHARED_SECTIONS;
+}
+
+/* ---- load_config ---- */
+
+typedef struct
+{
+    const char* path;
+    config_t cfg;
+} load_ctx_t;
+
+// A first load: no file text cached and no previous sections to compare with
+static void bench_load_config(void* ctx)
+{
+    load_ctx_t* c = ctx;
+    free_config(&c->cfg);
+    memset(&c->cfg, 0, sizeof(c->cfg));
+    if (!load_config(c->path, &c->cfg))
+    {
+        fprintf(stderr, "load_config failed for %s\n", c->path);
+        exit(1);
+    }
+}
+
+// A reload of an unchanged file: the cached text is parsed again and nothing is rebuilt
+static void bench_reload_config(void* ctx)
+{
+    load_ctx_t* c = ctx;
+    if (!load_config(c->path, &c->cfg))
+    {
+        fprintf(stderr, "load_config failed for %s\n", c->path);
+        exit(1);
+    }
+}
+
+typedef struct
+{
+    const char* paths[2];  // the config and its one-section edit
+    int next;
+    config_t cfg;
+} edit_ctx_t;
+
+// A reload after one section changed. Alternating between the two files reads the other one
+// each time, as an edit would, and rebuilds only what the changed section reaches.
+static void bench_reload_edit(void* ctx)
+{
+    edit_ctx_t* c = ctx;
+    const char* path = c->paths[c->next++ & 1];
+    if (!load_config(path, &c->cfg))
+    {
+        fprintf(stderr, "load_config failed for %s\n", path);
+        exit(1);
+    }
+}
+
+/* ---- get_command_for_key ---- */
+
+typedef struct
+{
+    const config_t* cfg;
+    uint16_t vendor;
+    uint16_t product;
+    uint16_t keycode;
+} lookup_ctx_t;
+
+static volatile uintptr_t lookup_sink;
+
+static void bench_lookup(void* ctx)
+{
+    lookup_ctx_t* c = ctx;
+    char command[COMMAND_MAX];
+    lookup_sink =
+        (uintptr_t)get_command_for_key(c->cfg, c->vendor, c->product, c->keycode, command,
+                                       sizeof(command));
+}
+
+static void bench_lookup_table(void* ctx)
+{
+    lookup_ctx_t* c = ctx;
+    lookup_sink = (uintptr_t)lookup_binding(c->cfg, c->vendor, c->product, c->keycode, NULL);
+}
+
+// Worst case of the modifier decision table: miss on the mask, then the plain binding
+static void bench_lookup_modified(void* ctx)
+{
+    lookup_ctx_t* c = ctx;
+    const keymap_entry_t* e =
+        lookup_keymap_entry(c->cfg, c->vendor, c->product, c->keycode, MOD_CTRL);
+    if (!e)
+        e = lookup_keymap_entry(c->cfg, c->vendor, c->product, c->keycode, 0);
+    lookup_sink = (uintptr_t)e;
+}
+
+/* ---- report decoding ---- */
+
+static volatile uint16_t decode_sink;
+
+static void bench_decode(void* ctx)
+{
+    const unsigned char* report = ctx;
+    uint16_t keycode = 0;
+    if (hid_manager_decode_report(report, 8, &keycode))
+        decode_sink = keycode;
+}
+
+/* ---- end-to-end dispatch through a fake backend ---- */
+
+static struct
+{
+    struct hid_device_info infos[BENCH_MAX_FAKE_DEVICES];
+    int count;
+    unsigned char report[8];
+    bool release;
+} fake;
+
+static int fake_init(void)
+{
+    return 0;
+}
+
+static int fake_exit(void)
+{
+    return 0;
+}
+
+static struct hid_device_info* fake_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+    (void)vendor_id;
+    (void)product_id;
+    return fake.count > 0 ? &fake.infos[0] : NULL;
+}
+
+static void fake_free_enumeration(struct hid_device_info* devs)
+{
+    (void)devs;  // Static storage
+}
+
+static hid_device* fake_open_path(const char* path)
+{
+    (void)path;
+    return (hid_device*)&fake;  // Any non-NULL handle
+}
+
+static void fake_close(hid_device* device)
+{
+    (void)device;
+}
+
+static int fake_read_timeout(hid_device* device, unsigned char* data, size_t length,
+                             int milliseconds)
+{
+    (void)device;
+    (void)milliseconds;
+    size_t n = length < sizeof(fake.report) ? length : sizeof(fake.report);
+    memcpy(data, fake.report, n);
+    if (fake.release)
+        data[0] = 0;
+    return (int)n;
+}
+
+static const hid_backend_t fake_backend = {
+    .init = fake_init,
+    .exit = fake_exit,
+    .enumerate = fake_enumerate,
+    .free_enumeration = fake_free_enumeration,
+    .open_path = fake_open_path,
+    .close = fake_close,
+    .read_timeout = fake_read_timeout,
+};
+
+// The dispatch state and devices every dispatch benchmark runs against
+static dispatch_t dispatch;
+static hid_manager_t manager;
+static metrics_t metrics;
+
+static uint64_t executed = 0;
+
+static int noop_executor(char* const argv[])
+{
+    (void)argv;
+    executed++;
+    return 0;
+}
+
+static void bench_key_event(uint16_t vendor_id, uint16_t product_id, uint8_t section,
+                            uint16_t keycode, uint8_t modifiers, bool pressed, void* user_data)
+{
+    (void)user_data;
+    dispatch_device_key(&dispatch, &config, section, vendor_id, product_id, keycode, modifiers,
+                        pressed);
+}
+
+static void bench_poll(void* ctx)
+{
+    (void)ctx;
+    hid_manager_poll(&manager);
+    // Alternate press and release reports so every poll produces an event per device
+    fake.release = !fake.release;
+}
+
+static void bench_dispatch(const char* path, int keyboards, int layers)
+{
+    if (!write_config(path, keyboards, layers, false) || !load_config(path, &config))
+    {
+        fprintf(stderr, "Failed to prepare dispatch config\n");
+        exit(1);
+    }
+
+    fake.count = 0;
+    for (int k = 0; k < keyboards && k < BENCH_MAX_FAKE_DEVICES; k++)
+    {
+        struct hid_device_info* info = &fake.infos[fake.count];
+        memset(info, 0, sizeof(*info));
+        info->path = "fake";
+        info->vendor_id = (unsigned short)(0x1000 + k);
+        info->product_id = (unsigned short)(0x2000 + k);
+        if (fake.count > 0)
+            fake.infos[fake.count - 1].next = info;
+        fake.count++;
+    }
+
+    // Report a key of the shared group, in the top layer, so the lookup walks the whole chain
+    memset(fake.report, 0, sizeof(fake.report));
+    fake.report[0] = BENCH_GROUP_KEY + MAX_BINDINGS - 1;
+    set_layer(&config, config.layer_count - 1);
+
+    hid_manager_set_backend(&manager, &fake_backend);
+    hid_manager_set_config(&manager, &config);
+    if (!hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) ||
+        !hid_manager_reload(&manager))
+    {
+        fprintf(stderr, "Failed to initialize fake backend\n");
+        exit(1);
+    }
+    while (hid_manager_reloading(&manager))
+    {
+        uv_run(uv_default_loop(), UV_RUN_ONCE);
+    }
+    hid_manager_set_key_callback(&manager, bench_key_event, NULL);
+
+    char params[64];
+    snprintf(params, sizeof(params), "keyboards=%d,layers=%d", keyboards, layers);
+    run_bench("dispatch_end_to_end", params, bench_poll, NULL, (uint64_t)fake.count);
+
+    hid_manager_cleanup(&manager);
+    hid_manager_set_backend(&manager, NULL);
+}
+
+/* ---- write actions ---- */
+
+static void bench_write_action(void* ctx)
+{
+    (void)ctx;
+    dispatch_key_event(&dispatch, &config, 0x1000, 0x2000, 100);
+}
+
+static void bench_write_actions(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+        return;
+    fprintf(f, "[0x1000/0x2000]\n100 = append:/dev/null caps on\\n\n");
+    fclose(f);
+
+    if (!load_config(path, &config) || !actions_open(&dispatch.actions, &config))
+    {
+        fprintf(stderr, "Failed to prepare write action config\n");
+        exit(1);
+    }
+    run_bench("dispatch_write_action", "target=append:/dev/null", bench_write_action, NULL, 1);
+    actions_cleanup(&dispatch.actions);
+}
+
+/* ---- key actions ---- */
+
+static ssize_t discard_events(const void* data, size_t length)
+{
+    (void)data;
+    return (ssize_t)length;
+}
+
+static void bench_key_actions(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+        return;
+    fprintf(f, "[0x1000/0x2000]\n100 = key: ctrl+shift+t\n");
+    fclose(f);
+
+    if (!load_config(path, &config))
+    {
+        fprintf(stderr, "Failed to prepare key action config\n");
+        exit(1);
+    }
+    uinput_set_sink(&dispatch.uinput, discard_events);
+    run_bench("dispatch_key_action", "keys=3", bench_write_action, NULL, 1);
+    uinput_set_sink(&dispatch.uinput, NULL);
+}
+
+/* ---- hidraw reads ---- */
+
+typedef struct
+{
+    int pipes[HID_URING_MAX_DEVICES][2];
+    int count;
+    int delivered;  // reports seen by the io_uring callback
+} read_ctx_t;
+
+static void count_report(size_t slot, const unsigned char* report, int length, void* user_data)
+{
+    (void)slot;
+    (void)report;
+    read_ctx_t* r = user_data;
+    if (length > 0)
+        r->delivered++;
+}
+
+static void send_reports(read_ctx_t* r)
+{
+    static const unsigned char report[8] = {0x00, 0x00, 0x04};
+    for (int i = 0; i < r->count; i++)
+    {
+        if (write(r->pipes[i][1], report, sizeof(report)) != (ssize_t)sizeof(report))
+            exit(1);
+    }
+}
+
+// What the polling path costs per report: a zero-timeout poll and a read for every device
+static void bench_read_poll(void* ctx)
+{
+    read_ctx_t* r = ctx;
+    unsigned char buf[HID_URING_REPORT_SIZE];
+    send_reports(r);
+    for (int i = 0; i < r->count; i++)
+    {
+        struct pollfd pfd = {.fd = r->pipes[i][0], .events = POLLIN};
+        if (poll(&pfd, 1, 0) == 1)
+            decode_sink = (uint16_t)read(r->pipes[i][0], buf, sizeof(buf));
+    }
+}
+
+// The io_uring path: completions drained on one wakeup, reads re-posted with one submit
+static void bench_read_uring(void* ctx)
+{
+    read_ctx_t* r = ctx;
+    send_reports(r);
+    int expected = r->delivered + r->count;
+    while (r->delivered < expected)
+        uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+}
+
+static bool open_pipes(read_ctx_t* r, int count)
+{
+    r->count = count;
+    r->delivered = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (pipe(r->pipes[i]) != 0)
+            return false;
+    }
+    return true;
+}
+
+static void close_pipes(read_ctx_t* r)
+{
+    for (int i = 0; i < r->count; i++)
+    {
+        close(r->pipes[i][0]);
+        close(r->pipes[i][1]);
+    }
+}
+
+static void bench_hid_reads(void)
+{
+    const int counts[] = {1, 8, HID_URING_MAX_DEVICES};
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        read_ctx_t r;
+        char params[64];
+        if (!open_pipes(&r, counts[i]))
+        {
+            perror("pipe");
+            exit(1);
+        }
+        snprintf(params, sizeof(params), "path=poll,devices=%d", counts[i]);
+        run_bench("hid_read", params, bench_read_poll, &r, (uint64_t)r.count);
+
+        int fds[HID_URING_MAX_DEVICES];
+        for (int d = 0; d < r.count; d++)
+        {
+            fds[d] = r.pipes[d][0];
+        }
+        hid_uring_t ring;
+        hid_uring_init(&ring);
+        if (hid_uring_start(&ring, uv_default_loop(), fds, (size_t)r.count, count_report, &r))
+        {
+            snprintf(params, sizeof(params), "path=uring,devices=%d", counts[i]);
+            run_bench("hid_read", params, bench_read_uring, &r, (uint64_t)r.count);
+            hid_uring_stop(&ring);
+            uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+        }
+        close_pipes(&r);
+    }
+}
+
+/* ---- loop monitor ---- */
+
+// The cost every instrumented callback pays: one stage nested in another, as dispatch runs
+// inside HID polling
+static void bench_stage(void* ctx)
+{
+    loop_monitor_t* monitor = ctx;
+    uint64_t outer = loop_monitor_begin(monitor);
+    uint64_t inner = loop_monitor_begin(monitor);
+    loop_monitor_end(monitor, LOOP_STAGE_DISPATCH, inner);
+    loop_monitor_end(monitor, LOOP_STAGE_HID, outer);
+}
+
+static void bench_loop_monitor(void)
+{
+    loop_monitor_t monitor = {0};
+    if (!loop_monitor_init(&monitor, uv_default_loop(), DEFAULT_STALL_MS))
+    {
+        fprintf(stderr, "Failed to start loop monitor\n");
+        exit(1);
+    }
+    run_bench("loop_monitor_stage", "nesting=2", bench_stage, &monitor, 2);
+    loop_monitor_cleanup(&monitor);
+    uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+}
+
+/* ---- timer wheel ---- */
+
+typedef struct
+{
+    timer_wheel_t wheel;
+    wheel_timer_t* timers;
+    size_t count;
+} wheel_ctx_t;
+
+static void on_bench_timer(wheel_timer_t* timer)
+{
+    (void)timer;
+}
+
+// Schedule every timer with delays spread over the first two levels, then run them all
+static void bench_timer_wheel(void* ctx)
+{
+    wheel_ctx_t* w = ctx;
+    for (size_t i = 0; i < w->count; i++)
+    {
+        timer_wheel_schedule(&w->wheel, &w->timers[i], 1 + (i * 7919) % 2000, on_bench_timer,
+                             NULL);
+    }
+    timer_wheel_advance(&w->wheel, w->wheel.now + 2000);
+}
+
+static void bench_timer_wheels(void)
+{
+    const size_t counts[] = {1000, 10000};
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        wheel_ctx_t w = {.count = counts[i]};
+        w.timers = calloc(w.count, sizeof(*w.timers));
+        if (!w.timers || !timer_wheel_init(&w.wheel, NULL, NULL))
+        {
+            fprintf(stderr, "Failed to prepare timer wheel\n");
+            exit(1);
+        }
+        char params[64];
+        snprintf(params, sizeof(params), "timers=%zu", w.count);
+        run_bench("timer_wheel_schedule_fire", params, bench_timer_wheel, &w, w.count);
+        timer_wheel_close(&w.wheel);
+        free(w.timers);
+    }
+}
+
+/* ---- leader sequences ---- */
+
+// Three-key sequences: 16 x 16 x (sequences / 256) keys under one device
+static bool write_leader_config(const char* path, int sequences)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+        return false;
+
+    fprintf(f, "[general]\n");
+    fprintf(f, "setleds = /usr/local/bin/setleds\n\n");
+    fprintf(f, "[0x1000/0x2000]\n");
+    for (int i = 0; i < sequences; i++)
+    {
+        fprintf(f, "%d,%d,%d = ^caps\n", 100 + i % 16, 200 + (i / 16) % 16, 300 + i / 256);
+    }
+    fclose(f);
+    return true;
+}
+
+typedef struct
+{
+    const config_t* cfg;
+    int sequences;
+    int next;
+} leader_ctx_t;
+
+// Walk one complete sequence, cycling through all of them
+static void bench_leader_walk(void* ctx)
+{
+    leader_ctx_t* c = ctx;
+    int i = c->next++ % c->sequences;
+    uint32_t node = leader_next(c->cfg, c->cfg->devices[0].leader_root, 100 + i % 16);
+    node = leader_next(c->cfg, node, 200 + (i / 16) % 16);
+    node = leader_next(c->cfg, node, 300 + i / 256);
+    lookup_sink = (uintptr_t)leader_action(c->cfg, node);
+}
+
+static void bench_leaders(const char* path)
+{
+    const int counts[] = {256, 4096};
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        if (!write_leader_config(path, counts[i]))
+        {
+            perror("write_leader_config");
+            exit(1);
+        }
+        char params[64];
+        snprintf(params, sizeof(params), "sequences=%d", counts[i]);
+
+        load_ctx_t load = {.path = path};
+        run_bench("leader_load_config", params, bench_load_config, &load, 1);
+        bench_load_config(&load);
+
+        leader_ctx_t walk = {.cfg = &load.cfg, .sequences = counts[i]};
+        run_bench("leader_walk", params, bench_leader_walk, &walk, 1);
+        free_config(&load.cfg);
+    }
+}
+
+/* ---- groups and wildcard sections ---- */
+
+// One group of bindings shared by an exact, a vendor-wide and an any-device section
+static bool write_group_config(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+        return false;
+
+    fprintf(f, "[general]\n");
+    fprintf(f, "setleds = /usr/local/bin/setleds\n\n");
+    fprintf(f, "[group:keys]\n");
+    for (int b = 0; b < MAX_BINDINGS; b++)
+    {
+        fprintf(f, "%d = ^caps\n", 100 + b);
+    }
+    fprintf(f, "[0x1000/0x2000]\ngroup = keys\n");
+    fprintf(f, "[0x1000/*]\ngroup = keys\n");
+    fprintf(f, "[*/*]\ngroup = keys\n");
+    fclose(f);
+    return true;
+}
+
+static void bench_groups(const char* path)
+{
+    if (!write_group_config(path))
+    {
+        perror("write_group_config");
+        exit(1);
+    }
+    load_ctx_t load = {.path = path};
+    bench_load_config(&load);
+
+    // Resolution is a device index probe per fallback level; the key is then one table probe
+    lookup_ctx_t exact = {&load.cfg, 0x1000, 0x2000, 100 + MAX_BINDINGS - 1};
+    lookup_ctx_t vendor = {&load.cfg, 0x1000, 0x2fff, 100 + MAX_BINDINGS - 1};
+    lookup_ctx_t any = {&load.cfg, 0x3000, 0x4000, 100 + MAX_BINDINGS - 1};
+    run_bench("lookup_table_group", "section=exact", bench_lookup_table, &exact, 1);
+    run_bench("lookup_table_group", "section=vendor", bench_lookup_table, &vendor, 1);
+    run_bench("lookup_table_group", "section=any", bench_lookup_table, &any, 1);
+    free_config(&load.cfg);
+}
+
+/* ---- command templates ---- */
+
+typedef struct
+{
+    const config_t* cfg;
+    uint8_t template;
+} render_ctx_t;
+
+static void bench_render(void* ctx)
+{
+    render_ctx_t* c = ctx;
+    command_context_t context = {0x5043, 0x54a3, 111, '^', "caps"};
+    char buf[COMMAND_MAX];
+    char* argv[COMMAND_MAX_ARGS + 1];
+    lookup_sink = render_command(c->cfg, c->template, &context, buf, sizeof(buf), argv);
+}
+
+static void bench_templates(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+    {
+        perror("bench_templates");
+        exit(1);
+    }
+    fprintf(f, "[general]\nsetleds = /usr/local/bin/setleds\n");
+    fprintf(f, "[0x1000/0x2000]\n");
+    fprintf(f, "100 = cmd: notify-send \"key {keycode} on {device}\" {mode}{led} {vendor}\n");
+    fclose(f);
+
+    load_ctx_t load = {.path = path};
+    bench_load_config(&load);
+    render_ctx_t setleds = {&load.cfg, TEMPLATE_NONE};
+    render_ctx_t placeholders = {&load.cfg, 0};
+    run_bench("render_command", "template=setleds", bench_render, &setleds, 1);
+    run_bench("render_command", "template=placeholders", bench_render, &placeholders, 1);
+    free_config(&load.cfg);
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [--json] [--min-time MS] [--filter NAME]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+        {
+            json_output = true;
+        }
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+        {
+            min_time_ns = strtoull(argv[++i], NULL, 10) * 1000000ULL;
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            name_filter = argv[++i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!mkdtemp(temp_dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    char path[PATH_MAX];
+    char edited_path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/config", temp_dir);
+    snprintf(edited_path, sizeof(edited_path), "%s/config.edited", temp_dir);
+
+    if (!json_output)
+    {
+        printf("belvedere %s benchmarks\n", BELVEDERE_VERSION);
+        printf("%-24s %-28s %12s %18s %18s\n", "benchmark", "params", "ops", "time", "allocs");
+    }
+
+    // Config sizes: one keyboard, a typical desk, and as many keyboards in every layer as
+    // MAX_SECTIONS holds
+    const int sizes[][2] = {
+        {1, 1},
+        {2, 4},
+        {(MAX_SECTIONS - BENCH_SHARED_SECTIONS) / MAX_LAYERS, MAX_LAYERS},
+    };
+    const size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+
+    for (size_t i = 0; i < size_count; i++)
+    {
+        int keyboards = sizes[i][0];
+        int layers = sizes[i][1];
+        char params[64];
+        snprintf(params, sizeof(params), "keyboards=%d,layers=%d,sections=%zu", keyboards,
+                 layers, config_sections(keyboards, layers));
+
+        if (!write_config(path, keyboards, layers, false) ||
+            !write_config(edited_path, keyboards, layers, true))
+        {
+            perror("write_config");
+            return 1;
+        }
+        load_ctx_t load = {.path = path};
+        run_bench("load_config", params, bench_load_config, &load, 1);
+        bench_load_config(&load);  // In case the filter skipped it
+        if (load.cfg.device_count != config_sections(keyboards, layers))
+        {
+            fprintf(stderr, "Parser kept %zu of %zu sections\n", load.cfg.device_count,
+                    config_sections(keyboards, layers));
+            return 1;
+        }
+        run_bench("reload_config_noop", params, bench_reload_config, &load, 1);
+
+        edit_ctx_t edit = {.paths = {path, edited_path}};
+        bench_reload_edit(&edit);
+        run_bench("reload_config_edit", params, bench_reload_edit, &edit, 1);
+        free_config(&edit.cfg);
+
+        // Lookups against the parsed config: the first keyboard's own binding in the base
+        // layer, then from the last keyboard in the top layer a key that falls through its
+        // layer and base sections to the group, and a miss
+        config_t* cfg = &load.cfg;
+        uint16_t last_vendor = (uint16_t)(0x1000 + keyboards - 1);
+        uint16_t last_product = (uint16_t)(0x2000 + keyboards - 1);
+        lookup_ctx_t first_hit = {cfg, 0x1000, 0x2000, BENCH_KEY};
+        lookup_ctx_t last_hit = {cfg, last_vendor, last_product,
+                                 BENCH_GROUP_KEY + MAX_BINDINGS - 1};
+        lookup_ctx_t miss = {cfg, last_vendor, last_product, 0xFFFF};
+        run_bench("lookup_first", params, bench_lookup, &first_hit, 1);
+        run_bench("lookup_table_first", params, bench_lookup_table, &first_hit, 1);
+        set_layer(cfg, cfg->layer_count - 1);
+        if (!lookup_binding(cfg, last_vendor, last_product, last_hit.keycode, NULL))
+        {
+            fprintf(stderr, "Group key not found from the top layer\n");
+            return 1;
+        }
+        run_bench("lookup_last", params, bench_lookup, &last_hit, 1);
+        run_bench("lookup_miss", params, bench_lookup, &miss, 1);
+        run_bench("lookup_table_last", params, bench_lookup_table, &last_hit, 1);
+        run_bench("lookup_table_miss", params, bench_lookup_table, &miss, 1);
+        run_bench("lookup_table_modified", params, bench_lookup_modified, &last_hit, 1);
+        free_config(cfg);
+    }
+
+    unsigned char report[8] = {111, 0, 0, 0, 0, 0, 0, 0};
+    run_bench("decode_report", "bytes=8", bench_decode, report, 1);
+
+    if (!dispatch_init(&dispatch, uv_default_loop(), NULL, NULL))
+    {
+        fprintf(stderr, "Failed to initialize dispatch\n");
+        return 1;
+    }
+    dispatch_set_executor(&dispatch, noop_executor);
+    for (size_t i = 0; i < size_count; i++)
+    {
+        bench_dispatch(path, sizes[i][0], sizes[i][1]);
+    }
+    dispatch_set_executor(&dispatch, NULL);
+
+    bench_write_actions(path);
+    bench_key_actions(path);
+    bench_hid_reads();
+    bench_loop_monitor();
+    bench_timer_wheels();
+    bench_leaders(path);
+    bench_groups(path);
+    bench_templates(path);
+    dispatch_cleanup(&dispatch);
+
+    unlink(path);
+    unlink(edited_path);
+    rmdir(temp_dir);
+    return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef ACTIONS_H
+#define ACTIONS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "config.h"
+
+#define ACTIONS_PENDING_SIZE 4096
+
+// One open FIFO, file or socket
+typedef struct
+{
+    action_type_t type;
+    char path[MAX_PATH];
+    int fd;
+    uv_poll_t* poll_handle;  // active while queued FIFO data waits for the reader
+    size_t pending_len;
+    char pending[ACTIONS_PENDING_SIZE];
+} actions_target_t;
+
+// The write targets of one configuration
+typedef struct
+{
+    uv_loop_t* loop;
+    actions_target_t targets[MAX_ACTION_TARGETS];
+    size_t target_count;
+} actions_t;
+
+/**
+ * Initialize write actions on the given loop.
+ *
+ * @param actions Targets to initialize
+ * @param loop Loop used to flush writes that could not complete immediately
+ * @return true on success, false otherwise
+ */
+bool actions_init(actions_t* actions, uv_loop_t* loop);
+
+/**
+ * Open the FIFOs, files and sockets referenced by a configuration, closing those of the
+ * previous configuration. Targets that cannot be opened yet (e.g. a FIFO without a reader)
+ * are retried on their next write.
+ *
+ * @param actions Targets to replace
+ * @param config Loaded configuration
+ * @return true on success, false otherwise
+ */
+bool actions_open(actions_t* actions, const config_t* config);
+
+/**
+ * Close all targets and release resources.
+ */
+void actions_cleanup(actions_t* actions);
+
+/**
+ * Write a binding's payload to its target without blocking. FIFO data that does not fit
+ * is queued and flushed when the FIFO becomes writable.
+ *
+ * @param actions Open targets
+ * @param target Index into the configuration's targets
+ * @param payload Bytes to write
+ * @param length Number of bytes
+ * @return 0 if the payload was written or queued, -1 if it was dropped
+ */
+int actions_write(actions_t* actions, uint8_t target, const char* payload, size_t length);
+
+#endif  // ACTIONS_H
@@ -0,0 +1,72 @@
+#ifndef CHORD_H
+#define CHORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+// Runs the chord binding at config->devices[device].bindings[binding]
+typedef void (*chord_fire_cb_t)(const config_t* config, uint8_t device, uint8_t binding,
+                                void* user_data);
+
+// Delivers a key event that was held back while it might have started a chord
+typedef void (*chord_replay_cb_t)(const config_t* config, uint8_t device, uint16_t vendor_id,
+                                  uint16_t product_id, uint16_t keycode, uint8_t modifiers,
+                                  bool pressed, void* user_data);
+
+// Automaton state per config device
+typedef struct
+{
+    uint8_t state;  // 0 when no chord keys are held
+    uint8_t held_count;
+    uint8_t deferred;  // bit per held key whose press was held back
+    uint16_t held[MAX_CHORD_KEYS];
+    uint8_t modifiers[MAX_CHORD_KEYS];
+} chord_device_t;
+
+typedef struct
+{
+    chord_fire_cb_t fire;
+    chord_replay_cb_t replay;
+    void* user_data;
+    chord_device_t devices[MAX_SECTIONS];
+} chord_t;
+
+/**
+ * Set the functions that run completed chords and replay held-back keys.
+ *
+ * @param chords Automatons to initialize
+ * @param fire_cb Function that runs a completed chord
+ * @param replay_cb Function that delivers held-back keys
+ * @param user_data Passed to both functions
+ */
+void chord_init(chord_t* chords, chord_fire_cb_t fire_cb, chord_replay_cb_t replay_cb,
+                void* user_data);
+
+/**
+ * Feed a key event through the device's chord automaton.
+ *
+ * A press that can start or continue a chord is held back. Completing a chord runs its
+ * binding and drops the held-back presses; pressing a key that continues no chord, or
+ * releasing one of the held keys, replays the held-back presses (and that release) in order.
+ *
+ * @param chords Automatons
+ * @param config Pointer to compiled configuration
+ * @param device Section the device resolved to, KEYMAP_EMPTY if none
+ * @param vendor_id Device vendor ID
+ * @param product_id Device product ID
+ * @param keycode Key code reported by the device
+ * @param modifiers HID modifier byte at the time of the event
+ * @param pressed true for a press, false for a release
+ * @return true if the event was consumed, false if it should be dispatched as usual
+ */
+bool chord_key(chord_t* chords, const config_t* config, uint8_t device, uint16_t vendor_id,
+               uint16_t product_id, uint16_t keycode, uint8_t modifiers, bool pressed);
+
+/**
+ * Forget held chord keys on every device without replaying them.
+ */
+void chord_reset(chord_t* chords);
+
+#endif  // CHORD_H
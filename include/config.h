@@ -4,11 +4,157 @@
 #include <stdint.h>
 
 #define MAX_BINDINGS 5
-#define MAX_CONFIG_DEVICES 5
+#define MAX_SECTIONS 40  // device, layer, group and wildcard sections: 5 devices in 8 layers
 #define MAX_MONITORED_KEYCODES 5
+#define MAX_ACTION_TARGETS 8
+#define MAX_PAYLOAD 64
+#define MAX_SEQUENCE_STEPS 64
 #define MAX_PATH 256
+#define MAX_CONFIG_FILES 16  // the main file and the conf.d fragments merged after it
+#define CONF_D_DIR "conf.d"  // fragment directory, next to the main file
+#define MAX_TEMPLATES 16
+#define MAX_TEMPLATE_SEGMENTS 128
+#define TEMPLATE_TEXT_MAX 1024  // literal text of every template
+#define COMMAND_MAX 256         // rendered command, including the argument terminators
+#define COMMAND_MAX_ARGS 16
+#define TEMPLATE_NONE 0xFF
+
+// Compiled lookup table size; a power of two at least twice the entries one layer can hold
+#define KEYMAP_SIZE 1024
+#define KEYMAP_EMPTY 0xFF
+#define CHORDMAP_SIZE 256
+#define MAX_CHORD_KEYS 4
+#define MAX_LAYERS 8
+#define LAYER_NAME_MAX 32
+#define LAYER_NONE 0xFF
+#define DEVICE_INDEX_SIZE 128  // power of two at least twice MAX_SECTIONS
+#define SECTION_CHAIN_MAX 4   // layer section, its group, base section, its group
+
+// Modifier mask bits; left and right keys are folded together
+#define MOD_CTRL 0x01
+#define MOD_SHIFT 0x02
+#define MOD_ALT 0x04
+#define MOD_GUI 0x08
+
+// HID usages of the eight modifier keys (left ctrl, shift, alt, gui, then right)
+#define HID_MODIFIER_FIRST 0xE0
+#define HID_MODIFIER_LAST 0xE7
 
 #define DEFAULT_SETLEDS_PATH "/usr/local/bin/setleds"
+#define DEFAULT_HOLD_MS 250
+#define DEFAULT_DOUBLE_TAP_MS 200
+#define DEFAULT_LEADER_TIMEOUT_MS 1000
+#define DEFAULT_STALL_MS 100
+#define DEFAULT_METRICS_INTERVAL_MS 15000
+#define LEADER_MAX_KEYS 16
+#define LEADER_NONE 0  // node 0 is never used, so zeroed configs have no sequences
+
+typedef enum
+{
+    EXECUTOR_SYSTEM = 0,  // posix_spawn and wait on the loop thread
+    EXECUTOR_HELPER,      // pre-forked helper process using posix_spawn
+} executor_mode_t;
+
+typedef enum
+{
+    HID_READER_POLL = 0,  // hid_read_timeout() on every device each poll tick
+    HID_READER_URING,     // reads posted to io_uring for hidraw devices, polling elsewhere
+} hid_reader_t;
+
+typedef enum
+{
+    ACTION_SETLEDS = 0,  // run setleds with mode+led
+    ACTION_FIFO,         // write payload to a FIFO
+    ACTION_APPEND,       // append payload to a file
+    ACTION_DATAGRAM,     // send payload as a datagram to a Unix socket
+    ACTION_SEQUENCE,     // run timed LED steps from config_t.steps
+    ACTION_LAYER,        // switch config_t.active to another layer
+    ACTION_COMMAND,      // run the command template config_t.templates[target]
+    ACTION_KEYS,         // emit the key codes in payload through the virtual keyboard
+} action_type_t;
+
+typedef enum
+{
+    SEGMENT_TEXT = 0,  // literal text from config_t.template_text
+    SEGMENT_BREAK,     // end of an argument
+    SEGMENT_VENDOR,    // {vendor}, four hex digits
+    SEGMENT_PRODUCT,   // {product}, four hex digits
+    SEGMENT_KEYCODE,   // {keycode}, decimal
+    SEGMENT_DEVICE,    // {device}, vendor:product
+    SEGMENT_LED,       // {led}
+    SEGMENT_MODE,      // {mode}, '^', '+' or '-'
+    SEGMENT_SETLEDS,   // {setleds}, config_t.setleds_path
+} segment_type_t;
+
+// One piece of a command template, parsed at load time
+typedef struct
+{
+    uint8_t type;     // segment_type_t
+    uint8_t len;      // text length, for SEGMENT_TEXT
+    uint16_t offset;  // text position in config_t.template_text, for SEGMENT_TEXT
+} template_segment_t;
+
+// A command line as a run of segments in config_t.segments
+typedef struct
+{
+    uint16_t first_segment;
+    uint16_t segment_count;
+    uint16_t max_len;  // bytes it renders to at most, leaving out {setleds}
+    uint8_t setleds;   // {setleds} placeholders, each as long as config_t.setleds_path
+} command_template_t;
+
+// Values substituted for a template's placeholders
+typedef struct
+{
+    uint16_t vendor;
+    uint16_t product;
+    uint16_t keycode;
+    char mode;
+    const char* led;  // may be NULL
+} command_context_t;
+
+typedef enum
+{
+    TRIGGER_PRESS = 0,   // key press, or a tap when the key also has hold/double-tap bindings
+    TRIGGER_HOLD,        // key held for hold_ms
+    TRIGGER_DOUBLE_TAP,  // second press within double_tap_ms of a tap
+    TRIGGER_CHORD,       // keycode and every key in chord held together
+} trigger_t;
+
+typedef enum
+{
+    SECTION_DEVICE = 0,  // [VID/PID]
+    SECTION_VENDOR,      // [VID/*], any product of a vendor
+    SECTION_ANY,         // [*/*], any device
+    SECTION_GROUP,       // [group:NAME], bindings used by other sections
+} section_kind_t;
+
+typedef enum
+{
+    REPORT_KEYCODE = 0,  // byte 0 is the one key down, 0 when none
+    REPORT_BOOT,         // HID boot keyboard: modifier byte, reserved, six keycodes
+} report_format_t;
+
+typedef enum
+{
+    INPUT_HID = 0,  // raw HID reports read through hidapi
+    INPUT_EVDEV,    // key events decoded by the kernel, read from /dev/input/event*
+} input_source_t;
+
+// One LED operation of a timed sequence
+typedef struct
+{
+    uint16_t delay_ms;  // wait after the previous step
+    char mode;          // '^', '+', or '-'
+    char led[16];
+} sequence_step_t;
+
+// A file, FIFO or socket written to by bindings; opened once per config load
+typedef struct
+{
+    action_type_t type;
+    char path[MAX_PATH];
+} action_target_t;
 
 typedef struct
 {
@@ -16,29 +162,201 @@ typedef struct
     char led[16];  // "caps", "num", "scroll"
     char mode;     // '^', '+', or '-'
     bool has_mode_override;
+    action_type_t action;
+    uint8_t target;  // index into config_t.targets for write actions, config_t.layers for layer
+                     // actions (LAYER_NONE if the layer is unknown), config_t.templates for
+                     // command actions
+    uint8_t payload_len;
+    char payload[MAX_PAYLOAD];  // layer name for layer actions, with mode '^' to toggle; packed
+                                // uint16_t key codes for key actions, 0 between strokes
+    uint16_t debounce_ms;  // drop events closer than this to the previous event, 0 disables
+    uint16_t max_rate;     // maximum triggers per second, 0 disables
+    uint8_t first_step;    // first entry in config_t.steps for sequences
+    uint8_t step_count;
+    uint8_t trigger;         // trigger_t
+    uint16_t hold_ms;        // hold threshold, set on the press binding, 0 for the default
+    uint16_t double_tap_ms;  // double-tap window, set on the press binding, 0 for the default
+    uint8_t modifiers;       // MOD_* mask that must be held, 0 for any
+    uint8_t chord_len;       // number of keys in chord, for TRIGGER_CHORD
+    uint16_t chord[MAX_CHORD_KEYS - 1];  // other keys of a chord
 } key_binding_t;
 
 typedef struct
 {
-    uint16_t vendor;
-    uint16_t product;
-    char target[128];  // wildcard match name for target device
+    uint16_t vendor;            // unused for [*/*] and group sections
+    uint16_t product;           // unused for [VID/*], [*/*] and group sections
+    uint8_t kind;               // section_kind_t
+    char target[128];           // wildcard match name for target device
+    char name[LAYER_NAME_MAX];  // group name, for group sections
     char default_mode;
+    uint8_t report_format;  // report_format_t
+    bool led_sync;          // receives the shared LED state as output reports
+    uint8_t input;          // input_source_t
+    bool grab;              // evdev input only: keep the device's keys from other readers
+    uint8_t layer;          // index into config_t.layers, 0 for the base layer
+    uint8_t group;          // group section also used by this one, KEYMAP_EMPTY if none
+    uint8_t refs;           // for group sections, the number of sections using the group
+    uint32_t leader_root;   // trie node of this device's sequences, LEADER_NONE if none
+    uint16_t leader_timeout_ms;
     key_binding_t bindings[10];
     size_t binding_count;
+    uint32_t hash;  // hash of the section's text and parsed bindings, to find the sections a
+                    // reload changed
 } device_config_t;
 
+/**
+ * One slot of the compiled device index, an open-addressing hash of (kind, vendor, product)
+ * to the section that devices matching an exact or vendor-wide section resolve to.
+ */
+typedef struct
+{
+    uint16_t vendor;
+    uint16_t product;  // 0 for SECTION_VENDOR
+    uint8_t kind;      // SECTION_DEVICE or SECTION_VENDOR
+    uint8_t device;    // index into config_t.devices, KEYMAP_EMPTY for a free slot
+} device_index_entry_t;
+
+/**
+ * One slot of the compiled lookup table, an open-addressing hash of
+ * (table, keycode, modifiers) to the binding's position in config_t.devices. Devices whose
+ * sections resolve to the same bindings share a table number, so their keys share entries.
+ */
+typedef struct
+{
+    uint8_t table;  // binding table, from layer_t.tables
+    uint16_t keycode;
+    uint8_t modifiers;
+    uint8_t device;      // index into config_t.devices, KEYMAP_EMPTY for a free slot
+    uint8_t binding;     // index into device_config_t.bindings
+    uint8_t hold;        // hold binding, KEYMAP_EMPTY if none
+    uint8_t double_tap;  // double-tap binding, KEYMAP_EMPTY if none
+    uint16_t hold_ms;
+    uint16_t double_tap_ms;
+} keymap_entry_t;
+
+/**
+ * One transition of the compiled chord automaton, an open-addressing hash of
+ * (table, state, keycode). State 0 means no chord keys are held; every other state stands for
+ * a set of held keys that is part of at least one chord.
+ */
+typedef struct
+{
+    uint8_t table;  // binding table, from layer_t.tables
+    uint16_t keycode;
+    uint8_t state;    // state before the key is pressed
+    uint8_t next;     // state after the key is pressed
+    uint8_t device;   // index into config_t.devices, KEYMAP_EMPTY for a free slot
+    uint8_t binding;  // chord binding completed by this key, KEYMAP_EMPTY if none
+} chord_entry_t;
+
+/**
+ * Leader-key sequences of all devices, compiled into one flat trie. Nodes and edges live in
+ * arrays; edges are an open-addressing hash of (node, keycode), so each key of a sequence
+ * advances the trie with one probe.
+ */
+typedef struct
+{
+    uint32_t action;    // 1-based index into leader_trie_t.actions, 0 if none
+    uint32_t children;  // number of outgoing edges
+} leader_node_t;
+
+typedef struct
+{
+    uint32_t node;  // parent node, LEADER_NONE for a free slot
+    uint32_t child;
+    uint16_t keycode;
+} leader_edge_t;
+
+typedef struct
+{
+    leader_node_t* nodes;  // index 0 unused
+    size_t node_count;
+    size_t node_capacity;
+    leader_edge_t* edges;
+    size_t edge_count;
+    size_t edge_capacity;  // power of two
+    key_binding_t* actions;
+    size_t action_count;
+    size_t action_capacity;
+} leader_trie_t;
+
+// One file of a configuration, cached so an unchanged file is not read again on reload
+typedef struct
+{
+    char path[MAX_PATH];
+    int64_t mtime_ns;  // modification time and size when the text was read
+    int64_t size;
+    uint32_t hash;  // hash of the text
+    char* text;     // heap-allocated; released by free_config()
+} config_file_t;
+
+// What the last load_config() changed, compared with the configuration it replaced
+typedef struct
+{
+    uint16_t files;     // bit per config_t.files entry that is new or whose text changed
+    uint64_t sections;  // bit per config_t.devices entry whose text changed
+    uint8_t layers;     // bit per config_t.layers entry whose tables were rebuilt
+    bool layout;        // sections were added, removed or matched differently; all rebuilt
+    bool devices;       // device matching or reading options changed; devices need reopening
+} config_changes_t;
+
+/**
+ * One binding layer compiled into its own lookup tables. A layer's tables hold its own
+ * sections' bindings and, for keys it does not bind, the base layer's. Tables are not changed
+ * after compile_config(), so switching layers is a swap of config_t.active.
+ */
+typedef struct
+{
+    char name[LAYER_NAME_MAX];
+    uint8_t tables[MAX_SECTIONS];  // binding table per resolved device section, KEYMAP_EMPTY
+                                   // if the device has no bindings in this layer
+    keymap_entry_t keymap[KEYMAP_SIZE];
+    chord_entry_t chordmap[CHORDMAP_SIZE];
+    size_t chord_count;  // chord bindings compiled into chordmap
+} layer_t;
+
 typedef struct
 {
     char setleds_path[MAX_PATH];
-    device_config_t devices[10];
+    char control_path[MAX_PATH];  // control socket, empty if disabled
+    char metrics_path[MAX_PATH];  // Prometheus textfile, empty if disabled
+    uint32_t metrics_interval_ms;
+    char status_name[MAX_PATH];   // shared memory status segment, empty if disabled
+    executor_mode_t executor;
+    uint32_t coalesce_ms;  // window for merging setleds invocations, 0 disables
+    hid_reader_t hid_reader;
+    uint32_t stall_ms;  // loop callback time reported as a stall, 0 disables
+    device_config_t devices[MAX_SECTIONS];  // device, layer and group sections
     size_t device_count;
+    device_index_entry_t device_index[DEVICE_INDEX_SIZE];
+    uint8_t any_device;  // [*/*] section, KEYMAP_EMPTY if none
     uint32_t monitored_keycodes[MAX_MONITORED_KEYCODES];
     size_t monitored_keycodes_count;
+    action_target_t targets[MAX_ACTION_TARGETS];
+    size_t target_count;
+    sequence_step_t steps[MAX_SEQUENCE_STEPS];
+    size_t step_count;
+    command_template_t templates[MAX_TEMPLATES];
+    size_t template_count;
+    template_segment_t segments[MAX_TEMPLATE_SEGMENTS];
+    size_t segment_count;
+    char template_text[TEMPLATE_TEXT_MAX];
+    size_t template_text_len;
+    uint8_t led_command;  // template run by LED bindings, TEMPLATE_NONE to run setleds directly
+    bool key_actions;     // some binding emits keys, so the virtual keyboard is needed
+    layer_t layers[MAX_LAYERS];  // layers[0] is the base layer
+    size_t layer_count;
+    const layer_t* active;  // layer used by lookups; set by compile_config() and set_layer()
+    leader_trie_t leaders;  // heap-allocated; reused by later loads, released by free_config()
+    bool compiled;
+    config_file_t files[MAX_CONFIG_FILES];  // files[0] is the main file, then fragments by name
+    size_t file_count;
+    char fragment_dir[MAX_PATH];  // conf.d directory the fragments were looked for in
+    uint32_t layout_hash;         // section kinds, matches, layers and groups
+    uint32_t devices_hash;  // what decides which devices are opened and how
+    config_changes_t changes;
 } config_t;
 
-extern config_t config;
-
 /**
  * Load configuration from a file.
  * If filename is NULL, searches for config in the following order:
@@ -46,20 +364,234 @@ extern config_t config;
  * 2. $HOME/.config/belvedere/config
  * 3. /etc/belvedere/config
  *
+ * Files ending in .ini in the conf.d directory next to the file are merged after it, in
+ * byte order of their names; each starts outside any section, and an unreadable one is
+ * skipped. Files unchanged since the last load are not read again.
+ *
+ * Reloading into a compiled configuration rebuilds only the layers whose sections changed,
+ * and records what changed in config_t.changes.
+ *
  * @param filename Optional path to config file. If NULL, uses XDG paths.
- * @param config Pointer to config_t structure to populate
+ * @param config Pointer to config_t structure to populate; zeroed or previously loaded
  * @return true if config was loaded successfully, false otherwise
  */
 bool load_config(const char* filename, config_t* config);
 
 /**
- * Get the command string for a given key on a device.
+ * Release memory owned by a configuration. The configuration can be loaded again afterwards.
+ *
+ * @param config Pointer to configuration to release
+ */
+void free_config(config_t* config);
+
+/**
+ * Build the lookup tables of every layer. load_config() calls this; call it again after
+ * modifying devices or bindings by hand. The active layer stays selected if it still exists.
+ *
+ * @param config Pointer to configuration to compile
+ */
+void compile_config(config_t* config);
+
+/**
+ * Find a layer by name.
+ *
+ * @param config Pointer to loaded configuration
+ * @param name Layer name; "base" is the base layer
+ * @return Index into config_t.layers, or -1 if there is no such layer
+ */
+int find_layer(const config_t* config, const char* name);
+
+/**
+ * Make a compiled layer the one used by lookups.
+ *
+ * @param config Pointer to compiled configuration
+ * @param layer Index into config_t.layers
+ * @return true if the layer exists, false otherwise
+ */
+bool set_layer(config_t* config, size_t layer);
+
+/**
+ * Find the section a device's bindings are looked up through: its exact VID/PID section if
+ * there is one, else its vendor-wide section, else the section for any device. Of several
+ * sections for the same pattern, the first base-layer one is used. A compiled configuration
+ * answers from its device index without scanning the sections.
+ *
+ * @param config Pointer to loaded configuration
+ * @param vendor Device vendor ID
+ * @param product Device product ID
+ * @return Index into config_t.devices, or KEYMAP_EMPTY if no section applies to the device
+ */
+uint8_t resolve_device(const config_t* config, uint16_t vendor, uint16_t product);
+
+/**
+ * List the sections whose bindings apply to a resolved device in a layer, most specific
+ * first: the layer's section for the device's pattern, its group, the base section and its
+ * group. Sections that do not exist are left out.
+ *
+ * @param config Pointer to loaded configuration
+ * @param device Section from resolve_device()
+ * @param layer Index into config_t.layers
+ * @param sections Receives up to SECTION_CHAIN_MAX indexes into config_t.devices
+ * @return Number of sections stored
+ */
+size_t device_sections(const config_t* config, uint8_t device, size_t layer, uint8_t* sections);
+
+/**
+ * Find the binding for a given key on a device using the active layer's lookup table.
+ * Typically a single probe regardless of the number of devices and bindings.
+ *
+ * @param config Pointer to compiled configuration
+ * @param vendor Device vendor ID
+ * @param product Device product ID
+ * @param keycode Key code to look up
+ * @param slot Receives a stable index for per-binding runtime state, may be NULL
+ * @return Matching binding if found, NULL otherwise
+ */
+const key_binding_t* lookup_binding(const config_t* config, uint16_t vendor, uint16_t product,
+                                    uint16_t keycode, uint16_t* slot);
+
+/**
+ * Find the active layer's lookup table entry for a key, including its hold and double-tap
+ * bindings and thresholds. Bindings without modifiers are only found with modifiers of 0.
+ *
+ * @param config Pointer to compiled configuration
+ * @param vendor Device vendor ID
+ * @param product Device product ID
+ * @param keycode Key code to look up
+ * @param modifiers MOD_* mask currently held
+ * @return Matching entry if found, NULL otherwise
+ */
+const keymap_entry_t* lookup_keymap_entry(const config_t* config, uint16_t vendor,
+                                          uint16_t product, uint16_t keycode, uint8_t modifiers);
+
+/**
+ * lookup_keymap_entry() for a device whose section was resolved when it was opened: a single
+ * probe of the active layer's table, with no device lookup.
+ *
+ * @param config Pointer to compiled configuration
+ * @param device Section from resolve_device(), KEYMAP_EMPTY if none applies
+ * @param keycode Key code to look up
+ * @param modifiers MOD_* mask currently held
+ * @return Matching entry if found, NULL otherwise
+ */
+const keymap_entry_t* lookup_section_entry(const config_t* config, uint8_t device,
+                                           uint16_t keycode, uint8_t modifiers);
+
+/**
+ * Find the active layer's chord automaton transition for pressing a key in a given state.
+ *
+ * @param config Pointer to compiled configuration
+ * @param vendor Device vendor ID
+ * @param product Device product ID
+ * @param state Current automaton state, 0 when no chord keys are held
+ * @param keycode Key being pressed
+ * @return Matching transition if the key continues a chord, NULL otherwise
+ */
+const chord_entry_t* lookup_chord(const config_t* config, uint16_t vendor, uint16_t product,
+                                  uint8_t state, uint16_t keycode);
+
+/**
+ * lookup_chord() for a device whose section is already resolved.
+ *
+ * @param config Pointer to compiled configuration
+ * @param device Section from resolve_device(), KEYMAP_EMPTY if none applies
+ * @param state Current automaton state, 0 when no chord keys are held
+ * @param keycode Key being pressed
+ * @return Matching transition if the key continues a chord, NULL otherwise
+ */
+const chord_entry_t* lookup_section_chord(const config_t* config, uint8_t device, uint8_t state,
+                                          uint16_t keycode);
+
+/**
+ * Number of distinct slots lookup_binding() can return.
+ */
+#define BINDING_SLOTS (sizeof(((config_t*)0)->devices) / sizeof(((config_t*)0)->devices[0]) * \
+                       sizeof(((device_config_t*)0)->bindings) /                         \
+                       sizeof(((device_config_t*)0)->bindings[0]))
+
+/**
+ * Follow the trie edge for a key from a leader-sequence node.
+ *
+ * @param config Pointer to loaded configuration
+ * @param node Current node, such as a device's leader_root
+ * @param keycode Key pressed next
+ * @return Next node, or LEADER_NONE if no sequence continues with this key
+ */
+uint32_t leader_next(const config_t* config, uint32_t node, uint16_t keycode);
+
+/**
+ * The action bound to a leader-sequence node.
+ *
+ * @return Binding run when the sequence ends at this node, NULL if none does
+ */
+const key_binding_t* leader_action(const config_t* config, uint32_t node);
+
+/**
+ * Stable index of an entry's binding for per-binding runtime state, as from lookup_binding().
+ */
+static inline uint16_t keymap_entry_slot(const keymap_entry_t* entry)
+{
+    return (uint16_t)(entry->device * (sizeof(((device_config_t*)0)->bindings) /
+                                       sizeof(((device_config_t*)0)->bindings[0])) +
+                      entry->binding);
+}
+
+/**
+ * Template LED bindings run, or TEMPLATE_NONE to run setleds with "{mode}{led}" directly.
+ */
+static inline uint8_t led_command_template(const config_t* config)
+{
+    return config->led_command < config->template_count ? config->led_command : TEMPLATE_NONE;
+}
+
+/**
+ * Fold a HID modifier byte (left keys in bits 0-3, right keys in bits 4-7) into a MOD_* mask.
+ */
+static inline uint8_t modifier_mask(uint8_t hid_modifiers)
+{
+    return (uint8_t)((hid_modifiers | hid_modifiers >> 4) & 0x0F);
+}
+
+/**
+ * Find the binding for a given key on a device.
+ *
+ * @param config Pointer to loaded configuration
+ * @param vendor Device vendor ID
+ * @param product Device product ID
+ * @param keycode Key code to look up
+ * @return Matching binding if found, NULL otherwise
+ */
+const key_binding_t* get_binding_for_key(const config_t* config, uint16_t vendor,
+                                         uint16_t product, uint16_t keycode);
+
+/**
+ * Render a command template into an argument vector. Every argument is written to buf,
+ * terminated by '\0', and argv points into it, ending with NULL. Placeholders are copied from
+ * the context; no formatting functions are involved.
+ *
+ * @param config Pointer to loaded configuration
+ * @param template Index into config_t.templates, or TEMPLATE_NONE for "{setleds} {mode}{led}"
+ * @param context Values for the placeholders
+ * @param buf Receives the arguments; COMMAND_MAX bytes holds every template load_config()
+ *            accepts, as templates and setleds paths that could render longer are rejected
+ * @param size Size of buf
+ * @param argv Receives COMMAND_MAX_ARGS + 1 pointers
+ * @return Number of arguments, 0 if the template is invalid or does not fit buf
+ */
+size_t render_command(const config_t* config, uint8_t template, const command_context_t* context,
+                      char* buf, size_t size, char** argv);
+
+/**
+ * Get the command line for a given key on a device, with its arguments separated by spaces.
+ * LED bindings give the LED command and command bindings their template.
  *
  * @param config Pointer to loaded configuration
  * @param vendor Device vendor ID
  * @param product Device product ID
  * @param keycode Key code to look up
- * @return Command string if found, NULL otherwise
+ * @param buf Receives the command line; COMMAND_MAX bytes is enough, as for render_command()
+ * @param size Size of buf
+ * @return buf, or NULL if there is no binding, it does not run a command or it does not fit
  */
 const char* get_command_for_key(const config_t* config, uint16_t vendor, uint16_t product,
-                                uint16_t keycode);
+                                uint16_t keycode, char* buf, size_t size);
@@ -0,0 +1,78 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <uv.h>
+
+#include "config.h"
+#include "dispatch.h"
+#include "loop_monitor.h"
+
+// Longest command or reply line, newline included
+#define CONTROL_LINE_MAX 1024
+
+typedef struct
+{
+    uv_pipe_t* server;  // NULL while not listening
+    config_t* config;
+    dispatch_t* dispatch;
+    loop_monitor_t* monitor;  // NULL reports zero loop counters
+    char path[MAX_PATH];
+} control_t;
+
+/**
+ * Prepare a control endpoint without listening yet.
+ *
+ * @param control Control state to initialize
+ * @param config Configuration that commands act on
+ * @param dispatch Dispatch state that commands act on
+ * @param monitor Monitor whose counters stats reports, or NULL
+ */
+void control_init(control_t* control, config_t* config, dispatch_t* dispatch,
+                  loop_monitor_t* monitor);
+
+/**
+ * Listen for control commands on a Unix stream socket. Each command is one line and gets
+ * one line in reply; see control_execute() for the commands.
+ *
+ * @param control Control state prepared by control_init()
+ * @param loop Loop that serves the socket
+ * @param path Socket path; a stale socket at this path is replaced
+ * @return true if the socket is listening, false otherwise
+ */
+bool control_listen(control_t* control, uv_loop_t* loop, const char* path);
+
+/**
+ * Stop listening, close open connections and remove the socket.
+ */
+void control_cleanup(control_t* control);
+
+/**
+ * Run one control command:
+ *   layer         reply with the active layer's name
+ *   layer NAME    switch to layer NAME
+ *   layers        reply with all layer names, separated by spaces
+ *   stats         reply with the dispatch and loop counters as key=value pairs
+ *
+ * @param control Control state whose configuration and dispatch the command acts on
+ * @param command Command line, without the newline
+ * @param reply Receives the reply, newline terminated: "ok", a value, or "error: ..."
+ * @param size Size of reply
+ * @return Length of the reply
+ */
+size_t control_execute(control_t* control, const char* command, char* reply, size_t size);
+
+/**
+ * Send a command to a running daemon and wait for its reply. Blocks; meant for the command
+ * line client rather than the daemon's loop.
+ *
+ * @param path Socket path
+ * @param command Command line, without the newline
+ * @param reply Receives the reply without its newline
+ * @param size Size of reply
+ * @return 0 on success, -1 if the daemon could not be reached
+ */
+int control_send(const char* path, const char* command, char* reply, size_t size);
+
+#endif  // CONTROL_H
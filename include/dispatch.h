@@ -0,0 +1,224 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "actions.h"
+#include "chord.h"
+#include "config.h"
+#include "executor.h"
+#include "gesture.h"
+#include "leader.h"
+#include "led_state.h"
+#include "loop_monitor.h"
+#include "sequence.h"
+#include "timer_wheel.h"
+#include "uinput.h"
+
+#define DISPATCH_COALESCE_LEDS 8
+#define DISPATCH_HELD_MAX 16  // gesture keys held at once
+
+typedef struct
+{
+    uint64_t dispatched;    // events that matched a binding and ran its action
+    uint64_t unmatched;     // events with no binding
+    uint64_t debounced;     // events dropped by a binding's debounce_ms
+    uint64_t rate_limited;  // events dropped by a binding's max_rate
+    uint64_t failed;        // actions whose write failed or whose command could not start
+} dispatch_stats_t;
+
+// Runs a resolved command given as a NULL-terminated argv; returns the command's status
+typedef int (*command_executor_t)(char* const argv[]);
+
+typedef struct
+{
+    char led[16];
+    char mode;  // net operation for this LED, 0 if the window's operations cancelled out
+} led_op_t;
+
+// Runtime state per binding slot; plain arrays so the hot path never allocates
+typedef struct
+{
+    uint64_t last_event_ns;     // last event seen, accepted or not
+    uint64_t last_accepted_ns;  // last event that ran its action
+    uint64_t suppressed;
+} binding_state_t;
+
+/**
+ * Everything bindings act on, and the state key events build up between them: the LED state,
+ * action targets and virtual keyboard, the timer wheel with the sequences, gestures, chords
+ * and leader keys it times, and the counters.
+ */
+typedef struct
+{
+    executor_t* executor;            // runs commands, NULL if only run_command does
+    command_executor_t run_command;  // replaces the executor when set
+    loop_monitor_t* monitor;
+    led_state_t leds;
+    actions_t actions;
+    uinput_t uinput;
+    timer_wheel_t wheel;
+    bool wheel_ready;
+    sequence_t sequences;
+    gesture_t gestures;
+    chord_t chords;
+    leader_t leaders;
+    binding_state_t binding_state[BINDING_SLOTS];
+    dispatch_stats_t stats;
+
+    // The key event being dispatched, for command placeholders; timed actions see the latest
+    struct
+    {
+        uint16_t vendor;
+        uint16_t product;
+        uint16_t keycode;
+    } event;
+
+    // Gesture keys that are down and the entry each was pressed with; a release carries the
+    // modifiers left after it, so looking the key up again could find another entry
+    struct
+    {
+        uint16_t vendor;
+        uint16_t product;
+        uint16_t keycode;
+        const keymap_entry_t* entry;
+    } held[DISPATCH_HELD_MAX];
+    size_t held_count;
+
+    struct
+    {
+        uv_timer_t* timer;
+        bool pending;
+        char setleds_path[MAX_PATH];
+        led_op_t ops[DISPATCH_COALESCE_LEDS];
+        size_t op_count;
+    } coalesce;
+} dispatch_t;
+
+/**
+ * Initialize dispatch on the given loop, with no action targets open and every LED off.
+ *
+ * @param dispatch Dispatch state to initialize
+ * @param loop Loop used for the timer wheel and the coalescing window timer
+ * @param executor Executor that runs commands, or NULL to run them only through
+ *                 dispatch_set_executor()
+ * @param monitor Monitor that times the timers, or NULL
+ * @return true on success, false otherwise
+ */
+bool dispatch_init(dispatch_t* dispatch, uv_loop_t* loop, executor_t* executor,
+                   loop_monitor_t* monitor);
+
+/**
+ * Run any coalesced commands still waiting for their window, close the action targets and
+ * the virtual keyboard, and release resources.
+ */
+void dispatch_cleanup(dispatch_t* dispatch);
+
+/**
+ * Stop running sequences, return keys to idle and clear per-binding state. Call before the
+ * configuration that running sequences and gestures point into is reloaded.
+ */
+void dispatch_reset(dispatch_t* dispatch);
+
+/**
+ * Switch the layer used for key lookups. Only a pointer changes; the layer's tables were
+ * built when the configuration was compiled. Partial gestures, chords and leader sequences
+ * are abandoned, while running timed sequences continue.
+ *
+ * @param dispatch Dispatch state
+ * @param config Pointer to compiled configuration
+ * @param layer Index into config_t.layers
+ * @return true if the layer exists, false otherwise
+ */
+bool dispatch_set_layer(dispatch_t* dispatch, config_t* config, size_t layer);
+
+/**
+ * Replace the function used to run commands.
+ *
+ * @param dispatch Dispatch state
+ * @param executor Executor to use, or NULL to restore the one given to dispatch_init()
+ */
+void dispatch_set_executor(dispatch_t* dispatch, command_executor_t executor);
+
+/**
+ * Copy the dispatch counters.
+ */
+void dispatch_get_stats(const dispatch_t* dispatch, dispatch_stats_t* stats);
+
+/**
+ * Number of events a binding has had suppressed by debounce or rate limiting.
+ *
+ * @param dispatch Dispatch state
+ * @param slot Binding slot as returned by lookup_binding()
+ */
+uint64_t dispatch_get_suppressed(const dispatch_t* dispatch, uint16_t slot);
+
+/**
+ * Resolve a key event against the configuration and run the bound action.
+ *
+ * Bindings with debounce_ms drop events that follow the previous event on that binding
+ * (suppressed or not) too closely, so a chattering switch fires once. Bindings with max_rate
+ * fire at most that many times per second, measured from the last accepted event.
+ *
+ * Sequence bindings run their first steps immediately and the rest from a timer wheel on
+ * the loop passed to dispatch_init().
+ *
+ * When config->coalesce_ms is set, setleds actions are collected for that long and merged
+ * into a single invocation. Per LED, opposite operations cancel out (+scroll then -scroll,
+ * or two toggles) and are dropped.
+ *
+ * @param dispatch Dispatch state
+ * @param config Pointer to loaded (compiled) configuration
+ * @param vendor_id Device vendor ID
+ * @param product_id Device product ID
+ * @param keycode Key code reported by the device
+ * @return true if a binding matched and its action was started, false otherwise
+ */
+bool dispatch_key_event(dispatch_t* dispatch, const config_t* config, uint16_t vendor_id,
+                        uint16_t product_id, uint16_t keycode);
+
+/**
+ * Feed a key press or release.
+ *
+ * Presses first advance the device's leader-key sequences, then the chord automaton, which
+ * holds back presses that may start a chord. The binding is then chosen by (keycode,
+ * modifier mask), falling back to the key's binding without modifiers. Keys with hold or
+ * double-tap bindings go through the gesture state machine, so their press binding runs as a
+ * tap on release (or once the double-tap window closes). All other bindings run on press, as
+ * with dispatch_key_event().
+ *
+ * @param dispatch Dispatch state
+ * @param config Pointer to loaded (compiled) configuration
+ * @param vendor_id Device vendor ID
+ * @param product_id Device product ID
+ * @param keycode Key code reported by the device
+ * @param modifiers HID modifier byte (left keys in bits 0-3, right keys in bits 4-7)
+ * @param pressed true for a press, false for a release
+ * @return true if the event ran a binding or advanced a sequence, gesture or chord,
+ *         false otherwise
+ */
+bool dispatch_key_state(dispatch_t* dispatch, const config_t* config, uint16_t vendor_id,
+                        uint16_t product_id, uint16_t keycode, uint8_t modifiers, bool pressed);
+
+/**
+ * dispatch_key_state() for a device whose section was resolved when it was opened, so the
+ * event goes straight to the section's tables without looking the device up again.
+ *
+ * @param dispatch Dispatch state
+ * @param config Pointer to loaded (compiled) configuration
+ * @param device Section from resolve_device(), KEYMAP_EMPTY if none applies
+ * @param vendor_id Device vendor ID, for command placeholders
+ * @param product_id Device product ID, for command placeholders
+ * @param keycode Key code reported by the device
+ * @param modifiers HID modifier byte (left keys in bits 0-3, right keys in bits 4-7)
+ * @param pressed true for a press, false for a release
+ * @return true if the event ran a binding or advanced a sequence, gesture or chord,
+ *         false otherwise
+ */
+bool dispatch_device_key(dispatch_t* dispatch, const config_t* config, uint8_t device,
+                         uint16_t vendor_id, uint16_t product_id, uint16_t keycode,
+                         uint8_t modifiers, bool pressed);
+
+#endif  // DISPATCH_H
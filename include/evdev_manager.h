@@ -0,0 +1,102 @@
+#ifndef EVDEV_MANAGER_H
+#define EVDEV_MANAGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "config.h"
+#include "hid_manager.h"  // key_callback_t
+#include "loop_monitor.h"
+#include "metrics.h"
+#include "status_shm.h"
+
+#define EVDEV_MAX_DEVICES 16
+
+struct evdev_device;
+
+/**
+ * The event devices being read. Zero-initialize it, then set the configuration before
+ * evdev_manager_reload().
+ */
+typedef struct
+{
+    uv_loop_t* loop;          // NULL until evdev_manager_init()
+    const config_t* config;   // sections devices are matched against
+    loop_monitor_t* monitor;  // times the reads, or NULL
+    metrics_t* metrics;
+    struct evdev_device* devices[EVDEV_MAX_DEVICES];
+    int device_count;
+    key_callback_t key_callback;
+    void* user_data;
+} evdev_manager_t;
+
+/**
+ * Initialize the evdev manager. Devices whose section sets input = evdev are read from
+ * /dev/input/event* instead of through hidapi, on the given loop.
+ *
+ * @param manager Manager to initialize
+ * @param loop Loop that watches the event devices
+ * @param monitor Monitor that times the reads, or NULL
+ * @param metrics Counters for attaches, detaches and events
+ * @return true on success, false otherwise
+ */
+bool evdev_manager_init(evdev_manager_t* manager, uv_loop_t* loop, loop_monitor_t* monitor,
+                        metrics_t* metrics);
+
+/**
+ * Set the configuration whose sections decide which event devices are read. Must be called
+ * before evdev_manager_reload(); the configuration must outlive the manager. Call it again
+ * after the configuration is reloaded in place, so attached devices follow their sections.
+ *
+ * @param manager Manager to configure
+ * @param config Configuration to match devices against
+ */
+void evdev_manager_set_config(evdev_manager_t* manager, const config_t* config);
+
+/**
+ * Close all event devices and release resources.
+ */
+void evdev_manager_cleanup(evdev_manager_t* manager);
+
+/**
+ * Close the open event devices and open those of the current configuration.
+ *
+ * @return true on success, false otherwise, as when no configuration was set
+ */
+bool evdev_manager_reload(evdev_manager_t* manager);
+
+/**
+ * Start reading an open event device. Used by evdev_manager_reload() for each matching
+ * device, and by tests to feed events through a pipe.
+ *
+ * @param manager Manager that reads the device
+ * @param fd Non-blocking descriptor yielding struct input_event records; owned by the manager
+ * @param vendor_id Vendor ID reported with the device's keys
+ * @param product_id Product ID reported with the device's keys
+ * @param section resolve_device() of the device, reported with its keys
+ * @return true if the device is being read, false otherwise (fd is closed)
+ */
+bool evdev_manager_attach(evdev_manager_t* manager, int fd, uint16_t vendor_id,
+                          uint16_t product_id, uint8_t section);
+
+/**
+ * Describe the open event devices, for the status segment.
+ *
+ * @param manager Manager whose devices are listed
+ * @param devices Receives one entry per device
+ * @param max Size of devices
+ * @return Number of entries written
+ */
+int evdev_manager_list_devices(const evdev_manager_t* manager, status_device_t* devices,
+                               int max);
+
+/**
+ * Set the function called for key presses and releases. Key codes are mapped to the HID
+ * usages bindings use, so a section behaves the same whichever input it reads; autorepeat
+ * events are ignored.
+ */
+void evdev_manager_set_key_callback(evdev_manager_t* manager, key_callback_t callback,
+                                    void* user_data);
+
+#endif  // EVDEV_MANAGER_H
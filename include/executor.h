@@ -0,0 +1,78 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <uv.h>
+
+#include "config.h"
+#include "loop_monitor.h"
+
+#define EXECUTOR_MAX_PENDING 256
+
+// Called when a command finishes; status is a wait(2) status, or -1 if it could not be started
+typedef void (*executor_done_cb_t)(int status, uint64_t latency_ns, void* user_data);
+
+// How one instance runs commands, and its helper process if it has one
+typedef struct
+{
+    uv_loop_t* loop;
+    loop_monitor_t* monitor;
+    executor_mode_t mode;
+    int sock;      // daemon end of the helper socketpair
+    int lifeline;  // write end of a pipe whose closure tells the helper to exit
+    pid_t helper_pid;
+    uv_poll_t* poll_handle;
+    uint32_t next_id;
+    uint64_t started_at[EXECUTOR_MAX_PENDING];
+    executor_done_cb_t done_callback;
+    void* user_data;
+} executor_t;
+
+/**
+ * Initialize the executor on the given loop. Commands run synchronously until
+ * executor_set_mode() selects another mode.
+ *
+ * @param executor Executor to initialize
+ * @param loop Loop used to receive helper completions
+ * @param monitor Monitor that times the completions, or NULL
+ * @return true on success, false otherwise
+ */
+bool executor_init(executor_t* executor, uv_loop_t* loop, loop_monitor_t* monitor);
+
+/**
+ * Select how commands are launched. Switching to EXECUTOR_HELPER forks the helper
+ * process if it is not running yet, so call this early, while the daemon is still small.
+ *
+ * @param executor Executor
+ * @param mode Executor mode from the configuration
+ * @return true if the mode is active, false if the helper could not be started
+ */
+bool executor_set_mode(executor_t* executor, executor_mode_t mode);
+
+/**
+ * Stop the helper process (if any) and release executor resources.
+ */
+void executor_cleanup(executor_t* executor);
+
+/**
+ * Run a command without a shell.
+ *
+ * In helper mode the argv is handed to the helper process and this returns immediately;
+ * completion is reported through the done callback. In system mode the command is spawned
+ * and waited for. Either way each argument reaches the program unchanged.
+ *
+ * @param executor Executor
+ * @param argv NULL-terminated argument vector; argv[0] is the program
+ * @return 0 if the command was started (helper) or its exit status (system), -1 on failure
+ */
+int executor_run(executor_t* executor, char* const argv[]);
+
+/**
+ * Set a callback invoked for every finished command.
+ */
+void executor_set_done_callback(executor_t* executor, executor_done_cb_t callback,
+                                void* user_data);
+
+#endif  // EXECUTOR_H
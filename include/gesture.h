@@ -0,0 +1,63 @@
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "timer_wheel.h"
+
+// Runs the binding at config->devices[device].bindings[binding]
+typedef void (*gesture_fire_cb_t)(const config_t* config, uint8_t device, uint8_t binding,
+                                  void* user_data);
+
+// Per-key state, indexed like the active layer's keymap so it is found without another lookup
+typedef struct
+{
+    wheel_timer_t timer;  // first, so a timer leads back to its key
+    uint8_t phase;
+} gesture_key_t;
+
+typedef struct
+{
+    timer_wheel_t* wheel;
+    gesture_fire_cb_t fire;
+    void* user_data;
+    const config_t* config;
+    gesture_key_t keys[KEYMAP_SIZE];
+} gesture_t;
+
+/**
+ * Detect taps, holds and double taps on the given wheel.
+ *
+ * @param gestures State to initialize
+ * @param wheel Timer wheel that measures hold and double-tap thresholds
+ * @param fire_cb Function that runs a recognized binding
+ * @param user_data Passed to fire_cb
+ */
+void gesture_init(gesture_t* gestures, timer_wheel_t* wheel, gesture_fire_cb_t fire_cb,
+                  void* user_data);
+
+/**
+ * Feed a press or release of a key with hold or double-tap bindings.
+ *
+ * A press arms the hold timer; reaching hold_ms runs the hold binding. A release before
+ * that is a tap, which runs the press binding at once, or after double_tap_ms when the key
+ * has a double-tap binding and no second press arrives. A second press within the window
+ * runs the double-tap binding instead. Repeated presses without a release are ignored.
+ *
+ * @param gestures Gesture state
+ * @param config Configuration the entry belongs to
+ * @param entry Lookup table entry of the key
+ * @param pressed true for a press, false for a release
+ * @return true if the event advanced the key's state, false if it was ignored
+ */
+bool gesture_key(gesture_t* gestures, const config_t* config, const keymap_entry_t* entry,
+                 bool pressed);
+
+/**
+ * Return every key to idle, cancelling pending hold and double-tap timers.
+ */
+void gesture_reset(gesture_t* gestures);
+
+#endif  // GESTURE_H
@@ -6,15 +6,184 @@
 #include <hidapi/hidapi.h>
 #include <uv.h>
 #include "config.h"
+#include "hid_uring.h"
+#include "loop_monitor.h"
+#include "metrics.h"
+#include "status_shm.h"
 
-// Type definitions
-typedef void (*key_callback_t)(uint16_t vendor_id, uint16_t product_id, uint16_t keycode, void* user_data);
+#define HID_MANAGER_MAX_DEVICES 16
+#define HID_MANAGER_HELD_KEYS 14  // boot report keys plus the eight modifiers
+
+// Type definitions; section is the resolve_device() of the device, found once when it was opened
+typedef void (*key_callback_t)(uint16_t vendor_id, uint16_t product_id, uint8_t section,
+                               uint16_t keycode, uint8_t modifiers, bool pressed,
+                               void* user_data);
+
+/**
+ * Device access operations used by the HID manager.
+ * Defaults to hidapi; tests and benchmarks install fakes with hid_manager_set_backend().
+ */
+typedef struct hid_backend
+{
+    int (*init)(void);
+    int (*exit)(void);
+    struct hid_device_info* (*enumerate)(unsigned short vendor_id, unsigned short product_id);
+    void (*free_enumeration)(struct hid_device_info* devs);
+    hid_device* (*open_path)(const char* path);
+    void (*close)(hid_device* device);
+    int (*read_timeout)(hid_device* device, unsigned char* data, size_t length, int milliseconds);
+    int (*write)(hid_device* device, const unsigned char* data, size_t length);  // may be NULL
+} hid_backend_t;
+
+/**
+ * The open devices, read by polling or through io_uring, and the reloads and reopens in
+ * flight for them. Zero-initialize it, then set the backend and configuration before
+ * hid_manager_init().
+ */
+typedef struct
+{
+    uv_loop_t* loop;               // timers, reopens and background reloads run here
+    const hid_backend_t* backend;  // NULL for hidapi
+    const config_t* config;        // sections devices are matched against
+    loop_monitor_t* monitor;       // times the reads, or NULL
+    metrics_t* metrics;
+    hid_uring_t ring;
+    hid_device* devices[HID_MANAGER_MAX_DEVICES];
+    uint16_t vendor_ids[HID_MANAGER_MAX_DEVICES];
+    uint16_t product_ids[HID_MANAGER_MAX_DEVICES];
+    uint8_t sections[HID_MANAGER_MAX_DEVICES];  // section each device resolves to in config
+    char paths[HID_MANAGER_MAX_DEVICES][MAX_PATH];  // where each device was opened
+    uint8_t report_formats[HID_MANAGER_MAX_DEVICES];
+    uint16_t held_keys[HID_MANAGER_MAX_DEVICES][HID_MANAGER_HELD_KEYS];  // keys down per device
+    uint8_t held_counts[HID_MANAGER_MAX_DEVICES];
+    bool led_sync[HID_MANAGER_MAX_DEVICES];
+    int leds_sent[HID_MANAGER_MAX_DEVICES];  // LED state last sent, -1 if none
+    int raw_fds[HID_MANAGER_MAX_DEVICES];    // hidraw descriptor read by io_uring, -1 if polled
+    uint8_t uring_slots[HID_URING_MAX_DEVICES];  // device slot of each io_uring descriptor
+    uint64_t* report_counters[HID_MANAGER_MAX_DEVICES];  // metrics_device_counter() per device
+    bool dead[HID_MANAGER_MAX_DEVICES];  // closed after a read error, waiting to be reopened
+    uint64_t reopen_at[HID_MANAGER_MAX_DEVICES];   // loop time of the next attempt, 0 if running
+    uint32_t backoff_ms[HID_MANAGER_MAX_DEVICES];  // wait before the last attempt, doubles
+    int led_state;  // state of the last sync, -1 before the first
+    int device_count;
+    unsigned generation;  // bumped by cleanup so results of an abandoned reload are dropped
+    unsigned device_set;  // bumped whenever the slots are emptied, so reopens know theirs
+    unsigned in_flight;   // reloads and reopens that have yet to come back to the loop
+    bool reloading;
+    bool reload_again;  // reload requested while one was in flight
+    bool reopening;     // a reopen is on the threadpool; one at a time
+    key_callback_t key_callback;
+    void* user_data;
+    uv_timer_t* poll_timer;
+    uv_timer_t* reopen_timer;
+} hid_manager_t;
 
 // Public functions
-bool hid_manager_init(void);
-void hid_manager_cleanup(void);
-bool hid_manager_reload(void);
-void hid_manager_set_key_callback(key_callback_t callback, void* user_data);
-void hid_manager_poll(void);
 
-#endif // HID_MANAGER_H
\ No newline at end of file
+/**
+ * Initialize the device backend and start polling.
+ *
+ * @param manager Manager to initialize
+ * @param loop Loop the poll and reopen timers and the background reloads run on
+ * @param monitor Monitor that times the reads, or NULL
+ * @param metrics Counters for attaches, detaches, reloads and reports
+ * @return true on success, false otherwise
+ */
+bool hid_manager_init(hid_manager_t* manager, uv_loop_t* loop, loop_monitor_t* monitor,
+                      metrics_t* metrics);
+
+/**
+ * Close the devices and release the backend. Reloads and reopens still on the threadpool
+ * drop what they opened when they come back; see hid_manager_idle().
+ */
+void hid_manager_cleanup(hid_manager_t* manager);
+
+/**
+ * Whether no reload or reopen is on the threadpool. Their completions run on the loop and
+ * use the manager, so it must stay allocated until this is true.
+ */
+bool hid_manager_idle(const hid_manager_t* manager);
+
+/**
+ * Reopen devices for the current configuration. Enumeration and opening run on the libuv
+ * threadpool, devices are opened in parallel, and the new set replaces the old one in a single
+ * step on the loop thread; the old devices are polled until then. A reload requested while one
+ * is in flight runs again once it completes.
+ *
+ * @return true if the reload was started or queued, false otherwise, as when no configuration
+ *         was set with hid_manager_set_config()
+ */
+bool hid_manager_reload(hid_manager_t* manager);
+
+/**
+ * Whether a reload started by hid_manager_reload() has yet to attach its devices.
+ */
+bool hid_manager_reloading(const hid_manager_t* manager);
+
+/**
+ * Set the function called for key presses and releases. Each report lists the keys that are
+ * down (one keycode, or a boot keyboard report when the device sets report = boot); keys
+ * that left the list are released and new ones pressed. Modifier keys are reported as their
+ * HID usages 0xE0-0xE7, and every event carries the HID modifier byte of the new report.
+ */
+void hid_manager_set_key_callback(hid_manager_t* manager, key_callback_t callback,
+                                  void* user_data);
+
+/**
+ * Read one report from every polled device. A device whose read fails, as it does once the
+ * device is unplugged or reset, is closed, its held keys are released and it is no longer
+ * read; it is reopened in the background, found again by its IDs, after 250ms and then after
+ * twice the previous wait each time that fails, up to 30s.
+ */
+void hid_manager_poll(hid_manager_t* manager);
+
+/**
+ * Bring the LEDs of every open device whose section sets led_sync to a state, in one pass.
+ * A device is only sent an output report if its LEDs differ from the last state it was sent,
+ * and devices opened later get the latest state.
+ *
+ * @param manager Manager whose devices are updated
+ * @param state LED_* mask from led_state.h
+ */
+void hid_manager_sync_leds(hid_manager_t* manager, uint8_t state);
+
+/**
+ * Describe the open devices, for the status segment.
+ *
+ * @param manager Manager whose devices are listed
+ * @param devices Receives one entry per device
+ * @param max Size of devices
+ * @return Number of entries written
+ */
+int hid_manager_list_devices(const hid_manager_t* manager, status_device_t* devices, int max);
+
+/**
+ * Set the configuration whose sections decide which devices are opened, and how. Must be
+ * called before hid_manager_reload(); the configuration must outlive the manager. Call it
+ * again after the configuration is reloaded in place, so the open devices report the
+ * sections they now resolve to.
+ *
+ * @param manager Manager to configure
+ * @param config Configuration to match devices against
+ */
+void hid_manager_set_config(hid_manager_t* manager, const config_t* config);
+
+/**
+ * Replace the device backend. Must be called before hid_manager_init().
+ *
+ * @param manager Manager to configure
+ * @param backend Backend operations, or NULL to restore the hidapi backend
+ */
+void hid_manager_set_backend(hid_manager_t* manager, const hid_backend_t* backend);
+
+/**
+ * Decode a raw HID input report into a keycode.
+ *
+ * @param report Report bytes as returned by the backend
+ * @param length Number of valid bytes in report
+ * @param keycode Receives the decoded keycode
+ * @return true if the report was decoded (keycode 0 means no key is down), false otherwise
+ */
+bool hid_manager_decode_report(const unsigned char* report, int length, uint16_t* keycode);
+
+#endif // HID_MANAGER_H
@@ -0,0 +1,89 @@
+#ifndef HID_URING_H
+#define HID_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <uv.h>
+
+#define HID_URING_MAX_DEVICES 16
+#define HID_URING_REPORT_SIZE 64
+
+/**
+ * Called on the loop thread for each completed read.
+ *
+ * @param slot Index of the descriptor in the array given to hid_uring_start()
+ * @param report Report bytes, valid until the callback returns
+ * @param length Number of bytes read, or 0 or a negative errno if the descriptor ended or
+ *               failed (report is NULL then); such a descriptor is not read again
+ * @param user_data Pointer given to hid_uring_start()
+ */
+typedef void (*hid_uring_report_cb)(size_t slot, const unsigned char* report, int length,
+                                    void* user_data);
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// One ring and the reads posted on it; only the io_uring build uses the fields
+typedef struct
+{
+    int ring_fd;
+    int event_fd;
+    uv_poll_t* poll_handle;
+    hid_uring_report_cb callback;
+    void* user_data;
+    size_t count;
+    unsigned pending;     // reads queued since the last io_uring_enter()
+    unsigned generation;  // bumped by hid_uring_stop(), so a drain notices a stop in a callback
+
+    // Shared rings; cq_ptr is sq_ptr when the kernel maps both at once
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    unsigned char buffers[HID_URING_MAX_DEVICES][HID_URING_REPORT_SIZE];  // registered
+} hid_uring_t;
+
+/**
+ * Whether this build can read devices through io_uring at all. hid_uring_start() can still
+ * fail at runtime, e.g. on older kernels or where io_uring is disabled.
+ */
+bool hid_uring_supported(void);
+
+/**
+ * Initialize a ring that is not reading anything.
+ */
+void hid_uring_init(hid_uring_t* ring);
+
+/**
+ * Read a set of descriptors through one io_uring. Every descriptor has a read posted into its
+ * own registered buffer; completions are signalled through an eventfd watched by the loop,
+ * drained together, and the reads re-posted with a single io_uring_enter().
+ *
+ * @param ring Ring initialized by hid_uring_init(); a running one is stopped first
+ * @param loop Loop to deliver reports on
+ * @param fds Blocking descriptors to read, such as /dev/hidraw* devices; they stay owned by
+ *            the caller
+ * @param count Number of descriptors, at most HID_URING_MAX_DEVICES
+ * @param callback Receives each report
+ * @param user_data Passed to the callback
+ * @return true if reading started, false if io_uring is unavailable (nothing is left running)
+ */
+bool hid_uring_start(hid_uring_t* ring, uv_loop_t* loop, const int* fds, size_t count,
+                     hid_uring_report_cb callback, void* user_data);
+
+/**
+ * Cancel outstanding reads and release the ring. The descriptors may be closed afterwards.
+ */
+void hid_uring_stop(hid_uring_t* ring);
+
+#endif  // HID_URING_H
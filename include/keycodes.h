@@ -0,0 +1,27 @@
+#ifndef KEYCODES_H
+#define KEYCODES_H
+
+#include <stdint.h>
+
+// Highest Linux input key code (KEY_MAX); codes above it cannot be emitted
+#define KEY_CODE_MAX 0x2ff
+
+/**
+ * Look up a Linux input key code by name. Names follow the KEY_* constants without the prefix,
+ * in any case ("leftctrl", "KEY_A"); ctrl, shift, alt and super stand for the left-hand keys.
+ * A decimal or 0x-prefixed number is taken as the code itself.
+ *
+ * @param name Key name or number
+ * @return Key code, or 0 if the name is unknown or the number out of range
+ */
+uint16_t key_code_from_name(const char* name);
+
+/**
+ * Map a Linux input key code to the HID keyboard usage that bindings use.
+ *
+ * @param code Key code from an input_event
+ * @return HID usage, modifiers as 0xE0-0xE7, or 0 if the key has no keyboard usage
+ */
+uint16_t key_code_to_hid_usage(uint16_t code);
+
+#endif  // KEYCODES_H
@@ -0,0 +1,64 @@
+#ifndef LEADER_H
+#define LEADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "timer_wheel.h"
+
+// Runs the action of a completed sequence
+typedef void (*leader_fire_cb_t)(const config_t* config, const key_binding_t* action,
+                                 void* user_data);
+
+// Position in the trie per config device
+typedef struct
+{
+    wheel_timer_t timeout;  // first, so a timeout leads back to its device
+    uint32_t node;          // LEADER_NONE when no sequence is in progress
+} leader_device_t;
+
+typedef struct
+{
+    timer_wheel_t* wheel;
+    leader_fire_cb_t fire;
+    void* user_data;
+    const config_t* config;
+    leader_device_t devices[MAX_SECTIONS];
+} leader_t;
+
+/**
+ * Track leader-key sequences, timing out partial sequences on the given wheel.
+ *
+ * @param leaders State to initialize
+ * @param wheel Timer wheel for the per-device sequence timeout
+ * @param fire_cb Function that runs a completed sequence's action
+ * @param user_data Passed to fire_cb
+ */
+void leader_init(leader_t* leaders, timer_wheel_t* wheel, leader_fire_cb_t fire_cb,
+                 void* user_data);
+
+/**
+ * Feed a key event through the device's sequence trie.
+ *
+ * A press that starts or continues a sequence is consumed and restarts the device's
+ * leader_timeout_ms timer. A sequence runs as soon as it is complete, unless a longer
+ * sequence shares its prefix; then it runs when the timeout expires. A press that continues
+ * no sequence abandons the partial one and is dispatched as usual.
+ *
+ * @param leaders Sequence state
+ * @param config Pointer to loaded configuration
+ * @param device Section the device resolved to, KEYMAP_EMPTY if none
+ * @param keycode Key code reported by the device
+ * @param pressed true for a press, false for a release
+ * @return true if the event was consumed, false if it should be dispatched as usual
+ */
+bool leader_key(leader_t* leaders, const config_t* config, uint8_t device, uint16_t keycode,
+                bool pressed);
+
+/**
+ * Abandon partial sequences on every device.
+ */
+void leader_reset(leader_t* leaders);
+
+#endif  // LEADER_H
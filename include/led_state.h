@@ -0,0 +1,70 @@
+#ifndef LED_STATE_H
+#define LED_STATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bits of the HID keyboard LED output report
+#define LED_NUM 0x01
+#define LED_CAPS 0x02
+#define LED_SCROLL 0x04
+#define LED_COMPOSE 0x08
+#define LED_KANA 0x10
+
+// Receives the LED state each time it changes
+typedef void (*led_sink_t)(uint8_t state, void* user_data);
+
+// The LED state bindings change, shared by every device of one instance
+typedef struct
+{
+    uint8_t state;
+    uint8_t published;
+    bool dirty;
+    led_sink_t sink;
+    void* sink_data;
+} led_state_t;
+
+/**
+ * Look up the report bit of an LED by its setleds name.
+ *
+ * @param led LED name, such as "caps"
+ * @return LED_* bit, or 0 if the LED has no bit in the report
+ */
+uint8_t led_state_mask(const char* led);
+
+/**
+ * Apply one LED operation to the state without publishing it.
+ *
+ * @param leds State to change
+ * @param mode '^' to toggle, '+' to turn on, '-' to turn off
+ * @param led LED name, such as "caps"
+ * @return true if the state changed, false otherwise
+ */
+bool led_state_apply(led_state_t* leds, char mode, const char* led);
+
+/**
+ * Pass the state to the sink if it changed since it was last published. Apply a burst of
+ * operations first and publish once, so devices are updated in one pass.
+ */
+void led_state_publish(led_state_t* leds);
+
+/**
+ * Current LED state as a mask of LED_* bits.
+ */
+uint8_t led_state_get(const led_state_t* leds);
+
+/**
+ * Set the function that receives published states.
+ *
+ * @param leds State whose changes go to the sink
+ * @param sink Sink to use, or NULL for none
+ * @param user_data Passed to the sink with each state
+ */
+void led_state_set_sink(led_state_t* leds, led_sink_t sink, void* user_data);
+
+/**
+ * Forget the state, turning every LED off without publishing.
+ */
+void led_state_reset(led_state_t* leds);
+
+#endif  // LED_STATE_H
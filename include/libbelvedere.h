@@ -0,0 +1,185 @@
+#ifndef LIBBELVEDERE_H
+#define LIBBELVEDERE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+/**
+ * The dispatch engine behind the belvedere daemon, for embedding in another process: load a
+ * configuration, feed it key events or let it read devices, and run its timers and
+ * callbacks from the caller's loop. The daemon itself is a thin wrapper around this API.
+ *
+ * The engine's handles and timers live on the loop given in belvedere_options_t. Each
+ * instance has its own devices, executor, virtual keyboard and control socket, so several can
+ * run side by side, on one loop or on several.
+ */
+typedef struct belvedere belvedere_t;
+
+// Runs a resolved command given as a NULL-terminated argv; returns the command's status
+typedef int (*belvedere_executor_t)(char* const argv[]);
+
+// HID device operations, laid out as hid_backend_t in hid_manager.h of the source tree
+typedef struct hid_backend belvedere_hid_backend_t;
+
+typedef struct
+{
+    const char* config_path;  // NULL searches the locations load_config() does
+    bool watch_config;        // reload when the configuration or a conf.d fragment changes
+    uv_loop_t* loop;          // loop the engine runs on; NULL for uv_default_loop()
+} belvedere_options_t;
+
+typedef struct
+{
+    uint64_t dispatched;        // key events that ran a binding's action
+    uint64_t unmatched;         // key events with no binding
+    uint64_t filtered;          // key events dropped by debounce_ms or max_rate
+    uint64_t failed;            // actions that failed
+    uint64_t reloads;           // configuration reloads that took effect
+    uint64_t reloads_rejected;  // configuration reloads rejected, keeping the running one
+    uint64_t device_reloads;    // device sets attached by a reload
+    uint32_t devices;           // HID and evdev devices open
+} belvedere_stats_t;
+
+/**
+ * Load a configuration and start the engine: executor, action targets, dispatch timers and,
+ * when the configuration asks for them, the control socket, metrics file and status segment.
+ * No device is opened until belvedere_open_devices().
+ *
+ * @param options Where the configuration is and whether to watch it
+ * @return New instance, or NULL if the configuration cannot be loaded or lacks
+ *         monitored_keycodes or devices
+ */
+belvedere_t* belvedere_create(const belvedere_options_t* options);
+
+/**
+ * Stop the engine, close its devices and handles and free the instance. Close callbacks run
+ * before this returns, so the loop can be closed afterwards.
+ *
+ * @param ctx Instance from belvedere_create(), or NULL
+ */
+void belvedere_destroy(belvedere_t* ctx);
+
+/**
+ * Open the HID and evdev devices the configuration has sections for, in the background, and
+ * dispatch their keys. LED changes go to devices with led_sync.
+ *
+ * @param ctx Instance
+ * @return true if opening started, false otherwise
+ */
+bool belvedere_open_devices(belvedere_t* ctx);
+
+/**
+ * Reload the configuration. Only layers whose sections changed are rebuilt, and open devices
+ * are reconciled only when device settings changed or rescan is set. A configuration that
+ * fails to load or lacks monitored_keycodes or devices is rejected, and the running one keeps
+ * dispatching.
+ *
+ * @param ctx Instance
+ * @param rescan Look for devices again even if no device setting changed
+ * @return true on success, false if the new configuration was rejected
+ */
+bool belvedere_reload(belvedere_t* ctx, bool rescan);
+
+/**
+ * Dispatch a key event as if a device had reported it.
+ *
+ * @param ctx Instance
+ * @param vendor_id Vendor ID of the device the key belongs to
+ * @param product_id Product ID of the device the key belongs to
+ * @param keycode HID usage or keycode, as bindings name it
+ * @param modifiers HID modifier byte held with the key
+ * @param pressed true for a press, false for a release
+ * @return true if the event ran an action, false otherwise
+ */
+bool belvedere_feed_key(belvedere_t* ctx, uint16_t vendor_id, uint16_t product_id,
+                        uint16_t keycode, uint8_t modifiers, bool pressed);
+
+/**
+ * Run ready callbacks and timers without blocking, for callers with their own event loop.
+ * Not for a loop the caller runs itself: its callbacks already run the engine, and calling
+ * this from one of them would re-enter uv_run().
+ *
+ * @param ctx Instance
+ * @return true if the engine has more work pending, false if it is idle
+ */
+bool belvedere_poll(belvedere_t* ctx);
+
+/**
+ * Descriptor that becomes readable when belvedere_poll() has work, for callers that wait in
+ * their own poll loop; wait no longer than belvedere_poll_timeout().
+ *
+ * @param ctx Instance
+ * @return Descriptor, or -1 where the loop has none
+ */
+int belvedere_poll_fd(belvedere_t* ctx);
+
+/**
+ * Milliseconds until the next engine timer is due, -1 if none is.
+ *
+ * @param ctx Instance
+ */
+int belvedere_poll_timeout(belvedere_t* ctx);
+
+/**
+ * Run the engine until belvedere_stop() is called. Like belvedere_poll(), not for a loop the
+ * caller runs itself.
+ *
+ * @param ctx Instance
+ */
+void belvedere_run(belvedere_t* ctx);
+
+/**
+ * Make belvedere_run() return once the current callback finishes.
+ *
+ * @param ctx Instance
+ */
+void belvedere_stop(belvedere_t* ctx);
+
+/**
+ * Switch the active layer.
+ *
+ * @param ctx Instance
+ * @param name Layer name; "base" is the base layer
+ * @return true if the layer exists, false otherwise
+ */
+bool belvedere_set_layer(belvedere_t* ctx, const char* name);
+
+/**
+ * Name of the active layer.
+ *
+ * @param ctx Instance
+ */
+const char* belvedere_layer(const belvedere_t* ctx);
+
+/**
+ * Copy the engine's counters.
+ *
+ * @param ctx Instance
+ * @param stats Receives the counters
+ */
+void belvedere_get_stats(const belvedere_t* ctx, belvedere_stats_t* stats);
+
+/**
+ * Run the instance's commands through a function instead of the configured executor.
+ *
+ * @param ctx Instance
+ * @param executor Executor to use, or NULL to restore the configured one
+ */
+void belvedere_set_executor(belvedere_t* ctx, belvedere_executor_t executor);
+
+/**
+ * Replace the HID device backend the instance opens its devices with. Must be called before
+ * belvedere_open_devices().
+ *
+ * @param ctx Instance
+ * @param backend Backend operations, or NULL to restore hidapi
+ */
+void belvedere_set_hid_backend(belvedere_t* ctx, const belvedere_hid_backend_t* backend);
+
+/**
+ * Enable or disable debug logging to stdout, for every instance.
+ */
+void belvedere_set_debug(bool enabled);
+
+#endif  // LIBBELVEDERE_H
@@ -0,0 +1,113 @@
+#ifndef LOOP_MONITOR_H
+#define LOOP_MONITOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <uv.h>
+
+// Loop callbacks that are timed separately, so a stall names the code that caused it
+typedef enum
+{
+    LOOP_STAGE_HID = 0,   // HID report polling and io_uring completions
+    LOOP_STAGE_EVDEV,     // evdev event reads
+    LOOP_STAGE_DISPATCH,  // running the binding of one key event
+    LOOP_STAGE_TIMERS,    // timer wheel ticks and the setleds coalescing window
+    LOOP_STAGE_EXECUTOR,  // exit reports from the executor helper
+    LOOP_STAGE_CONTROL,   // control socket commands
+    LOOP_STAGE_RELOAD,    // configuration reloads
+    LOOP_STAGE_COUNT,
+} loop_stage_t;
+
+typedef struct
+{
+    uint64_t iterations;       // loop iterations measured
+    uint64_t busy_ns;          // time spent running callbacks rather than waiting
+    uint64_t lag_last_ns;      // callback time of the last iteration
+    uint64_t lag_max_ns;       // longest callback time of any iteration
+    uint64_t slow_iterations;  // iterations whose callback time exceeded the stall threshold
+    uint64_t stalls;           // stage callbacks that exceeded the stall threshold
+    uint64_t stage_stalls[LOOP_STAGE_COUNT];
+    uint64_t stage_max_ns[LOOP_STAGE_COUNT];  // longest single callback of each stage
+} loop_stats_t;
+
+#define LOOP_MONITOR_NESTING 8  // stages timed inside one another, e.g. dispatch in HID polling
+
+/**
+ * Timings of one loop. Modules that run callbacks on the loop are handed the monitor and
+ * time their stages with it.
+ */
+typedef struct
+{
+    uv_loop_t* loop;  // NULL while the monitor is not running
+    uv_prepare_t prepare;
+    uv_check_t check;
+    bool idle_metrics;  // the loop reports time spent waiting for I/O
+    uint64_t stall_ns;
+
+    // Stamps of the current iteration
+    uint64_t prepared_at;
+    uint64_t prepared_idle;
+    uint64_t checked_at;  // 0 until the first check
+    uint64_t io_busy;     // callback time of the last I/O phase
+    bool stage_stalled;   // a stage stall was already reported in this iteration
+
+    // Stages being timed; child_ns collects the time of the stages nested in each
+    int depth;
+    uint64_t child_ns[LOOP_MONITOR_NESTING];
+
+    loop_stats_t stats;
+} loop_monitor_t;
+
+/**
+ * Start measuring the loop. A prepare handle stamps the time just before the loop blocks
+ * for I/O and a check handle the time just after; with the loop's idle time metric the
+ * difference between them is the time spent in callbacks. Neither handle keeps the loop
+ * alive.
+ *
+ * @param monitor Monitor to start, zeroed or cleaned up
+ * @param loop Loop to measure; must not have started running if idle time is to be measured
+ * @param stall_ms Threshold for counting and reporting stalls, 0 to only collect timings
+ * @return true on success, false otherwise
+ */
+bool loop_monitor_init(loop_monitor_t* monitor, uv_loop_t* loop, uint32_t stall_ms);
+
+/**
+ * Stop measuring and release the handles. The counters are kept.
+ */
+void loop_monitor_cleanup(loop_monitor_t* monitor);
+
+/**
+ * Change the stall threshold, e.g. after a reload.
+ */
+void loop_monitor_set_threshold(loop_monitor_t* monitor, uint32_t stall_ms);
+
+/**
+ * Mark the start of a stage callback.
+ *
+ * @param monitor Monitor of the loop the callback runs on, or NULL
+ * @return Token to pass to loop_monitor_end(), 0 while the monitor is not running
+ */
+uint64_t loop_monitor_begin(loop_monitor_t* monitor);
+
+/**
+ * Mark the end of a stage callback. Time spent in stages nested inside it is charged to
+ * those stages, so a stall is reported against the innermost stage that caused it.
+ *
+ * @param monitor Monitor passed to the matching loop_monitor_begin()
+ * @param stage Stage that ran
+ * @param start Token returned by the matching loop_monitor_begin()
+ */
+void loop_monitor_end(loop_monitor_t* monitor, loop_stage_t stage, uint64_t start);
+
+/**
+ * Copy the counters.
+ */
+void loop_monitor_get_stats(const loop_monitor_t* monitor, loop_stats_t* stats);
+
+/**
+ * Name of a stage as used in stall reports and the stats output.
+ */
+const char* loop_monitor_stage_name(loop_stage_t stage);
+
+#endif  // LOOP_MONITOR_H
@@ -0,0 +1,91 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "dispatch.h"
+#include "loop_monitor.h"
+
+#define METRICS_MAX_DEVICES 32
+#define METRICS_LATENCY_BUCKETS 10
+
+// Reports (or events) read from one device
+typedef struct
+{
+    uint16_t vendor_id;
+    uint16_t product_id;
+    uint8_t input;
+    uint64_t reports;
+} metrics_device_t;
+
+/**
+ * Counters that have no home in another module's stats. All of them are plain integers
+ * touched only on the loop thread, so counting costs an increment.
+ */
+typedef struct
+{
+    uint64_t commands;          // commands that finished
+    uint64_t commands_failed;   // commands that exited non-zero or could not run
+    uint64_t reloads;           // configuration reloads that took effect
+    uint64_t reloads_rejected;  // configuration reloads rejected, keeping the running one
+    uint64_t device_reloads;    // device sets attached by a reload
+    uint64_t attaches;          // devices taken into use
+    uint64_t detaches;          // devices closed
+    uint64_t spawn_buckets[METRICS_LATENCY_BUCKETS + 1];  // per bucket, the last one +Inf
+    uint64_t spawn_sum_ns;
+
+    // Entries are never removed, so counters handed out stay valid
+    metrics_device_t devices[METRICS_MAX_DEVICES];
+    size_t device_count;
+    uint64_t device_overflow;  // devices that did not fit; not exported
+} metrics_t;
+
+/**
+ * Counter of the reports (or events) read from one device, to be incremented directly for
+ * each one. Resolve it when the device is attached; counters outlive reloads, so a device
+ * that comes back keeps counting where it left off.
+ *
+ * @param metrics Counters of the instance
+ * @param vendor_id Device vendor ID
+ * @param product_id Device product ID
+ * @param input Where the device is read from
+ * @return Counter, never NULL; devices past METRICS_MAX_DEVICES share one that is not exported
+ */
+uint64_t* metrics_device_counter(metrics_t* metrics, uint16_t vendor_id, uint16_t product_id,
+                                 input_source_t input);
+
+/**
+ * Count a finished command and its latency, from launch to exit.
+ */
+void metrics_command_done(metrics_t* metrics, int status, uint64_t latency_ns);
+
+/**
+ * Write all metrics in the Prometheus text exposition format.
+ *
+ * @param out Stream to write to
+ * @param metrics Counters of the instance
+ * @param dispatch Dispatch counters
+ * @param loop Event loop counters
+ * @return true if everything was written, false otherwise
+ */
+bool metrics_write(FILE* out, const metrics_t* metrics, const dispatch_stats_t* dispatch,
+                   const loop_stats_t* loop);
+
+/**
+ * Replace the file at path with the current metrics. The file is written next to its final
+ * name and renamed over it, so a collector never reads a partial file.
+ *
+ * @return true on success, false otherwise
+ */
+bool metrics_export(const char* path, const metrics_t* metrics, const dispatch_stats_t* dispatch,
+                    const loop_stats_t* loop);
+
+/**
+ * Forget every counter.
+ */
+void metrics_reset(metrics_t* metrics);
+
+#endif  // METRICS_H
@@ -0,0 +1,57 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes under the "belvedere" provider, for perf, bpftrace and SystemTap. Each probe
+// is a single nop until a tracer attaches; its arguments are only read by the tracer. Without
+// sys/sdt.h, or with ENABLE_USDT off, the probes compile to nothing and their arguments are
+// never evaluated.
+//
+//   hid_report_read    vendor, product, length          a report arrived (poll or io_uring)
+//   hid_report_decode  vendor, product, keys, modifiers  keys held according to the report
+//   key_lookup         vendor, product, keycode, mask, found
+//   key_filtered       vendor, product, keycode, reason  dropped; 1 debounce, 2 max_rate
+//   action_start       vendor, product, keycode, action  a binding's action begins
+//   action_done        vendor, product, keycode, action  it returned to the loop
+//   command_start      id, program                       handed to the executor; id 0 runs inline
+//   command_done       id, status, latency_ns            the command exited
+//   reload_begin       rescan                            configuration reload started
+//   reload_end         loaded, sections, layers, latency_ns
+//                                                        sections changed and layers rebuilt;
+//                                                        0 and 0 when the reload was rejected
+//   hid_reload_begin   generation                        HID device reload started
+//   hid_reload_end     generation, devices, latency_ns   new device set attached
+//   device_attach      vendor, product, slot, path       HID device taken into use
+//   device_detach      vendor, product, slot
+//   evdev_read         vendor, product, events           a batch of input events was read
+//   evdev_decode       vendor, product, usage, pressed, modifiers
+//                                                        a key event as a HID usage
+//   evdev_reload_begin devices                           event devices closed for reopening
+//   evdev_reload_end   ok, devices, latency_ns           event devices reopened
+//   evdev_attach       vendor, product, fd
+//   evdev_detach       vendor, product, fd
+
+#if defined(BELVEDERE_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BELVEDERE_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef BELVEDERE_HAVE_USDT
+#define PROBE1(name, a) DTRACE_PROBE1(belvedere, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(belvedere, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(belvedere, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(belvedere, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(belvedere, name, a, b, c, d, e)
+#else
+// sizeof keeps variables that only feed probes from being reported unused
+#define PROBE1(name, a) ((void)sizeof(a))
+#define PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define PROBE3(name, a, b, c) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#define PROBE4(name, a, b, c, d) \
+    ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c), (void)sizeof(d))
+#define PROBE5(name, a, b, c, d, e) \
+    ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c), (void)sizeof(d), (void)sizeof(e))
+#endif
+
+#endif  // PROBES_H
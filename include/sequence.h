@@ -0,0 +1,68 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "timer_wheel.h"
+
+#define SEQUENCE_MAX_RUNNING 256
+
+// Runs one step of a sequence
+typedef void (*sequence_step_cb_t)(const config_t* config, const sequence_step_t* step,
+                                   void* user_data);
+
+typedef struct
+{
+    wheel_timer_t timer;  // first, so a timer leads back to its run
+    const config_t* config;
+    uint8_t next;  // next step in config->steps
+    uint8_t end;   // one past the last step
+    bool active;
+} sequence_run_t;
+
+// Fixed pool of runs with a free stack, so starting a sequence never allocates
+typedef struct
+{
+    timer_wheel_t* wheel;
+    sequence_step_cb_t step_cb;
+    void* user_data;
+    sequence_run_t runs[SEQUENCE_MAX_RUNNING];
+    uint16_t free_stack[SEQUENCE_MAX_RUNNING];
+    size_t free_count;
+} sequence_t;
+
+/**
+ * Run sequences on the given wheel. Steps are carried out by step_cb as they come due.
+ *
+ * @param sequences Pool to initialize
+ * @param wheel Timer wheel that schedules the delays between steps
+ * @param step_cb Function that performs a step
+ * @param user_data Passed to step_cb
+ */
+void sequence_init(sequence_t* sequences, timer_wheel_t* wheel, sequence_step_cb_t step_cb,
+                   void* user_data);
+
+/**
+ * Start a sequence binding. Leading steps without a delay run immediately; the rest are
+ * scheduled on the wheel, so no process sleeps between steps.
+ *
+ * @param sequences Pool to run the sequence from
+ * @param config Configuration holding the binding's steps; must stay valid while it runs
+ * @param binding Binding with action ACTION_SEQUENCE
+ * @return true if the sequence was started, false if it is invalid or too many are running
+ */
+bool sequence_start(sequence_t* sequences, const config_t* config, const key_binding_t* binding);
+
+/**
+ * Stop every running sequence without running its remaining steps.
+ */
+void sequence_cancel_all(sequence_t* sequences);
+
+/**
+ * Number of sequences currently running.
+ */
+size_t sequence_running(const sequence_t* sequences);
+
+#endif  // SEQUENCE_H
@@ -0,0 +1,116 @@
+#ifndef STATUS_SHM_H
+#define STATUS_SHM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Layout of the shared memory segment external status readers map. It depends on nothing
+// else in belvedere, so a reader can copy this header; bump STATUS_SHM_VERSION whenever the
+// layout changes.
+#define STATUS_SHM_MAGIC 0x564c4542u  // "BELV" in little-endian byte order
+#define STATUS_SHM_VERSION 1
+#define STATUS_SHM_DEFAULT "/belvedere"
+#define STATUS_MAX_DEVICES 32
+#define STATUS_LAYER_MAX 32
+#define STATUS_READ_TRIES 1000  // attempts before a reader gives up on a writer mid-update
+#define STATUS_NAME_MAX 256
+
+// One open device
+typedef struct
+{
+    uint16_t vendor_id;
+    uint16_t product_id;
+    uint8_t input;     // 0 for HID, 1 for evdev
+    uint8_t led_sync;  // 1 if the device mirrors the shared LED state
+    uint8_t leds;      // LED_* mask last sent to the device
+    uint8_t reserved;
+    uint64_t reports;  // reports (HID) or key events (evdev) read since the daemon started
+} status_device_t;
+
+// The published state; readers always get a copy of one whole update
+typedef struct
+{
+    uint64_t updated_ns;  // CLOCK_MONOTONIC time of the update
+    uint8_t leds;         // shared LED state, LED_* mask from led_state.h
+    uint8_t reserved[3];
+    uint32_t device_count;
+    char layer[STATUS_LAYER_MAX];  // active layer
+    uint64_t dispatched;           // key events that ran a binding's action
+    uint64_t unmatched;            // key events with no binding
+    uint64_t filtered;             // key events dropped by debounce_ms or max_rate
+    uint64_t failed;               // actions that failed
+    status_device_t devices[STATUS_MAX_DEVICES];
+} status_t;
+
+/**
+ * The segment. sequence is a seqlock: the daemon makes it odd, rewrites status and makes it
+ * even again, so a reader that saw the same even value before and after its copy has a
+ * consistent snapshot. Reading takes no lock and no system call.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;  // sizeof(status_t)
+    _Atomic uint32_t sequence;
+    status_t status;
+} status_shm_t;
+
+// The daemon's side of one segment; zero-initialized means no segment
+typedef struct
+{
+    status_shm_t* shm;
+    char name[STATUS_NAME_MAX];
+    status_t last;  // last status published, to skip updates that change nothing
+} status_writer_t;
+
+/**
+ * Create the segment, replacing one left behind under the same name, and publish an empty
+ * status. A segment the writer created earlier under another name is removed.
+ *
+ * @param writer Writer to create the segment for
+ * @param name POSIX shared memory name, such as STATUS_SHM_DEFAULT
+ * @return true on success, false otherwise
+ */
+bool status_shm_create(status_writer_t* writer, const char* name);
+
+/**
+ * Publish a status if it differs from the last one published. Only the daemon's loop thread
+ * writes; a reader copying concurrently retries.
+ *
+ * @param writer Writer whose segment is updated
+ * @param status Status to publish; updated_ns is filled in
+ * @return true if the segment was written, false if nothing changed or there is no segment
+ */
+bool status_shm_publish(status_writer_t* writer, status_t* status);
+
+/**
+ * Unmap and remove the writer's segment. Readers that still have it mapped keep the last
+ * status.
+ */
+void status_shm_destroy(status_writer_t* writer);
+
+/**
+ * Map a daemon's segment read-only.
+ *
+ * @param name Name the daemon created the segment under
+ * @return Mapped segment, or NULL if it does not exist or has another layout version
+ */
+const status_shm_t* status_shm_attach(const char* name);
+
+/**
+ * Copy a consistent snapshot out of a mapped segment.
+ *
+ * @param shm Segment from status_shm_attach()
+ * @param status Receives the snapshot
+ * @return true on success, false if no consistent copy was made in STATUS_READ_TRIES attempts
+ */
+bool status_shm_read(const status_shm_t* shm, status_t* status);
+
+/**
+ * Unmap a segment from status_shm_attach().
+ */
+void status_shm_detach(const status_shm_t* shm);
+
+#endif  // STATUS_SHM_H
@@ -0,0 +1,83 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "loop_monitor.h"
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+typedef struct wheel_timer wheel_timer_t;
+typedef void (*wheel_timer_cb_t)(wheel_timer_t* timer);
+
+/**
+ * A timer embedded in the caller's own structure; the wheel never allocates.
+ */
+struct wheel_timer
+{
+    wheel_timer_t* next;
+    wheel_timer_t* prev;
+    uint64_t expires;  // absolute tick (ms)
+    wheel_timer_cb_t callback;
+    void* data;
+};
+
+/**
+ * Hierarchical timer wheel with 1ms ticks. Four levels of 64 slots cover delays of up to
+ * about 4.6 hours; scheduling, cancelling and firing are O(1) per timer, with timers in the
+ * higher levels cascaded down as their slot comes due.
+ */
+typedef struct
+{
+    uint64_t now;  // current tick (ms)
+    size_t count;  // scheduled timers
+    uint64_t due;  // next tick a slot fires or cascades; may be early, never late
+    wheel_timer_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];  // list heads
+    uv_timer_t* tick;         // drives the wheel while timers are pending, NULL without a loop
+    loop_monitor_t* monitor;  // times the ticks, or NULL
+} timer_wheel_t;
+
+/**
+ * Initialize a wheel. With a loop, the wheel advances itself from a one-shot uv timer armed
+ * for the next due slot while timers are pending; without one, the caller drives it with
+ * timer_wheel_advance().
+ *
+ * @param wheel Wheel to initialize
+ * @param loop Loop to run on, or NULL
+ * @param monitor Monitor that times the ticks, or NULL
+ * @return true on success, false otherwise
+ */
+bool timer_wheel_init(timer_wheel_t* wheel, uv_loop_t* loop, loop_monitor_t* monitor);
+
+/**
+ * Release the wheel's loop resources. Pending timers are dropped without firing.
+ */
+void timer_wheel_close(timer_wheel_t* wheel);
+
+/**
+ * Schedule a timer to fire after delay_ms. The timer must not already be scheduled.
+ */
+void timer_wheel_schedule(timer_wheel_t* wheel, wheel_timer_t* timer, uint64_t delay_ms,
+                          wheel_timer_cb_t callback, void* data);
+
+/**
+ * Cancel a scheduled timer. Cancelling an idle timer is a no-op.
+ */
+void timer_wheel_cancel(timer_wheel_t* wheel, wheel_timer_t* timer);
+
+/**
+ * Advance the wheel to now_ms, firing every timer that has expired.
+ */
+void timer_wheel_advance(timer_wheel_t* wheel, uint64_t now_ms);
+
+static inline bool timer_wheel_pending(const wheel_timer_t* timer)
+{
+    return timer->next != NULL;
+}
+
+#endif  // TIMER_WHEEL_H
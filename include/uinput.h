@@ -0,0 +1,61 @@
+#ifndef UINPUT_H
+#define UINPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+// Receives the bytes of one batch of input events instead of the virtual device
+typedef ssize_t (*uinput_sink_t)(const void* data, size_t length);
+
+// The virtual keyboard of one instance
+typedef struct
+{
+    int fd;  // -1 until the device is created
+    uinput_sink_t sink;
+} uinput_t;
+
+/**
+ * Prepare a virtual keyboard that has not been created yet.
+ */
+void uinput_init(uinput_t* uinput);
+
+/**
+ * Create the virtual keyboard if the configuration has key actions and it does not exist yet.
+ * It is kept across reloads, so applications see one stable input device.
+ *
+ * @param uinput Virtual keyboard
+ * @param config Loaded configuration
+ * @return true if key actions can be emitted (or none are configured), false otherwise
+ */
+bool uinput_open(uinput_t* uinput, const config_t* config);
+
+/**
+ * Destroy the virtual keyboard.
+ */
+void uinput_cleanup(uinput_t* uinput);
+
+/**
+ * Emit a key action's keystrokes with a single write. Each stroke presses its keys in order,
+ * then releases them in reverse, each half closed by a SYN_REPORT.
+ *
+ * @param uinput Virtual keyboard
+ * @param keys Packed uint16_t key codes as stored in a binding's payload, 0 between strokes
+ * @param length Payload length in bytes
+ * @return 0 if the events were written, -1 otherwise
+ */
+int uinput_emit(uinput_t* uinput, const void* keys, size_t length);
+
+/**
+ * Send emitted events to a sink instead of the virtual device, e.g. to test without access to
+ * /dev/uinput.
+ *
+ * @param uinput Virtual keyboard
+ * @param sink Sink to use, or NULL for the virtual device
+ */
+void uinput_set_sink(uinput_t* uinput, uinput_sink_t sink);
+
+#endif  // UINPUT_H
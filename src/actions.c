@@ -0,0 +1,210 @@
+#include "actions.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "debug.h"
+
+static int open_target(actions_target_t* t)
+{
+    t->fd = -1;
+    switch (t->type)
+    {
+    case ACTION_FIFO:
+        // Fails with ENXIO until a reader opens the FIFO
+        t->fd = open(t->path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        break;
+    case ACTION_APPEND:
+        t->fd = open(t->path, O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK | O_CLOEXEC, 0644);
+        break;
+    case ACTION_DATAGRAM:
+    {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(t->path) >= sizeof(addr.sun_path))
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(addr.sun_path, t->path);
+
+        t->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (t->fd < 0)
+            break;
+        fcntl(t->fd, F_SETFL, fcntl(t->fd, F_GETFL) | O_NONBLOCK);
+        fcntl(t->fd, F_SETFD, FD_CLOEXEC);
+        if (connect(t->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            int saved_errno = errno;
+            close(t->fd);
+            t->fd = -1;
+            errno = saved_errno;
+        }
+        break;
+    }
+    default:
+        t->fd = -1;
+        errno = EINVAL;
+        break;
+    }
+    return t->fd;
+}
+
+static void on_poll_closed(uv_handle_t* handle)
+{
+    free(handle);
+}
+
+static void stop_polling(actions_target_t* t)
+{
+    if (t->poll_handle)
+    {
+        uv_poll_stop(t->poll_handle);
+        uv_close((uv_handle_t*)t->poll_handle, on_poll_closed);
+        t->poll_handle = NULL;
+    }
+}
+
+static void close_target(actions_target_t* t)
+{
+    stop_polling(t);
+    if (t->fd >= 0)
+    {
+        close(t->fd);
+        t->fd = -1;
+    }
+    t->pending_len = 0;
+}
+
+static void on_target_writable(uv_poll_t* handle, int status, int events)
+{
+    (void)events;  // Silence unused parameter warning
+    actions_target_t* t = handle->data;
+
+    if (status < 0)
+    {
+        debugf(stderr, "Error waiting for %s: %s\n", t->path, uv_strerror(status));
+        close_target(t);
+        return;
+    }
+
+    ssize_t n = write(t->fd, t->pending, t->pending_len);
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        debugf(stderr, "Failed to write to %s: %s\n", t->path, strerror(errno));
+        close_target(t);
+        return;
+    }
+
+    memmove(t->pending, t->pending + n, t->pending_len - (size_t)n);
+    t->pending_len -= (size_t)n;
+    if (t->pending_len == 0)
+        stop_polling(t);
+}
+
+// Queue FIFO data and wait on the loop until the reader drains the pipe
+static int queue_pending(actions_t* actions, actions_target_t* t, const char* payload,
+                         size_t length)
+{
+    if (t->pending_len + length > sizeof(t->pending))
+    {
+        debugf(stderr, "Write queue for %s is full, dropping %zu bytes\n", t->path, length);
+        return -1;
+    }
+    memcpy(t->pending + t->pending_len, payload, length);
+    t->pending_len += length;
+
+    if (!t->poll_handle && actions->loop)
+    {
+        t->poll_handle = malloc(sizeof(uv_poll_t));
+        if (!t->poll_handle)
+            return -1;
+        uv_poll_init(actions->loop, t->poll_handle, t->fd);
+        t->poll_handle->data = t;
+        uv_poll_start(t->poll_handle, UV_WRITABLE, on_target_writable);
+    }
+    return 0;
+}
+
+bool actions_init(actions_t* actions, uv_loop_t* loop)
+{
+    actions->loop = loop;
+    return true;
+}
+
+bool actions_open(actions_t* actions, const config_t* config)
+{
+    actions_cleanup(actions);
+
+    for (size_t i = 0; i < config->target_count && i < MAX_ACTION_TARGETS; i++)
+    {
+        actions_target_t* t = &actions->targets[i];
+        t->type = config->targets[i].type;
+        strncpy(t->path, config->targets[i].path, sizeof(t->path) - 1);
+        t->path[sizeof(t->path) - 1] = '\0';
+        t->pending_len = 0;
+        t->poll_handle = NULL;
+
+        if (open_target(t) < 0)
+        {
+            debug("Action target %s not ready (%s), will retry on write\n", t->path,
+                  strerror(errno));
+        }
+        actions->target_count++;
+    }
+    return true;
+}
+
+void actions_cleanup(actions_t* actions)
+{
+    for (size_t i = 0; i < actions->target_count; i++)
+    {
+        close_target(&actions->targets[i]);
+    }
+    actions->target_count = 0;
+}
+
+int actions_write(actions_t* actions, uint8_t target, const char* payload, size_t length)
+{
+    if (target >= actions->target_count)
+        return -1;
+
+    actions_target_t* t = &actions->targets[target];
+    if (t->fd < 0 && open_target(t) < 0)
+    {
+        debug("Action target %s unavailable: %s\n", t->path, strerror(errno));
+        return -1;
+    }
+
+    // Keep FIFO output ordered behind anything already queued
+    if (t->pending_len > 0)
+        return queue_pending(actions, t, payload, length);
+
+    ssize_t n = t->type == ACTION_DATAGRAM ? send(t->fd, payload, length, 0)
+                                           : write(t->fd, payload, length);
+    if (n == (ssize_t)length)
+        return 0;
+
+    if (n >= 0 && t->type == ACTION_FIFO)
+        return queue_pending(actions, t, payload + n, length - (size_t)n);
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        if (t->type == ACTION_FIFO)
+            return queue_pending(actions, t, payload, length);
+        debug("Action target %s is busy, dropping payload\n", t->path);
+        return -1;
+    }
+
+    // Reader went away (EPIPE) or the socket was rebound; reopen on the next write
+    debug("Failed to write to %s: %s\n", t->path, n < 0 ? strerror(errno) : "short write");
+    close_target(t);
+    return -1;
+}
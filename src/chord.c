@@ -0,0 +1,92 @@
+#include "chord.h"
+
+#include <string.h>
+
+#include "debug.h"
+
+#define DEVICE_SLOTS (sizeof(((config_t*)0)->devices) / sizeof(((config_t*)0)->devices[0]))
+
+void chord_init(chord_t* chords, chord_fire_cb_t fire_cb, chord_replay_cb_t replay_cb,
+                void* user_data)
+{
+    memset(chords, 0, sizeof(*chords));
+    chords->fire = fire_cb;
+    chords->replay = replay_cb;
+    chords->user_data = user_data;
+}
+
+// Leave the chord: replay held-back presses, plus the release of released_key if held back
+static void flush(chord_t* chords, const config_t* config, uint8_t device, uint16_t vendor_id,
+                  uint16_t product_id, chord_device_t* dev, int released_key)
+{
+    chord_device_t pending = *dev;
+    dev->state = 0;
+    dev->held_count = 0;
+    dev->deferred = 0;
+
+    for (uint8_t i = 0; i < pending.held_count; i++)
+    {
+        if (!(pending.deferred & (1u << i)))
+            continue;
+        chords->replay(config, device, vendor_id, product_id, pending.held[i],
+                       pending.modifiers[i], true, chords->user_data);
+        if (pending.held[i] == released_key)
+        {
+            chords->replay(config, device, vendor_id, product_id, pending.held[i],
+                           pending.modifiers[i], false, chords->user_data);
+        }
+    }
+}
+
+bool chord_key(chord_t* chords, const config_t* config, uint8_t device, uint16_t vendor_id,
+               uint16_t product_id, uint16_t keycode, uint8_t modifiers, bool pressed)
+{
+    if (!chords->fire || device >= DEVICE_SLOTS)
+        return false;
+    chord_device_t* dev = &chords->devices[device];
+
+    if (!pressed)
+    {
+        for (uint8_t i = 0; i < dev->held_count; i++)
+        {
+            if (dev->held[i] != keycode)
+                continue;
+            // Releases of keys absorbed by a completed chord are consumed with it
+            flush(chords, config, device, vendor_id, product_id, dev, keycode);
+            return true;
+        }
+        return false;
+    }
+
+    const chord_entry_t* t = lookup_section_chord(config, device, dev->state, keycode);
+    if (!t && dev->state != 0)
+    {
+        flush(chords, config, device, vendor_id, product_id, dev, -1);
+        t = lookup_section_chord(config, device, 0, keycode);
+    }
+    if (!t)
+        return false;
+
+    if (dev->held_count < MAX_CHORD_KEYS)
+    {
+        dev->held[dev->held_count] = keycode;
+        dev->modifiers[dev->held_count] = modifiers;
+        dev->deferred |= (uint8_t)(1u << dev->held_count);
+        dev->held_count++;
+    }
+    dev->state = t->next;
+
+    if (t->binding != KEYMAP_EMPTY)
+    {
+        debug("Chord completed by keycode=%d\n", keycode);
+        // The chord replaces the presses of its keys; a longer chord may still follow
+        dev->deferred = 0;
+        chords->fire(config, t->device, t->binding, chords->user_data);
+    }
+    return true;
+}
+
+void chord_reset(chord_t* chords)
+{
+    memset(chords->devices, 0, sizeof(chords->devices));
+}
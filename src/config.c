@@ -2,15 +2,19 @@
 #include "../include/config.h"
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
+#include <limits.h>
 #include <pwd.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "../include/debug.h"
+#include "../include/keycodes.h"
 
 static char* get_config_path(void)
 {
@@ -62,207 +66,2291 @@ static char* trim(char* str)
     return str;
 }
 
+// A binding's key as written in the config: modifiers, keycode and any chord keys
+typedef struct
+{
+    uint16_t keycode;
+    uint8_t modifiers;
+    uint8_t chord_len;
+    uint16_t chord[MAX_CHORD_KEYS - 1];
+    const char* suffix;  // rest of the key, e.g. ".hold", empty if none
+} key_spec_t;
+
+static uint8_t parse_modifier(const char* name, size_t len)
+{
+    static const struct
+    {
+        const char* name;
+        uint8_t mask;
+    } names[] = {
+        {"ctrl", MOD_CTRL}, {"shift", MOD_SHIFT}, {"alt", MOD_ALT},
+        {"gui", MOD_GUI},   {"super", MOD_GUI},   {"meta", MOD_GUI},
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strlen(names[i].name) == len && strncasecmp(name, names[i].name, len) == 0)
+            return names[i].mask;
+    }
+    return 0;
+}
+
+static bool parse_keycode_at(const char* str, uint16_t* keycode, const char** end)
+{
+    char* stop;
+    long value;
+    if (strncmp(str, "0x", 2) == 0 || strncmp(str, "0X", 2) == 0)
+        value = strtol(str + 2, &stop, 16);
+    else
+        value = strtol(str, &stop, 10);
+
+    if (stop == str || value < 0 || value > 0xFFFF)
+        return false;
+    *keycode = (uint16_t)value;
+    *end = stop;
+    return true;
+}
+
+/**
+ * Parse a binding key of the form "[mod+]...KEY[&KEY]...[.suffix]", e.g. "111",
+ * "ctrl+shift+0x6F", "111&112" or "ctrl+111.hold".
+ */
+static bool parse_key_spec(const char* str, key_spec_t* spec)
+{
+    memset(spec, 0, sizeof(*spec));
+
+    // Modifier names start with a letter; keycodes with a digit
+    const char* plus;
+    while (isalpha((unsigned char)*str) && (plus = strchr(str, '+')))
+    {
+        uint8_t mod = parse_modifier(str, (size_t)(plus - str));
+        if (!mod)
+            return false;
+        spec->modifiers |= mod;
+        str = plus + 1;
+    }
+
+    if (!parse_keycode_at(str, &spec->keycode, &str))
+        return false;
+    while (*str == '&')
+    {
+        if (spec->chord_len >= MAX_CHORD_KEYS - 1 ||
+            !parse_keycode_at(str + 1, &spec->chord[spec->chord_len], &str))
+        {
+            return false;
+        }
+        spec->chord_len++;
+    }
+
+    spec->suffix = str;
+    return true;
+}
+
+static bool binding_matches(const key_binding_t* binding, const key_spec_t* spec)
+{
+    return (binding->trigger == TRIGGER_PRESS || binding->trigger == TRIGGER_CHORD) &&
+           binding->keycode == spec->keycode && binding->modifiers == spec->modifiers &&
+           binding->chord_len == spec->chord_len &&
+           memcmp(binding->chord, spec->chord, spec->chord_len * sizeof(spec->chord[0])) == 0;
+}
+
+// The first press or chord binding for a key, as written earlier in the section
+static key_binding_t* find_binding(device_config_t* dev, const key_spec_t* spec)
+{
+    for (size_t i = 0; i < dev->binding_count; i++)
+    {
+        if (binding_matches(&dev->bindings[i], spec))
+            return &dev->bindings[i];
+    }
+    return NULL;
+}
+
+/**
+ * Parse a per-binding option of the form "<key>.<option> = <value>". The binding must
+ * appear earlier in the same section.
+ */
+static bool parse_binding_option(device_config_t* dev, const key_spec_t* spec, const char* val)
+{
+    const char* option = spec->suffix + 1;
+    int value = atoi(val);
+    if (value < 0)
+        value = 0;
+    if (value > 0xFFFF)
+        value = 0xFFFF;
+
+    key_binding_t* binding = find_binding(dev, spec);
+    if (!binding)
+        return false;
+
+    if (strcasecmp(option, "debounce_ms") == 0)
+    {
+        binding->debounce_ms = (uint16_t)value;
+        return true;
+    }
+    if (strcasecmp(option, "max_rate") == 0)
+    {
+        binding->max_rate = (uint16_t)value;
+        return true;
+    }
+    if (strcasecmp(option, "hold_ms") == 0)
+    {
+        binding->hold_ms = (uint16_t)value;
+        return true;
+    }
+    if (strcasecmp(option, "double_tap_ms") == 0)
+    {
+        binding->double_tap_ms = (uint16_t)value;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Parse a sequence of the form "seq: <op>, <delay>, <op>, ...", where op is mode+led and
+ * delay is a number of milliseconds with an optional "ms" suffix.
+ */
+static bool parse_sequence(config_t* config, key_binding_t* binding, char* val)
+{
+    size_t first = config->step_count;
+    uint32_t delay = 0;
+
+    for (char* token = strtok(val + strlen("seq:"), ","); token; token = strtok(NULL, ","))
+    {
+        token = trim(token);
+        if (isdigit((unsigned char)*token))
+        {
+            delay += (uint32_t)atoi(token);
+            continue;
+        }
+        if (!strchr("^+-", *token) || token[0] == '\0' || token[1] == '\0')
+        {
+            debugf(stderr, "Invalid sequence step '%s'\n", token);
+            config->step_count = first;
+            return false;
+        }
+        if (config->step_count >= MAX_SEQUENCE_STEPS)
+        {
+            debugf(stderr, "Too many sequence steps\n");
+            config->step_count = first;
+            return false;
+        }
+
+        sequence_step_t* step = &config->steps[config->step_count++];
+        step->delay_ms = delay > 0xFFFF ? 0xFFFF : (uint16_t)delay;
+        step->mode = token[0];
+        strncpy(step->led, token + 1, sizeof(step->led) - 1);
+        step->led[sizeof(step->led) - 1] = '\0';
+        delay = 0;
+    }
+
+    if (config->step_count == first)
+        return false;
+
+    binding->action = ACTION_SEQUENCE;
+    binding->first_step = (uint8_t)first;
+    binding->step_count = (uint8_t)(config->step_count - first);
+    return true;
+}
+
+/**
+ * Parse a write action of the form "<kind>:<path> <payload>", where kind is fifo, append or
+ * socket. The payload supports \n, \t and \\ escapes.
+ */
+static bool parse_write_action(config_t* config, key_binding_t* binding, char* val)
+{
+    static const struct
+    {
+        const char* prefix;
+        action_type_t type;
+    } kinds[] = {
+        {"fifo:", ACTION_FIFO},
+        {"append:", ACTION_APPEND},
+        {"socket:", ACTION_DATAGRAM},
+    };
+
+    size_t k;
+    for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+    {
+        if (strncasecmp(val, kinds[k].prefix, strlen(kinds[k].prefix)) == 0)
+            break;
+    }
+    if (k == sizeof(kinds) / sizeof(kinds[0]))
+        return false;
+
+    char* path = val + strlen(kinds[k].prefix);
+    char* payload = path;
+    while (*payload && !isspace((unsigned char)*payload))
+        payload++;
+    if (*payload)
+        *payload++ = '\0';
+    if (*path == '\0')
+        return false;
+
+    // Reuse the target if another binding already writes to it
+    size_t t;
+    for (t = 0; t < config->target_count; t++)
+    {
+        if (config->targets[t].type == kinds[k].type && strcmp(config->targets[t].path, path) == 0)
+            break;
+    }
+    if (t == config->target_count)
+    {
+        if (config->target_count >= MAX_ACTION_TARGETS)
+        {
+            debugf(stderr, "Too many action targets, ignoring %s\n", path);
+            return false;
+        }
+        config->targets[t].type = kinds[k].type;
+        strncpy(config->targets[t].path, path, sizeof(config->targets[t].path) - 1);
+        config->targets[t].path[sizeof(config->targets[t].path) - 1] = '\0';
+        config->target_count++;
+    }
+
+    size_t len = 0;
+    for (const char* p = payload; *p && len < sizeof(binding->payload); p++)
+    {
+        char c = *p;
+        if (c == '\\' && p[1])
+        {
+            p++;
+            c = *p == 'n' ? '\n' : *p == 't' ? '\t' : *p;
+        }
+        binding->payload[len++] = c;
+    }
+
+    binding->action = kinds[k].type;
+    binding->target = (uint8_t)t;
+    binding->payload_len = (uint8_t)len;
+    return true;
+}
+
+/**
+ * Parse a layer action of the form "layer:[^]NAME". The name is resolved to a layer index
+ * when the configuration is compiled, so it may refer to a section further down the file.
+ */
+static bool parse_layer_action(key_binding_t* binding, const char* val)
+{
+    while (isspace((unsigned char)*val))
+        val++;
+    binding->mode = '=';
+    if (*val == '^')
+    {
+        binding->mode = '^';
+        val++;
+    }
+
+    size_t len = strlen(val);
+    if (len == 0 || len >= LAYER_NAME_MAX)
+        return false;
+
+    binding->action = ACTION_LAYER;
+    binding->target = LAYER_NONE;
+    memcpy(binding->payload, val, len + 1);
+    binding->payload_len = (uint8_t)len;
+    return true;
+}
+
+/**
+ * Parse a key action of the form "key:STROKE [STROKE...]", where each stroke is one key or
+ * several joined by '+' and pressed together, e.g. "key: ctrl+shift+t" or "key: h i enter".
+ */
+static bool parse_key_action(config_t* config, key_binding_t* binding, char* val)
+{
+    uint16_t codes[MAX_PAYLOAD / 2];
+    size_t count = 0;
+    char* save = NULL;
+
+    for (char* stroke = strtok_r(val, " \t", &save); stroke;
+         stroke = strtok_r(NULL, " \t", &save))
+    {
+        if (count > 0)
+            codes[count++] = 0;
+        char* key_save = NULL;
+        for (char* key = strtok_r(stroke, "+", &key_save); key;
+             key = strtok_r(NULL, "+", &key_save))
+        {
+            uint16_t code = key_code_from_name(key);
+            if (code == 0)
+            {
+                debugf(stderr, "Unknown key '%s' in key action\n", key);
+                return false;
+            }
+            if (count >= sizeof(codes) / sizeof(codes[0]) - 1)
+            {
+                debugf(stderr, "Too many keys in key action\n");
+                return false;
+            }
+            codes[count++] = code;
+        }
+    }
+    if (count == 0 || codes[count - 1] == 0)
+        return false;
+
+    binding->action = ACTION_KEYS;
+    binding->payload_len = (uint8_t)(count * sizeof(uint16_t));
+    memcpy(binding->payload, codes, binding->payload_len);
+    config->key_actions = true;
+    return true;
+}
+
+static const struct
+{
+    const char* name;
+    segment_type_t type;
+} placeholders[] = {
+    {"vendor", SEGMENT_VENDOR}, {"product", SEGMENT_PRODUCT}, {"keycode", SEGMENT_KEYCODE},
+    {"device", SEGMENT_DEVICE}, {"led", SEGMENT_LED},         {"mode", SEGMENT_MODE},
+    {"setleds", SEGMENT_SETLEDS},
+};
+
+static bool add_segment(config_t* config, segment_type_t type)
+{
+    if (config->segment_count >= MAX_TEMPLATE_SEGMENTS)
+        return false;
+    config->segments[config->segment_count++] = (template_segment_t){.type = (uint8_t)type};
+    return true;
+}
+
+// Append a character of literal text, extending the previous text segment when it is adjacent
+static bool add_template_char(config_t* config, size_t first, char c)
+{
+    if (config->template_text_len >= TEMPLATE_TEXT_MAX)
+        return false;
+
+    template_segment_t* last =
+        config->segment_count > first ? &config->segments[config->segment_count - 1] : NULL;
+    if (!last || last->type != SEGMENT_TEXT || last->len == UINT8_MAX ||
+        last->offset + last->len != config->template_text_len)
+    {
+        if (!add_segment(config, SEGMENT_TEXT))
+            return false;
+        last = &config->segments[config->segment_count - 1];
+        last->offset = (uint16_t)config->template_text_len;
+    }
+    config->template_text[config->template_text_len++] = c;
+    last->len++;
+    return true;
+}
+
+// Length of the setleds path commands will run; it may be set after the templates using it
+static size_t setleds_len(const config_t* config)
+{
+    return strlen(config->setleds_path[0] ? config->setleds_path : DEFAULT_SETLEDS_PATH);
+}
+
+// Bytes a template renders to at most, with a setleds path of the given length
+static size_t template_bound(const command_template_t* template, size_t setleds)
+{
+    return template->max_len + template->setleds * setleds;
+}
+
+// Whether a setleds path of the given length keeps every command within COMMAND_MAX:
+// each template using it and the built-in "{setleds} {mode}{led}"
+static bool setleds_fits(const config_t* config, size_t len)
+{
+    if (len + 1 + 1 + sizeof(((key_binding_t*)0)->led) > COMMAND_MAX)
+        return false;
+    for (size_t t = 0; t < config->template_count; t++)
+    {
+        if (template_bound(&config->templates[t], len) > COMMAND_MAX)
+            return false;
+    }
+    return true;
+}
+
+// Worst case of one rendered segment; {setleds} is counted separately
+static size_t segment_bound(const template_segment_t* segment)
+{
+    switch (segment->type)
+    {
+    case SEGMENT_TEXT:
+        return segment->len;
+    case SEGMENT_BREAK:
+        return 1;  // the terminator
+    case SEGMENT_VENDOR:
+    case SEGMENT_PRODUCT:
+        return 4;  // hex digits
+    case SEGMENT_KEYCODE:
+        return 5;  // decimal digits of a uint16_t
+    case SEGMENT_DEVICE:
+        return 9;  // vendor:product
+    case SEGMENT_LED:
+        return sizeof(((key_binding_t*)0)->led) - 1;
+    case SEGMENT_MODE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Parse a command template into segments. Arguments are separated by whitespace; double quotes
+ * keep whitespace in an argument and a backslash takes the next character literally.
+ * Placeholders such as {keycode} may appear anywhere in an argument. Every executor mode
+ * spawns the program from the rendered argv without a shell, so the arguments reach it exactly
+ * as rendered. A template whose longest rendering would not fit COMMAND_MAX is rejected.
+ */
+static bool parse_command_template(config_t* config, const char* text, uint8_t* index)
+{
+    size_t first = config->segment_count;
+    size_t text_len = config->template_text_len;
+    size_t args = 0;
+    bool in_arg = false;
+    bool quoted = false;
+    bool ok = config->template_count < MAX_TEMPLATES;
+
+    for (const char* p = text; ok && *p; p++)
+    {
+        if (!quoted && isspace((unsigned char)*p))
+        {
+            if (in_arg)
+                ok = add_segment(config, SEGMENT_BREAK);
+            in_arg = false;
+            continue;
+        }
+        if (!in_arg)
+        {
+            in_arg = true;
+            ok = ++args <= COMMAND_MAX_ARGS;
+        }
+
+        if (*p == '"')
+        {
+            quoted = !quoted;
+        }
+        else if (*p == '{')
+        {
+            const char* close = strchr(p, '}');
+            size_t k = 0;
+            size_t count = sizeof(placeholders) / sizeof(placeholders[0]);
+            while (close && k < count &&
+                   (strlen(placeholders[k].name) != (size_t)(close - p - 1) ||
+                    strncmp(placeholders[k].name, p + 1, (size_t)(close - p - 1)) != 0))
+                k++;
+            if (!close || k == count)
+            {
+                debugf(stderr, "Unknown placeholder in command '%s'\n", text);
+                ok = false;
+                break;
+            }
+            ok = ok && add_segment(config, placeholders[k].type);
+            p = close;
+        }
+        else
+        {
+            if (*p == '\\' && p[1])
+                p++;
+            ok = ok && add_template_char(config, first, *p);
+        }
+    }
+    if (ok && in_arg)
+        ok = add_segment(config, SEGMENT_BREAK);
+
+    command_template_t template = {
+        .first_segment = (uint16_t)first,
+        .segment_count = (uint16_t)(config->segment_count - first),
+    };
+    size_t max_len = 0;
+    for (size_t i = first; i < config->segment_count; i++)
+    {
+        max_len += segment_bound(&config->segments[i]);
+        template.setleds += config->segments[i].type == SEGMENT_SETLEDS;
+    }
+    template.max_len = (uint16_t)(max_len < UINT16_MAX ? max_len : UINT16_MAX);
+
+    size_t bound = template_bound(&template, setleds_len(config));
+    if (ok && bound > COMMAND_MAX)
+    {
+        debugf(stderr, "Command '%s' can run to %zu bytes, more than %d\n", text, bound,
+               COMMAND_MAX);
+        ok = false;
+    }
+
+    if (!ok || quoted || args == 0)
+    {
+        config->segment_count = first;
+        config->template_text_len = text_len;
+        return false;
+    }
+
+    *index = (uint8_t)config->template_count;
+    config->templates[config->template_count++] = template;
+    return true;
+}
+
+/**
+ * Parse a binding's action: a sequence, a layer switch, keys to emit, a command, a write
+ * action, or mode+led for setleds.
+ */
+static bool parse_action(config_t* config, key_binding_t* binding, char* val)
+{
+    if (strlen(val) < 2)
+        return false;  // Require at least mode+led
+    if (strncasecmp(val, "seq:", 4) == 0)
+        return parse_sequence(config, binding, val);
+    if (strncasecmp(val, "layer:", 6) == 0)
+        return parse_layer_action(binding, val + 6);
+    if (strncasecmp(val, "key:", 4) == 0)
+        return parse_key_action(config, binding, val + 4);
+    if (strncasecmp(val, "cmd:", 4) == 0)
+    {
+        binding->action = ACTION_COMMAND;
+        return parse_command_template(config, val + 4, &binding->target);
+    }
+    if (strchr(val, ':') && !strchr("^+-", val[0]))
+        return parse_write_action(config, binding, val);
+
+    binding->mode = val[0];
+    strncpy(binding->led, val + 1, sizeof(binding->led) - 1);
+    binding->led[sizeof(binding->led) - 1] = '\0';
+    return true;
+}
+
+// Map a "KEY.<name>" suffix to its trigger; anything else is an option
+static trigger_t parse_trigger(const char* name)
+{
+    if (strcasecmp(name, "hold") == 0)
+        return TRIGGER_HOLD;
+    if (strcasecmp(name, "double_tap") == 0)
+        return TRIGGER_DOUBLE_TAP;
+    return TRIGGER_PRESS;
+}
+
+/* ---- leader-key trie ---- */
+
+static bool grow(void** items, size_t* capacity, size_t size, size_t needed)
+{
+    if (needed <= *capacity)
+        return true;
+
+    size_t new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+    void* p = realloc(*items, new_capacity * size);
+    if (!p)
+        return false;
+    *items = p;
+    *capacity = new_capacity;
+    return true;
+}
+
+static inline uint32_t leader_hash(uint32_t node, uint16_t keycode)
+{
+    uint32_t h = node * 0x9E3779B1u ^ keycode * 0x85EBCA6Bu;
+    return h ^ (h >> 16);
+}
+
+static void reset_leaders(leader_trie_t* trie)
+{
+    trie->node_count = 1;  // node 0 is LEADER_NONE
+    trie->action_count = 0;
+    trie->edge_count = 0;
+    for (size_t i = 0; i < trie->edge_capacity; i++)
+    {
+        trie->edges[i].node = LEADER_NONE;
+    }
+}
+
+static void put_edge(leader_edge_t* edges, size_t capacity, const leader_edge_t* edge)
+{
+    size_t h = leader_hash(edge->node, edge->keycode) & (capacity - 1);
+    while (edges[h].node != LEADER_NONE)
+        h = (h + 1) & (capacity - 1);
+    edges[h] = *edge;
+}
+
+// Keep the edge table at most half full so probes stay short
+static bool reserve_edge(leader_trie_t* trie)
+{
+    if ((trie->edge_count + 1) * 2 <= trie->edge_capacity)
+        return true;
+
+    size_t capacity = trie->edge_capacity ? trie->edge_capacity * 2 : 64;
+    leader_edge_t* edges = malloc(capacity * sizeof(*edges));
+    if (!edges)
+        return false;
+    for (size_t i = 0; i < capacity; i++)
+    {
+        edges[i].node = LEADER_NONE;
+    }
+    for (size_t i = 0; i < trie->edge_capacity; i++)
+    {
+        if (trie->edges[i].node != LEADER_NONE)
+            put_edge(edges, capacity, &trie->edges[i]);
+    }
+    free(trie->edges);
+    trie->edges = edges;
+    trie->edge_capacity = capacity;
+    return true;
+}
+
+static uint32_t new_leader_node(leader_trie_t* trie)
+{
+    if (!grow((void**)&trie->nodes, &trie->node_capacity, sizeof(leader_node_t),
+              trie->node_count + 1))
+        return LEADER_NONE;
+    trie->nodes[trie->node_count] = (leader_node_t){0};
+    return (uint32_t)trie->node_count++;
+}
+
+uint32_t leader_next(const config_t* config, uint32_t node, uint16_t keycode)
+{
+    const leader_trie_t* trie = &config->leaders;
+    if (node == LEADER_NONE || trie->edge_count == 0)
+        return LEADER_NONE;
+
+    size_t h = leader_hash(node, keycode) & (trie->edge_capacity - 1);
+    for (;;)
+    {
+        const leader_edge_t* e = &trie->edges[h];
+        if (e->node == LEADER_NONE)
+            return LEADER_NONE;
+        if (e->node == node && e->keycode == keycode)
+            return e->child;
+        h = (h + 1) & (trie->edge_capacity - 1);
+    }
+}
+
+const key_binding_t* leader_action(const config_t* config, uint32_t node)
+{
+    const leader_trie_t* trie = &config->leaders;
+    if (node == LEADER_NONE || node >= trie->node_count || !trie->nodes[node].action)
+        return NULL;
+    return &trie->actions[trie->nodes[node].action - 1];
+}
+
+/**
+ * Add a sequence to a device's trie. The first action for a sequence wins.
+ */
+static bool add_leader_sequence(config_t* config, device_config_t* dev, const uint16_t* keys,
+                                size_t count, const key_binding_t* action)
+{
+    leader_trie_t* trie = &config->leaders;
+
+    if (dev->leader_root == LEADER_NONE)
+    {
+        dev->leader_root = new_leader_node(trie);
+        if (dev->leader_root == LEADER_NONE)
+            return false;
+    }
+
+    uint32_t node = dev->leader_root;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t next = leader_next(config, node, keys[i]);
+        if (next == LEADER_NONE)
+        {
+            if (!reserve_edge(trie) || (next = new_leader_node(trie)) == LEADER_NONE)
+                return false;
+            leader_edge_t edge = {.node = node, .child = next, .keycode = keys[i]};
+            put_edge(trie->edges, trie->edge_capacity, &edge);
+            trie->edge_count++;
+            trie->nodes[node].children++;
+        }
+        node = next;
+    }
+
+    if (trie->nodes[node].action)
+        return true;
+    if (!grow((void**)&trie->actions, &trie->action_capacity, sizeof(key_binding_t),
+              trie->action_count + 1))
+        return false;
+    trie->actions[trie->action_count++] = *action;
+    trie->nodes[node].action = (uint32_t)trie->action_count;
+    return true;
+}
+
+// Parse "KEY,KEY[,KEY]..." into keys; returns the number of keys, 0 if invalid
+static size_t parse_leader_keys(const char* str, uint16_t* keys)
+{
+    size_t count = 0;
+    for (;;)
+    {
+        while (isspace((unsigned char)*str))
+            str++;
+        if (count == LEADER_MAX_KEYS || !parse_keycode_at(str, &keys[count], &str))
+            return 0;
+        count++;
+        while (isspace((unsigned char)*str))
+            str++;
+        if (*str == '\0')
+            break;
+        if (*str++ != ',')
+            return 0;
+    }
+    return count >= 2 ? count : 0;
+}
+
+int find_layer(const config_t* config, const char* name)
+{
+    for (size_t i = 0; i < config->layer_count; i++)
+    {
+        if (strcasecmp(config->layers[i].name, name) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+// Parse ":NAME]" at the end of a section header into name, which holds LAYER_NAME_MAX bytes
+static bool parse_section_name(const char* rest, char* name)
+{
+    size_t len = strlen(rest);
+    if (rest[0] != ':' || len < 3 || rest[len - 1] != ']' || len - 2 >= LAYER_NAME_MAX)
+        return false;
+
+    memcpy(name, rest + 1, len - 2);
+    name[len - 2] = '\0';
+    return true;
+}
+
+/**
+ * Parse what follows "[VID/PID" in a section header: "]" for the base layer or ":NAME]" for
+ * a named layer, which is added on first use. Returns the layer index, -1 if invalid.
+ */
+static int parse_section_layer(config_t* config, const char* rest)
+{
+    if (strcmp(rest, "]") == 0)
+        return 0;
+
+    char name[LAYER_NAME_MAX];
+    if (!parse_section_name(rest, name))
+        return -1;
+
+    int layer = find_layer(config, name);
+    if (layer >= 0)
+        return layer;
+    if (config->layer_count >= MAX_LAYERS)
+    {
+        debugf(stderr, "Too many layers, ignoring section for layer '%s'\n", name);
+        return -1;
+    }
+    strcpy(config->layers[config->layer_count].name, name);
+    return (int)config->layer_count++;
+}
+
+/**
+ * Parse a device section header: an exact, vendor-wide or any-device VID/PID pattern,
+ * optionally followed by :LAYER, or group:NAME. Returns false if the header is not a device
+ * section.
+ */
+static bool parse_section(config_t* config, const char* header, device_config_t* dev)
+{
+    unsigned int vid = 0, pid = 0;
+    int end = 0;
+    int layer = -1;
+
+    memset(dev, 0, sizeof(*dev));
+    if (strncasecmp(header, "[group", 6) == 0)
+    {
+        dev->kind = SECTION_GROUP;
+        return parse_section_name(header + 6, dev->name);
+    }
+
+    if (strncmp(header, "[*/*", 4) == 0)
+    {
+        dev->kind = SECTION_ANY;
+        layer = parse_section_layer(config, header + 4);
+    }
+    else if (sscanf(header, "[%x/%n", &vid, &end) == 1 && end > 0 && header[end] == '*')
+    {
+        dev->kind = SECTION_VENDOR;
+        layer = parse_section_layer(config, header + end + 1);
+    }
+    else if (sscanf(header, "[%x/%x%n", &vid, &pid, &end) == 2)
+    {
+        dev->kind = SECTION_DEVICE;
+        layer = parse_section_layer(config, header + end);
+    }
+    if (layer < 0)
+        return false;
+
+    dev->vendor = (uint16_t)vid;
+    dev->product = (uint16_t)pid;
+    dev->layer = (uint8_t)layer;
+    return true;
+}
+
+// Section header text for messages, such as "0x5043/*" or "group:media"
+static const char* section_label(const device_config_t* dev, char* buf, size_t size)
+{
+    switch (dev->kind)
+    {
+    case SECTION_VENDOR:
+        snprintf(buf, size, "0x%04x/*", dev->vendor);
+        break;
+    case SECTION_ANY:
+        snprintf(buf, size, "*/*");
+        break;
+    case SECTION_GROUP:
+        snprintf(buf, size, "group:%s", dev->name);
+        break;
+    default:
+        snprintf(buf, size, "0x%04x/0x%04x", dev->vendor, dev->product);
+        break;
+    }
+    return buf;
+}
+
+void free_config(config_t* config)
+{
+    for (size_t i = 0; i < config->file_count; i++)
+    {
+        free(config->files[i].text);
+        config->files[i].text = NULL;
+    }
+    config->file_count = 0;
+    free(config->leaders.nodes);
+    free(config->leaders.edges);
+    free(config->leaders.actions);
+    memset(&config->leaders, 0, sizeof(config->leaders));
+}
+
+// FNV-1a, to notice which parts of a reloaded configuration changed
+#define HASH_SEED 2166136261u
+
+static uint32_t hash_bytes(uint32_t h, const void* data, size_t len)
+{
+    const unsigned char* p = data;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t hash_string(uint32_t h, const char* s)
+{
+    return hash_bytes(h, s, strlen(s) + 1);
+}
+
+// Everything that decides which sections a device resolves to and which layer tables exist
+static uint32_t layout_hash(const config_t* config,
+                            const char groups[MAX_SECTIONS][LAYER_NAME_MAX])
+{
+    uint32_t h = HASH_SEED;
+    for (size_t d = 0; d < config->device_count; d++)
+    {
+        const device_config_t* dev = &config->devices[d];
+        h = hash_bytes(h, &dev->kind, sizeof(dev->kind));
+        h = hash_bytes(h, &dev->vendor, sizeof(dev->vendor));
+        h = hash_bytes(h, &dev->product, sizeof(dev->product));
+        h = hash_bytes(h, &dev->layer, sizeof(dev->layer));
+        h = hash_string(h, dev->name);
+        h = hash_string(h, groups[d]);
+    }
+    for (size_t l = 0; l < config->layer_count; l++)
+    {
+        h = hash_string(h, config->layers[l].name);
+    }
+    return h;
+}
+
+// Everything that decides which devices are opened and how they are read
+static uint32_t devices_hash(const config_t* config)
+{
+    uint32_t h = hash_bytes(HASH_SEED, &config->hid_reader, sizeof(config->hid_reader));
+    for (size_t d = 0; d < config->device_count; d++)
+    {
+        const device_config_t* dev = &config->devices[d];
+        h = hash_bytes(h, &dev->kind, sizeof(dev->kind));
+        h = hash_bytes(h, &dev->vendor, sizeof(dev->vendor));
+        h = hash_bytes(h, &dev->product, sizeof(dev->product));
+        h = hash_bytes(h, &dev->report_format, sizeof(dev->report_format));
+        h = hash_bytes(h, &dev->led_sync, sizeof(dev->led_sync));
+        h = hash_bytes(h, &dev->input, sizeof(dev->input));
+        h = hash_bytes(h, &dev->grab, sizeof(dev->grab));
+    }
+    return h;
+}
+
+static void compile_layers(config_t* config, uint32_t layers, bool index);
+
+// Modification time in nanoseconds, to tell whether a cached file must be read again
+static int64_t mtime_ns(const struct stat* st)
+{
+#ifdef __APPLE__
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+/**
+ * Fill in one file of a configuration. The text cached by the last load is moved over when
+ * the file's time and size are unchanged; otherwise the file is read and hashed.
+ *
+ * @return true on success, false if the file cannot be read
+ */
+static bool read_config_file(config_t* config, config_file_t* file, const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    config_file_t* cached = NULL;
+    for (size_t i = 0; i < config->file_count && !cached; i++)
+    {
+        if (config->files[i].text && strcmp(config->files[i].path, path) == 0)
+            cached = &config->files[i];
+    }
+    if (cached && cached->mtime_ns == mtime_ns(&st) && cached->size == (int64_t)st.st_size)
+    {
+        *file = *cached;
+        cached->text = NULL;
+        return true;
+    }
+
+    FILE* f = fopen(path, "r");
+    char* text = f ? malloc((size_t)st.st_size + 1) : NULL;
+    if (!text)
+    {
+        if (f)
+            fclose(f);
+        return false;
+    }
+    size_t len = fread(text, 1, (size_t)st.st_size, f);
+    text[len] = '\0';
+    fclose(f);
+
+    memset(file, 0, sizeof(*file));
+    snprintf(file->path, sizeof(file->path), "%s", path);
+    file->mtime_ns = mtime_ns(&st);
+    file->size = (int64_t)st.st_size;
+    file->hash = hash_bytes(HASH_SEED, text, len);
+    file->text = text;
+    return true;
+}
+
+static int compare_names(const void* a, const void* b)
+{
+    return strcmp(a, b);
+}
+
+/**
+ * Read the main file and the fragments in its conf.d directory into files, in merge order.
+ * Texts cached in the configuration move into files or are released.
+ *
+ * @return Number of files read, 0 if the main file cannot be read
+ */
+static size_t read_config_files(config_t* config, const char* path,
+                                config_file_t files[MAX_CONFIG_FILES])
+{
+    size_t count = 0;
+    if (read_config_file(config, &files[0], path))
+        count = 1;
+
+    // Fragments sit next to the main file, so a config named on the command line has its own
+    const char* slash = strrchr(path, '/');
+    if (slash)
+        snprintf(config->fragment_dir, sizeof(config->fragment_dir), "%.*s/%s",
+                 (int)(slash - path), path, CONF_D_DIR);
+    else
+        snprintf(config->fragment_dir, sizeof(config->fragment_dir), "%s", CONF_D_DIR);
+
+    char names[MAX_CONFIG_FILES - 1][MAX_PATH];
+    size_t name_count = 0;
+    DIR* dir = count ? opendir(config->fragment_dir) : NULL;
+    for (struct dirent* entry; dir && (entry = readdir(dir));)
+    {
+        size_t len = strlen(entry->d_name);
+        if (entry->d_name[0] == '.' || len < 5 || strcmp(entry->d_name + len - 4, ".ini") != 0 ||
+            len >= MAX_PATH)
+            continue;
+        if (name_count == MAX_CONFIG_FILES - 1)
+        {
+            debugf(stderr, "Ignoring %s: more than %d files in %s\n", entry->d_name,
+                   MAX_CONFIG_FILES - 1, config->fragment_dir);
+            continue;
+        }
+        strcpy(names[name_count++], entry->d_name);
+    }
+    if (dir)
+        closedir(dir);
+
+    // Merged in byte order of their names, whatever order the directory lists them in
+    qsort(names, name_count, MAX_PATH, compare_names);
+    for (size_t i = 0; i < name_count; i++)
+    {
+        char fragment[MAX_PATH * 2];
+        snprintf(fragment, sizeof(fragment), "%s/%s", config->fragment_dir, names[i]);
+        if (read_config_file(config, &files[count], fragment))
+            count++;
+        else
+            debugf(stderr, "Skipping unreadable fragment %s\n", fragment);
+    }
+    return count;
+}
+
+// Copy the next line of the merged files into line, as fgets() would; file is its file's index
+static bool next_line(const config_t* config, size_t* file, const char** pos, char* line,
+                      size_t size)
+{
+    while (!**pos)
+    {
+        if (++*file >= config->file_count)
+            return false;
+        *pos = config->files[*file].text;
+    }
+    size_t len = 0;
+    while ((*pos)[len] && (*pos)[len] != '\n' && len < size - 2)
+        len++;
+    if ((*pos)[len] == '\n')
+        len++;
+    memcpy(line, *pos, len);
+    line[len] = '\0';
+    *pos += len;
+    return true;
+}
+
+_Static_assert(MAX_SECTIONS <= 64, "config_changes_t.sections has a bit per section");
+
+/**
+ * Compare a reloaded configuration with the one it replaced and rebuild what changed. A
+ * changed base or group section can fall through into every layer; a changed layer section
+ * only into its own. Any change to the layout rebuilds everything.
+ */
+static void compile_changes(config_t* config, bool was_compiled, size_t old_count,
+                            const uint32_t old_hashes[MAX_SECTIONS],
+                            const char groups[MAX_SECTIONS][LAYER_NAME_MAX])
+{
+    config_changes_t* changes = &config->changes;
+    uint32_t layout = layout_hash(config, groups);
+    uint32_t devices = devices_hash(config);
+    memset(changes, 0, sizeof(*changes));
+    changes->layout = !was_compiled || old_count != config->device_count ||
+                      layout != config->layout_hash;
+    changes->devices = changes->layout || devices != config->devices_hash;
+    config->layout_hash = layout;
+    config->devices_hash = devices;
+
+    uint32_t layers = 0;
+    for (size_t d = 0; d < config->device_count; d++)
+    {
+        const device_config_t* dev = &config->devices[d];
+        if (!changes->layout && dev->hash == old_hashes[d])
+            continue;
+        changes->sections |= 1ULL << d;
+        if (dev->kind == SECTION_GROUP || dev->layer == 0)
+            layers = UINT32_MAX;
+        else
+            layers |= 1u << dev->layer;
+    }
+    if (changes->layout)
+        layers = UINT32_MAX;
+    layers &= (1u << config->layer_count) - 1;
+    changes->layers = (uint8_t)layers;
+
+    debug("Reload changed %d sections, rebuilding %d layers%s\n",
+          __builtin_popcountll(changes->sections), __builtin_popcount(layers),
+          changes->devices ? ", devices changed" : "");
+    compile_layers(config, layers, changes->layout);
+}
+
 bool load_config(const char* filename, config_t* config)
 {
-    const char* config_path = filename ? filename : get_config_path();
-    if (!config_path)
+    const char* config_path = filename ? filename : get_config_path();
+    if (!config_path)
+    {
+        debug("No configuration file found\n");
+        return false;
+    }
+
+    config_file_t files[MAX_CONFIG_FILES];
+    uint32_t old_file_hashes[MAX_CONFIG_FILES];
+    char old_file_paths[MAX_CONFIG_FILES][MAX_PATH];
+    size_t old_file_count = config->file_count;
+    for (size_t i = 0; i < old_file_count; i++)
+    {
+        old_file_hashes[i] = config->files[i].hash;
+        strcpy(old_file_paths[i], config->files[i].path);
+    }
+    size_t file_count = read_config_files(config, config_path, files);
+
+    // Texts of files that are gone, or were read again, are no longer needed
+    for (size_t i = 0; i < config->file_count; i++)
+    {
+        free(config->files[i].text);
+        config->files[i].text = NULL;
+    }
+    if (file_count == 0)
+    {
+        config->file_count = 0;
+        debug("Failed to open configuration file: %s\n", config_path);
+        return false;
+    }
+    memcpy(config->files, files, file_count * sizeof(files[0]));
+    config->file_count = file_count;
+
+    debug("Loading configuration from: %s\n", config_path);
+    uint16_t changed_files = 0;
+    for (size_t i = 0; i < file_count; i++)
+    {
+        size_t o = 0;
+        while (o < old_file_count && strcmp(old_file_paths[o], files[i].path) != 0)
+            o++;
+        if (o == old_file_count || old_file_hashes[o] != files[i].hash)
+        {
+            changed_files |= (uint16_t)(1u << i);
+            if (i > 0)
+                debug("Merging fragment %s\n", files[i].path);
+        }
+    }
+
+    // Compared with the reloaded sections, so only what changed is rebuilt
+    bool was_compiled = config->compiled;
+    size_t old_count = config->device_count;
+    uint32_t old_hashes[MAX_SECTIONS];
+    for (size_t d = 0; d < old_count; d++)
+    {
+        old_hashes[d] = config->devices[d].hash;
+    }
+
+    char line[256];
+    char groups[MAX_SECTIONS][LAYER_NAME_MAX] = {{0}};  // group named by each section
+    device_config_t* current = NULL;
+    config->device_count = 0;
+    config->setleds_path[0] = '\0';
+    config->control_path[0] = '\0';
+    config->metrics_path[0] = '\0';
+    config->metrics_interval_ms = DEFAULT_METRICS_INTERVAL_MS;
+    config->status_name[0] = '\0';
+    config->executor = EXECUTOR_SYSTEM;
+    config->coalesce_ms = 0;
+    config->hid_reader = HID_READER_POLL;
+    config->stall_ms = DEFAULT_STALL_MS;
+    config->target_count = 0;
+    config->step_count = 0;
+    config->template_count = 0;
+    config->segment_count = 0;
+    config->template_text_len = 0;
+    config->led_command = TEMPLATE_NONE;
+    config->key_actions = false;
+    reset_leaders(&config->leaders);
+    bool in_general_section = false;
+
+    // Keep the active layer across reloads, by name
+    char active_layer[LAYER_NAME_MAX] = "";
+    if (config->compiled && config->active)
+        strcpy(active_layer, config->active->name);
+    config->layer_count = 1;
+    strcpy(config->layers[0].name, "base");
+
+    config->monitored_keycodes_count = 0;
+    memset(config->monitored_keycodes, 0, sizeof(config->monitored_keycodes_count));
+
+    size_t file = 0;
+    size_t line_file = SIZE_MAX;
+    const char* pos = config->files[0].text;
+    while (next_line(config, &file, &pos, line, sizeof(line)))
+    {
+        // A file never continues the section the one before it ended in
+        if (file != line_file)
+        {
+            line_file = file;
+            current = NULL;
+            in_general_section = false;
+        }
+
+        char* trimmed = trim(line);
+        if (*trimmed == '\0' || *trimmed == '#')
+            continue;
+        if (current && *trimmed != '[')
+            current->hash = hash_string(current->hash, trimmed);
+
+        if (*trimmed == '[')
+        {
+            if (strcasecmp(trimmed, "[general]") == 0)
+            {
+                in_general_section = true;
+                current = NULL;
+                continue;
+            }
+            else
+            {
+                in_general_section = false;
+                current = NULL;
+                if (config->device_count >= MAX_SECTIONS)
+                {
+                    debugf(stderr, "Too many sections, ignoring section %s\n", trimmed);
+                    continue;
+                }
+                device_config_t* dev = &config->devices[config->device_count];
+                if (parse_section(config, trimmed, dev))
+                {
+                    current = dev;
+                    current->hash = hash_string(HASH_SEED, trimmed);
+                    groups[config->device_count++][0] = '\0';
+                    current->report_format = REPORT_KEYCODE;
+                    current->group = KEYMAP_EMPTY;
+                    current->leader_root = LEADER_NONE;
+                    current->leader_timeout_ms = DEFAULT_LEADER_TIMEOUT_MS;
+                }
+                else
+                {
+                    debugf(stderr, "Ignoring invalid section %s\n", trimmed);
+                }
+            }
+        }
+        else if (in_general_section)
+        {
+            char* eq = strchr(trimmed, '=');
+            if (!eq)
+                continue;
+            *eq = '\0';
+            char* key = trim(trimmed);
+            char* val = trim(eq + 1);
+            if (strcasecmp(key, "setleds") == 0)
+            {
+                size_t len = strlen(val);
+                if (len >= sizeof(config->setleds_path) || !setleds_fits(config, len))
+                {
+                    debugf(stderr, "setleds path '%s' makes commands too long, ignoring it\n", val);
+                    continue;
+                }
+                strncpy(config->setleds_path, val, sizeof(config->setleds_path) - 1);
+                config->setleds_path[sizeof(config->setleds_path) - 1] = '\0';
+            }
+            else if (strcasecmp(key, "led_command") == 0)
+            {
+                if (!parse_command_template(config, val, &config->led_command))
+                {
+                    debugf(stderr, "Invalid led_command '%s', running setleds directly.\n", val);
+                    config->led_command = TEMPLATE_NONE;
+                }
+            }
+            else if (strcasecmp(key, "control") == 0)
+            {
+                strncpy(config->control_path, val, sizeof(config->control_path) - 1);
+                config->control_path[sizeof(config->control_path) - 1] = '\0';
+            }
+            else if (strcasecmp(key, "metrics") == 0)
+            {
+                strncpy(config->metrics_path, val, sizeof(config->metrics_path) - 1);
+                config->metrics_path[sizeof(config->metrics_path) - 1] = '\0';
+            }
+            else if (strcasecmp(key, "metrics_interval_ms") == 0)
+            {
+                int ms = atoi(val);
+                config->metrics_interval_ms = ms > 0 ? (uint32_t)ms : DEFAULT_METRICS_INTERVAL_MS;
+            }
+            else if (strcasecmp(key, "status") == 0)
+            {
+                strncpy(config->status_name, val, sizeof(config->status_name) - 1);
+                config->status_name[sizeof(config->status_name) - 1] = '\0';
+            }
+            else if (strcasecmp(key, "executor") == 0)
+            {
+                if (strcasecmp(val, "helper") == 0)
+                {
+                    config->executor = EXECUTOR_HELPER;
+                }
+                else if (strcasecmp(val, "system") == 0)
+                {
+                    config->executor = EXECUTOR_SYSTEM;
+                }
+                else
+                {
+                    debugf(stderr, "Unknown executor '%s', using 'system'.\n", val);
+                }
+            }
+            else if (strcasecmp(key, "hid_reader") == 0)
+            {
+                if (strcasecmp(val, "uring") == 0)
+                {
+                    config->hid_reader = HID_READER_URING;
+                }
+                else if (strcasecmp(val, "poll") == 0)
+                {
+                    config->hid_reader = HID_READER_POLL;
+                }
+                else
+                {
+                    debugf(stderr, "Unknown hid_reader '%s', using 'poll'.\n", val);
+                }
+            }
+            else if (strcasecmp(key, "coalesce_ms") == 0)
+            {
+                int ms = atoi(val);
+                config->coalesce_ms = ms > 0 ? (uint32_t)ms : 0;
+            }
+            else if (strcasecmp(key, "stall_ms") == 0)
+            {
+                int ms = atoi(val);
+                config->stall_ms = ms > 0 ? (uint32_t)ms : 0;
+            }
+            else if (strcasecmp(key, "monitored_keycodes") == 0)
+            {
+                // Parse comma-separated keycodes (supports decimal and hex)
+                char* token = strtok(val, ",");
+                while (token && config->monitored_keycodes_count < MAX_MONITORED_KEYCODES)
+                {
+                    int keycode;
+                    if (strncmp(token, "0x", 2) == 0 || strncmp(token, "0X", 2) == 0)
+                    {
+                        // Parse hexadecimal keycode
+                        keycode = strtol(token + 2, NULL, 16);
+                    }
+                    else
+                    {
+                        // Parse decimal keycode
+                        keycode = atoi(token);
+                    }
+
+                    if (keycode >= 0 && keycode <= 0xFFFF)
+                    {  // Allow full 16-bit range
+                        config->monitored_keycodes[config->monitored_keycodes_count++] =
+                            (uint32_t)keycode;
+                        debug("Parsed monitored keycode: 0x%04x (%d)\n", keycode, keycode);
+                    }
+                    else
+                    {
+                        debugf(stderr,
+                               "Invalid keycode: 0x%04x in monitored_keycodes. Must be between 0 "
+                               "and 0xFFFF.\n",
+                               keycode);
+                    }
+                    token = strtok(NULL, ",");
+                }
+            }
+        }
+        else if (current)
+        {
+            char* eq = strchr(trimmed, '=');
+            if (!eq)
+                continue;
+            *eq = '\0';
+            char* key = trim(trimmed);
+            char* val = trim(eq + 1);
+
+            if (strcasecmp(key, "target") == 0)
+            {
+                strncpy(current->target, val, sizeof(current->target) - 1);
+                current->target[sizeof(current->target) - 1] = '\0';
+            }
+            else if (strcasecmp(key, "group") == 0 && current->kind != SECTION_GROUP)
+            {
+                // Resolved once every section has been read, so groups can come later
+                strncpy(groups[current - config->devices], val, LAYER_NAME_MAX - 1);
+            }
+            else if (strcasecmp(key, "report") == 0)
+            {
+                if (strcasecmp(val, "boot") == 0)
+                {
+                    current->report_format = REPORT_BOOT;
+                }
+                else if (strcasecmp(val, "keycode") == 0)
+                {
+                    current->report_format = REPORT_KEYCODE;
+                }
+                else
+                {
+                    debugf(stderr, "Unknown report format '%s', using 'keycode'.\n", val);
+                }
+            }
+            else if (strcasecmp(key, "input") == 0)
+            {
+                if (strcasecmp(val, "evdev") == 0)
+                {
+                    current->input = INPUT_EVDEV;
+                }
+                else if (strcasecmp(val, "hid") == 0)
+                {
+                    current->input = INPUT_HID;
+                }
+                else
+                {
+                    debugf(stderr, "Unknown input '%s', using 'hid'.\n", val);
+                }
+            }
+            else if (strcasecmp(key, "grab") == 0)
+            {
+                current->grab = strcasecmp(val, "true") == 0 || strcmp(val, "1") == 0;
+            }
+            else if (strcasecmp(key, "led_sync") == 0)
+            {
+                current->led_sync = strcasecmp(val, "true") == 0 || strcmp(val, "1") == 0;
+            }
+            else if (strcasecmp(key, "leader_timeout_ms") == 0)
+            {
+                int ms = atoi(val);
+                current->leader_timeout_ms =
+                    ms > 0 ? (uint16_t)(ms > 0xFFFF ? 0xFFFF : ms) : DEFAULT_LEADER_TIMEOUT_MS;
+            }
+            else if (strchr(key, ','))
+            {
+                // Leader sequence: KEY,KEY,... = action
+                uint16_t keys[LEADER_MAX_KEYS];
+                size_t count = parse_leader_keys(key, keys);
+                key_binding_t action = {0};
+                if (!count)
+                {
+                    debugf(stderr, "Ignoring invalid key sequence '%s'\n", key);
+                    continue;
+                }
+                action.keycode = keys[count - 1];
+                if (!parse_action(config, &action, val) ||
+                    !add_leader_sequence(config, current, keys, count, &action))
+                {
+                    debugf(stderr, "Invalid action for %s: %s\n", key, val);
+                }
+            }
+            else
+            {
+                key_spec_t spec;
+                if (!parse_key_spec(key, &spec) || (*spec.suffix && *spec.suffix != '.'))
+                {
+                    debugf(stderr, "Ignoring invalid key '%s'\n", key);
+                    continue;
+                }
+
+                trigger_t trigger = TRIGGER_PRESS;
+                if (*spec.suffix == '.')
+                {
+                    trigger = parse_trigger(spec.suffix + 1);
+                    if (trigger == TRIGGER_PRESS)
+                    {
+                        if (!parse_binding_option(current, &spec, val))
+                        {
+                            debugf(stderr,
+                                   "Ignoring option %s: unknown option or no such binding\n", key);
+                        }
+                        continue;
+                    }
+
+                    // KEY.hold / KEY.double_tap: an extra action on a key bound earlier
+                    if (spec.chord_len > 0 || !find_binding(current, &spec))
+                    {
+                        debugf(stderr, "Ignoring %s: no binding for that key\n", key);
+                        continue;
+                    }
+                }
+                else if (spec.chord_len > 0)
+                {
+                    trigger = TRIGGER_CHORD;
+                }
+
+                if (current->binding_count >= MAX_BINDINGS)
+                    continue;
+
+                key_binding_t* binding = &current->bindings[current->binding_count++];
+                memset(binding, 0, sizeof(*binding));
+                binding->keycode = spec.keycode;
+                binding->modifiers = spec.modifiers;
+                binding->trigger = (uint8_t)trigger;
+                binding->chord_len = spec.chord_len;
+                memcpy(binding->chord, spec.chord, sizeof(binding->chord));
+                if (!parse_action(config, binding, val))
+                {
+                    debugf(stderr, "Invalid action for %s: %s\n", key, val);
+                    current->binding_count--;
+                }
+            }
+        }
+    }
+
+    if (config->setleds_path[0] == '\0')
+    {
+        strncpy(config->setleds_path, DEFAULT_SETLEDS_PATH, sizeof(config->setleds_path) - 1);
+        config->setleds_path[sizeof(config->setleds_path) - 1] = '\0';
+    }
+
+    // Process each device
+    for (size_t i = 0; i < config->device_count; i++)
+    {
+        device_config_t* dev = &config->devices[i];
+        char label[64];
+        debug("Processing section %zu: [%s], layer=%s\n", i,
+              section_label(dev, label, sizeof(label)), config->layers[dev->layer].name);
+
+        if (groups[i][0])
+        {
+            for (size_t g = 0; g < config->device_count && dev->group == KEYMAP_EMPTY; g++)
+            {
+                if (config->devices[g].kind == SECTION_GROUP &&
+                    strcasecmp(config->devices[g].name, groups[i]) == 0)
+                    dev->group = (uint8_t)g;
+            }
+            if (dev->group == KEYMAP_EMPTY)
+                debugf(stderr, "Unknown group '%s' in [%s]\n", groups[i], label);
+        }
+
+        // Process each binding for this device
+        for (size_t j = 0; j < dev->binding_count; j++)
+        {
+            key_binding_t* binding = &dev->bindings[j];
+            if (binding->action == ACTION_SEQUENCE)
+            {
+                debug("  Binding %zu: keycode=0x%04x, sequence of %u steps\n", j,
+                      binding->keycode, binding->step_count);
+                continue;
+            }
+            if (binding->action == ACTION_LAYER)
+            {
+                debug("  Binding %zu: keycode=0x%04x, %s layer %s\n", j, binding->keycode,
+                      binding->mode == '^' ? "toggles" : "selects", binding->payload);
+                continue;
+            }
+            if (binding->action == ACTION_COMMAND)
+            {
+                debug("  Binding %zu: keycode=0x%04x, runs command template %u\n", j,
+                      binding->keycode, binding->target);
+                continue;
+            }
+            if (binding->action == ACTION_KEYS)
+            {
+                debug("  Binding %zu: keycode=0x%04x, emits %u key codes\n", j, binding->keycode,
+                      binding->payload_len / 2);
+                continue;
+            }
+            if (binding->action != ACTION_SETLEDS)
+            {
+                debug("  Binding %zu: keycode=0x%04x, writes %u bytes to %s\n", j,
+                      binding->keycode, binding->payload_len,
+                      config->targets[binding->target].path);
+                continue;
+            }
+            debug("  Binding %zu: keycode=0x%04x, led=%s, mode=%c\n", j, binding->keycode,
+                  binding->led, binding->mode);
+        }
+    }
+
+    // Full template, target or step tables drop bindings from sections whose text is the same,
+    // and other sections shift their indexes; what was parsed counts as much as the text
+    for (size_t d = 0; d < config->device_count; d++)
+    {
+        device_config_t* dev = &config->devices[d];
+        dev->hash =
+            hash_bytes(dev->hash, dev->bindings, dev->binding_count * sizeof(dev->bindings[0]));
+    }
+
+    compile_changes(config, was_compiled, old_count, old_hashes, groups);
+    config->changes.files = changed_files;
+    int layer = active_layer[0] ? find_layer(config, active_layer) : 0;
+    set_layer(config, layer >= 0 ? (size_t)layer : 0);
+    return true;
+}
+
+static inline uint32_t keymap_hash(uint32_t key, uint32_t extra)
+{
+    uint32_t h = key ^ (extra * 0x9E3779B1u);
+    h ^= h >> 15;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h;
+}
+
+// Index of the set of keys among a device's chord states, adding it if new; 0 is the empty set
+typedef struct
+{
+    uint16_t keys[KEYMAP_EMPTY][MAX_CHORD_KEYS];  // sorted
+    uint8_t lens[KEYMAP_EMPTY];
+    size_t count;
+} chord_states_t;
+
+static int chord_state(chord_states_t* states, const uint16_t* keys, uint8_t len)
+{
+    for (size_t i = 0; i < states->count; i++)
+    {
+        if (states->lens[i] == len && memcmp(states->keys[i], keys, len * sizeof(keys[0])) == 0)
+            return (int)i;
+    }
+    if (states->count == KEYMAP_EMPTY)
+        return -1;
+
+    memcpy(states->keys[states->count], keys, len * sizeof(keys[0]));
+    states->lens[states->count] = len;
+    return (int)states->count++;
+}
+
+static bool add_chord_transition(layer_t* layer, uint8_t table, uint8_t device, uint8_t state,
+                                 uint16_t keycode, uint8_t next, uint8_t binding)
+{
+    uint32_t h = keymap_hash(table, (uint32_t)state << 16 | keycode) & (CHORDMAP_SIZE - 1);
+    size_t probes = 0;
+
+    while (layer->chordmap[h].device != KEYMAP_EMPTY)
+    {
+        chord_entry_t* e = &layer->chordmap[h];
+        if (e->table == table && e->state == state && e->keycode == keycode)
+        {
+            // Shared prefix of several chords; keep the first binding that ends here
+            if (e->binding == KEYMAP_EMPTY)
+                e->binding = binding;
+            return true;
+        }
+        if (++probes == CHORDMAP_SIZE / 2)
+            return false;  // Keep the table sparse enough for short probes
+        h = (h + 1) & (CHORDMAP_SIZE - 1);
+    }
+
+    layer->chordmap[h] = (chord_entry_t){
+        .table = table,
+        .keycode = keycode,
+        .state = state,
+        .next = next,
+        .device = device,
+        .binding = binding,
+    };
+    return true;
+}
+
+/**
+ * Compile a section's chord bindings into a table of a layer's automaton. Each state is a set
+ * of held keys, so A&B matches whichever key goes down first, and chords sharing keys share
+ * states. States are numbered per layer, so the sections compiled into one table agree on
+ * them.
+ */
+static void compile_chords(const config_t* config, layer_t* layer, chord_states_t* states,
+                           uint8_t table, uint8_t device)
+{
+    const device_config_t* dev = &config->devices[device];
+
+    for (size_t b = 0; b < dev->binding_count; b++)
+    {
+        const key_binding_t* binding = &dev->bindings[b];
+        if (binding->trigger != TRIGGER_CHORD)
+            continue;
+
+        // Sorted, de-duplicated key set
+        uint16_t keys[MAX_CHORD_KEYS];
+        uint8_t n = 0;
+        for (size_t k = 0; k <= binding->chord_len; k++)
+        {
+            uint16_t key = k == 0 ? binding->keycode : binding->chord[k - 1];
+            size_t pos = 0;
+            while (pos < n && keys[pos] < key)
+                pos++;
+            if (pos < n && keys[pos] == key)
+                continue;
+            memmove(&keys[pos + 1], &keys[pos], (n - pos) * sizeof(keys[0]));
+            keys[pos] = key;
+            n++;
+        }
+
+        // One transition per (held subset, next key); the full set completes the chord
+        bool ok = n > 1;
+        for (unsigned held = 0; ok && held < (1u << n) - 1; held++)
+        {
+            uint16_t from_keys[MAX_CHORD_KEYS];
+            uint8_t from_len = 0;
+            for (uint8_t k = 0; k < n; k++)
+            {
+                if (held & (1u << k))
+                    from_keys[from_len++] = keys[k];
+            }
+            int from = chord_state(states, from_keys, from_len);
+
+            for (uint8_t k = 0; ok && k < n; k++)
+            {
+                if (held & (1u << k))
+                    continue;
+
+                unsigned after = held | (1u << k);
+                uint16_t to_keys[MAX_CHORD_KEYS];
+                uint8_t to_len = 0;
+                for (uint8_t t = 0; t < n; t++)
+                {
+                    if (after & (1u << t))
+                        to_keys[to_len++] = keys[t];
+                }
+                int to = chord_state(states, to_keys, to_len);
+                uint8_t completes = after == (1u << n) - 1 ? (uint8_t)b : KEYMAP_EMPTY;
+
+                ok = from >= 0 && to >= 0 &&
+                     add_chord_transition(layer, table, device, (uint8_t)from, keys[k],
+                                          (uint8_t)to, completes);
+            }
+        }
+
+        if (ok)
+            layer->chord_count++;
+        else
+            debugf(stderr, "Ignoring chord on keycode 0x%04x: invalid or chord table full\n",
+                   binding->keycode);
+    }
+}
+
+// A layer holds at most one table per device section that has a layer section of its own, each
+// of up to SECTION_CHAIN_MAX sections, so probing always finds a free slot
+_Static_assert(KEYMAP_SIZE >= 2 * (MAX_SECTIONS / 2) * SECTION_CHAIN_MAX * MAX_BINDINGS,
+               "keymap too small for the sections a layer can hold");
+
+// Enter a section's press bindings into a table of a layer's keymap; keys already entered are
+// kept
+static void compile_keymap(const config_t* config, layer_t* layer, uint8_t table, uint8_t device)
+{
+    const device_config_t* dev = &config->devices[device];
+
+    for (size_t b = 0; b < dev->binding_count; b++)
+    {
+        if (dev->bindings[b].trigger != TRIGGER_PRESS)
+            continue;
+
+        uint16_t keycode = dev->bindings[b].keycode;
+        uint8_t modifiers = dev->bindings[b].modifiers;
+        uint32_t h = keymap_hash(table, (uint32_t)modifiers << 16 | keycode) & (KEYMAP_SIZE - 1);
+
+        // Linear probing; the first binding for a key and modifier mask wins
+        while (layer->keymap[h].device != KEYMAP_EMPTY)
+        {
+            const keymap_entry_t* e = &layer->keymap[h];
+            if (e->table == table && e->keycode == keycode && e->modifiers == modifiers)
+                break;
+            h = (h + 1) & (KEYMAP_SIZE - 1);
+        }
+        if (layer->keymap[h].device != KEYMAP_EMPTY)
+            continue;
+
+        layer->keymap[h] = (keymap_entry_t){
+            .table = table,
+            .keycode = keycode,
+            .modifiers = modifiers,
+            .device = device,
+            .binding = (uint8_t)b,
+            .hold = KEYMAP_EMPTY,
+            .double_tap = KEYMAP_EMPTY,
+            .hold_ms = dev->bindings[b].hold_ms ? dev->bindings[b].hold_ms : DEFAULT_HOLD_MS,
+            .double_tap_ms = dev->bindings[b].double_tap_ms ? dev->bindings[b].double_tap_ms
+                                                            : DEFAULT_DOUBLE_TAP_MS,
+        };
+    }
+}
+
+// Whether a section applies to devices matching (kind, vendor, product)
+static bool section_matches(const device_config_t* dev, uint8_t kind, uint16_t vendor,
+                            uint16_t product)
+{
+    return dev->kind == kind &&
+           (kind == SECTION_ANY ||
+            (dev->vendor == vendor && (kind == SECTION_VENDOR || dev->product == product)));
+}
+
+// First section for a device pattern in a layer, or in any layer for LAYER_NONE; -1 if none
+static int find_section(const config_t* config, uint8_t kind, uint16_t vendor, uint16_t product,
+                        uint8_t layer)
+{
+    for (size_t d = 0; d < config->device_count; d++)
     {
-        debug("No configuration file found\n");
-        return false;
+        const device_config_t* dev = &config->devices[d];
+        if (section_matches(dev, kind, vendor, product) &&
+            (layer == LAYER_NONE || dev->layer == layer))
+            return (int)d;
     }
+    return -1;
+}
+
+/**
+ * The section devices matching a pattern resolve to: the first base-layer section for it, or
+ * the first section if it only appears in layer sections. KEYMAP_EMPTY if there is none.
+ */
+static uint8_t pattern_section(const config_t* config, uint8_t kind, uint16_t vendor,
+                               uint16_t product)
+{
+    int d = find_section(config, kind, vendor, product, 0);
+    if (d < 0)
+        d = find_section(config, kind, vendor, product, LAYER_NONE);
+    return d < 0 ? KEYMAP_EMPTY : (uint8_t)d;
+}
 
-    FILE* file = fopen(config_path, "r");
-    if (!file)
+// Slot of a pattern in the device index: its entry, or the free slot it would go in
+static size_t device_index_slot(const config_t* config, uint8_t kind, uint16_t vendor,
+                                uint16_t product)
+{
+    uint32_t h = keymap_hash(kind, (uint32_t)vendor << 16 | product) & (DEVICE_INDEX_SIZE - 1);
+    for (;;)
     {
-        debug("Failed to open configuration file: %s\n", config_path);
-        return false;
+        const device_index_entry_t* e = &config->device_index[h];
+        if (e->device == KEYMAP_EMPTY ||
+            (e->kind == kind && e->vendor == vendor && e->product == product))
+            return h;
+        h = (h + 1) & (DEVICE_INDEX_SIZE - 1);
     }
+}
 
-    debug("Loading configuration from: %s\n", config_path);
+// Map every [VID/PID] and [VID/*] pattern to the section its devices resolve to
+static void compile_device_index(config_t* config)
+{
+    for (size_t i = 0; i < DEVICE_INDEX_SIZE; i++)
+    {
+        config->device_index[i].device = KEYMAP_EMPTY;
+    }
+    config->any_device = pattern_section(config, SECTION_ANY, 0, 0);
 
-    char line[256];
-    device_config_t* current = NULL;
-    config->device_count = 0;
-    config->setleds_path[0] = '\0';
-    bool in_general_section = false;
+    for (size_t d = 0; d < config->device_count; d++)
+    {
+        const device_config_t* dev = &config->devices[d];
+        if (dev->kind != SECTION_DEVICE && dev->kind != SECTION_VENDOR)
+            continue;
 
-    config->monitored_keycodes_count = 0;
-    memset(config->monitored_keycodes, 0, sizeof(config->monitored_keycodes_count));
+        uint16_t product = dev->kind == SECTION_VENDOR ? 0 : dev->product;
+        size_t slot = device_index_slot(config, dev->kind, dev->vendor, product);
+        if (config->device_index[slot].device != KEYMAP_EMPTY)
+            continue;
+        config->device_index[slot] = (device_index_entry_t){
+            .vendor = dev->vendor,
+            .product = product,
+            .kind = dev->kind,
+            .device = pattern_section(config, dev->kind, dev->vendor, product),
+        };
+    }
+}
 
-    while (fgets(line, sizeof(line), file))
+uint8_t resolve_device(const config_t* config, uint16_t vendor, uint16_t product)
+{
+    if (!config->compiled)
     {
-        char* trimmed = trim(line);
-        if (*trimmed == '\0' || *trimmed == '#')
+        uint8_t device = pattern_section(config, SECTION_DEVICE, vendor, product);
+        if (device == KEYMAP_EMPTY)
+            device = pattern_section(config, SECTION_VENDOR, vendor, 0);
+        return device != KEYMAP_EMPTY ? device : pattern_section(config, SECTION_ANY, 0, 0);
+    }
+
+    const device_index_entry_t* e =
+        &config->device_index[device_index_slot(config, SECTION_DEVICE, vendor, product)];
+    if (e->device == KEYMAP_EMPTY)
+        e = &config->device_index[device_index_slot(config, SECTION_VENDOR, vendor, 0)];
+    return e->device != KEYMAP_EMPTY ? e->device : config->any_device;
+}
+
+// A section's group, or KEYMAP_EMPTY if it names none
+static uint8_t section_group(const config_t* config, const device_config_t* dev)
+{
+    if (dev->kind == SECTION_GROUP || dev->group >= config->device_count ||
+        config->devices[dev->group].kind != SECTION_GROUP)
+        return KEYMAP_EMPTY;
+    return dev->group;
+}
+
+size_t device_sections(const config_t* config, uint8_t device, size_t layer, uint8_t* sections)
+{
+    const device_config_t* rep = &config->devices[device];
+    size_t count = 0;
+
+    for (int pass = layer == 0 ? 1 : 0; pass < 2; pass++)
+    {
+        int d = find_section(config, rep->kind, rep->vendor, rep->product,
+                             pass == 0 ? (uint8_t)layer : 0);
+        if (d < 0)
             continue;
 
-        if (*trimmed == '[')
+        uint8_t candidates[2] = {(uint8_t)d, section_group(config, &config->devices[d])};
+        for (size_t c = 0; c < 2; c++)
         {
-            if (strcasecmp(trimmed, "[general]") == 0)
-            {
-                in_general_section = true;
-                current = NULL;
+            if (candidates[c] == KEYMAP_EMPTY || memchr(sections, candidates[c], count))
                 continue;
-            }
-            else
-            {
-                in_general_section = false;
-                if (config->device_count >= MAX_CONFIG_DEVICES)
-                    continue;
-                unsigned int vid, pid;
-                if (sscanf(trimmed, "[%x/%x]", &vid, &pid) == 2)
-                {
-                    current = &config->devices[config->device_count++];
-                    current->vendor = vid;
-                    current->product = pid;
-                    current->binding_count = 0;
-                    current->target[0] = '\0';
-                }
-                else
-                {
-                    current = NULL;
-                }
-            }
+            sections[count++] = candidates[c];
         }
-        else if (in_general_section)
-        {
-            char* eq = strchr(trimmed, '=');
-            if (!eq)
-                continue;
-            *eq = '\0';
-            char* key = trim(trimmed);
-            char* val = trim(eq + 1);
-            if (strcasecmp(key, "setleds") == 0)
-            {
-                strncpy(config->setleds_path, val, sizeof(config->setleds_path) - 1);
-                config->setleds_path[sizeof(config->setleds_path) - 1] = '\0';
-            }
-            else if (strcasecmp(key, "monitored_keycodes") == 0)
-            {
-                // Parse comma-separated keycodes (supports decimal and hex)
-                char* token = strtok(val, ",");
-                while (token && config->monitored_keycodes_count < MAX_MONITORED_KEYCODES)
-                {
-                    int keycode;
-                    if (strncmp(token, "0x", 2) == 0 || strncmp(token, "0X", 2) == 0)
-                    {
-                        // Parse hexadecimal keycode
-                        keycode = strtol(token + 2, NULL, 16);
-                    }
-                    else
-                    {
-                        // Parse decimal keycode
-                        keycode = atoi(token);
-                    }
+    }
+    return count;
+}
 
-                    if (keycode >= 0 && keycode <= 0xFFFF)
-                    {  // Allow full 16-bit range
-                        config->monitored_keycodes[config->monitored_keycodes_count++] =
-                            (uint32_t)keycode;
-                        debug("Parsed monitored keycode: 0x%04x (%d)\n", keycode, keycode);
-                    }
-                    else
-                    {
-                        debugf(stderr,
-                               "Invalid keycode: 0x%04x in monitored_keycodes. Must be between 0 "
-                               "and 0xFFFF.\n",
-                               keycode);
-                    }
-                    token = strtok(NULL, ",");
-                }
-            }
+/**
+ * Build one layer's tables. A device's table holds its sections in device_sections() order,
+ * so a named layer's bindings shadow base bindings for the same key and the rest fall through.
+ * Devices whose bindings all come from one section, such as a shared group, get that
+ * section's table, so it is compiled once however many devices use it.
+ */
+static void compile_layer(config_t* config, uint8_t index)
+{
+    static chord_states_t states;  // too large for the stack; compile is not reentrant
+    layer_t* layer = &config->layers[index];
+    bool compiled[MAX_SECTIONS] = {false};
+
+    for (size_t i = 0; i < KEYMAP_SIZE; i++)
+    {
+        layer->keymap[i].device = KEYMAP_EMPTY;
+    }
+    for (size_t i = 0; i < CHORDMAP_SIZE; i++)
+    {
+        layer->chordmap[i].device = KEYMAP_EMPTY;
+    }
+    memset(layer->tables, KEYMAP_EMPTY, sizeof(layer->tables));
+    layer->chord_count = 0;
+    states.count = 1;  // state 0, no keys held
+    states.lens[0] = 0;
+
+    for (size_t d = 0; d < config->device_count; d++)
+    {
+        const device_config_t* dev = &config->devices[d];
+        if (dev->kind == SECTION_GROUP ||
+            pattern_section(config, dev->kind, dev->vendor, dev->product) != d)
+            continue;
+
+        uint8_t sections[SECTION_CHAIN_MAX];
+        uint8_t used[SECTION_CHAIN_MAX];
+        size_t count = device_sections(config, (uint8_t)d, index, sections);
+        size_t used_count = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (config->devices[sections[i]].binding_count > 0)
+                used[used_count++] = sections[i];
         }
-        else if (current)
+        if (used_count == 0)
+            continue;
+
+        // A table of several sections is numbered after the device's own first section, which
+        // no other device resolves to
+        uint8_t table = used_count == 1 ? used[0] : sections[0];
+        layer->tables[d] = table;
+        if (compiled[table])
+            continue;
+        compiled[table] = true;
+
+        for (size_t i = 0; i < used_count; i++)
         {
-            char* eq = strchr(trimmed, '=');
-            if (!eq)
-                continue;
-            *eq = '\0';
-            char* key = trim(trimmed);
-            char* val = trim(eq + 1);
+            compile_chords(config, layer, &states, table, used[i]);
+            compile_keymap(config, layer, table, used[i]);
+        }
+    }
 
-            if (strcasecmp(key, "target") == 0)
-            {
-                strncpy(current->target, val, sizeof(current->target) - 1);
-                current->target[sizeof(current->target) - 1] = '\0';
-            }
-            else
-            {
-                if (current->binding_count >= MAX_BINDINGS)
-                    continue;
-                if (strlen(val) < 2)
-                    continue;  // Require at least mode+led
+    // Attach hold and double-tap bindings to their key's entry
+    for (size_t i = 0; i < KEYMAP_SIZE; i++)
+    {
+        keymap_entry_t* e = &layer->keymap[i];
+        if (e->device == KEYMAP_EMPTY)
+            continue;
 
-                key_binding_t* binding = &current->bindings[current->binding_count++];
-                int keycode;
-                if (strncmp(key, "0x", 2) == 0 || strncmp(key, "0X", 2) == 0)
-                {
-                    // Parse hexadecimal keycode
-                    keycode = strtol(key + 2, NULL, 16);
-                }
-                else
-                {
-                    // Parse decimal keycode
-                    keycode = atoi(key);
-                }
-                binding->keycode = (uint16_t)keycode;
-                binding->mode = val[0];
-                strncpy(binding->led, val + 1, sizeof(binding->led) - 1);
-                binding->led[sizeof(binding->led) - 1] = '\0';
-            }
+        const device_config_t* dev = &config->devices[e->device];
+        for (size_t b = 0; b < dev->binding_count; b++)
+        {
+            const key_binding_t* binding = &dev->bindings[b];
+            if (binding->keycode != e->keycode || binding->modifiers != e->modifiers)
+                continue;
+            if (binding->trigger == TRIGGER_HOLD && e->hold == KEYMAP_EMPTY)
+                e->hold = (uint8_t)b;
+            else if (binding->trigger == TRIGGER_DOUBLE_TAP && e->double_tap == KEYMAP_EMPTY)
+                e->double_tap = (uint8_t)b;
         }
     }
+}
+
+// Point a layer action at its layer now that every section has been read
+static void resolve_layer_action(const config_t* config, key_binding_t* binding)
+{
+    if (binding->action != ACTION_LAYER)
+        return;
 
-    fclose(file);
+    int layer = find_layer(config, binding->payload);
+    binding->target = layer >= 0 ? (uint8_t)layer : LAYER_NONE;
+    if (layer < 0)
+        debugf(stderr, "Unknown layer '%s' for keycode 0x%04x\n", binding->payload,
+               binding->keycode);
+}
 
-    if (config->setleds_path[0] == '\0')
+/**
+ * Resolve what the parser left by name and build the tables of the layers in a mask. The
+ * device index only needs building when the sections or their matches changed.
+ */
+static void compile_layers(config_t* config, uint32_t layers, bool index)
+{
+    size_t active = config->active ? (size_t)(config->active - config->layers) : 0;
+    if (config->layer_count == 0)
+        config->layer_count = 1;
+    if (config->layers[0].name[0] == '\0')
+        strcpy(config->layers[0].name, "base");
+
+    for (size_t d = 0; d < config->device_count; d++)
     {
-        strncpy(config->setleds_path, DEFAULT_SETLEDS_PATH, sizeof(config->setleds_path) - 1);
-        config->setleds_path[sizeof(config->setleds_path) - 1] = '\0';
+        config->devices[d].refs = 0;
     }
-
-    // Process each device
-    for (size_t i = 0; i < config->device_count; i++)
+    for (size_t d = 0; d < config->device_count; d++)
     {
-        device_config_t* dev = &config->devices[i];
-        debug("Processing device %zu: VID=0x%04x, PID=0x%04x\n", i, dev->vendor, dev->product);
-
-        // Process each binding for this device
-        for (size_t j = 0; j < dev->binding_count; j++)
+        device_config_t* dev = &config->devices[d];
+        for (size_t b = 0; b < dev->binding_count; b++)
         {
-            key_binding_t* binding = &dev->bindings[j];
-            debug("  Binding %zu: keycode=0x%04x, led=%s, mode=%c\n", j, binding->keycode,
-                  binding->led, binding->mode);
+            resolve_layer_action(config, &dev->bindings[b]);
         }
+        uint8_t group = section_group(config, dev);
+        if (group != KEYMAP_EMPTY)
+            config->devices[group].refs++;
+    }
+    for (size_t d = 0; d < config->device_count; d++)
+    {
+        if (config->devices[d].kind == SECTION_GROUP && config->devices[d].refs == 0)
+            debugf(stderr, "Group '%s' is not used by any section\n", config->devices[d].name);
+    }
+    for (size_t i = 0; i < config->leaders.action_count; i++)
+    {
+        resolve_layer_action(config, &config->leaders.actions[i]);
+    }
+
+    if (index)
+        compile_device_index(config);
+    for (size_t l = 0; l < config->layer_count; l++)
+    {
+        if (layers & (1u << l))
+            compile_layer(config, (uint8_t)l);
     }
+    config->compiled = true;
+    config->active = &config->layers[active < config->layer_count ? active : 0];
+}
+
+void compile_config(config_t* config)
+{
+    // Sections changed by hand no longer match their text, so the next load rebuilds all
+    config->layout_hash = 0;
+    config->devices_hash = 0;
+    compile_layers(config, UINT32_MAX, true);
+}
 
+bool set_layer(config_t* config, size_t layer)
+{
+    if (!config->compiled || layer >= config->layer_count)
+        return false;
+
+    config->active = &config->layers[layer];
     return true;
 }
 
-const char* get_command_for_key(const config_t* config, uint16_t vendor, uint16_t product,
-                                uint16_t keycode)
+// The active layer's table for a resolved device, KEYMAP_EMPTY if it has no bindings there
+static uint8_t active_table(const config_t* config, uint8_t device)
+{
+    return device == KEYMAP_EMPTY ? KEYMAP_EMPTY : config->active->tables[device];
+}
+
+const keymap_entry_t* lookup_section_entry(const config_t* config, uint8_t device,
+                                           uint16_t keycode, uint8_t modifiers)
+{
+    if (!config->compiled)
+        return NULL;
+
+    uint8_t table = active_table(config, device);
+    if (table == KEYMAP_EMPTY)
+        return NULL;
+
+    uint32_t h = keymap_hash(table, (uint32_t)modifiers << 16 | keycode) & (KEYMAP_SIZE - 1);
+    for (;;)
+    {
+        const keymap_entry_t* e = &config->active->keymap[h];
+        if (e->device == KEYMAP_EMPTY)
+            return NULL;
+        if (e->keycode == keycode && e->table == table && e->modifiers == modifiers)
+            return e;
+        h = (h + 1) & (KEYMAP_SIZE - 1);
+    }
+}
+
+const keymap_entry_t* lookup_keymap_entry(const config_t* config, uint16_t vendor,
+                                          uint16_t product, uint16_t keycode, uint8_t modifiers)
+{
+    if (!config->compiled)
+        return NULL;
+    return lookup_section_entry(config, resolve_device(config, vendor, product), keycode,
+                                modifiers);
+}
+
+const chord_entry_t* lookup_section_chord(const config_t* config, uint8_t device, uint8_t state,
+                                          uint16_t keycode)
+{
+    if (!config->compiled || config->active->chord_count == 0)
+        return NULL;
+
+    uint8_t table = active_table(config, device);
+    if (table == KEYMAP_EMPTY)
+        return NULL;
+
+    uint32_t h = keymap_hash(table, (uint32_t)state << 16 | keycode) & (CHORDMAP_SIZE - 1);
+    for (;;)
+    {
+        const chord_entry_t* e = &config->active->chordmap[h];
+        if (e->device == KEYMAP_EMPTY)
+            return NULL;
+        if (e->keycode == keycode && e->state == state && e->table == table)
+            return e;
+        h = (h + 1) & (CHORDMAP_SIZE - 1);
+    }
+}
+
+const chord_entry_t* lookup_chord(const config_t* config, uint16_t vendor, uint16_t product,
+                                  uint8_t state, uint16_t keycode)
 {
-    static char cmd_buffer[256];  // Static buffer for the command string
+    if (!config->compiled || config->active->chord_count == 0)
+        return NULL;
+    return lookup_section_chord(config, resolve_device(config, vendor, product), state, keycode);
+}
+
+const key_binding_t* lookup_binding(const config_t* config, uint16_t vendor, uint16_t product,
+                                    uint16_t keycode, uint16_t* slot)
+{
+    const keymap_entry_t* e = lookup_keymap_entry(config, vendor, product, keycode, 0);
+    if (!e)
+        return NULL;
+
+    if (slot)
+        *slot = keymap_entry_slot(e);
+    return &config->devices[e->device].bindings[e->binding];
+}
 
+const key_binding_t* get_binding_for_key(const config_t* config, uint16_t vendor,
+                                         uint16_t product, uint16_t keycode)
+{
     // Find matching device
-    for (size_t i = 0; i < config->device_count; i++)
+    uint8_t device = resolve_device(config, vendor, product);
+    if (device == KEYMAP_EMPTY)
+        return NULL;
+
+    // Find matching binding in its base-layer section or that section's group
+    uint8_t sections[SECTION_CHAIN_MAX];
+    size_t count = device_sections(config, device, 0, sections);
+    for (size_t i = 0; i < count; i++)
     {
-        const device_config_t* dev = &config->devices[i];
-        if (dev->vendor == vendor && dev->product == product)
+        const device_config_t* dev = &config->devices[sections[i]];
+        for (size_t j = 0; j < dev->binding_count; j++)
         {
-            // Find matching binding
-            for (size_t j = 0; j < dev->binding_count; j++)
+            if (dev->bindings[j].keycode == keycode && dev->bindings[j].trigger == TRIGGER_PRESS &&
+                dev->bindings[j].modifiers == 0)
             {
-                const key_binding_t* binding = &dev->bindings[j];
-                if (binding->keycode == keycode)
-                {
-                    // Construct the full command string
-                    snprintf(cmd_buffer, sizeof(cmd_buffer), "%s %c%s", config->setleds_path,
-                             binding->mode, binding->led);
-                    return cmd_buffer;
-                }
+                return &dev->bindings[j];
             }
-            break;  // Device found but no matching binding
         }
     }
     return NULL;  // No matching device or binding
 }
+
+// Four lowercase hex digits, as lsusb shows IDs
+static size_t put_hex(char* out, uint16_t value)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 3; i >= 0; i--)
+    {
+        out[i] = digits[value & 0xF];
+        value >>= 4;
+    }
+    return 4;
+}
+
+static size_t put_decimal(char* out, uint16_t value)
+{
+    char reversed[5];
+    size_t n = 0;
+    do
+    {
+        reversed[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = reversed[n - 1 - i];
+    }
+    return n;
+}
+
+size_t render_command(const config_t* config, uint8_t template, const command_context_t* context,
+                      char* buf, size_t size, char** argv)
+{
+    static const template_segment_t setleds_template[] = {
+        {.type = SEGMENT_SETLEDS},
+        {.type = SEGMENT_BREAK},
+        {.type = SEGMENT_MODE},
+        {.type = SEGMENT_LED},
+        {.type = SEGMENT_BREAK},
+    };
+
+    const template_segment_t* segments = setleds_template;
+    size_t count = sizeof(setleds_template) / sizeof(setleds_template[0]);
+    if (template != TEMPLATE_NONE)
+    {
+        if (template >= config->template_count)
+            return 0;
+        segments = &config->segments[config->templates[template].first_segment];
+        count = config->templates[template].segment_count;
+    }
+
+    size_t len = 0;
+    size_t argc = 0;
+    bool new_arg = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        const template_segment_t* segment = &segments[i];
+        char digits[16];
+        const char* src = digits;
+        size_t n = 0;
+
+        if (new_arg)
+        {
+            if (argc == COMMAND_MAX_ARGS)
+                return 0;
+            argv[argc++] = buf + len;
+            new_arg = false;
+        }
+
+        switch (segment->type)
+        {
+        case SEGMENT_TEXT:
+            src = config->template_text + segment->offset;
+            n = segment->len;
+            break;
+        case SEGMENT_BREAK:
+            new_arg = true;
+            src = "";
+            n = 1;  // the terminator
+            break;
+        case SEGMENT_VENDOR:
+            n = put_hex(digits, context->vendor);
+            break;
+        case SEGMENT_PRODUCT:
+            n = put_hex(digits, context->product);
+            break;
+        case SEGMENT_KEYCODE:
+            n = put_decimal(digits, context->keycode);
+            break;
+        case SEGMENT_DEVICE:
+            n = put_hex(digits, context->vendor);
+            digits[n++] = ':';
+            n += put_hex(digits + n, context->product);
+            break;
+        case SEGMENT_LED:
+            src = context->led ? context->led : "";
+            n = strlen(src);
+            break;
+        case SEGMENT_MODE:
+            digits[0] = context->mode;
+            n = context->mode ? 1 : 0;
+            break;
+        case SEGMENT_SETLEDS:
+            src = config->setleds_path;
+            n = strlen(src);
+            break;
+        default:
+            return 0;
+        }
+
+        if (n > size - len)
+            return 0;
+        memcpy(buf + len, src, n);
+        len += n;
+    }
+
+    argv[argc] = NULL;
+    return argc;
+}
+
+const char* get_command_for_key(const config_t* config, uint16_t vendor, uint16_t product,
+                                uint16_t keycode, char* buf, size_t size)
+{
+    const key_binding_t* binding = get_binding_for_key(config, vendor, product, keycode);
+    if (!binding)
+        return NULL;
+
+    uint8_t template;
+    if (binding->action == ACTION_SETLEDS)
+        template = led_command_template(config);
+    else if (binding->action == ACTION_COMMAND)
+        template = binding->target;
+    else
+        return NULL;
+
+    command_context_t context = {vendor, product, keycode, binding->mode, binding->led};
+    char* argv[COMMAND_MAX_ARGS + 1];
+    size_t argc = render_command(config, template, &context, buf, size, argv);
+    if (argc == 0)
+        return NULL;
+
+    // Join the arguments for display
+    for (size_t i = 1; i < argc; i++)
+    {
+        argv[i][-1] = ' ';
+    }
+    return buf;
+}
@@ -0,0 +1,336 @@
+#include "control.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "dispatch.h"
+#include "loop_monitor.h"
+
+#define CONTROL_TIMEOUT_S 2
+
+// One accepted connection; commands are buffered until their newline arrives
+typedef struct
+{
+    uv_pipe_t pipe;
+    control_t* control;
+    size_t len;
+    char line[CONTROL_LINE_MAX];
+} control_client_t;
+
+// A reply in flight, freed once written
+typedef struct
+{
+    uv_write_t req;
+    char data[CONTROL_LINE_MAX];
+} control_reply_t;
+
+// Append to a reply being built, stopping quietly once it is full
+static void append(char* reply, size_t size, size_t* len, const char* format, ...)
+{
+    if (*len >= size)
+        return;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(reply + *len, size - *len, format, args);
+    va_end(args);
+    if (n > 0)
+        *len = *len + (size_t)n < size ? *len + (size_t)n : size;
+}
+
+static int format_stats(const control_t* control, char* reply, size_t size)
+{
+    dispatch_stats_t dispatch;
+    loop_stats_t loop = {0};
+    dispatch_get_stats(control->dispatch, &dispatch);
+    if (control->monitor)
+        loop_monitor_get_stats(control->monitor, &loop);
+
+    size_t len = 0;
+    append(reply, size, &len,
+           "dispatched=%" PRIu64 " unmatched=%" PRIu64 " debounced=%" PRIu64
+           " rate_limited=%" PRIu64,
+           dispatch.dispatched, dispatch.unmatched, dispatch.debounced, dispatch.rate_limited);
+    append(reply, size, &len,
+           " iterations=%" PRIu64 " busy_ms=%" PRIu64 " lag_us=%" PRIu64 " lag_max_us=%" PRIu64
+           " slow_iterations=%" PRIu64 " stalls=%" PRIu64,
+           loop.iterations, loop.busy_ns / 1000000, loop.lag_last_ns / 1000,
+           loop.lag_max_ns / 1000, loop.slow_iterations, loop.stalls);
+    for (int stage = 0; stage < LOOP_STAGE_COUNT; stage++)
+    {
+        const char* name = loop_monitor_stage_name((loop_stage_t)stage);
+        append(reply, size, &len, " stalls_%s=%" PRIu64 " max_%s_us=%" PRIu64, name,
+               loop.stage_stalls[stage], name, loop.stage_max_ns[stage] / 1000);
+    }
+    append(reply, size, &len, "\n");
+    return (int)len;
+}
+
+size_t control_execute(control_t* control, const char* command, char* reply, size_t size)
+{
+    config_t* config = control->config;
+    int n;
+
+    if (strcmp(command, "layer") == 0)
+    {
+        n = snprintf(reply, size, "%s\n", config->active ? config->active->name : "base");
+    }
+    else if (strncmp(command, "layer ", 6) == 0)
+    {
+        const char* name = command + 6;
+        int layer = find_layer(config, name);
+        if (layer >= 0 && dispatch_set_layer(control->dispatch, config, (size_t)layer))
+            n = snprintf(reply, size, "ok\n");
+        else
+            n = snprintf(reply, size, "error: unknown layer %s\n", name);
+    }
+    else if (strcmp(command, "layers") == 0)
+    {
+        size_t len = 0;
+        for (size_t i = 0; i < config->layer_count; i++)
+        {
+            int w = snprintf(reply + len, size - len, "%s%s", i ? " " : "",
+                             config->layers[i].name);
+            if (w < 0 || (size_t)w >= size - len)
+                break;
+            len += (size_t)w;
+        }
+        n = (int)len + snprintf(reply + len, size - len, "\n");
+    }
+    else if (strcmp(command, "stats") == 0)
+    {
+        n = format_stats(control, reply, size);
+    }
+    else
+    {
+        n = snprintf(reply, size, "error: unknown command\n");
+    }
+
+    return n < 0 ? 0 : (size_t)n < size ? (size_t)n : size - 1;
+}
+
+static void on_client_closed(uv_handle_t* handle)
+{
+    free(handle->data);
+}
+
+static void on_server_closed(uv_handle_t* handle)
+{
+    free(handle);
+}
+
+static void close_client(control_client_t* client)
+{
+    if (!uv_is_closing((uv_handle_t*)&client->pipe))
+        uv_close((uv_handle_t*)&client->pipe, on_client_closed);
+}
+
+static void on_reply_written(uv_write_t* req, int status)
+{
+    (void)status;
+    free(req->data);
+}
+
+static void send_reply(control_client_t* client, const char* command)
+{
+    control_reply_t* reply = malloc(sizeof(*reply));
+    if (!reply)
+    {
+        close_client(client);
+        return;
+    }
+
+    size_t len = control_execute(client->control, command, reply->data, sizeof(reply->data));
+    reply->req.data = reply;
+    uv_buf_t buf = uv_buf_init(reply->data, (unsigned int)len);
+    if (uv_write(&reply->req, (uv_stream_t*)&client->pipe, &buf, 1, on_reply_written) != 0)
+    {
+        free(reply);
+        close_client(client);
+    }
+}
+
+static void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
+{
+    (void)suggested_size;
+    control_client_t* client = handle->data;
+    *buf = uv_buf_init(client->line + client->len,
+                       (unsigned int)(sizeof(client->line) - client->len));
+}
+
+static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+{
+    (void)buf;
+    control_client_t* client = stream->data;
+    if (nread < 0)
+    {
+        close_client(client);
+        return;
+    }
+
+    loop_monitor_t* monitor = client->control->monitor;
+    uint64_t started = loop_monitor_begin(monitor);
+    client->len += (size_t)nread;
+    char* start = client->line;
+    char* newline;
+    while (!uv_is_closing((uv_handle_t*)&client->pipe) &&
+           (newline = memchr(start, '\n', client->len - (size_t)(start - client->line))))
+    {
+        *newline = '\0';
+        if (newline > start && newline[-1] == '\r')
+            newline[-1] = '\0';
+        send_reply(client, start);
+        start = newline + 1;
+    }
+
+    client->len -= (size_t)(start - client->line);
+    memmove(client->line, start, client->len);
+    loop_monitor_end(monitor, LOOP_STAGE_CONTROL, started);
+    if (client->len == sizeof(client->line))
+    {
+        debugf(stderr, "Control command too long, closing connection\n");
+        close_client(client);
+    }
+}
+
+static void on_connection(uv_stream_t* server, int status)
+{
+    if (status < 0)
+    {
+        debugf(stderr, "Control connection failed: %s\n", uv_strerror(status));
+        return;
+    }
+
+    control_client_t* client = calloc(1, sizeof(*client));
+    if (!client)
+        return;
+    uv_pipe_init(server->loop, &client->pipe, 0);
+    client->pipe.data = client;
+    client->control = server->data;
+
+    if (uv_accept(server, (uv_stream_t*)&client->pipe) != 0 ||
+        uv_read_start((uv_stream_t*)&client->pipe, on_alloc, on_read) != 0)
+    {
+        close_client(client);
+    }
+}
+
+void control_init(control_t* control, config_t* config, dispatch_t* dispatch,
+                  loop_monitor_t* monitor)
+{
+    memset(control, 0, sizeof(*control));
+    control->config = config;
+    control->dispatch = dispatch;
+    control->monitor = monitor;
+}
+
+bool control_listen(control_t* control, uv_loop_t* loop, const char* path)
+{
+    if (strlen(path) >= sizeof(control->path) ||
+        strlen(path) >= sizeof(((struct sockaddr_un*)0)->sun_path))
+    {
+        debugf(stderr, "Control socket path too long: %s\n", path);
+        return false;
+    }
+
+    control->server = malloc(sizeof(uv_pipe_t));
+    if (!control->server)
+        return false;
+    uv_pipe_init(loop, control->server, 0);
+    control->server->data = control;
+
+    // A socket left by a daemon that did not exit cleanly would make bind fail
+    unlink(path);
+    int err = uv_pipe_bind(control->server, path);
+    if (err == 0)
+        err = uv_listen((uv_stream_t*)control->server, 8, on_connection);
+    if (err != 0)
+    {
+        debugf(stderr, "Failed to listen on control socket %s: %s\n", path, uv_strerror(err));
+        uv_close((uv_handle_t*)control->server, on_server_closed);
+        control->server = NULL;
+        return false;
+    }
+
+    strcpy(control->path, path);
+    debug("Listening for control commands on %s\n", path);
+    return true;
+}
+
+static void close_walk(uv_handle_t* handle, void* arg)
+{
+    if (handle->type != UV_NAMED_PIPE || ((uv_stream_t*)handle)->read_cb != on_read)
+        return;
+    control_client_t* client = handle->data;
+    if (client->control == arg)
+        close_client(client);
+}
+
+void control_cleanup(control_t* control)
+{
+    if (!control->server)
+        return;
+
+    uv_walk(control->server->loop, close_walk, control);
+    uv_close((uv_handle_t*)control->server, on_server_closed);
+    control->server = NULL;
+    unlink(control->path);
+    control->path[0] = '\0';
+}
+
+int control_send(const char* path, const char* command, char* reply, size_t size)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path) || size == 0)
+        return -1;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    struct timeval timeout = {.tv_sec = CONTROL_TIMEOUT_S};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    char line[CONTROL_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "%s\n", command);
+    if (len < 0 || (size_t)len >= sizeof(line) || write(fd, line, (size_t)len) != len)
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t got = 0;
+    while (got < size - 1)
+    {
+        ssize_t n = read(fd, reply + got, size - 1 - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += (size_t)n;
+        if (memchr(reply + got - n, '\n', (size_t)n))
+            break;
+    }
+    close(fd);
+
+    reply[got] = '\0';
+    char* newline = strchr(reply, '\n');
+    if (!newline)
+        return -1;
+    *newline = '\0';
+    return 0;
+}
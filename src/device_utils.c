@@ -99,18 +99,21 @@ void HIDInputCallback(void* context, IOReturn result, void* sender, IOHIDValueRe
         }
 
         // Get the mapped command for the key event
+        char command_buf[COMMAND_MAX];
         const char* command = NULL;
 
         // For QMK custom keycodes, try the QMK keycode first
         if (is_qmk_custom_keycode)
         {
-            command = get_command_for_key(&config, *vendor_id, *product_id, (uint16_t)qmk_keycode);
+            command = get_command_for_key(&config, *vendor_id, *product_id, (uint16_t)qmk_keycode,
+                                          command_buf, sizeof(command_buf));
         }
 
         // If no command found or not a QMK keycode, try the raw usage
         if (!command)
         {
-            command = get_command_for_key(&config, *vendor_id, *product_id, (uint8_t)usage);
+            command = get_command_for_key(&config, *vendor_id, *product_id, (uint8_t)usage,
+                                          command_buf, sizeof(command_buf));
         }
 
         if (command)
@@ -0,0 +1,555 @@
+#include "dispatch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "actions.h"
+#include "chord.h"
+#include "config.h"
+#include "debug.h"
+#include "executor.h"
+#include "gesture.h"
+#include "leader.h"
+#include "led_state.h"
+#include "loop_monitor.h"
+#include "probes.h"
+#include "sequence.h"
+#include "timer_wheel.h"
+#include "uinput.h"
+
+// Forward declarations
+static void fire_binding(const config_t* config, uint8_t device, uint8_t binding,
+                         void* user_data);
+static void run_binding(const config_t* config, const key_binding_t* binding, void* user_data);
+static void replay_key(const config_t* config, uint8_t device, uint16_t vendor_id,
+                       uint16_t product_id, uint16_t keycode, uint8_t modifiers, bool pressed,
+                       void* user_data);
+
+void dispatch_set_executor(dispatch_t* dispatch, command_executor_t fn)
+{
+    dispatch->run_command = fn;
+}
+
+// Run a command through the replacement executor, or the instance's
+static int run_command(dispatch_t* dispatch, char* const argv[])
+{
+    if (dispatch->run_command)
+        return dispatch->run_command(argv);
+    return dispatch->executor ? executor_run(dispatch->executor, argv) : -1;
+}
+
+/**
+ * Combine an LED's pending operation with a new one. Returns 0 when they cancel.
+ */
+static char merge_mode(char prev, char next)
+{
+    switch (next)
+    {
+    case '^':
+        if (prev == '^')
+            return 0;
+        if (prev == '+')
+            return '-';
+        if (prev == '-')
+            return '+';
+        return '^';
+    case '+':
+        return prev == '-' ? 0 : '+';
+    case '-':
+        return prev == '+' ? 0 : '-';
+    default:
+        return next;
+    }
+}
+
+static void coalesce_flush(dispatch_t* dispatch)
+{
+    char args[DISPATCH_COALESCE_LEDS][sizeof(((led_op_t*)0)->led) + 1];
+    char* argv[DISPATCH_COALESCE_LEDS + 2];
+    size_t argc = 0;
+
+    argv[argc++] = dispatch->coalesce.setleds_path;
+    for (size_t i = 0; i < dispatch->coalesce.op_count; i++)
+    {
+        const led_op_t* op = &dispatch->coalesce.ops[i];
+        if (!op->mode)
+            continue;
+        led_state_apply(&dispatch->leds, op->mode, op->led);
+        args[i][0] = op->mode;
+        memcpy(args[i] + 1, op->led, sizeof(op->led));
+        args[i][sizeof(args[i]) - 1] = '\0';
+        argv[argc++] = args[i];
+    }
+    argv[argc] = NULL;
+
+    dispatch->coalesce.op_count = 0;
+    dispatch->coalesce.pending = false;
+    led_state_publish(&dispatch->leds);  // the window's net change, in one pass over the devices
+
+    if (argc == 1)
+    {
+        debug("Coalesced LED operations cancelled out, nothing to run\n");
+        return;
+    }
+
+    debug("Executing %zu coalesced LED operation(s) with %s\n", argc - 1, argv[0]);
+    if (run_command(dispatch, argv) < 0)
+        dispatch->stats.failed++;
+}
+
+static void on_coalesce_timer(uv_timer_t* handle)
+{
+    dispatch_t* dispatch = handle->data;
+    uint64_t started = loop_monitor_begin(dispatch->monitor);
+    coalesce_flush(dispatch);
+    loop_monitor_end(dispatch->monitor, LOOP_STAGE_TIMERS, started);
+}
+
+static void coalesce_add(dispatch_t* dispatch, const config_t* config, char mode, const char* led)
+{
+    // A reload may change setleds between windows; never mix two programs in one call
+    if (dispatch->coalesce.pending &&
+        strcmp(dispatch->coalesce.setleds_path, config->setleds_path) != 0)
+    {
+        uv_timer_stop(dispatch->coalesce.timer);
+        coalesce_flush(dispatch);
+    }
+
+    led_op_t* ops = dispatch->coalesce.ops;
+    size_t i;
+    for (i = 0; i < dispatch->coalesce.op_count; i++)
+    {
+        if (strncmp(ops[i].led, led, sizeof(ops[i].led)) == 0)
+            break;
+    }
+
+    if (i == dispatch->coalesce.op_count)
+    {
+        if (dispatch->coalesce.op_count == DISPATCH_COALESCE_LEDS)
+        {
+            uv_timer_stop(dispatch->coalesce.timer);
+            coalesce_flush(dispatch);
+            i = 0;
+        }
+        strncpy(ops[i].led, led, sizeof(ops[i].led) - 1);
+        ops[i].led[sizeof(ops[i].led) - 1] = '\0';
+        ops[i].mode = 0;
+        dispatch->coalesce.op_count = i + 1;
+    }
+    ops[i].mode = merge_mode(ops[i].mode, mode);
+
+    if (!dispatch->coalesce.pending)
+    {
+        size_t size = sizeof(dispatch->coalesce.setleds_path);
+        strncpy(dispatch->coalesce.setleds_path, config->setleds_path, size - 1);
+        dispatch->coalesce.setleds_path[size - 1] = '\0';
+        dispatch->coalesce.pending = true;
+        // The window opens with the first operation, so added latency is bounded
+        uv_timer_start(dispatch->coalesce.timer, on_coalesce_timer, config->coalesce_ms, 0);
+    }
+}
+
+// Render a command template for the current event and run it
+static void run_template(dispatch_t* dispatch, const config_t* config, uint8_t template,
+                         uint16_t keycode, char mode, const char* led)
+{
+    command_context_t context = {dispatch->event.vendor, dispatch->event.product, keycode, mode,
+                                 led};
+    char buf[COMMAND_MAX];
+    char* argv[COMMAND_MAX_ARGS + 1];
+    if (render_command(config, template, &context, buf, sizeof(buf), argv) == 0)
+    {
+        debug("Command for keycode=%d does not fit, not running it\n", keycode);
+        return;
+    }
+
+    debug("Executing command: %s\n", argv[0]);
+    if (run_command(dispatch, argv) < 0)
+        dispatch->stats.failed++;
+}
+
+// Run one LED operation, through the coalescing window when enabled
+static void run_led_op(dispatch_t* dispatch, const config_t* config, char mode, const char* led,
+                       uint16_t keycode)
+{
+    // A led_command template takes one LED per invocation, so it is never coalesced
+    uint8_t template = led_command_template(config);
+    if (template != TEMPLATE_NONE)
+    {
+        led_state_apply(&dispatch->leds, mode, led);
+        led_state_publish(&dispatch->leds);
+        run_template(dispatch, config, template, keycode, mode, led);
+        return;
+    }
+
+    if (config->coalesce_ms > 0 && dispatch->coalesce.timer)
+    {
+        coalesce_add(dispatch, config, mode, led);
+        return;
+    }
+
+    led_state_apply(&dispatch->leds, mode, led);
+    led_state_publish(&dispatch->leds);
+
+    // Build "<setleds> <mode><led>" as an argv; no shell is involved
+    char arg[sizeof(((led_op_t*)0)->led) + 1];
+    arg[0] = mode;
+    strncpy(arg + 1, led, sizeof(arg) - 2);
+    arg[sizeof(arg) - 1] = '\0';
+    char* argv[] = {(char*)config->setleds_path, arg, NULL};
+
+    debug("Executing command: %s %s\n", argv[0], argv[1]);
+    if (run_command(dispatch, argv) < 0)
+        dispatch->stats.failed++;
+}
+
+static void run_sequence_step(const config_t* config, const sequence_step_t* step,
+                              void* user_data)
+{
+    dispatch_t* dispatch = user_data;
+    run_led_op(dispatch, config, step->mode, step->led, dispatch->event.keycode);
+}
+
+bool dispatch_init(dispatch_t* dispatch, uv_loop_t* loop, executor_t* executor,
+                   loop_monitor_t* monitor)
+{
+    memset(dispatch, 0, sizeof(*dispatch));
+    dispatch->executor = executor;
+    dispatch->monitor = monitor;
+    actions_init(&dispatch->actions, loop);
+    uinput_init(&dispatch->uinput);
+    chord_init(&dispatch->chords, fire_binding, replay_key, dispatch);
+    if (!timer_wheel_init(&dispatch->wheel, loop, monitor))
+        return false;
+    dispatch->wheel_ready = true;
+    sequence_init(&dispatch->sequences, &dispatch->wheel, run_sequence_step, dispatch);
+    gesture_init(&dispatch->gestures, &dispatch->wheel, fire_binding, dispatch);
+    leader_init(&dispatch->leaders, &dispatch->wheel, run_binding, dispatch);
+
+    dispatch->coalesce.timer = malloc(sizeof(uv_timer_t));
+    if (!dispatch->coalesce.timer)
+    {
+        debug("Failed to allocate coalescing timer");
+        return false;
+    }
+    uv_timer_init(loop, dispatch->coalesce.timer);
+    dispatch->coalesce.timer->data = dispatch;
+    return true;
+}
+
+static void on_timer_closed(uv_handle_t* handle)
+{
+    free(handle);
+}
+
+void dispatch_reset(dispatch_t* dispatch)
+{
+    if (dispatch->wheel_ready)
+    {
+        sequence_cancel_all(&dispatch->sequences);
+        gesture_reset(&dispatch->gestures);
+        leader_reset(&dispatch->leaders);
+    }
+    chord_reset(&dispatch->chords);
+    dispatch->held_count = 0;
+    memset(dispatch->binding_state, 0, sizeof(dispatch->binding_state));
+}
+
+bool dispatch_set_layer(dispatch_t* dispatch, config_t* config, size_t layer)
+{
+    if (!set_layer(config, layer))
+        return false;
+
+    debug("Active layer: %s\n", config->active->name);
+    // Partial gestures, chords and leader sequences were matched against the old layer
+    if (dispatch->wheel_ready)
+    {
+        gesture_reset(&dispatch->gestures);
+        leader_reset(&dispatch->leaders);
+    }
+    chord_reset(&dispatch->chords);
+    dispatch->held_count = 0;
+    return true;
+}
+
+void dispatch_cleanup(dispatch_t* dispatch)
+{
+    if (dispatch->wheel_ready)
+    {
+        sequence_cancel_all(&dispatch->sequences);
+        gesture_reset(&dispatch->gestures);
+        leader_reset(&dispatch->leaders);
+        timer_wheel_close(&dispatch->wheel);
+        dispatch->wheel_ready = false;
+    }
+    dispatch->held_count = 0;
+
+    if (dispatch->coalesce.timer)
+    {
+        uv_timer_stop(dispatch->coalesce.timer);
+        if (dispatch->coalesce.pending)
+            coalesce_flush(dispatch);
+        uv_close((uv_handle_t*)dispatch->coalesce.timer, on_timer_closed);
+        dispatch->coalesce.timer = NULL;
+    }
+    actions_cleanup(&dispatch->actions);
+    uinput_cleanup(&dispatch->uinput);
+}
+
+void dispatch_get_stats(const dispatch_t* dispatch, dispatch_stats_t* out)
+{
+    *out = dispatch->stats;
+}
+
+uint64_t dispatch_get_suppressed(const dispatch_t* dispatch, uint16_t slot)
+{
+    return slot < BINDING_SLOTS ? dispatch->binding_state[slot].suppressed : 0;
+}
+
+// Apply debounce_ms and max_rate; returns false if the event must be dropped
+static bool admit_event(dispatch_t* dispatch, const key_binding_t* binding, uint16_t slot)
+{
+    if (!binding->debounce_ms && !binding->max_rate)
+        return true;
+
+    binding_state_t* state = &dispatch->binding_state[slot];
+    uint64_t now = uv_hrtime();  // monotonic
+    uint64_t since_event = now - state->last_event_ns;
+    uint64_t since_accepted = now - state->last_accepted_ns;
+    bool first = state->last_accepted_ns == 0;
+    state->last_event_ns = now;
+
+    if (!first && binding->debounce_ms && since_event < binding->debounce_ms * 1000000ULL)
+    {
+        state->suppressed++;
+        dispatch->stats.debounced++;
+        PROBE4(key_filtered, dispatch->event.vendor, dispatch->event.product, binding->keycode, 1);
+        debug("Debounced keycode=%d\n", binding->keycode);
+        return false;
+    }
+    if (!first && binding->max_rate && since_accepted < 1000000000ULL / binding->max_rate)
+    {
+        state->suppressed++;
+        dispatch->stats.rate_limited++;
+        PROBE4(key_filtered, dispatch->event.vendor, dispatch->event.product, binding->keycode, 2);
+        debug("Rate limited keycode=%d\n", binding->keycode);
+        return false;
+    }
+
+    state->last_accepted_ns = now;
+    return true;
+}
+
+// Perform a binding's action
+static void run_action(dispatch_t* dispatch, const config_t* config,
+                       const key_binding_t* binding)
+{
+    if (binding->action == ACTION_SEQUENCE)
+    {
+        if (!sequence_start(&dispatch->sequences, config, binding))
+            debug("Could not start sequence for keycode=%d\n", binding->keycode);
+        return;
+    }
+
+    if (binding->action == ACTION_LAYER)
+    {
+        if (binding->target == LAYER_NONE)
+            return;
+        size_t layer = binding->target;
+        if (binding->mode == '^' && config->active == &config->layers[layer])
+            layer = 0;
+        // Bindings see the configuration as const; the active layer is the one field they change
+        dispatch_set_layer(dispatch, (config_t*)config, layer);
+        return;
+    }
+
+    if (binding->action == ACTION_COMMAND)
+    {
+        run_template(dispatch, config, binding->target, binding->keycode, binding->mode,
+                     binding->led);
+        return;
+    }
+
+    if (binding->action == ACTION_KEYS)
+    {
+        // All of the action's events go to the virtual keyboard in one write
+        if (uinput_emit(&dispatch->uinput, binding->payload, binding->payload_len) < 0)
+            dispatch->stats.failed++;
+        return;
+    }
+
+    if (binding->action != ACTION_SETLEDS)
+    {
+        // Write actions are a single non-blocking syscall; no process is spawned
+        if (actions_write(&dispatch->actions, binding->target, binding->payload,
+                          binding->payload_len) < 0)
+            dispatch->stats.failed++;
+        return;
+    }
+
+    run_led_op(dispatch, config, binding->mode, binding->led, binding->keycode);
+}
+
+// Run a binding's action
+static void run_binding(const config_t* config, const key_binding_t* binding, void* user_data)
+{
+    dispatch_t* dispatch = user_data;
+    dispatch->stats.dispatched++;
+    PROBE4(action_start, dispatch->event.vendor, dispatch->event.product, binding->keycode,
+           binding->action);
+    run_action(dispatch, config, binding);
+    PROBE4(action_done, dispatch->event.vendor, dispatch->event.product, binding->keycode,
+           binding->action);
+}
+
+// Run a binding recognized by the gesture or chord engine
+static void fire_binding(const config_t* config, uint8_t device, uint8_t binding,
+                         void* user_data)
+{
+    run_binding(config, &config->devices[device].bindings[binding], user_data);
+}
+
+// Admit and run the press binding of a lookup table entry
+static bool dispatch_entry(dispatch_t* dispatch, const config_t* config,
+                           const keymap_entry_t* entry)
+{
+    const key_binding_t* binding = &config->devices[entry->device].bindings[entry->binding];
+    if (!admit_event(dispatch, binding, keymap_entry_slot(entry)))
+        return false;
+
+    run_binding(config, binding, dispatch);
+    return true;
+}
+
+bool dispatch_key_event(dispatch_t* dispatch, const config_t* config, uint16_t vendor_id,
+                        uint16_t product_id, uint16_t keycode)
+{
+    dispatch->event.vendor = vendor_id;
+    dispatch->event.product = product_id;
+    dispatch->event.keycode = keycode;
+    const keymap_entry_t* entry = lookup_keymap_entry(config, vendor_id, product_id, keycode, 0);
+    PROBE5(key_lookup, vendor_id, product_id, keycode, 0, entry != NULL);
+    if (!entry)
+    {
+        dispatch->stats.unmatched++;
+        debug("No command mapped for keycode=%d\n", keycode);
+        return false;
+    }
+    return dispatch_entry(dispatch, config, entry);
+}
+
+// Remember the entry a gesture key was pressed with, until its release
+static void hold_entry(dispatch_t* dispatch, uint16_t vendor_id, uint16_t product_id,
+                       uint16_t keycode, const keymap_entry_t* entry)
+{
+    size_t i = 0;
+    while (i < dispatch->held_count &&
+           (dispatch->held[i].vendor != vendor_id || dispatch->held[i].product != product_id ||
+            dispatch->held[i].keycode != keycode))
+    {
+        i++;
+    }
+    if (i == DISPATCH_HELD_MAX)
+        return;  // the release falls back to a lookup
+    dispatch->held[i].vendor = vendor_id;
+    dispatch->held[i].product = product_id;
+    dispatch->held[i].keycode = keycode;
+    dispatch->held[i].entry = entry;
+    if (i == dispatch->held_count)
+        dispatch->held_count++;
+}
+
+// Take the entry a key was pressed with, or NULL if it was not held
+static const keymap_entry_t* release_entry(dispatch_t* dispatch, uint16_t vendor_id,
+                                           uint16_t product_id, uint16_t keycode)
+{
+    for (size_t i = 0; i < dispatch->held_count; i++)
+    {
+        if (dispatch->held[i].vendor == vendor_id && dispatch->held[i].product == product_id &&
+            dispatch->held[i].keycode == keycode)
+        {
+            const keymap_entry_t* entry = dispatch->held[i].entry;
+            dispatch->held[i] = dispatch->held[--dispatch->held_count];
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Dispatch a key event that is not part of a chord
+static bool handle_key_state(dispatch_t* dispatch, const config_t* config, uint8_t device,
+                             uint16_t vendor_id, uint16_t product_id, uint16_t keycode,
+                             uint8_t modifiers, bool pressed)
+{
+    // A release goes to the entry its press matched, whatever modifiers are left
+    if (!pressed && dispatch->held_count > 0)
+    {
+        const keymap_entry_t* entry = release_entry(dispatch, vendor_id, product_id, keycode);
+        if (entry)
+            return gesture_key(&dispatch->gestures, config, entry, false);
+    }
+
+    // Decision table: the exact modifier mask first, then the key's plain binding
+    uint8_t mask = modifier_mask(modifiers);
+    const keymap_entry_t* entry = lookup_section_entry(config, device, keycode, mask);
+    if (!entry && mask)
+        entry = lookup_section_entry(config, device, keycode, 0);
+    PROBE5(key_lookup, vendor_id, product_id, keycode, mask, entry != NULL);
+    if (!entry)
+    {
+        if (pressed)
+        {
+            dispatch->stats.unmatched++;
+            debug("No command mapped for keycode=%d modifiers=0x%02x\n", keycode, mask);
+        }
+        return false;
+    }
+
+    // Plain bindings fire on press; so does everything when there is no loop to time holds
+    bool gestures = entry->hold != KEYMAP_EMPTY || entry->double_tap != KEYMAP_EMPTY;
+    if (!gestures || !dispatch->wheel_ready)
+        return pressed ? dispatch_entry(dispatch, config, entry) : false;
+
+    if (pressed)
+    {
+        const key_binding_t* binding = &config->devices[entry->device].bindings[entry->binding];
+        if (!admit_event(dispatch, binding, keymap_entry_slot(entry)))
+            return false;
+        hold_entry(dispatch, vendor_id, product_id, keycode, entry);
+    }
+    return gesture_key(&dispatch->gestures, config, entry, pressed);
+}
+
+static void replay_key(const config_t* config, uint8_t device, uint16_t vendor_id,
+                       uint16_t product_id, uint16_t keycode, uint8_t modifiers, bool pressed,
+                       void* user_data)
+{
+    handle_key_state(user_data, config, device, vendor_id, product_id, keycode, modifiers,
+                     pressed);
+}
+
+bool dispatch_device_key(dispatch_t* dispatch, const config_t* config, uint8_t device,
+                         uint16_t vendor_id, uint16_t product_id, uint16_t keycode,
+                         uint8_t modifiers, bool pressed)
+{
+    dispatch->event.vendor = vendor_id;
+    dispatch->event.product = product_id;
+    dispatch->event.keycode = keycode;
+    if (leader_key(&dispatch->leaders, config, device, keycode, pressed))
+        return true;
+    if (config->active && config->active->chord_count > 0 &&
+        chord_key(&dispatch->chords, config, device, vendor_id, product_id, keycode, modifiers,
+                  pressed))
+        return true;
+
+    return handle_key_state(dispatch, config, device, vendor_id, product_id, keycode, modifiers,
+                            pressed);
+}
+
+bool dispatch_key_state(dispatch_t* dispatch, const config_t* config, uint16_t vendor_id,
+                        uint16_t product_id, uint16_t keycode, uint8_t modifiers, bool pressed)
+{
+    return dispatch_device_key(dispatch, config, resolve_device(config, vendor_id, product_id),
+                               vendor_id, product_id, keycode, modifiers, pressed);
+}
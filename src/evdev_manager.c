@@ -0,0 +1,391 @@
+#include "evdev_manager.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "debug.h"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "keycodes.h"
+#include "loop_monitor.h"
+#include "metrics.h"
+#include "probes.h"
+
+#define EVDEV_DIR "/dev/input"
+#define EVDEV_BATCH 64  // events taken per read
+#define EVDEV_HELD_MAX 16  // pressed keys remembered per device for release on detach
+
+typedef struct evdev_device
+{
+    uv_poll_t poll;
+    evdev_manager_t* manager;
+    int fd;
+    uint16_t vendor_id;
+    uint16_t product_id;
+    uint8_t section;    // resolve_device() of the device in the current configuration
+    uint8_t modifiers;  // HID modifier byte of the keys held on this device
+    uint16_t held[EVDEV_HELD_MAX];  // usages pressed and not yet released
+    int held_count;
+    uint64_t* events;   // metrics_device_counter() of this device
+    bool dropped;       // events were lost; skip until the next SYN_REPORT
+} evdev_device_t;
+
+void evdev_manager_set_config(evdev_manager_t* manager, const config_t* config)
+{
+    manager->config = config;
+
+    // Attached devices follow sections that moved in a reload
+    for (int i = 0; config && i < manager->device_count; i++)
+    {
+        evdev_device_t* dev = manager->devices[i];
+        dev->section = resolve_device(config, dev->vendor_id, dev->product_id);
+    }
+}
+
+static void on_device_closed(uv_handle_t* handle)
+{
+    free(handle->data);
+}
+
+// Keys held on a device that goes away are released, so nothing stays pressed
+static void release_held(evdev_device_t* dev)
+{
+    evdev_manager_t* manager = dev->manager;
+    dev->modifiers = 0;
+    for (int k = 0; k < dev->held_count && manager->key_callback; k++)
+    {
+        manager->key_callback(dev->vendor_id, dev->product_id, dev->section, dev->held[k], 0,
+                              false, manager->user_data);
+    }
+    dev->held_count = 0;
+}
+
+static void close_device(evdev_device_t* dev)
+{
+    release_held(dev);
+    PROBE3(evdev_detach, dev->vendor_id, dev->product_id, dev->fd);
+    dev->manager->metrics->detaches++;
+    uv_poll_stop(&dev->poll);
+    close(dev->fd);
+    uv_close((uv_handle_t*)&dev->poll, on_device_closed);
+}
+
+// Stop reading a device that went away; the last slot moves into its place
+static void detach_device(evdev_device_t* dev)
+{
+    evdev_manager_t* manager = dev->manager;
+    for (int i = 0; i < manager->device_count; i++)
+    {
+        if (manager->devices[i] == dev)
+        {
+            manager->devices[i] = manager->devices[--manager->device_count];
+            manager->devices[manager->device_count] = NULL;
+            break;
+        }
+    }
+    close_device(dev);
+}
+
+int evdev_manager_list_devices(const evdev_manager_t* manager, status_device_t* devices,
+                               int max)
+{
+    int count = 0;
+    for (int i = 0; i < manager->device_count && count < max; i++)
+    {
+        status_device_t* dev = &devices[count++];
+        memset(dev, 0, sizeof(*dev));
+        dev->vendor_id = manager->devices[i]->vendor_id;
+        dev->product_id = manager->devices[i]->product_id;
+        dev->input = INPUT_EVDEV;
+        dev->reports = *manager->devices[i]->events;
+    }
+    return count;
+}
+
+// Remember which keys are down; a full table only loses the release on detach
+static void track_held(evdev_device_t* dev, uint16_t usage, bool pressed)
+{
+    for (int k = 0; k < dev->held_count; k++)
+    {
+        if (dev->held[k] != usage)
+            continue;
+        if (!pressed)
+            dev->held[k] = dev->held[--dev->held_count];
+        return;
+    }
+    if (pressed && dev->held_count < EVDEV_HELD_MAX)
+        dev->held[dev->held_count++] = usage;
+}
+
+static void handle_event(evdev_device_t* dev, const struct input_event* ev)
+{
+    if (ev->type == EV_SYN)
+    {
+        if (ev->code == SYN_DROPPED)
+            dev->dropped = true;
+        else if (ev->code == SYN_REPORT)
+            dev->dropped = false;
+        return;
+    }
+
+    // Value 2 is autorepeat; the HID path never sees repeats, so neither do bindings here
+    if (dev->dropped || ev->type != EV_KEY || ev->value > 1)
+        return;
+    uint16_t usage = key_code_to_hid_usage(ev->code);
+    if (!usage)
+        return;
+
+    bool pressed = ev->value == 1;
+    if (usage >= HID_MODIFIER_FIRST && usage <= HID_MODIFIER_LAST)
+    {
+        uint8_t bit = (uint8_t)(1u << (usage - HID_MODIFIER_FIRST));
+        dev->modifiers = pressed ? dev->modifiers | bit : dev->modifiers & (uint8_t)~bit;
+    }
+    track_held(dev, usage, pressed);
+    PROBE5(evdev_decode, dev->vendor_id, dev->product_id, usage, pressed, dev->modifiers);
+    evdev_manager_t* manager = dev->manager;
+    if (manager->key_callback)
+    {
+        manager->key_callback(dev->vendor_id, dev->product_id, dev->section, usage,
+                              dev->modifiers, pressed, manager->user_data);
+    }
+}
+
+static void on_readable(uv_poll_t* handle, int status, int events)
+{
+    (void)events;  // Silence unused parameter warning
+    evdev_device_t* dev = handle->data;
+    if (status < 0)
+    {
+        debugf(stderr, "Error waiting for event device: %s\n", uv_strerror(status));
+        detach_device(dev);
+        return;
+    }
+
+    // One read per wakeup takes every event queued since the last one
+    struct input_event batch[EVDEV_BATCH];
+    ssize_t n = read(dev->fd, batch, sizeof(batch));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0)
+    {
+        // ENODEV once the device is unplugged
+        debug("Event device %04x:%04x closed: %s\n", dev->vendor_id, dev->product_id,
+              n < 0 ? strerror(errno) : "end of file");
+        detach_device(dev);
+        return;
+    }
+
+    loop_monitor_t* monitor = dev->manager->monitor;
+    uint64_t started = loop_monitor_begin(monitor);
+    PROBE3(evdev_read, dev->vendor_id, dev->product_id, (size_t)n / sizeof(batch[0]));
+    *dev->events += (size_t)n / sizeof(batch[0]);
+    for (size_t i = 0; i < (size_t)n / sizeof(batch[0]); i++)
+    {
+        handle_event(dev, &batch[i]);
+    }
+    loop_monitor_end(monitor, LOOP_STAGE_EVDEV, started);
+}
+
+bool evdev_manager_init(evdev_manager_t* manager, uv_loop_t* loop, loop_monitor_t* monitor,
+                        metrics_t* metrics)
+{
+    manager->loop = loop;
+    manager->monitor = monitor;
+    manager->metrics = metrics;
+    return true;
+}
+
+void evdev_manager_cleanup(evdev_manager_t* manager)
+{
+    for (int i = 0; i < manager->device_count; i++)
+    {
+        close_device(manager->devices[i]);
+        manager->devices[i] = NULL;
+    }
+    manager->device_count = 0;
+}
+
+void evdev_manager_set_key_callback(evdev_manager_t* manager, key_callback_t callback,
+                                    void* user_data)
+{
+    manager->key_callback = callback;
+    manager->user_data = user_data;
+}
+
+bool evdev_manager_attach(evdev_manager_t* manager, int fd, uint16_t vendor_id,
+                          uint16_t product_id, uint8_t section)
+{
+    evdev_device_t* dev = NULL;
+    if (manager->loop && manager->device_count < EVDEV_MAX_DEVICES)
+        dev = calloc(1, sizeof(*dev));
+    if (!dev)
+    {
+        close(fd);
+        return false;
+    }
+
+    dev->manager = manager;
+    dev->fd = fd;
+    dev->vendor_id = vendor_id;
+    dev->product_id = product_id;
+    dev->section = section;
+    dev->events = metrics_device_counter(manager->metrics, vendor_id, product_id, INPUT_EVDEV);
+    dev->poll.data = dev;
+    if (uv_poll_init(manager->loop, &dev->poll, fd) != 0)
+    {
+        close(fd);
+        free(dev);
+        return false;
+    }
+    uv_poll_start(&dev->poll, UV_READABLE, on_readable);
+    manager->devices[manager->device_count++] = dev;
+    PROBE3(evdev_attach, vendor_id, product_id, fd);
+    manager->metrics->attaches++;
+    return true;
+}
+
+// Open an event device if it is a keyboard whose section reads evdev input
+static void try_open(evdev_manager_t* manager, const char* path)
+{
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    struct input_id id;
+    unsigned long types = 0;
+    uint8_t section = KEYMAP_EMPTY;
+    if (ioctl(fd, EVIOCGID, &id) == 0 && ioctl(fd, EVIOCGBIT(0, sizeof(types)), &types) >= 0 &&
+        (types & (1ul << EV_KEY)))
+    {
+        section = resolve_device(manager->config, id.vendor, id.product);
+    }
+    if (section == KEYMAP_EMPTY || manager->config->devices[section].input != INPUT_EVDEV)
+    {
+        close(fd);
+        return;
+    }
+
+    if (manager->config->devices[section].grab && ioctl(fd, EVIOCGRAB, 1) != 0)
+        debugf(stderr, "Failed to grab %s: %s\n", path, strerror(errno));
+    if (evdev_manager_attach(manager, fd, id.vendor, id.product, section))
+        debug("Reading %04x:%04x from %s\n", id.vendor, id.product, path);
+}
+
+static bool reopen_devices(evdev_manager_t* manager)
+{
+    const config_t* config = manager->config;
+    evdev_manager_cleanup(manager);
+    if (!config)
+        return false;
+
+    bool wanted = false;
+    for (size_t i = 0; i < config->device_count; i++)
+    {
+        wanted = wanted || config->devices[i].input == INPUT_EVDEV;
+    }
+    if (!wanted)
+        return true;
+
+    DIR* dir = opendir(EVDEV_DIR);
+    if (!dir)
+    {
+        debugf(stderr, "Failed to open %s: %s\n", EVDEV_DIR, strerror(errno));
+        return false;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) && manager->device_count < EVDEV_MAX_DEVICES)
+    {
+        if (strncmp(entry->d_name, "event", 5) != 0)
+            continue;
+        char path[sizeof(EVDEV_DIR) + sizeof(entry->d_name)];
+        snprintf(path, sizeof(path), "%s/%s", EVDEV_DIR, entry->d_name);
+        try_open(manager, path);
+    }
+    closedir(dir);
+    return true;
+}
+
+bool evdev_manager_reload(evdev_manager_t* manager)
+{
+    uint64_t started_ns = uv_hrtime();
+    PROBE1(evdev_reload_begin, manager->device_count);
+    bool ok = reopen_devices(manager);
+    PROBE3(evdev_reload_end, ok, manager->device_count, uv_hrtime() - started_ns);
+    return ok;
+}
+
+#else  // !__linux__
+
+bool evdev_manager_init(evdev_manager_t* manager, uv_loop_t* loop, loop_monitor_t* monitor,
+                        metrics_t* metrics)
+{
+    manager->loop = loop;
+    manager->monitor = monitor;
+    manager->metrics = metrics;
+    return true;
+}
+
+void evdev_manager_cleanup(evdev_manager_t* manager)
+{
+    (void)manager;  // Silence unused parameter warning
+}
+
+void evdev_manager_set_config(evdev_manager_t* manager, const config_t* config)
+{
+    manager->config = config;
+}
+
+void evdev_manager_set_key_callback(evdev_manager_t* manager, key_callback_t callback,
+                                    void* user_data)
+{
+    manager->key_callback = callback;
+    manager->user_data = user_data;
+}
+
+bool evdev_manager_attach(evdev_manager_t* manager, int fd, uint16_t vendor_id,
+                          uint16_t product_id, uint8_t section)
+{
+    close(fd);
+    (void)manager;     // Silence unused parameter warning
+    (void)vendor_id;   // Silence unused parameter warning
+    (void)product_id;  // Silence unused parameter warning
+    (void)section;     // Silence unused parameter warning
+    return false;
+}
+
+int evdev_manager_list_devices(const evdev_manager_t* manager, status_device_t* devices,
+                               int max)
+{
+    (void)manager;  // Silence unused parameter warning
+    (void)devices;  // Silence unused parameter warning
+    (void)max;      // Silence unused parameter warning
+    return 0;
+}
+
+bool evdev_manager_reload(evdev_manager_t* manager)
+{
+    const config_t* config = manager->config;
+    if (!config)
+        return false;
+    for (size_t i = 0; i < config->device_count; i++)
+    {
+        if (config->devices[i].input == INPUT_EVDEV)
+        {
+            debugf(stderr, "evdev input is only available on Linux\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif  // __linux__
@@ -0,0 +1,474 @@
+#include "executor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "loop_monitor.h"
+#include "probes.h"
+
+#define EXECUTOR_MAX_MESSAGE 4096
+#define EXECUTOR_MAX_ARGS 64
+
+extern char** environ;
+
+/*
+ * Helper protocol. Both directions use one datagram per message over a socketpair, so
+ * messages arrive whole and never need reassembly.
+ *
+ * Request:  executor_request_t followed by `length` bytes of NUL-terminated arguments.
+ * Response: executor_response_t once the spawned process has been reaped.
+ */
+typedef struct
+{
+    uint32_t id;
+    uint32_t argc;
+    uint32_t length;
+} executor_request_t;
+
+typedef struct
+{
+    uint32_t id;
+    int32_t status;  // wait(2) status, or -1 if the spawn failed
+} executor_response_t;
+
+/* ---- helper process ---- */
+
+// The helper is a process of its own, so its state is per process
+static int helper_sigchld_pipe[2] = {-1, -1};
+
+static void helper_on_sigchld(int signum)
+{
+    (void)signum;
+    int saved_errno = errno;
+    char byte = 0;
+    ssize_t ignored = write(helper_sigchld_pipe[1], &byte, 1);
+    (void)ignored;
+    errno = saved_errno;
+}
+
+static void set_cloexec(int fd)
+{
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Start argv[0] from PATH with argv as is, with default signal handling and nothing blocked
+static int spawn_command(char* const argv[], pid_t* pid)
+{
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    int err = posix_spawnp(pid, argv[0], NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    return err;
+}
+
+static void helper_spawn(int sock, const char* payload, size_t length, uint32_t id,
+                         uint32_t argc, pid_t* pids, uint32_t* ids)
+{
+    char* argv[EXECUTOR_MAX_ARGS + 1];
+    size_t argn = 0;
+    const char* p = payload;
+    const char* end = payload + length;
+
+    while (p < end && argn < argc && argn < EXECUTOR_MAX_ARGS)
+    {
+        argv[argn++] = (char*)p;
+        p += strnlen(p, (size_t)(end - p)) + 1;
+    }
+    argv[argn] = NULL;
+
+    pid_t pid = -1;
+    int err = argn > 0 ? spawn_command(argv, &pid) : EINVAL;
+
+    if (err != 0)
+    {
+        executor_response_t response = {.id = id, .status = -1};
+        send(sock, &response, sizeof(response), 0);
+        return;
+    }
+
+    for (int i = 0; i < EXECUTOR_MAX_PENDING; i++)
+    {
+        if (pids[i] <= 0)
+        {
+            pids[i] = pid;
+            ids[i] = id;
+            return;
+        }
+    }
+    // Table full: the child still runs, its completion is reported with id 0
+}
+
+static void helper_reap(int sock, pid_t* pids, uint32_t* ids)
+{
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        executor_response_t response = {.id = 0, .status = status};
+        for (int i = 0; i < EXECUTOR_MAX_PENDING; i++)
+        {
+            if (pids[i] == pid)
+            {
+                response.id = ids[i];
+                pids[i] = 0;
+                break;
+            }
+        }
+        send(sock, &response, sizeof(response), 0);
+    }
+}
+
+static void helper_main(int sock, int lifeline)
+{
+    static pid_t pids[EXECUTOR_MAX_PENDING];
+    static uint32_t ids[EXECUTOR_MAX_PENDING];
+    char buf[EXECUTOR_MAX_MESSAGE];
+
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (pipe(helper_sigchld_pipe) != 0)
+        _exit(1);
+    set_nonblocking(helper_sigchld_pipe[0]);
+    set_nonblocking(helper_sigchld_pipe[1]);
+    set_cloexec(helper_sigchld_pipe[0]);
+    set_cloexec(helper_sigchld_pipe[1]);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = helper_on_sigchld;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    sigset_t unblock;
+    sigemptyset(&unblock);
+    sigprocmask(SIG_SETMASK, &unblock, NULL);
+
+    struct pollfd fds[3] = {
+        {.fd = sock, .events = POLLIN},
+        {.fd = helper_sigchld_pipe[0], .events = POLLIN},
+        {.fd = lifeline, .events = POLLIN},
+    };
+
+    for (;;)
+    {
+        if (poll(fds, 3, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        // The daemon holds the only write end; readable or hung up means it is gone
+        if (fds[2].revents)
+            break;
+
+        if (fds[1].revents & POLLIN)
+        {
+            while (read(helper_sigchld_pipe[0], buf, sizeof(buf)) > 0)
+            {
+            }
+            helper_reap(sock, pids, ids);
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            ssize_t n = recv(sock, buf, sizeof(buf), 0);
+            if (n < (ssize_t)sizeof(executor_request_t))
+                continue;
+
+            executor_request_t request;
+            memcpy(&request, buf, sizeof(request));
+            size_t length = (size_t)n - sizeof(request);
+            if (request.length < length)
+                length = request.length;
+            helper_spawn(sock, buf + sizeof(request), length, request.id, request.argc, pids,
+                         ids);
+        }
+    }
+
+    _exit(0);
+}
+
+static void close_inherited_fds(int keep_a, int keep_b)
+{
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0 || max_fd > 65536)
+        max_fd = 65536;
+
+    for (int fd = 3; fd < max_fd; fd++)
+    {
+        if (fd != keep_a && fd != keep_b)
+            close(fd);
+    }
+}
+
+/* ---- daemon side ---- */
+
+static void on_helper_readable(uv_poll_t* handle, int status, int events)
+{
+    (void)events;  // Silence unused parameter warning
+    executor_t* executor = handle->data;
+    if (status < 0)
+    {
+        debugf(stderr, "Executor helper poll error: %s\n", uv_strerror(status));
+        return;
+    }
+
+    uint64_t began = loop_monitor_begin(executor->monitor);
+    executor_response_t response;
+    while (recv(executor->sock, &response, sizeof(response), 0) == (ssize_t)sizeof(response))
+    {
+        uint64_t started = executor->started_at[response.id % EXECUTOR_MAX_PENDING];
+        uint64_t latency = (response.id != 0 && started) ? uv_hrtime() - started : 0;
+        PROBE3(command_done, response.id, response.status, latency);
+
+        if (response.status != 0)
+        {
+            debug("Command %u finished with status %d\n", response.id, response.status);
+        }
+        if (executor->done_callback)
+        {
+            executor->done_callback(response.status, latency, executor->user_data);
+        }
+    }
+    loop_monitor_end(executor->monitor, LOOP_STAGE_EXECUTOR, began);
+}
+
+static bool start_helper(executor_t* executor)
+{
+    int sv[2];
+    int lifeline[2];
+
+    if (!executor->loop)
+        return false;
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) != 0)
+    {
+        debugf(stderr, "Failed to create executor socketpair: %s\n", strerror(errno));
+        return false;
+    }
+    if (pipe(lifeline) != 0)
+    {
+        debugf(stderr, "Failed to create executor lifeline: %s\n", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        debugf(stderr, "Failed to fork executor helper: %s\n", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        close(lifeline[0]);
+        close(lifeline[1]);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        close(sv[0]);
+        close(lifeline[1]);
+        close_inherited_fds(sv[1], lifeline[0]);
+        set_cloexec(sv[1]);
+        set_cloexec(lifeline[0]);
+        helper_main(sv[1], lifeline[0]);
+    }
+
+    close(sv[1]);
+    close(lifeline[0]);
+    set_cloexec(sv[0]);
+    set_cloexec(lifeline[1]);
+    set_nonblocking(sv[0]);
+
+    executor->poll_handle = malloc(sizeof(uv_poll_t));
+    if (!executor->poll_handle)
+    {
+        close(sv[0]);
+        close(lifeline[1]);
+        return false;
+    }
+    uv_poll_init(executor->loop, executor->poll_handle, sv[0]);
+    executor->poll_handle->data = executor;
+    uv_poll_start(executor->poll_handle, UV_READABLE, on_helper_readable);
+
+    executor->sock = sv[0];
+    executor->lifeline = lifeline[1];
+    executor->helper_pid = pid;
+    debug("Started executor helper (pid %d)\n", (int)pid);
+    return true;
+}
+
+static void on_poll_closed(uv_handle_t* handle)
+{
+    free(handle);
+}
+
+static void stop_helper(executor_t* executor)
+{
+    if (executor->helper_pid <= 0)
+        return;
+
+    if (executor->poll_handle)
+    {
+        uv_poll_stop(executor->poll_handle);
+        uv_close((uv_handle_t*)executor->poll_handle, on_poll_closed);
+        executor->poll_handle = NULL;
+    }
+
+    // Closing the lifeline makes the helper exit; reap it so it does not linger as a zombie
+    close(executor->lifeline);
+    close(executor->sock);
+    waitpid(executor->helper_pid, NULL, 0);
+
+    executor->lifeline = -1;
+    executor->sock = -1;
+    executor->helper_pid = -1;
+}
+
+bool executor_init(executor_t* executor, uv_loop_t* loop, loop_monitor_t* monitor)
+{
+    memset(executor, 0, sizeof(*executor));
+    executor->loop = loop;
+    executor->monitor = monitor;
+    executor->mode = EXECUTOR_SYSTEM;
+    executor->sock = -1;
+    executor->lifeline = -1;
+    executor->helper_pid = -1;
+    return true;
+}
+
+bool executor_set_mode(executor_t* executor, executor_mode_t mode)
+{
+    if (mode == EXECUTOR_HELPER && executor->helper_pid < 0 && !start_helper(executor))
+    {
+        executor->mode = EXECUTOR_SYSTEM;
+        return false;
+    }
+
+    executor->mode = mode;
+    return true;
+}
+
+void executor_cleanup(executor_t* executor)
+{
+    stop_helper(executor);
+    executor->mode = EXECUTOR_SYSTEM;
+}
+
+void executor_set_done_callback(executor_t* executor, executor_done_cb_t callback,
+                                void* user_data)
+{
+    executor->done_callback = callback;
+    executor->user_data = user_data;
+}
+
+// Spawn the command and wait for it on the loop thread; like the helper, no shell is involved
+static int run_and_wait(executor_t* executor, char* const argv[])
+{
+    PROBE2(command_start, 0, argv[0]);
+    uint64_t start = uv_hrtime();
+    pid_t pid = -1;
+    int status = -1;
+    int err = spawn_command(argv, &pid);
+    if (err != 0)
+    {
+        debugf(stderr, "Failed to run %s: %s\n", argv[0], strerror(err));
+    }
+    else
+    {
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+    }
+    uint64_t latency = uv_hrtime() - start;
+    PROBE3(command_done, 0, status, latency);
+    if (executor->done_callback)
+    {
+        executor->done_callback(status, latency, executor->user_data);
+    }
+    return status;
+}
+
+static int run_with_helper(executor_t* executor, char* const argv[])
+{
+    char msg[EXECUTOR_MAX_MESSAGE];
+    executor_request_t request = {0};
+    size_t used = sizeof(request);
+
+    for (; argv[request.argc]; request.argc++)
+    {
+        size_t len = strlen(argv[request.argc]) + 1;
+        if (request.argc >= EXECUTOR_MAX_ARGS || used + len > sizeof(msg))
+        {
+            errno = E2BIG;
+            return -1;
+        }
+        memcpy(msg + used, argv[request.argc], len);
+        used += len;
+    }
+
+    // Skip 0, which the helper uses for completions it cannot attribute
+    if (++executor->next_id == 0)
+        executor->next_id = 1;
+    request.id = executor->next_id;
+    request.length = (uint32_t)(used - sizeof(request));
+    memcpy(msg, &request, sizeof(request));
+
+    if (send(executor->sock, msg, used, 0) != (ssize_t)used)
+    {
+        return -1;
+    }
+    executor->started_at[request.id % EXECUTOR_MAX_PENDING] = uv_hrtime();
+    PROBE2(command_start, request.id, argv[0]);
+    return 0;
+}
+
+int executor_run(executor_t* executor, char* const argv[])
+{
+    if (!argv || !argv[0])
+        return -1;
+
+    if (executor->mode == EXECUTOR_HELPER)
+    {
+        if (run_with_helper(executor, argv) == 0)
+            return 0;
+
+        // Never lose an action because the helper is busy or gone
+        debugf(stderr, "Executor helper unavailable (%s), running the command directly.\n",
+               strerror(errno));
+    }
+
+    return run_and_wait(executor, argv);
+}
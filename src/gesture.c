@@ -0,0 +1,119 @@
+#include "gesture.h"
+
+#include <string.h>
+
+#include "debug.h"
+
+typedef enum
+{
+    GESTURE_IDLE = 0,
+    GESTURE_DOWN,         // pressed, hold timer running if the key has a hold binding
+    GESTURE_HELD,         // hold binding ran, waiting for the release
+    GESTURE_TAPPED,       // released once, waiting for a second press
+    GESTURE_SECOND_DOWN,  // double-tap binding ran, waiting for the release
+} gesture_phase_t;
+
+void gesture_init(gesture_t* gestures, timer_wheel_t* wheel, gesture_fire_cb_t fire_cb,
+                  void* user_data)
+{
+    memset(gestures, 0, sizeof(*gestures));
+    gestures->wheel = wheel;
+    gestures->fire = fire_cb;
+    gestures->user_data = user_data;
+}
+
+static void fire(gesture_t* gestures, const keymap_entry_t* entry, uint8_t binding)
+{
+    gestures->fire(gestures->config, entry->device, binding, gestures->user_data);
+}
+
+static void on_threshold(wheel_timer_t* timer)
+{
+    gesture_t* gestures = timer->data;
+    gesture_key_t* key = (gesture_key_t*)timer;
+    const keymap_entry_t* entry = &gestures->config->active->keymap[key - gestures->keys];
+
+    if (key->phase == GESTURE_DOWN)
+    {
+        debug("Hold on keycode=%d\n", entry->keycode);
+        key->phase = GESTURE_HELD;
+        fire(gestures, entry, entry->hold);
+    }
+    else if (key->phase == GESTURE_TAPPED)
+    {
+        // No second press in time: it was a single tap
+        key->phase = GESTURE_IDLE;
+        fire(gestures, entry, entry->binding);
+    }
+}
+
+static bool on_press(gesture_t* gestures, gesture_key_t* key, const keymap_entry_t* entry)
+{
+    switch (key->phase)
+    {
+    case GESTURE_IDLE:
+        key->phase = GESTURE_DOWN;
+        if (entry->hold != KEYMAP_EMPTY)
+            timer_wheel_schedule(gestures->wheel, &key->timer, entry->hold_ms, on_threshold,
+                                 gestures);
+        return true;
+    case GESTURE_TAPPED:
+        debug("Double tap on keycode=%d\n", entry->keycode);
+        timer_wheel_cancel(gestures->wheel, &key->timer);
+        key->phase = GESTURE_SECOND_DOWN;
+        fire(gestures, entry, entry->double_tap);
+        return true;
+    default:
+        return false;  // Auto-repeat or a missed release
+    }
+}
+
+static bool on_release(gesture_t* gestures, gesture_key_t* key, const keymap_entry_t* entry)
+{
+    switch (key->phase)
+    {
+    case GESTURE_DOWN:
+        timer_wheel_cancel(gestures->wheel, &key->timer);
+        if (entry->double_tap != KEYMAP_EMPTY)
+        {
+            key->phase = GESTURE_TAPPED;
+            timer_wheel_schedule(gestures->wheel, &key->timer, entry->double_tap_ms, on_threshold,
+                                 gestures);
+        }
+        else
+        {
+            key->phase = GESTURE_IDLE;
+            fire(gestures, entry, entry->binding);
+        }
+        return true;
+    case GESTURE_HELD:
+    case GESTURE_SECOND_DOWN:
+        key->phase = GESTURE_IDLE;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool gesture_key(gesture_t* gestures, const config_t* config, const keymap_entry_t* entry,
+                 bool pressed)
+{
+    if (!gestures->wheel)
+        return false;
+
+    gestures->config = config;
+    gesture_key_t* key = &gestures->keys[entry - config->active->keymap];
+    return pressed ? on_press(gestures, key, entry) : on_release(gestures, key, entry);
+}
+
+void gesture_reset(gesture_t* gestures)
+{
+    if (!gestures->wheel)
+        return;
+
+    for (size_t i = 0; i < KEYMAP_SIZE; i++)
+    {
+        timer_wheel_cancel(gestures->wheel, &gestures->keys[i].timer);
+        gestures->keys[i].phase = GESTURE_IDLE;
+    }
+}
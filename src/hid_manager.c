@@ -1,158 +1,933 @@
 #include "hid_manager.h"
 
+#include <fcntl.h>
 #include <hidapi/hidapi.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <uv.h>
 
 #include "config.h"
 #include "debug.h"
+#include "hid_uring.h"
+#include "loop_monitor.h"
+#include "metrics.h"
+#include "probes.h"
 
 #define BUFFER_SIZE 64
-#define MAX_ACTIVE_DEVICES 16
+#define BOOT_REPORT_KEYS 6
+#define BOOT_ROLLOVER_ERROR 0x01
+#define REOPEN_FIRST_MS 250  // wait before the first attempt to reopen a device that failed
+#define REOPEN_MAX_MS 30000  // longest wait between attempts; each failure doubles it
+
+_Static_assert(HID_MANAGER_HELD_KEYS >= BOOT_REPORT_KEYS + 8, "boot report keys and modifiers");
 
 // Forward declarations
 static void poll_devices(uv_timer_t* handle);
+static void handle_report(hid_manager_t* manager, int slot, const unsigned char* report,
+                          int length);
+static void mark_dead(hid_manager_t* manager, int slot, const char* reason);
+static void on_reopen_timer(uv_timer_t* handle);
+
+typedef struct reload_s reload_t;
+
+// One device being opened on the threadpool, with the settings of the section it resolved to
+typedef struct
+{
+    uv_work_t req;
+    reload_t* reload;
+    const char* path;  // points into the reload's enumeration
+    uint16_t vendor_id;
+    uint16_t product_id;
+    uint8_t section;  // resolve_device() of the device, passed with its key events
+    uint8_t report_format;
+    bool led_sync;
+    int reuse;  // slot whose open device is kept as it is, -1 to open the device
+    hid_device* device;
+    int raw_fd;  // hidraw node opened for io_uring reads, -1 if the device is polled
+} open_req_t;
+
+// State a device kept open across a reload carries into its new slot
+typedef struct
+{
+    uint16_t held_keys[HID_MANAGER_HELD_KEYS];
+    uint8_t held_count;
+    int leds_sent;
+    bool dead;  // lost while the reload was in flight
+} kept_slot_t;
+
+// A reload in flight: enumeration, then parallel opens, then one attach on the loop thread
+struct reload_s
+{
+    uv_work_t req;
+    hid_manager_t* manager;
+    unsigned generation;
+    uint64_t started_ns;  // for the reload_end probe
+    bool uring;  // read hidraw devices through io_uring
+    struct hid_device_info* devs;
+    open_req_t opens[HID_MANAGER_MAX_DEVICES];
+    int open_count;
+    int remaining;
+};
+
+// A device that failed being reopened on the threadpool, found again by its IDs since a
+// reset or replug usually gives it a new path
+typedef struct
+{
+    uv_work_t req;
+    hid_manager_t* manager;
+    unsigned generation;
+    unsigned device_set;
+    int slot;
+    uint16_t vendor_id;
+    uint16_t product_id;
+    bool uring;
+    char path[MAX_PATH];
+    hid_device* device;
+    int raw_fd;
+} reopen_req_t;
+
+static const hid_backend_t hidapi_backend = {
+    .init = hid_init,
+    .exit = hid_exit,
+    .enumerate = hid_enumerate,
+    .free_enumeration = hid_free_enumeration,
+    .open_path = hid_open_path,
+    .close = hid_close,
+    .read_timeout = hid_read_timeout,
+    .write = hid_write,
+};
+
+// hidapi keeps its state per process, so only the first manager to start initializes it and
+// the last one to stop releases it
+static uv_once_t hidapi_once = UV_ONCE_INIT;
+static uv_mutex_t hidapi_lock;
+static int hidapi_users = 0;
+
+static void init_hidapi_lock(void)
+{
+    uv_mutex_init(&hidapi_lock);
+}
 
-// Global configuration
-extern config_t config;
+static int backend_init(const hid_backend_t* backend)
+{
+    if (backend != &hidapi_backend)
+        return backend->init();
+
+    uv_once(&hidapi_once, init_hidapi_lock);
+    uv_mutex_lock(&hidapi_lock);
+    int err = hidapi_users > 0 ? 0 : backend->init();
+    if (err == 0)
+        hidapi_users++;
+    uv_mutex_unlock(&hidapi_lock);
+    return err;
+}
 
-// Global variables
-static struct
+static int backend_exit(const hid_backend_t* backend)
 {
-    hid_device* devices[MAX_ACTIVE_DEVICES];
-    int device_count;
-    key_callback_t key_callback;
-    void* user_data;
-    uv_timer_t* poll_timer;
-} hid_manager = {0};
+    if (backend != &hidapi_backend)
+        return backend->exit();
+
+    uv_mutex_lock(&hidapi_lock);
+    int err = --hidapi_users > 0 ? 0 : backend->exit();
+    uv_mutex_unlock(&hidapi_lock);
+    return err;
+}
 
-// Platform-specific device matching
-static bool match_device(struct hid_device_info* dev_info, device_config_t* config)
+// Whether an earlier interface of the same VID/PID was already tried in this enumeration
+static bool already_tried(struct hid_device_info* devs, struct hid_device_info* dev_info)
 {
-    return dev_info->vendor_id == config->vendor && dev_info->product_id == config->product;
+    for (struct hid_device_info* cur = devs; cur != dev_info; cur = cur->next)
+    {
+        if (cur->vendor_id == dev_info->vendor_id && cur->product_id == dev_info->product_id)
+            return true;
+    }
+    return false;
+}
+
+void hid_manager_set_backend(hid_manager_t* manager, const hid_backend_t* backend)
+{
+    manager->backend = backend ? backend : &hidapi_backend;
+}
+
+void hid_manager_set_config(hid_manager_t* manager, const config_t* config)
+{
+    manager->config = config;
+
+    // Sections move when others are added or removed before them; the open devices follow
+    // at once rather than when the next device reload attaches its set
+    for (int i = 0; config && i < manager->device_count; i++)
+    {
+        manager->sections[i] =
+            resolve_device(config, manager->vendor_ids[i], manager->product_ids[i]);
+    }
 }
 
-bool hid_manager_init(void)
+bool hid_manager_init(hid_manager_t* manager, uv_loop_t* loop, loop_monitor_t* monitor,
+                      metrics_t* metrics)
 {
+    manager->loop = loop;
+    manager->monitor = monitor;
+    manager->metrics = metrics;
+    manager->led_state = -1;
+    if (!manager->backend)
+        manager->backend = &hidapi_backend;
+    hid_uring_init(&manager->ring);
+
     // Initialize HIDAPI library
-    if (hid_init() != 0)
+    if (backend_init(manager->backend) != 0)
     {
         debug("Failed to initialize HIDAPI");
         return false;
     }
 
-    // Initialize polling timer
-    hid_manager.poll_timer = malloc(sizeof(uv_timer_t));
-    if (!hid_manager.poll_timer)
+    // Initialize polling timer, and the one that reopens devices that failed
+    manager->poll_timer = malloc(sizeof(uv_timer_t));
+    manager->reopen_timer = malloc(sizeof(uv_timer_t));
+    if (!manager->poll_timer || !manager->reopen_timer)
     {
         debug("Failed to allocate timer");
-        hid_exit();
+        free(manager->poll_timer);
+        free(manager->reopen_timer);
+        manager->poll_timer = NULL;
+        manager->reopen_timer = NULL;
+        backend_exit(manager->backend);
         return false;
     }
 
-    uv_timer_init(uv_default_loop(), hid_manager.poll_timer);
-    uv_timer_start(hid_manager.poll_timer, poll_devices, 0, 10);  // Poll every 10ms
+    uv_timer_init(manager->loop, manager->poll_timer);
+    manager->poll_timer->data = manager;
+    uv_timer_start(manager->poll_timer, poll_devices, 0, 10);  // Poll every 10ms
+    uv_timer_init(manager->loop, manager->reopen_timer);
+    manager->reopen_timer->data = manager;
 
     return true;
 }
 
-void hid_manager_cleanup(void)
+static void on_timer_closed(uv_handle_t* handle)
+{
+    free(handle);
+}
+
+static void close_devices(hid_manager_t* manager)
+{
+    hid_uring_stop(&manager->ring);
+    for (int i = 0; i < manager->device_count; i++)
+    {
+        if (manager->raw_fds[i] >= 0)
+        {
+            close(manager->raw_fds[i]);
+            manager->raw_fds[i] = -1;
+        }
+        if (manager->devices[i])
+        {
+            PROBE3(device_detach, manager->vendor_ids[i], manager->product_ids[i], i);
+            manager->metrics->detaches++;
+            manager->backend->close(manager->devices[i]);
+            manager->devices[i] = NULL;
+        }
+    }
+    manager->device_count = 0;
+    manager->device_set++;
+    if (manager->reopen_timer)
+        uv_timer_stop(manager->reopen_timer);
+}
+
+void hid_manager_cleanup(hid_manager_t* manager)
 {
     // Stop and free timer
-    if (hid_manager.poll_timer)
+    if (manager->poll_timer)
+    {
+        uv_timer_stop(manager->poll_timer);
+        uv_close((uv_handle_t*)manager->poll_timer, on_timer_closed);
+        manager->poll_timer = NULL;
+    }
+    if (manager->reopen_timer)
+    {
+        uv_timer_stop(manager->reopen_timer);
+        uv_close((uv_handle_t*)manager->reopen_timer, on_timer_closed);
+        manager->reopen_timer = NULL;
+    }
+
+    // Close all devices; a reload still in flight closes what it opens when it completes
+    close_devices(manager);
+    manager->led_state = -1;
+    manager->generation++;
+    manager->reloading = false;
+    manager->reload_again = false;
+    manager->reopening = false;
+
+    // Cleanup HIDAPI
+    backend_exit(manager->backend);
+}
+
+bool hid_manager_idle(const hid_manager_t* manager)
+{
+    return manager->in_flight == 0;
+}
+
+void hid_manager_set_key_callback(hid_manager_t* manager, key_callback_t callback,
+                                  void* user_data)
+{
+    manager->key_callback = callback;
+    manager->user_data = user_data;
+}
+
+bool hid_manager_decode_report(const unsigned char* report, int length, uint16_t* keycode)
+{
+    if (length <= 0)
+        return false;
+
+    // Assuming report[0] contains the keycode - adjust based on your HID report format
+    *keycode = report[0];
+    return true;
+}
+
+static void on_uring_report(size_t slot, const unsigned char* report, int length,
+                            void* user_data)
+{
+    hid_manager_t* manager = user_data;
+    int device = manager->uring_slots[slot];
+    if (length <= 0)
     {
-        uv_timer_stop(hid_manager.poll_timer);
-        free(hid_manager.poll_timer);
-        hid_manager.poll_timer = NULL;
+        mark_dead(manager, device, length < 0 ? strerror(-length) : "end of file");
+        return;
     }
+    uint64_t started = loop_monitor_begin(manager->monitor);
+    handle_report(manager, device, report, length);
+    loop_monitor_end(manager->monitor, LOOP_STAGE_HID, started);
+}
 
-    // Close all devices
-    for (int i = 0; i < hid_manager.device_count; i++)
+// Hand the hidraw descriptors to io_uring; on failure every device falls back to polling
+static void start_uring(hid_manager_t* manager)
+{
+    int fds[HID_URING_MAX_DEVICES];
+    size_t count = 0;
+    for (int i = 0; i < manager->device_count && count < HID_URING_MAX_DEVICES; i++)
     {
-        if (hid_manager.devices[i])
+        if (manager->raw_fds[i] < 0)
+            continue;
+        manager->uring_slots[count] = (uint8_t)i;
+        fds[count++] = manager->raw_fds[i];
+    }
+    if (count == 0 ||
+        hid_uring_start(&manager->ring, manager->loop, fds, count, on_uring_report, manager))
+        return;
+
+    debugf(stderr, "io_uring is unavailable, polling HID devices instead\n");
+    for (int i = 0; i < manager->device_count; i++)
+    {
+        if (manager->raw_fds[i] >= 0)
         {
-            hid_close(hid_manager.devices[i]);
-            hid_manager.devices[i] = NULL;
+            close(manager->raw_fds[i]);
+            manager->raw_fds[i] = -1;
         }
     }
-    hid_manager.device_count = 0;
+}
 
-    // Cleanup HIDAPI
-    hid_exit();
+// Keys held on a device that went away are released, so nothing stays pressed
+static void release_held(hid_manager_t* manager, int i)
+{
+    for (int k = 0; k < manager->held_counts[i] && manager->key_callback; k++)
+    {
+        manager->key_callback(manager->vendor_ids[i], manager->product_ids[i],
+                                 manager->sections[i], manager->held_keys[i][k], 0, false,
+                                 manager->user_data);
+    }
+    manager->held_counts[i] = 0;
 }
 
-void hid_manager_set_key_callback(key_callback_t callback, void* user_data)
+// Arm the reopen timer for the earliest attempt due among the dead devices
+static void schedule_reopen(hid_manager_t* manager)
 {
-    hid_manager.key_callback = callback;
-    hid_manager.user_data = user_data;
+    if (!manager->reopen_timer || manager->reopening)
+        return;
+
+    uint64_t due = 0;
+    for (int i = 0; i < manager->device_count; i++)
+    {
+        if (manager->dead[i] && manager->reopen_at[i] &&
+            (!due || manager->reopen_at[i] < due))
+            due = manager->reopen_at[i];
+    }
+    if (!due)
+    {
+        uv_timer_stop(manager->reopen_timer);
+        return;
+    }
+    uint64_t now = uv_now(manager->loop);
+    uv_timer_start(manager->reopen_timer, on_reopen_timer, due > now ? due - now : 0, 0);
 }
 
-static void poll_devices(uv_timer_t* handle)
+// Close a device whose read failed and stop polling it; it is reopened with backoff
+static void mark_dead(hid_manager_t* manager, int i, const char* reason)
 {
-    (void)handle;  // Silence unused parameter warning
-    unsigned char buf[BUFFER_SIZE];
+    debugf(stderr, "Lost %04x:%04x (%s), reopening in the background\n",
+           manager->vendor_ids[i], manager->product_ids[i], reason);
+    release_held(manager, i);
+    PROBE3(device_detach, manager->vendor_ids[i], manager->product_ids[i], i);
+    manager->metrics->detaches++;
+
+    // A descriptor read through io_uring stays registered with the ring until it restarts
+    if (manager->raw_fds[i] >= 0)
+    {
+        close(manager->raw_fds[i]);
+        manager->raw_fds[i] = -1;
+    }
+    manager->backend->close(manager->devices[i]);
+    manager->devices[i] = NULL;
+    manager->dead[i] = true;
+    manager->backoff_ms[i] = REOPEN_FIRST_MS;
+    manager->reopen_at[i] = uv_now(manager->loop) + REOPEN_FIRST_MS;
+    schedule_reopen(manager);
+}
+
+static void reopen_work(uv_work_t* req)
+{
+    reopen_req_t* reopen = req->data;
+    hid_manager_t* manager = reopen->manager;
+    struct hid_device_info* devs =
+        manager->backend->enumerate(reopen->vendor_id, reopen->product_id);
 
-    for (int i = 0; i < hid_manager.device_count; i++)
+    // The first interface, as a reload would pick
+    for (struct hid_device_info* cur = devs; cur; cur = cur->next)
     {
-        if (!hid_manager.devices[i])
+        if (cur->vendor_id != reopen->vendor_id || cur->product_id != reopen->product_id)
             continue;
+        strncpy(reopen->path, cur->path, sizeof(reopen->path) - 1);
+        reopen->device = manager->backend->open_path(cur->path);
+        if (reopen->device && reopen->uring && strncmp(cur->path, "/dev/hidraw", 11) == 0)
+            reopen->raw_fd = open(cur->path, O_RDONLY | O_CLOEXEC);
+        break;
+    }
+    manager->backend->free_enumeration(devs);
+}
+
+static void after_reopen(uv_work_t* req, int status)
+{
+    (void)status;  // Reopens are never cancelled
+    reopen_req_t* reopen = req->data;
+    hid_manager_t* manager = reopen->manager;
+    int i = reopen->slot;
+    manager->in_flight--;
 
-        int res = hid_read_timeout(hid_manager.devices[i], buf, sizeof(buf), 0);
-        if (res > 0 && hid_manager.key_callback)
+    // A reload or cleanup replaced the slots meanwhile; a reload opens the device anyway
+    if (reopen->generation != manager->generation ||
+        reopen->device_set != manager->device_set)
+    {
+        if (reopen->device)
+            manager->backend->close(reopen->device);
+        if (reopen->raw_fd >= 0)
+            close(reopen->raw_fd);
+        if (reopen->generation == manager->generation)
         {
-            // Extract vendor and product ID for the device
-            struct hid_device_info* info = hid_get_device_info(hid_manager.devices[i]);
-            if (info)
-            {
-                // Assuming buf[0] contains the keycode - adjust based on your HID report format
-                hid_manager.key_callback(info->vendor_id, info->product_id, buf[0],
-                                         hid_manager.user_data);
-            }
+            manager->reopening = false;
+            schedule_reopen(manager);
         }
+        free(reopen);
+        return;
     }
+    manager->reopening = false;
+
+    if (!reopen->device)
+    {
+        manager->backoff_ms[i] = manager->backoff_ms[i] * 2 < REOPEN_MAX_MS
+                                        ? manager->backoff_ms[i] * 2
+                                        : REOPEN_MAX_MS;
+        manager->reopen_at[i] = uv_now(manager->loop) + manager->backoff_ms[i];
+        debug("Reopening %04x:%04x failed, next attempt in %ums\n", reopen->vendor_id,
+              reopen->product_id, manager->backoff_ms[i]);
+        free(reopen);
+        schedule_reopen(manager);
+        return;
+    }
+
+    debugf(stderr, "Reopened %04x:%04x at %s\n", reopen->vendor_id, reopen->product_id,
+           reopen->path);
+    memcpy(manager->paths[i], reopen->path, sizeof(reopen->path));
+    manager->devices[i] = reopen->device;
+    manager->raw_fds[i] = reopen->raw_fd;
+    manager->dead[i] = false;
+    manager->reopen_at[i] = 0;
+    manager->leds_sent[i] = -1;
+    manager->metrics->attaches++;
+    PROBE4(device_attach, reopen->vendor_id, reopen->product_id, i, reopen->path);
+    free(reopen);
+
+    // The ring reads a fixed set of descriptors, so it starts over with the new one
+    if (manager->raw_fds[i] >= 0)
+    {
+        hid_uring_stop(&manager->ring);
+        start_uring(manager);
+    }
+    if (manager->led_state >= 0)
+        hid_manager_sync_leds(manager, (uint8_t)manager->led_state);
+    schedule_reopen(manager);
 }
 
-bool hid_manager_reload(void)
+// Reopen one dead device that is due; the others wait until it completes
+static void on_reopen_timer(uv_timer_t* handle)
 {
-    // Close existing devices
-    for (int i = 0; i < hid_manager.device_count; i++)
+    hid_manager_t* manager = handle->data;
+
+    // A reload in flight enumerates and opens every device anyway
+    if (manager->reloading)
     {
-        if (hid_manager.devices[i])
+        uv_timer_start(manager->reopen_timer, on_reopen_timer, REOPEN_FIRST_MS, 0);
+        return;
+    }
+
+    uint64_t now = uv_now(manager->loop);
+    for (int i = 0; i < manager->device_count; i++)
+    {
+        if (!manager->dead[i] || !manager->reopen_at[i] || manager->reopen_at[i] > now)
+            continue;
+
+        reopen_req_t* reopen = calloc(1, sizeof(*reopen));
+        if (!reopen)
+            break;
+        *reopen = (reopen_req_t){
+            .manager = manager,
+            .generation = manager->generation,
+            .device_set = manager->device_set,
+            .slot = i,
+            .vendor_id = manager->vendor_ids[i],
+            .product_id = manager->product_ids[i],
+            .uring = manager->config->hid_reader == HID_READER_URING,
+            .raw_fd = -1,
+        };
+        reopen->req.data = reopen;
+        if (uv_queue_work(manager->loop, &reopen->req, reopen_work, after_reopen) != 0)
         {
-            hid_close(hid_manager.devices[i]);
-            hid_manager.devices[i] = NULL;
+            free(reopen);
+            manager->reopen_at[i] = now + manager->backoff_ms[i];
+            break;
         }
+        manager->reopen_at[i] = 0;
+        manager->reopening = true;
+        manager->in_flight++;
+        return;
     }
-    hid_manager.device_count = 0;
+    schedule_reopen(manager);
+}
 
-    // Enumerate and open configured devices
-    for (size_t i = 0; i < config.device_count && i < MAX_ACTIVE_DEVICES; i++)
+static void poll_devices(uv_timer_t* handle)
+{
+    hid_manager_t* manager = handle->data;
+    uint64_t started = loop_monitor_begin(manager->monitor);
+    hid_manager_poll(manager);
+    loop_monitor_end(manager->monitor, LOOP_STAGE_HID, started);
+}
+
+// Runs on the loop thread once every open of a reload has completed
+static void finish_reload(reload_t* reload)
+{
+    hid_manager_t* manager = reload->manager;
+    if (reload->generation != manager->generation)
+    {
+        // The manager was cleaned up meanwhile; nothing may keep these handles
+        for (int i = 0; i < reload->open_count; i++)
+        {
+            if (reload->opens[i].device)
+                manager->backend->close(reload->opens[i].device);
+            if (reload->opens[i].raw_fd >= 0)
+                close(reload->opens[i].raw_fd);
+        }
+    }
+    else
     {
-        struct hid_device_info* devs = hid_enumerate(0, 0);
-        struct hid_device_info* cur_dev;
+        // Take the devices that stay open out of their slots, so closing the rest leaves them
+        kept_slot_t kept[HID_MANAGER_MAX_DEVICES];
+        for (int i = 0; i < reload->open_count; i++)
+        {
+            open_req_t* open = &reload->opens[i];
+            int j = open->reuse;
+            if (j < 0)
+                continue;
+            open->device = manager->devices[j];
+            open->raw_fd = manager->raw_fds[j];
+            kept[i].held_count = manager->held_counts[j];
+            memcpy(kept[i].held_keys, manager->held_keys[j], sizeof(kept[i].held_keys));
+            kept[i].leds_sent = manager->leds_sent[j];
+            kept[i].dead = manager->dead[j];
+            manager->devices[j] = NULL;
+            manager->raw_fds[j] = -1;
+        }
 
-        for (cur_dev = devs; cur_dev; cur_dev = cur_dev->next)
+        // Swap the whole device set at once; polling never sees a half-opened set
+        close_devices(manager);
+        bool dead = false;
+        for (int i = 0; i < reload->open_count; i++)
         {
-            if (match_device(cur_dev, &config.devices[i]))
+            const open_req_t* open = &reload->opens[i];
+            bool reused = open->reuse >= 0;
+            if (!open->device && !(reused && kept[i].dead))
+                continue;
+
+            // Cache the IDs so polling needs no per-report device info lookup
+            int slot = manager->device_count++;
+            manager->devices[slot] = open->device;
+            manager->vendor_ids[slot] = open->vendor_id;
+            manager->product_ids[slot] = open->product_id;
+            // The configuration may have been replaced while the set was being opened
+            manager->sections[slot] =
+                resolve_device(manager->config, open->vendor_id, open->product_id);
+            snprintf(manager->paths[slot], sizeof(manager->paths[slot]), "%s", open->path);
+            manager->report_formats[slot] = open->report_format;
+            manager->held_counts[slot] = 0;
+            manager->led_sync[slot] = open->led_sync;
+            manager->leds_sent[slot] = -1;
+            manager->raw_fds[slot] = open->raw_fd;
+            manager->dead[slot] = false;
+            manager->report_counters[slot] =
+                metrics_device_counter(manager->metrics, open->vendor_id, open->product_id,
+                                       INPUT_HID);
+            if (!reused)
+            {
+                manager->metrics->attaches++;
+                PROBE4(device_attach, open->vendor_id, open->product_id, slot, open->path);
+                continue;
+            }
+
+            // A kept device was never detached; it keeps its held keys and LED state
+            manager->held_counts[slot] = kept[i].held_count;
+            memcpy(manager->held_keys[slot], kept[i].held_keys, sizeof(kept[i].held_keys));
+            manager->leds_sent[slot] = kept[i].leds_sent;
+            if (kept[i].dead)
             {
-                hid_manager.devices[hid_manager.device_count] = hid_open_path(cur_dev->path);
-                if (hid_manager.devices[hid_manager.device_count])
-                {
-                    hid_manager.device_count++;
-                }
-                break;
+                manager->dead[slot] = true;
+                manager->backoff_ms[slot] = REOPEN_FIRST_MS;
+                manager->reopen_at[slot] = uv_now(manager->loop) + REOPEN_FIRST_MS;
+                dead = true;
             }
         }
+        manager->reloading = false;
+        manager->metrics->device_reloads++;
+        PROBE3(hid_reload_end, reload->generation, manager->device_count,
+               uv_hrtime() - reload->started_ns);
+        start_uring(manager);
+
+        if (manager->led_state >= 0)
+            hid_manager_sync_leds(manager, (uint8_t)manager->led_state);
+        if (dead)
+            schedule_reopen(manager);
+    }
+
+    manager->backend->free_enumeration(reload->devs);
+    bool again = reload->generation == manager->generation && manager->reload_again;
+    free(reload);
+    manager->in_flight--;
+
+    // The configuration changed while this reload was in flight
+    if (again)
+    {
+        manager->reload_again = false;
+        hid_manager_reload(manager);
+    }
+}
+
+static void open_work(uv_work_t* req)
+{
+    open_req_t* request = req->data;
+    request->device = request->reload->manager->backend->open_path(request->path);
+
+    // hidraw hands every reader its own copy of each report, so reading a second descriptor
+    // leaves the hidapi handle for output reports; blocking, as io_uring waits for data itself
+    if (request->device && request->reload->uring &&
+        strncmp(request->path, "/dev/hidraw", 11) == 0)
+    {
+        request->raw_fd = open(request->path, O_RDONLY | O_CLOEXEC);
+    }
+}
+
+static void after_open(uv_work_t* req, int status)
+{
+    (void)status;  // Opens are never cancelled
+    open_req_t* open = req->data;
+    if (!open->device)
+        debug("Failed to open %04x:%04x\n", open->vendor_id, open->product_id);
+    if (--open->reload->remaining == 0)
+        finish_reload(open->reload);
+}
+
+// The slot of a device already open at a path with the same settings, -1 if there is none
+static int open_slot(const reload_t* reload, const open_req_t* open)
+{
+    const hid_manager_t* manager = reload->manager;
+    bool raw = reload->uring && strncmp(open->path, "/dev/hidraw", 11) == 0;
+    for (int i = 0; i < manager->device_count; i++)
+    {
+        if (manager->devices[i] && manager->vendor_ids[i] == open->vendor_id &&
+            manager->product_ids[i] == open->product_id &&
+            manager->report_formats[i] == open->report_format &&
+            manager->led_sync[i] == open->led_sync &&
+            (manager->raw_fds[i] >= 0) == raw && strcmp(manager->paths[i], open->path) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void enumerate_work(uv_work_t* req)
+{
+    reload_t* reload = req->data;
+    reload->devs = reload->manager->backend->enumerate(0, 0);
+}
 
-        hid_free_enumeration(devs);
+// Pick the devices to open on the loop thread, where the configuration may be read
+static void after_enumerate(uv_work_t* req, int status)
+{
+    (void)status;  // Enumeration is never cancelled
+    reload_t* reload = req->data;
+    hid_manager_t* manager = reload->manager;
+    if (reload->generation != manager->generation)
+    {
+        finish_reload(reload);
+        return;
+    }
+
+    // Open the first interface of every device a section applies to, with the settings of
+    // the section it resolves to
+    for (struct hid_device_info* cur_dev = reload->devs;
+         cur_dev && reload->open_count < HID_MANAGER_MAX_DEVICES; cur_dev = cur_dev->next)
+    {
+        const config_t* config = manager->config;
+        uint8_t section = resolve_device(config, cur_dev->vendor_id, cur_dev->product_id);
+        if (section == KEYMAP_EMPTY || config->devices[section].input != INPUT_HID ||
+            already_tried(reload->devs, cur_dev))
+            continue;
+
+        open_req_t* open = &reload->opens[reload->open_count++];
+        *open = (open_req_t){
+            .reload = reload,
+            .path = cur_dev->path,
+            .vendor_id = cur_dev->vendor_id,
+            .product_id = cur_dev->product_id,
+            .section = section,
+            .report_format = config->devices[section].report_format,
+            .led_sync = config->devices[section].led_sync,
+            .raw_fd = -1,
+        };
+        open->req.data = open;
+
+        // A device open with the settings it would get again is kept rather than reopened
+        open->reuse = open_slot(reload, open);
+        if (open->reuse < 0)
+            reload->remaining++;
+    }
+
+    if (reload->remaining == 0)
+    {
+        finish_reload(reload);
+        return;
+    }
+
+    // Each open blocks on its own device, so they run side by side on the threadpool
+    for (int i = 0; i < reload->open_count; i++)
+    {
+        if (reload->opens[i].reuse < 0)
+            uv_queue_work(manager->loop, &reload->opens[i].req, open_work, after_open);
+    }
+}
+
+bool hid_manager_reload(hid_manager_t* manager)
+{
+    if (!manager->config)
+        return false;
+
+    // One reload at a time; a request during it is served once it completes
+    if (manager->reloading)
+    {
+        manager->reload_again = true;
+        return true;
     }
 
+    reload_t* reload = calloc(1, sizeof(*reload));
+    if (!reload)
+        return false;
+    reload->manager = manager;
+    reload->generation = manager->generation;
+    reload->uring = manager->config->hid_reader == HID_READER_URING;
+    reload->started_ns = uv_hrtime();
+    reload->req.data = reload;
+    PROBE1(hid_reload_begin, reload->generation);
+
+    // Enumeration walks sysfs or IOKit and can take a long time; the current devices keep
+    // being polled until the new set is attached
+    if (uv_queue_work(manager->loop, &reload->req, enumerate_work, after_enumerate) != 0)
+    {
+        free(reload);
+        return false;
+    }
+    manager->reloading = true;
+    manager->in_flight++;
     return true;
 }
 
-void hid_manager_poll(void)
+bool hid_manager_reloading(const hid_manager_t* manager)
 {
-    uv_run(uv_default_loop(), UV_RUN_NOWAIT);
-}
\ No newline at end of file
+    return manager->reloading;
+}
+
+void hid_manager_sync_leds(hid_manager_t* manager, uint8_t state)
+{
+    // Boot keyboard LED output report, behind the report ID byte hidapi expects
+    unsigned char report[2] = {0x00, state};
+
+    manager->led_state = state;
+    if (!manager->backend->write)
+        return;
+
+    for (int i = 0; i < manager->device_count; i++)
+    {
+        if (!manager->devices[i] || !manager->led_sync[i] ||
+            manager->leds_sent[i] == state)
+            continue;
+
+        if (manager->backend->write(manager->devices[i], report, sizeof(report)) < 0)
+        {
+            debug("Failed to send LED report to %04x:%04x\n", manager->vendor_ids[i],
+                  manager->product_ids[i]);
+            continue;  // Retried on the next sync
+        }
+        manager->leds_sent[i] = state;
+    }
+}
+
+/**
+ * Decode a report into the set of keys it holds down, modifiers included as their HID
+ * usages. Returns the number of keys, or -1 if the report carries no key state.
+ */
+static int decode_keys(const unsigned char* report, int length, uint8_t format, uint16_t* keys)
+{
+    int count = 0;
+
+    if (format != REPORT_BOOT)
+    {
+        uint16_t keycode;
+        if (!hid_manager_decode_report(report, length, &keycode))
+            return -1;
+        if (keycode)
+            keys[count++] = keycode;
+        return count;
+    }
+
+    if (length < 3)
+        return -1;
+    for (int bit = 0; bit < 8; bit++)
+    {
+        if (report[0] & (1u << bit))
+            keys[count++] = (uint16_t)(HID_MODIFIER_FIRST + bit);
+    }
+    for (int i = 2; i < length && i < 2 + BOOT_REPORT_KEYS; i++)
+    {
+        if (report[i] == BOOT_ROLLOVER_ERROR)
+            return -1;  // Too many keys down; the report says nothing about which
+        if (report[i])
+            keys[count++] = report[i];
+    }
+    return count;
+}
+
+static bool contains(const uint16_t* keys, int count, uint16_t keycode)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (keys[i] == keycode)
+            return true;
+    }
+    return false;
+}
+
+// HID modifier byte for a set of keys
+static uint8_t modifiers_of(const uint16_t* keys, int count)
+{
+    uint8_t modifiers = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (keys[i] >= HID_MODIFIER_FIRST && keys[i] <= HID_MODIFIER_LAST)
+            modifiers |= (uint8_t)(1u << (keys[i] - HID_MODIFIER_FIRST));
+    }
+    return modifiers;
+}
+
+// Turn one report from a device slot into press and release events
+static void handle_report(hid_manager_t* manager, int i, const unsigned char* buf, int res)
+{
+    uint16_t keys[HID_MANAGER_HELD_KEYS];
+
+    PROBE3(hid_report_read, manager->vendor_ids[i], manager->product_ids[i], res);
+    (*manager->report_counters[i])++;
+    if (!manager->key_callback)
+        return;
+    int count = decode_keys(buf, res, manager->report_formats[i], keys);
+    if (count < 0)
+        return;
+
+    // Reports carry the keys that are down, so presses and releases are the changes
+    uint16_t* held = manager->held_keys[i];
+    int held_count = manager->held_counts[i];
+    uint8_t modifiers = modifiers_of(keys, count);
+    uint16_t vendor_id = manager->vendor_ids[i];
+    uint16_t product_id = manager->product_ids[i];
+    uint8_t section = manager->sections[i];
+    PROBE4(hid_report_decode, vendor_id, product_id, count, modifiers);
+
+    for (int k = 0; k < held_count; k++)
+    {
+        if (!contains(keys, count, held[k]))
+        {
+            manager->key_callback(vendor_id, product_id, section, held[k], modifiers, false,
+                                     manager->user_data);
+        }
+    }
+    for (int k = 0; k < count; k++)
+    {
+        if (!contains(held, held_count, keys[k]))
+        {
+            manager->key_callback(vendor_id, product_id, section, keys[k], modifiers, true,
+                                     manager->user_data);
+        }
+    }
+
+    memcpy(held, keys, count * sizeof(keys[0]));
+    manager->held_counts[i] = (uint8_t)count;
+}
+
+int hid_manager_list_devices(const hid_manager_t* manager, status_device_t* devices, int max)
+{
+    int count = 0;
+    for (int i = 0; i < manager->device_count && count < max; i++)
+    {
+        if (!manager->devices[i])
+            continue;
+        status_device_t* dev = &devices[count++];
+        memset(dev, 0, sizeof(*dev));
+        dev->vendor_id = manager->vendor_ids[i];
+        dev->product_id = manager->product_ids[i];
+        dev->input = INPUT_HID;
+        dev->led_sync = manager->led_sync[i];
+        dev->leds = manager->leds_sent[i] < 0 ? 0 : (uint8_t)manager->leds_sent[i];
+        dev->reports = *manager->report_counters[i];
+    }
+    return count;
+}
+
+void hid_manager_poll(hid_manager_t* manager)
+{
+    unsigned char buf[BUFFER_SIZE];
+
+    for (int i = 0; i < manager->device_count; i++)
+    {
+        // Devices read through io_uring deliver their reports from the completion ring
+        if (!manager->devices[i] || manager->raw_fds[i] >= 0)
+            continue;
+
+        // -1 once the device is unplugged or reset; its handle never reads again
+        int res = manager->backend->read_timeout(manager->devices[i], buf, sizeof(buf), 0);
+        if (res > 0)
+            handle_report(manager, i, buf, res);
+        else if (res < 0)
+            mark_dead(manager, i, "read failed");
+    }
+}
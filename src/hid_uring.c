@@ -0,0 +1,284 @@
+#include "hid_uring.h"
+
+#include <string.h>
+
+#include "debug.h"
+
+// Built on Linux when the kernel headers have io_uring, unless configured out
+#if defined(__linux__) && !defined(BELVEDERE_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HID_URING_ENABLED 1
+#endif
+#endif
+
+#ifdef HID_URING_ENABLED
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define HID_URING_ENTRIES 32  // power of two above HID_URING_MAX_DEVICES
+
+bool hid_uring_supported(void)
+{
+    return true;
+}
+
+static void* map_ring(hid_uring_t* ring, size_t size, off_t offset)
+{
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                offset);
+}
+
+static bool map_rings(hid_uring_t* ring, const struct io_uring_params* params)
+{
+    ring->sq_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    ring->cq_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        size_t size = ring->sq_size > ring->cq_size ? ring->sq_size : ring->cq_size;
+        ring->sq_size = ring->cq_size = size;
+    }
+
+    ring->sq_ptr = map_ring(ring, ring->sq_size, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        return false;
+    ring->cq_ptr = params->features & IORING_FEAT_SINGLE_MMAP
+                      ? ring->sq_ptr
+                      : map_ring(ring, ring->cq_size, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED)
+        return false;
+    ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = map_ring(ring, ring->sqes_size, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        return false;
+
+    char* sq = ring->sq_ptr;
+    char* cq = ring->cq_ptr;
+    ring->sq_tail = (unsigned*)(sq + params->sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params->sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params->sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params->cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params->cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params->cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params->cq_off.cqes);
+    return true;
+}
+
+// Post a read of one report into the slot's registered buffer; submitted by submit_reads(ring)
+static void queue_read(hid_uring_t* ring, size_t slot)
+{
+    unsigned tail = *ring->sq_tail;  // Only this thread moves the tail
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = (int)slot;  // index into the registered files
+    sqe->addr = (uint64_t)(uintptr_t)ring->buffers[slot];
+    sqe->len = HID_URING_REPORT_SIZE;
+    sqe->off = (uint64_t)-1;  // current position; devices and pipes have none
+    sqe->buf_index = (uint16_t)slot;
+    sqe->user_data = slot;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+}
+
+static int submit_reads(hid_uring_t* ring)
+{
+    while (ring->pending > 0)
+    {
+        long n = syscall(__NR_io_uring_enter, ring->ring_fd, ring->pending, 0, 0, NULL, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        ring->pending -= (unsigned)n;
+    }
+    return 0;
+}
+
+static void on_completions(uv_poll_t* handle, int status, int events)
+{
+    (void)events;  // Silence unused parameter warning
+    hid_uring_t* ring = handle->data;
+    if (status < 0)
+    {
+        debugf(stderr, "Error waiting for io_uring completions: %s\n", uv_strerror(status));
+        return;
+    }
+
+    uint64_t signals;
+    if (read(ring->event_fd, &signals, sizeof(signals)) < 0 && errno != EAGAIN)
+        return;
+
+    // Drain everything that completed since the last wakeup in one pass
+    unsigned generation = ring->generation;
+    unsigned head = *ring->cq_head;  // Only this thread moves the head
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail && ring->generation == generation; head++)
+    {
+        const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        size_t slot = (size_t)cqe->user_data;
+        int res = cqe->res;
+
+        if (res > 0 && ring->callback)
+            ring->callback(slot, ring->buffers[slot], res, ring->user_data);
+        else if (res <= 0 && res != -EINTR && ring->callback)
+            ring->callback(slot, NULL, res, ring->user_data);
+
+        // The callback may have stopped the ring
+        if (ring->generation == generation && (res > 0 || res == -EINTR))
+            queue_read(ring, slot);
+    }
+    if (ring->generation != generation)
+        return;
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    if (submit_reads(ring) != 0)
+        debugf(stderr, "Failed to resubmit io_uring reads: %s\n", strerror(errno));
+}
+
+static void on_poll_closed(uv_handle_t* handle)
+{
+    free(handle);
+}
+
+bool hid_uring_start(hid_uring_t* ring, uv_loop_t* loop, const int* fds, size_t count,
+                     hid_uring_report_cb callback, void* user_data)
+{
+    hid_uring_stop(ring);
+    if (count == 0 || count > HID_URING_MAX_DEVICES)
+        return false;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->ring_fd = (int)syscall(__NR_io_uring_setup, HID_URING_ENTRIES, &params);
+    if (ring->ring_fd < 0)
+    {
+        debug("io_uring unavailable: %s\n", strerror(errno));
+        return false;
+    }
+
+    struct iovec iovecs[HID_URING_MAX_DEVICES];
+    for (size_t i = 0; i < count; i++)
+    {
+        iovecs[i] = (struct iovec){.iov_base = ring->buffers[i], .iov_len = HID_URING_REPORT_SIZE};
+    }
+
+    // Registered files and buffers spare the kernel a lookup and a page pin on every read
+    ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    bool ok = map_rings(ring, &params) && ring->event_fd >= 0 &&
+              syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_FILES, fds,
+                      (unsigned)count) == 0 &&
+              syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_BUFFERS, iovecs,
+                      (unsigned)count) == 0 &&
+              syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_EVENTFD,
+                      &ring->event_fd, 1) == 0;
+    if (ok)
+    {
+        ring->count = count;
+        ring->callback = callback;
+        ring->user_data = user_data;
+        for (size_t i = 0; i < count; i++)
+        {
+            queue_read(ring, i);
+        }
+        ok = submit_reads(ring) == 0;
+    }
+    if (ok)
+    {
+        ring->poll_handle = malloc(sizeof(uv_poll_t));
+        ok = ring->poll_handle && uv_poll_init(loop, ring->poll_handle, ring->event_fd) == 0;
+        if (ok)
+            ring->poll_handle->data = ring;
+        else
+        {
+            free(ring->poll_handle);
+            ring->poll_handle = NULL;
+        }
+    }
+    if (!ok)
+    {
+        debug("io_uring setup failed: %s\n", strerror(errno));
+        hid_uring_stop(ring);
+        return false;
+    }
+
+    uv_poll_start(ring->poll_handle, UV_READABLE, on_completions);
+    return true;
+}
+
+void hid_uring_stop(hid_uring_t* ring)
+{
+    if (ring->poll_handle)
+    {
+        uv_poll_stop(ring->poll_handle);
+        uv_close((uv_handle_t*)ring->poll_handle, on_poll_closed);
+        ring->poll_handle = NULL;
+    }
+
+    // Closing the ring cancels the outstanding reads
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_size);
+    ring->sqes = NULL;
+    ring->cq_ptr = NULL;
+    ring->sq_ptr = NULL;
+
+    if (ring->ring_fd >= 0)
+        close(ring->ring_fd);
+    if (ring->event_fd >= 0)
+        close(ring->event_fd);
+    ring->ring_fd = -1;
+    ring->event_fd = -1;
+    ring->count = 0;
+    ring->pending = 0;
+    ring->callback = NULL;
+    ring->user_data = NULL;
+    ring->generation++;
+}
+
+#else  // !HID_URING_ENABLED
+
+bool hid_uring_supported(void)
+{
+    return false;
+}
+
+bool hid_uring_start(hid_uring_t* ring, uv_loop_t* loop, const int* fds, size_t count,
+                     hid_uring_report_cb callback, void* user_data)
+{
+    (void)ring;       // Silence unused parameter warning
+    (void)loop;       // Silence unused parameter warning
+    (void)fds;        // Silence unused parameter warning
+    (void)count;      // Silence unused parameter warning
+    (void)callback;   // Silence unused parameter warning
+    (void)user_data;  // Silence unused parameter warning
+    return false;
+}
+
+void hid_uring_stop(hid_uring_t* ring)
+{
+    (void)ring;  // Silence unused parameter warning
+}
+
+#endif  // HID_URING_ENABLED
+
+void hid_uring_init(hid_uring_t* ring)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+    ring->event_fd = -1;
+}
@@ -0,0 +1,98 @@
+#include "keycodes.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <strings.h>
+
+// Values of the Linux KEY_* constants, so names resolve on systems without linux/input.h
+static const struct
+{
+    const char* name;
+    uint16_t code;
+} key_names[] = {
+    {"esc", 1},          {"1", 2},            {"2", 3},            {"3", 4},
+    {"4", 5},            {"5", 6},            {"6", 7},            {"7", 8},
+    {"8", 9},            {"9", 10},           {"0", 11},           {"minus", 12},
+    {"equal", 13},       {"backspace", 14},   {"tab", 15},         {"q", 16},
+    {"w", 17},           {"e", 18},           {"r", 19},           {"t", 20},
+    {"y", 21},           {"u", 22},           {"i", 23},           {"o", 24},
+    {"p", 25},           {"leftbrace", 26},   {"rightbrace", 27},  {"enter", 28},
+    {"leftctrl", 29},    {"a", 30},           {"s", 31},           {"d", 32},
+    {"f", 33},           {"g", 34},           {"h", 35},           {"j", 36},
+    {"k", 37},           {"l", 38},           {"semicolon", 39},   {"apostrophe", 40},
+    {"grave", 41},       {"leftshift", 42},   {"backslash", 43},   {"z", 44},
+    {"x", 45},           {"c", 46},           {"v", 47},           {"b", 48},
+    {"n", 49},           {"m", 50},           {"comma", 51},       {"dot", 52},
+    {"slash", 53},       {"rightshift", 54},  {"kpasterisk", 55},  {"leftalt", 56},
+    {"space", 57},       {"capslock", 58},    {"f1", 59},          {"f2", 60},
+    {"f3", 61},          {"f4", 62},          {"f5", 63},          {"f6", 64},
+    {"f7", 65},          {"f8", 66},          {"f9", 67},          {"f10", 68},
+    {"numlock", 69},     {"scrolllock", 70},  {"kp7", 71},         {"kp8", 72},
+    {"kp9", 73},         {"kpminus", 74},     {"kp4", 75},         {"kp5", 76},
+    {"kp6", 77},         {"kpplus", 78},      {"kp1", 79},         {"kp2", 80},
+    {"kp3", 81},         {"kp0", 82},         {"kpdot", 83},       {"f11", 87},
+    {"f12", 88},         {"kpenter", 96},     {"rightctrl", 97},   {"kpslash", 98},
+    {"sysrq", 99},       {"rightalt", 100},   {"home", 102},       {"up", 103},
+    {"pageup", 104},     {"left", 105},       {"right", 106},      {"end", 107},
+    {"down", 108},       {"pagedown", 109},   {"insert", 110},     {"delete", 111},
+    {"mute", 113},       {"volumedown", 114}, {"volumeup", 115},   {"pause", 119},
+    {"leftmeta", 125},   {"rightmeta", 126},  {"compose", 127},    {"nextsong", 163},
+    {"playpause", 164},  {"previoussong", 165}, {"stopcd", 166}, {"f13", 183},
+    {"f14", 184},        {"f15", 185},        {"f16", 186},        {"f17", 187},
+    {"f18", 188},        {"f19", 189},        {"f20", 190},        {"f21", 191},
+    {"f22", 192},        {"f23", 193},        {"f24", 194},
+    // Aliases for the left-hand modifiers
+    {"ctrl", 29},        {"shift", 42},       {"alt", 56},         {"super", 125},
+    {"meta", 125},
+};
+
+// HID keyboard usage of each key code below 256, as hid-input maps them the other way
+static const uint8_t hid_usages[256] = {
+    [1] = 0x29,   [2] = 0x1e,   [3] = 0x1f,   [4] = 0x20,   [5] = 0x21,   [6] = 0x22,
+    [7] = 0x23,   [8] = 0x24,   [9] = 0x25,   [10] = 0x26,  [11] = 0x27,  [12] = 0x2d,
+    [13] = 0x2e,  [14] = 0x2a,  [15] = 0x2b,  [16] = 0x14,  [17] = 0x1a,  [18] = 0x08,
+    [19] = 0x15,  [20] = 0x17,  [21] = 0x1c,  [22] = 0x18,  [23] = 0x0c,  [24] = 0x12,
+    [25] = 0x13,  [26] = 0x2f,  [27] = 0x30,  [28] = 0x28,  [29] = 0xe0,  [30] = 0x04,
+    [31] = 0x16,  [32] = 0x07,  [33] = 0x09,  [34] = 0x0a,  [35] = 0x0b,  [36] = 0x0d,
+    [37] = 0x0e,  [38] = 0x0f,  [39] = 0x33,  [40] = 0x34,  [41] = 0x35,  [42] = 0xe1,
+    [43] = 0x31,  [44] = 0x1d,  [45] = 0x1b,  [46] = 0x06,  [47] = 0x19,  [48] = 0x05,
+    [49] = 0x11,  [50] = 0x10,  [51] = 0x36,  [52] = 0x37,  [53] = 0x38,  [54] = 0xe5,
+    [55] = 0x55,  [56] = 0xe2,  [57] = 0x2c,  [58] = 0x39,  [59] = 0x3a,  [60] = 0x3b,
+    [61] = 0x3c,  [62] = 0x3d,  [63] = 0x3e,  [64] = 0x3f,  [65] = 0x40,  [66] = 0x41,
+    [67] = 0x42,  [68] = 0x43,  [69] = 0x53,  [70] = 0x47,  [71] = 0x5f,  [72] = 0x60,
+    [73] = 0x61,  [74] = 0x56,  [75] = 0x5c,  [76] = 0x5d,  [77] = 0x5e,  [78] = 0x57,
+    [79] = 0x59,  [80] = 0x5a,  [81] = 0x5b,  [82] = 0x62,  [83] = 0x63,  [86] = 0x64,
+    [87] = 0x44,  [88] = 0x45,  [96] = 0x58,  [97] = 0xe4,  [98] = 0x54,  [99] = 0x46,
+    [100] = 0xe6, [102] = 0x4a, [103] = 0x52, [104] = 0x4b, [105] = 0x50, [106] = 0x4f,
+    [107] = 0x4d, [108] = 0x51, [109] = 0x4e, [110] = 0x49, [111] = 0x4c, [113] = 0x7f,
+    [114] = 0x81, [115] = 0x80, [116] = 0x66, [117] = 0x67, [119] = 0x48, [125] = 0xe3,
+    [126] = 0xe7, [127] = 0x65, [183] = 0x68, [184] = 0x69, [185] = 0x6a, [186] = 0x6b,
+    [187] = 0x6c, [188] = 0x6d, [189] = 0x6e, [190] = 0x6f, [191] = 0x70, [192] = 0x71,
+    [193] = 0x72, [194] = 0x73,
+};
+
+uint16_t key_code_from_name(const char* name)
+{
+    if (strncasecmp(name, "key_", 4) == 0)
+        name += 4;
+
+    // Digits name the number keys; longer numbers are raw codes
+    if (name[0] >= '0' && name[0] <= '9' && name[1] != '\0')
+    {
+        char* end;
+        unsigned long code = strtoul(name, &end, 0);
+        return *end == '\0' && code <= KEY_CODE_MAX ? (uint16_t)code : 0;
+    }
+
+    for (size_t i = 0; i < sizeof(key_names) / sizeof(key_names[0]); i++)
+    {
+        if (strcasecmp(key_names[i].name, name) == 0)
+            return key_names[i].code;
+    }
+    return 0;
+}
+
+uint16_t key_code_to_hid_usage(uint16_t code)
+{
+    return code < sizeof(hid_usages) ? hid_usages[code] : 0;
+}
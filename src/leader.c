@@ -0,0 +1,103 @@
+#include "leader.h"
+
+#include <string.h>
+
+#include "debug.h"
+
+#define DEVICE_SLOTS (sizeof(((config_t*)0)->devices) / sizeof(((config_t*)0)->devices[0]))
+
+void leader_init(leader_t* leaders, timer_wheel_t* wheel, leader_fire_cb_t fire_cb,
+                 void* user_data)
+{
+    memset(leaders, 0, sizeof(*leaders));
+    leaders->wheel = wheel;
+    leaders->fire = fire_cb;
+    leaders->user_data = user_data;
+}
+
+static void finish(leader_t* leaders, leader_device_t* dev)
+{
+    timer_wheel_cancel(leaders->wheel, &dev->timeout);
+    dev->node = LEADER_NONE;
+}
+
+static void on_timeout(wheel_timer_t* timer)
+{
+    leader_t* leaders = timer->data;
+    leader_device_t* dev = (leader_device_t*)timer;
+    const key_binding_t* action = leader_action(leaders->config, dev->node);
+
+    // A sequence that is also the prefix of a longer one runs once nothing follows it
+    dev->node = LEADER_NONE;
+    if (action)
+        leaders->fire(leaders->config, action, leaders->user_data);
+}
+
+// The most specific of a device's sections in the active layer that has sequences
+static size_t find_device(const config_t* config, uint8_t device)
+{
+    size_t layer = config->active ? (size_t)(config->active - config->layers) : 0;
+    if (device == KEYMAP_EMPTY)
+        return DEVICE_SLOTS;
+
+    uint8_t sections[SECTION_CHAIN_MAX];
+    size_t count = device_sections(config, device, layer, sections);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (sections[i] < DEVICE_SLOTS && config->devices[sections[i]].leader_root)
+            return sections[i];
+    }
+    return DEVICE_SLOTS;
+}
+
+bool leader_key(leader_t* leaders, const config_t* config, uint8_t device, uint16_t keycode,
+                bool pressed)
+{
+    if (!leaders->wheel || config->leaders.edge_count == 0 || !pressed)
+        return false;
+
+    size_t d = find_device(config, device);
+    if (d == DEVICE_SLOTS)
+        return false;
+
+    const device_config_t* dev_config = &config->devices[d];
+    leader_device_t* dev = &leaders->devices[d];
+    leaders->config = config;
+
+    uint32_t next = leader_next(config, dev->node, keycode);
+    if (next == LEADER_NONE && dev->node != LEADER_NONE)
+    {
+        debug("Leader sequence abandoned at keycode=%d\n", keycode);
+        finish(leaders, dev);
+    }
+    if (next == LEADER_NONE)
+        next = leader_next(config, dev_config->leader_root, keycode);
+    if (next == LEADER_NONE)
+        return false;
+
+    timer_wheel_cancel(leaders->wheel, &dev->timeout);
+    const key_binding_t* action = leader_action(config, next);
+    if (action && config->leaders.nodes[next].children == 0)
+    {
+        dev->node = LEADER_NONE;
+        leaders->fire(config, action, leaders->user_data);
+        return true;
+    }
+
+    dev->node = next;
+    uint16_t timeout = dev_config->leader_timeout_ms ? dev_config->leader_timeout_ms
+                                                     : DEFAULT_LEADER_TIMEOUT_MS;
+    timer_wheel_schedule(leaders->wheel, &dev->timeout, timeout, on_timeout, leaders);
+    return true;
+}
+
+void leader_reset(leader_t* leaders)
+{
+    if (!leaders->wheel)
+        return;
+
+    for (size_t i = 0; i < DEVICE_SLOTS; i++)
+    {
+        finish(leaders, &leaders->devices[i]);
+    }
+}
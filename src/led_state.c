@@ -0,0 +1,78 @@
+#include "led_state.h"
+
+#include <stddef.h>
+#include <strings.h>
+
+#include "debug.h"
+
+uint8_t led_state_mask(const char* led)
+{
+    static const struct
+    {
+        const char* name;
+        uint8_t mask;
+    } names[] = {
+        {"num", LED_NUM},         {"caps", LED_CAPS}, {"scroll", LED_SCROLL},
+        {"compose", LED_COMPOSE}, {"kana", LED_KANA},
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strcasecmp(led, names[i].name) == 0)
+            return names[i].mask;
+    }
+    return 0;
+}
+
+bool led_state_apply(led_state_t* leds, char mode, const char* led)
+{
+    uint8_t mask = led_state_mask(led);
+    uint8_t state = leds->state;
+
+    if (mode == '^')
+        state ^= mask;
+    else if (mode == '+')
+        state |= mask;
+    else if (mode == '-')
+        state &= (uint8_t)~mask;
+
+    if (state == leds->state)
+        return false;
+    leds->state = state;
+    leds->dirty = true;
+    return true;
+}
+
+void led_state_publish(led_state_t* leds)
+{
+    // Operations that cancel out within a burst leave nothing to send
+    if (!leds->dirty || leds->state == leds->published)
+    {
+        leds->dirty = false;
+        return;
+    }
+
+    leds->dirty = false;
+    leds->published = leds->state;
+    debug("LED state: 0x%02x\n", leds->state);
+    if (leds->sink)
+        leds->sink(leds->state, leds->sink_data);
+}
+
+uint8_t led_state_get(const led_state_t* leds)
+{
+    return leds->state;
+}
+
+void led_state_set_sink(led_state_t* leds, led_sink_t sink, void* user_data)
+{
+    leds->sink = sink;
+    leds->sink_data = user_data;
+}
+
+void led_state_reset(led_state_t* leds)
+{
+    leds->state = 0;
+    leds->published = 0;
+    leds->dirty = false;
+}
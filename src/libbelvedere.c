@@ -0,0 +1,575 @@
+#include "libbelvedere.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "actions.h"
+#include "config.h"
+#include "control.h"
+#include "debug.h"
+#include "dispatch.h"
+#include "evdev_manager.h"
+#include "executor.h"
+#include "hid_manager.h"
+#include "led_state.h"
+#include "loop_monitor.h"
+#include "metrics.h"
+#include "probes.h"
+#include "status_shm.h"
+#include "uinput.h"
+
+#define MAX_WATCHERS (MAX_CONFIG_FILES + 1)  // every configuration file, and conf.d itself
+
+// One polled configuration file, or the conf.d directory
+typedef struct
+{
+    uv_fs_poll_t poll;
+    belvedere_t* ctx;
+    char path[MAX_PATH];
+} config_watcher_t;
+
+struct belvedere
+{
+    config_t config;
+    char config_path[MAX_PATH];  // empty to search the default locations on every load
+    uv_loop_t* loop;  // options.loop, or uv_default_loop()
+    bool watch_config;
+    config_watcher_t* watchers[MAX_WATCHERS];
+    size_t watcher_count;
+    uv_timer_t metrics_timer;
+    uv_check_t status_check;
+    bool devices_open;
+
+    // The modules behind the engine; each instance has its own
+    loop_monitor_t monitor;
+    metrics_t metrics;
+    executor_t executor;
+    dispatch_t dispatch;
+    control_t control;
+    status_writer_t status;
+    hid_manager_t hid;
+    evdev_manager_t evdev;
+};
+
+// Dispatch one key event of a device whose section is already resolved
+static bool feed_device_key(belvedere_t* ctx, uint8_t section, uint16_t vendor_id,
+                            uint16_t product_id, uint16_t keycode, uint8_t modifiers, bool pressed)
+{
+    debug("Key %s: vendor_id=0x%04x, product_id=0x%04x, keycode=0x%x, modifiers=0x%02x\n",
+          pressed ? "press" : "release", vendor_id, product_id, keycode, modifiers);
+
+    uint64_t started = loop_monitor_begin(&ctx->monitor);
+    bool ran = dispatch_device_key(&ctx->dispatch, &ctx->config, section, vendor_id, product_id,
+                                   keycode, modifiers, pressed);
+    loop_monitor_end(&ctx->monitor, LOOP_STAGE_DISPATCH, started);
+    return ran;
+}
+
+static void on_key_event(uint16_t vendor_id, uint16_t product_id, uint8_t section,
+                         uint16_t keycode, uint8_t modifiers, bool pressed, void* user_data)
+{
+    feed_device_key(user_data, section, vendor_id, product_id, keycode, modifiers, pressed);
+}
+
+// Count finished commands for the metrics exporter
+static void on_command_done(int status, uint64_t latency_ns, void* user_data)
+{
+    belvedere_t* ctx = user_data;
+    metrics_command_done(&ctx->metrics, status, latency_ns);
+}
+
+// Bring the LEDs of led_sync devices to the state bindings left
+static void on_leds(uint8_t state, void* user_data)
+{
+    belvedere_t* ctx = user_data;
+    hid_manager_sync_leds(&ctx->hid, state);
+}
+
+// Write the metrics file for node_exporter's textfile collector
+static void on_metrics_timer(uv_timer_t* handle)
+{
+    belvedere_t* ctx = handle->data;
+    uint64_t started = loop_monitor_begin(&ctx->monitor);
+    dispatch_stats_t dispatch;
+    loop_stats_t loop;
+    dispatch_get_stats(&ctx->dispatch, &dispatch);
+    loop_monitor_get_stats(&ctx->monitor, &loop);
+    metrics_export(ctx->config.metrics_path, &ctx->metrics, &dispatch, &loop);
+    loop_monitor_end(&ctx->monitor, LOOP_STAGE_TIMERS, started);
+}
+
+// Start, restart or stop the metrics exporter to match the configuration
+static void configure_metrics(belvedere_t* ctx)
+{
+    uv_timer_stop(&ctx->metrics_timer);
+    if (ctx->config.metrics_path[0] != '\0')
+        uv_timer_start(&ctx->metrics_timer, on_metrics_timer, 0, ctx->config.metrics_interval_ms);
+}
+
+// Publish the state status bars read; runs once per loop iteration and only writes the
+// segment when something changed
+static void on_status_check(uv_check_t* handle)
+{
+    belvedere_t* ctx = handle->data;
+    status_t status;
+    dispatch_stats_t dispatch;
+    memset(&status, 0, sizeof(status));
+    dispatch_get_stats(&ctx->dispatch, &dispatch);
+
+    status.leds = led_state_get(&ctx->dispatch.leds);
+    if (ctx->config.active)  // same size as the layer name, see status_shm.c
+        memcpy(status.layer, ctx->config.active->name, sizeof(status.layer));
+    status.dispatched = dispatch.dispatched;
+    status.unmatched = dispatch.unmatched;
+    status.filtered = dispatch.debounced + dispatch.rate_limited;
+    status.failed = dispatch.failed;
+
+    int count = hid_manager_list_devices(&ctx->hid, status.devices, STATUS_MAX_DEVICES);
+    count += evdev_manager_list_devices(&ctx->evdev, status.devices + count,
+                                        STATUS_MAX_DEVICES - count);
+    status.device_count = (uint32_t)count;
+    status_shm_publish(&ctx->status, &status);
+}
+
+// Create, rename or remove the status segment to match the configuration
+static void configure_status(belvedere_t* ctx)
+{
+    if (ctx->config.status_name[0] != '\0' &&
+        status_shm_create(&ctx->status, ctx->config.status_name))
+    {
+        uv_check_start(&ctx->status_check, on_status_check);
+    }
+    else
+    {
+        uv_check_stop(&ctx->status_check);
+        status_shm_destroy(&ctx->status);
+    }
+}
+
+// Check a loaded configuration has what the daemon needs
+static bool usable(const config_t* config)
+{
+    if (config->monitored_keycodes_count < 1)
+    {
+        debugf(stderr, "monitored_keycodes are not defined in the configuration file.\n");
+        return false;
+    }
+    if (config->device_count < 1)
+    {
+        debugf(stderr, "no devices are defined in the configuration file.\n");
+        return false;
+    }
+    return true;
+}
+
+// Hand the file cache, and the list of files watched for changes, to another configuration
+static void move_files(config_t* to, config_t* from)
+{
+    memcpy(to->files, from->files, from->file_count * sizeof(from->files[0]));
+    to->file_count = from->file_count;
+    memcpy(to->fragment_dir, from->fragment_dir, sizeof(to->fragment_dir));
+    from->file_count = 0;
+}
+
+// Move a configuration into other storage, pointing its active layer at its own copy
+static void move_config(config_t* to, const config_t* from)
+{
+    memcpy(to, from, sizeof(*to));
+    if (from->active)
+        to->active = &to->layers[from->active - from->layers];
+}
+
+/**
+ * Load the configuration into a copy of the running one and check it has what the daemon
+ * needs. The copy keeps the compiled tables, so only what changed is rebuilt, and takes the
+ * file cache; it replaces the running configuration only if it is usable. Otherwise the
+ * running configuration stays in place and only the file cache comes back.
+ */
+static bool load(belvedere_t* ctx)
+{
+    config_t* next = malloc(sizeof(*next));
+    if (!next)
+        return false;
+    move_config(next, &ctx->config);
+    memset(&next->leaders, 0, sizeof(next->leaders));  // rebuilt by every load
+    ctx->config.file_count = 0;
+
+    if (!load_config(ctx->config_path[0] ? ctx->config_path : NULL, next))
+    {
+        debugf(stderr, "Failed to load config.\n");
+    }
+    else if (usable(next))
+    {
+        // Running sequences point into the configuration that is about to be replaced
+        dispatch_reset(&ctx->dispatch);
+        free_config(&ctx->config);
+        move_config(&ctx->config, next);
+        free(next);
+        return true;
+    }
+    move_files(&ctx->config, next);
+    free_config(next);
+    free(next);
+    return false;
+}
+
+static void watch_config_files(belvedere_t* ctx);
+
+static void on_watcher_closed(uv_handle_t* handle)
+{
+    free(handle->data);
+}
+
+// Callback for changes to a configuration file, or to conf.d when fragments come and go
+static void on_config_change(uv_fs_poll_t* handle, int status, const uv_stat_t* prev,
+                             const uv_stat_t* curr)
+{
+    (void)curr;  // Silence unused parameter warning
+    config_watcher_t* watcher = handle->data;
+    belvedere_t* ctx = watcher->ctx;
+    if (status < 0)
+    {
+        // A missing conf.d is fine; a file that existed and is gone takes its sections along
+        bool removed = status == UV_ENOENT && (prev->st_mtim.tv_sec || prev->st_mtim.tv_nsec);
+        if (status != UV_ENOENT)
+            debugf(stderr, "Error watching %s: %s\n", watcher->path, uv_strerror(status));
+        if (!removed)
+            return;
+    }
+
+    // Files that did not change are not read again, and sections that did not change are not
+    // compiled again
+    debug("%s has changed, reloading...\n", watcher->path);
+    belvedere_reload(ctx, false);
+}
+
+// Poll each file the configuration was merged from, and conf.d for fragments added later
+static void watch_config_files(belvedere_t* ctx)
+{
+    if (!ctx->watch_config)
+        return;
+
+    char paths[MAX_WATCHERS][MAX_PATH];
+    size_t count = 0;
+    if (ctx->config.fragment_dir[0] != '\0')
+        strcpy(paths[count++], ctx->config.fragment_dir);
+    for (size_t i = 0; i < ctx->config.file_count; i++)
+    {
+        strcpy(paths[count++], ctx->config.files[i].path);
+    }
+    if (ctx->config.file_count == 0 && ctx->config_path[0])
+        strcpy(paths[count++], ctx->config_path);  // the last load failed; wait for a fix
+
+    // Keep the watchers whose file is still part of the configuration, so they keep their stat
+    for (size_t w = 0; w < ctx->watcher_count;)
+    {
+        bool wanted = false;
+        for (size_t i = 0; i < count && !wanted; i++)
+        {
+            wanted = strcmp(ctx->watchers[w]->path, paths[i]) == 0;
+        }
+        if (wanted)
+        {
+            w++;
+            continue;
+        }
+        uv_fs_poll_stop(&ctx->watchers[w]->poll);
+        uv_close((uv_handle_t*)&ctx->watchers[w]->poll, on_watcher_closed);
+        ctx->watchers[w] = ctx->watchers[--ctx->watcher_count];
+    }
+
+    for (size_t i = 0; i < count && ctx->watcher_count < MAX_WATCHERS; i++)
+    {
+        bool watched = false;
+        for (size_t w = 0; w < ctx->watcher_count && !watched; w++)
+        {
+            watched = strcmp(ctx->watchers[w]->path, paths[i]) == 0;
+        }
+        config_watcher_t* watcher = watched ? NULL : malloc(sizeof(*watcher));
+        if (!watcher)
+            continue;
+        watcher->ctx = ctx;
+        strcpy(watcher->path, paths[i]);
+        uv_fs_poll_init(ctx->loop, &watcher->poll);
+        watcher->poll.data = watcher;
+        ctx->watchers[ctx->watcher_count++] = watcher;
+        uv_fs_poll_start(&watcher->poll, on_config_change, watcher->path, 1000);  // every second
+    }
+}
+
+belvedere_t* belvedere_create(const belvedere_options_t* options)
+{
+    belvedere_t* ctx = calloc(1, sizeof(*ctx));
+    if (!ctx)
+        return NULL;
+    if (options->config_path)
+        snprintf(ctx->config_path, sizeof(ctx->config_path), "%s", options->config_path);
+    ctx->watch_config = options->watch_config;
+    ctx->loop = options->loop ? options->loop : uv_default_loop();
+    if (!load(ctx))
+    {
+        free_config(&ctx->config);
+        free(ctx);
+        return NULL;
+    }
+    debug("Configuration loaded successfully.\n");
+
+    // Measure loop lag and callback stalls; idle time can only be enabled before the loop runs
+    loop_monitor_init(&ctx->monitor, ctx->loop, ctx->config.stall_ms);
+
+    // Start the executor before opening devices so a helper process forks while we are small
+    executor_init(&ctx->executor, ctx->loop, &ctx->monitor);
+    executor_set_done_callback(&ctx->executor, on_command_done, ctx);
+    if (!executor_set_mode(&ctx->executor, ctx->config.executor))
+        debugf(stderr, "Failed to start executor helper, running commands inline.\n");
+
+    // Open FIFO/file/socket targets once; bindings reuse them for every event
+    signal(SIGPIPE, SIG_IGN);  // A FIFO reader going away must not kill the process
+    dispatch_init(&ctx->dispatch, ctx->loop, &ctx->executor, &ctx->monitor);
+    actions_open(&ctx->dispatch.actions, &ctx->config);
+
+    // Key actions go through one virtual keyboard, created once and kept across reloads
+    uinput_open(&ctx->dispatch.uinput, &ctx->config);
+
+    // Control socket for switching layers without touching the configuration file
+    control_init(&ctx->control, &ctx->config, &ctx->dispatch, &ctx->monitor);
+    if (ctx->config.control_path[0] != '\0')
+        control_listen(&ctx->control, ctx->loop, ctx->config.control_path);
+
+    // Watch the configuration file and every conf.d fragment merged into it
+    watch_config_files(ctx);
+
+    // Export counters to a Prometheus textfile, if configured
+    uv_timer_init(ctx->loop, &ctx->metrics_timer);
+    ctx->metrics_timer.data = ctx;
+    configure_metrics(ctx);
+
+    // Publish LED, layer and device state in shared memory for status bars, if configured;
+    // the check handle alone does not keep the loop running
+    uv_check_init(ctx->loop, &ctx->status_check);
+    ctx->status_check.data = ctx;
+    uv_unref((uv_handle_t*)&ctx->status_check);
+    configure_status(ctx);
+    return ctx;
+}
+
+bool belvedere_open_devices(belvedere_t* ctx)
+{
+    if (ctx->devices_open)
+        return true;
+
+    hid_manager_set_config(&ctx->hid, &ctx->config);
+    if (!hid_manager_init(&ctx->hid, ctx->loop, &ctx->monitor, &ctx->metrics))
+    {
+        debugf(stderr, "Failed to initialize HID manager.\n");
+        return false;
+    }
+    ctx->devices_open = true;
+    hid_manager_set_key_callback(&ctx->hid, on_key_event, ctx);
+
+    // Open the configured devices in the background while the loop starts
+    if (!hid_manager_reload(&ctx->hid))
+        debugf(stderr, "Failed to start opening HID devices.\n");
+
+    // Sections with input = evdev read kernel key events, woken by the loop rather than polled
+    evdev_manager_set_config(&ctx->evdev, &ctx->config);
+    evdev_manager_init(&ctx->evdev, ctx->loop, &ctx->monitor, &ctx->metrics);
+    evdev_manager_set_key_callback(&ctx->evdev, on_key_event, ctx);
+    if (!evdev_manager_reload(&ctx->evdev))
+        debugf(stderr, "Failed to open evdev devices.\n");
+
+    // LED changes made by bindings go to every device with led_sync set
+    led_state_set_sink(&ctx->dispatch.leds, on_leds, ctx);
+    return true;
+}
+
+// Reload the configuration and whatever it is applied to; rescan reopens devices even if their
+// sections are unchanged
+static bool reload(belvedere_t* ctx, bool rescan)
+{
+    debug("Reloading configuration...\n");
+    uint64_t started_ns = uv_hrtime();
+    PROBE1(reload_begin, rescan);
+
+    bool loaded = load(ctx);
+    watch_config_files(ctx);
+    if (!loaded)
+    {
+        ctx->metrics.reloads_rejected++;
+        PROBE4(reload_end, false, 0, 0, uv_hrtime() - started_ns);
+        debugf(stderr, "Failed to reload config, keeping the running one.\n");
+        return false;
+    }
+    ctx->metrics.reloads++;
+    debug("Configuration reloaded successfully.\n");
+
+    loop_monitor_set_threshold(&ctx->monitor, ctx->config.stall_ms);
+    configure_metrics(ctx);
+    configure_status(ctx);
+    if (!executor_set_mode(&ctx->executor, ctx->config.executor))
+        debugf(stderr, "Failed to start executor helper, running commands inline.\n");
+
+    actions_open(&ctx->dispatch.actions, &ctx->config);
+    uinput_open(&ctx->dispatch.uinput, &ctx->config);
+
+    // Open devices keep reporting until a device reload replaces them; point them at the
+    // sections they resolve to now, which shift when sections are added or removed
+    if (ctx->devices_open)
+    {
+        hid_manager_set_config(&ctx->hid, &ctx->config);
+        evdev_manager_set_config(&ctx->evdev, &ctx->config);
+    }
+    // Device reloads below trace themselves; this covers the configuration taking effect
+    PROBE4(reload_end, true, __builtin_popcountll(ctx->config.changes.sections),
+           __builtin_popcount(ctx->config.changes.layers), uv_hrtime() - started_ns);
+
+    // Bindings alone were edited, so the open devices already read the right way
+    if (!ctx->devices_open || (!rescan && !ctx->config.changes.devices))
+    {
+        debug("Devices unchanged, rebuilt %d of %zu layers.\n",
+              __builtin_popcount(ctx->config.changes.layers), ctx->config.layer_count);
+        return true;
+    }
+
+    // Reopen HID devices; this returns at once and the new set is attached when it is ready
+    if (!hid_manager_reload(&ctx->hid))
+    {
+        debugf(stderr, "Failed to reload HID devices.\n");
+        return false;
+    }
+    if (!evdev_manager_reload(&ctx->evdev))
+    {
+        debugf(stderr, "Failed to reload evdev devices.\n");
+        return false;
+    }
+
+    debug("Device reload started.\n");
+    return true;
+}
+
+bool belvedere_reload(belvedere_t* ctx, bool rescan)
+{
+    uint64_t started = loop_monitor_begin(&ctx->monitor);
+    bool reloaded = reload(ctx, rescan);
+    loop_monitor_end(&ctx->monitor, LOOP_STAGE_RELOAD, started);
+    return reloaded;
+}
+
+bool belvedere_feed_key(belvedere_t* ctx, uint16_t vendor_id, uint16_t product_id,
+                        uint16_t keycode, uint8_t modifiers, bool pressed)
+{
+    uint8_t section = resolve_device(&ctx->config, vendor_id, product_id);
+    return feed_device_key(ctx, section, vendor_id, product_id, keycode, modifiers, pressed);
+}
+
+bool belvedere_poll(belvedere_t* ctx)
+{
+    return uv_run(ctx->loop, UV_RUN_NOWAIT) != 0;
+}
+
+int belvedere_poll_fd(belvedere_t* ctx)
+{
+    return uv_backend_fd(ctx->loop);
+}
+
+int belvedere_poll_timeout(belvedere_t* ctx)
+{
+    return uv_backend_timeout(ctx->loop);
+}
+
+void belvedere_run(belvedere_t* ctx)
+{
+    uv_run(ctx->loop, UV_RUN_DEFAULT);
+}
+
+void belvedere_stop(belvedere_t* ctx)
+{
+    uv_stop(ctx->loop);
+}
+
+bool belvedere_set_layer(belvedere_t* ctx, const char* name)
+{
+    int layer = find_layer(&ctx->config, name);
+    return layer >= 0 && dispatch_set_layer(&ctx->dispatch, &ctx->config, (size_t)layer);
+}
+
+const char* belvedere_layer(const belvedere_t* ctx)
+{
+    return ctx->config.active ? ctx->config.active->name : "base";
+}
+
+void belvedere_get_stats(const belvedere_t* ctx, belvedere_stats_t* stats)
+{
+    dispatch_stats_t dispatch;
+    status_device_t devices[STATUS_MAX_DEVICES];
+    dispatch_get_stats(&ctx->dispatch, &dispatch);
+    memset(stats, 0, sizeof(*stats));
+    stats->dispatched = dispatch.dispatched;
+    stats->unmatched = dispatch.unmatched;
+    stats->filtered = dispatch.debounced + dispatch.rate_limited;
+    stats->failed = dispatch.failed;
+    stats->reloads = ctx->metrics.reloads;
+    stats->reloads_rejected = ctx->metrics.reloads_rejected;
+    stats->device_reloads = ctx->metrics.device_reloads;
+    if (ctx->devices_open)
+    {
+        int count = hid_manager_list_devices(&ctx->hid, devices, STATUS_MAX_DEVICES);
+        count += evdev_manager_list_devices(&ctx->evdev, devices + count,
+                                            STATUS_MAX_DEVICES - count);
+        stats->devices = (uint32_t)count;
+    }
+}
+
+void belvedere_set_executor(belvedere_t* ctx, belvedere_executor_t executor)
+{
+    dispatch_set_executor(&ctx->dispatch, executor);
+}
+
+void belvedere_set_hid_backend(belvedere_t* ctx, const belvedere_hid_backend_t* backend)
+{
+    hid_manager_set_backend(&ctx->hid, backend);
+}
+
+void belvedere_set_debug(bool enabled)
+{
+    debug_enabled = enabled;
+}
+
+void belvedere_destroy(belvedere_t* ctx)
+{
+    if (!ctx)
+        return;
+
+    for (size_t w = 0; w < ctx->watcher_count; w++)
+    {
+        uv_fs_poll_stop(&ctx->watchers[w]->poll);
+        uv_close((uv_handle_t*)&ctx->watchers[w]->poll, on_watcher_closed);
+    }
+    ctx->watcher_count = 0;
+    uv_timer_stop(&ctx->metrics_timer);
+    uv_close((uv_handle_t*)&ctx->metrics_timer, NULL);
+    uv_check_stop(&ctx->status_check);
+    uv_close((uv_handle_t*)&ctx->status_check, NULL);
+    status_shm_destroy(&ctx->status);
+    control_cleanup(&ctx->control);
+    loop_monitor_cleanup(&ctx->monitor);
+    if (ctx->devices_open)
+    {
+        led_state_set_sink(&ctx->dispatch.leds, NULL, NULL);
+        evdev_manager_cleanup(&ctx->evdev);
+        hid_manager_cleanup(&ctx->hid);
+    }
+    dispatch_cleanup(&ctx->dispatch);
+    executor_cleanup(&ctx->executor);
+
+    // Reloads and reopens still on the threadpool come back to the manager in this instance
+    while (!hid_manager_idle(&ctx->hid))
+        uv_run(ctx->loop, UV_RUN_ONCE);
+
+    // The handles above live in the instance, so their close callbacks must run before it goes
+    uv_run(ctx->loop, UV_RUN_NOWAIT);
+    free_config(&ctx->config);
+    free(ctx);
+}
@@ -0,0 +1,147 @@
+#include "loop_monitor.h"
+
+#include <string.h>
+
+#include "debug.h"
+
+#define NS_PER_MS 1000000ULL
+
+static const char* stage_names[LOOP_STAGE_COUNT] = {
+    [LOOP_STAGE_HID] = "hid",           [LOOP_STAGE_EVDEV] = "evdev",
+    [LOOP_STAGE_DISPATCH] = "dispatch", [LOOP_STAGE_TIMERS] = "timers",
+    [LOOP_STAGE_EXECUTOR] = "executor", [LOOP_STAGE_CONTROL] = "control",
+    [LOOP_STAGE_RELOAD] = "reload",
+};
+
+const char* loop_monitor_stage_name(loop_stage_t stage)
+{
+    return stage < LOOP_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+// Just before the loop blocks: everything since the last check ran timers, close and check
+// callbacks, which together with the preceding I/O phase is one iteration's callback time
+static void on_prepare(uv_prepare_t* handle)
+{
+    loop_monitor_t* monitor = handle->data;
+    uint64_t now = uv_hrtime();
+
+    if (monitor->checked_at)
+    {
+        uint64_t lag = monitor->io_busy + (now - monitor->checked_at);
+        monitor->stats.iterations++;
+        monitor->stats.busy_ns += lag;
+        monitor->stats.lag_last_ns = lag;
+        if (lag > monitor->stats.lag_max_ns)
+            monitor->stats.lag_max_ns = lag;
+        if (monitor->stall_ns && lag > monitor->stall_ns)
+        {
+            monitor->stats.slow_iterations++;
+            if (!monitor->stage_stalled)
+                debugf(stderr, "Loop blocked for %.1fms\n", (double)lag / NS_PER_MS);
+        }
+    }
+
+    monitor->stage_stalled = false;
+    monitor->prepared_at = now;
+    monitor->prepared_idle = monitor->idle_metrics ? uv_metrics_idle_time(monitor->loop) : 0;
+}
+
+// Just after I/O callbacks ran: the poll phase minus the time spent waiting is their cost
+static void on_check(uv_check_t* handle)
+{
+    loop_monitor_t* monitor = handle->data;
+    uint64_t now = uv_hrtime();
+
+    monitor->io_busy = 0;
+    if (monitor->idle_metrics && monitor->prepared_at)
+    {
+        uint64_t waited = uv_metrics_idle_time(monitor->loop) - monitor->prepared_idle;
+        uint64_t phase = now - monitor->prepared_at;
+        monitor->io_busy = phase > waited ? phase - waited : 0;
+    }
+    monitor->checked_at = now;
+}
+
+bool loop_monitor_init(loop_monitor_t* monitor, uv_loop_t* loop, uint32_t stall_ms)
+{
+    if (monitor->loop)
+        return true;
+
+    // Only possible before the loop first runs; without it I/O callback time is not counted
+    monitor->idle_metrics = uv_loop_configure(loop, UV_METRICS_IDLE_TIME) == 0;
+    if (!monitor->idle_metrics)
+        debug("Loop idle time is unavailable; lag covers timers only.\n");
+
+    if (uv_prepare_init(loop, &monitor->prepare) != 0 ||
+        uv_check_init(loop, &monitor->check) != 0)
+        return false;
+    monitor->prepare.data = monitor;
+    monitor->check.data = monitor;
+    uv_prepare_start(&monitor->prepare, on_prepare);
+    uv_check_start(&monitor->check, on_check);
+    uv_unref((uv_handle_t*)&monitor->prepare);
+    uv_unref((uv_handle_t*)&monitor->check);
+
+    monitor->loop = loop;
+    monitor->checked_at = 0;
+    monitor->prepared_at = 0;
+    monitor->depth = 0;
+    loop_monitor_set_threshold(monitor, stall_ms);
+    return true;
+}
+
+void loop_monitor_cleanup(loop_monitor_t* monitor)
+{
+    if (!monitor->loop)
+        return;
+    uv_prepare_stop(&monitor->prepare);
+    uv_check_stop(&monitor->check);
+    uv_close((uv_handle_t*)&monitor->prepare, NULL);
+    uv_close((uv_handle_t*)&monitor->check, NULL);
+    monitor->loop = NULL;
+}
+
+void loop_monitor_set_threshold(loop_monitor_t* monitor, uint32_t stall_ms)
+{
+    monitor->stall_ns = (uint64_t)stall_ms * NS_PER_MS;
+}
+
+uint64_t loop_monitor_begin(loop_monitor_t* monitor)
+{
+    if (!monitor || !monitor->loop)
+        return 0;
+    if (monitor->depth < LOOP_MONITOR_NESTING)
+        monitor->child_ns[monitor->depth] = 0;
+    monitor->depth++;
+    return uv_hrtime();
+}
+
+void loop_monitor_end(loop_monitor_t* monitor, loop_stage_t stage, uint64_t start)
+{
+    if (!start || monitor->depth == 0 || stage >= LOOP_STAGE_COUNT)
+        return;
+
+    uint64_t elapsed = uv_hrtime() - start;
+    monitor->depth--;
+    uint64_t nested =
+        monitor->depth < LOOP_MONITOR_NESTING ? monitor->child_ns[monitor->depth] : 0;
+    uint64_t own = elapsed > nested ? elapsed - nested : 0;
+    if (monitor->depth > 0 && monitor->depth <= LOOP_MONITOR_NESTING)
+        monitor->child_ns[monitor->depth - 1] += elapsed;
+
+    if (own > monitor->stats.stage_max_ns[stage])
+        monitor->stats.stage_max_ns[stage] = own;
+    if (monitor->stall_ns && own > monitor->stall_ns)
+    {
+        monitor->stats.stalls++;
+        monitor->stats.stage_stalls[stage]++;
+        monitor->stage_stalled = true;
+        debugf(stderr, "Loop stalled for %.1fms in %s\n", (double)own / NS_PER_MS,
+               stage_names[stage]);
+    }
+}
+
+void loop_monitor_get_stats(const loop_monitor_t* monitor, loop_stats_t* stats)
+{
+    memcpy(stats, &monitor->stats, sizeof(*stats));
+}
@@ -0,0 +1,164 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "debug.h"
+
+// Upper bounds of the spawn latency buckets
+static const uint64_t spawn_bounds_ns[METRICS_LATENCY_BUCKETS] = {
+    1000000,  2500000,   5000000,   10000000,  25000000,
+    50000000, 100000000, 250000000, 500000000, 1000000000,
+};
+
+uint64_t* metrics_device_counter(metrics_t* metrics, uint16_t vendor_id, uint16_t product_id,
+                                 input_source_t input)
+{
+    for (size_t i = 0; i < metrics->device_count; i++)
+    {
+        metrics_device_t* device = &metrics->devices[i];
+        if (device->vendor_id == vendor_id && device->product_id == product_id &&
+            device->input == input)
+            return &device->reports;
+    }
+    if (metrics->device_count == METRICS_MAX_DEVICES)
+        return &metrics->device_overflow;
+
+    metrics_device_t* device = &metrics->devices[metrics->device_count++];
+    device->vendor_id = vendor_id;
+    device->product_id = product_id;
+    device->input = (uint8_t)input;
+    device->reports = 0;
+    return &device->reports;
+}
+
+void metrics_command_done(metrics_t* metrics, int status, uint64_t latency_ns)
+{
+    size_t bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS && latency_ns > spawn_bounds_ns[bucket])
+        bucket++;
+
+    metrics->commands++;
+    if (status != 0)
+        metrics->commands_failed++;
+    metrics->spawn_buckets[bucket]++;
+    metrics->spawn_sum_ns += latency_ns;
+}
+
+void metrics_reset(metrics_t* metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+static void write_counter(FILE* out, const char* name, const char* help, uint64_t value)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", name, help, name, name,
+            value);
+}
+
+bool metrics_write(FILE* out, const metrics_t* metrics, const dispatch_stats_t* dispatch,
+                   const loop_stats_t* loop)
+{
+    fprintf(out, "# HELP belvedere_reports_read_total Reports (HID) or key events (evdev) read.\n"
+                 "# TYPE belvedere_reports_read_total counter\n");
+    for (size_t i = 0; i < metrics->device_count; i++)
+    {
+        const metrics_device_t* device = &metrics->devices[i];
+        fprintf(out,
+                "belvedere_reports_read_total{device=\"%04x:%04x\",input=\"%s\"} %" PRIu64 "\n",
+                device->vendor_id, device->product_id,
+                device->input == INPUT_EVDEV ? "evdev" : "hid", device->reports);
+    }
+
+    write_counter(out, "belvedere_actions_total", "Key events that ran a binding's action.",
+                  dispatch->dispatched);
+    write_counter(out, "belvedere_actions_failed_total",
+                  "Actions whose write failed or whose command could not start.",
+                  dispatch->failed);
+    write_counter(out, "belvedere_events_unmatched_total", "Key events with no binding.",
+                  dispatch->unmatched);
+    fprintf(out,
+            "# HELP belvedere_events_filtered_total Key events dropped before their action.\n"
+            "# TYPE belvedere_events_filtered_total counter\n"
+            "belvedere_events_filtered_total{reason=\"debounce\"} %" PRIu64 "\n"
+            "belvedere_events_filtered_total{reason=\"max_rate\"} %" PRIu64 "\n",
+            dispatch->debounced, dispatch->rate_limited);
+
+    write_counter(out, "belvedere_commands_total", "Commands that finished.", metrics->commands);
+    write_counter(out, "belvedere_commands_failed_total",
+                  "Commands that exited non-zero or could not run.", metrics->commands_failed);
+
+    // Prometheus buckets are cumulative
+    fprintf(out, "# HELP belvedere_spawn_latency_seconds Command latency from launch to exit.\n"
+                 "# TYPE belvedere_spawn_latency_seconds histogram\n");
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+    {
+        cumulative += metrics->spawn_buckets[i];
+        fprintf(out, "belvedere_spawn_latency_seconds_bucket{le=\"%g\"} %" PRIu64 "\n",
+                (double)spawn_bounds_ns[i] / 1e9, cumulative);
+    }
+    cumulative += metrics->spawn_buckets[METRICS_LATENCY_BUCKETS];
+    fprintf(out,
+            "belvedere_spawn_latency_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n"
+            "belvedere_spawn_latency_seconds_sum %.9f\n"
+            "belvedere_spawn_latency_seconds_count %" PRIu64 "\n",
+            cumulative, (double)metrics->spawn_sum_ns / 1e9, cumulative);
+
+    fprintf(out,
+            "# HELP belvedere_reloads_total Configuration reloads.\n"
+            "# TYPE belvedere_reloads_total counter\n"
+            "belvedere_reloads_total{result=\"ok\"} %" PRIu64 "\n"
+            "belvedere_reloads_total{result=\"rejected\"} %" PRIu64 "\n",
+            metrics->reloads, metrics->reloads_rejected);
+    write_counter(out, "belvedere_device_reloads_total", "Device sets attached by a reload.",
+                  metrics->device_reloads);
+    write_counter(out, "belvedere_device_attaches_total", "Devices taken into use.",
+                  metrics->attaches);
+    write_counter(out, "belvedere_device_detaches_total", "Devices closed.", metrics->detaches);
+
+    fprintf(out,
+            "# HELP belvedere_loop_busy_seconds_total Time the event loop spent in callbacks.\n"
+            "# TYPE belvedere_loop_busy_seconds_total counter\n"
+            "belvedere_loop_busy_seconds_total %.9f\n"
+            "# HELP belvedere_loop_lag_max_seconds Longest callback time of one loop iteration.\n"
+            "# TYPE belvedere_loop_lag_max_seconds gauge\n"
+            "belvedere_loop_lag_max_seconds %.9f\n"
+            "# HELP belvedere_loop_stalls_total Callbacks that ran longer than stall_ms.\n"
+            "# TYPE belvedere_loop_stalls_total counter\n",
+            (double)loop->busy_ns / 1e9, (double)loop->lag_max_ns / 1e9);
+    for (int stage = 0; stage < LOOP_STAGE_COUNT; stage++)
+    {
+        fprintf(out, "belvedere_loop_stalls_total{stage=\"%s\"} %" PRIu64 "\n",
+                loop_monitor_stage_name((loop_stage_t)stage), loop->stage_stalls[stage]);
+    }
+
+    return !ferror(out);
+}
+
+bool metrics_export(const char* path, const metrics_t* metrics, const dispatch_stats_t* dispatch,
+                    const loop_stats_t* loop)
+{
+    // Same directory, so the rename cannot cross filesystems; the textfile collector only
+    // reads *.prom files and skips this one
+    char temp[MAX_PATH + 8];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    FILE* out = fopen(temp, "w");
+    if (!out)
+    {
+        debugf(stderr, "Failed to write metrics to %s: %s\n", temp, strerror(errno));
+        return false;
+    }
+    bool ok = metrics_write(out, metrics, dispatch, loop);
+    ok = fclose(out) == 0 && ok;
+    if (ok && rename(temp, path) == 0)
+        return true;
+
+    debugf(stderr, "Failed to write metrics to %s: %s\n", path, strerror(errno));
+    unlink(temp);
+    return false;
+}
@@ -0,0 +1,103 @@
+#include "sequence.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "debug.h"
+
+void sequence_init(sequence_t* sequences, timer_wheel_t* wheel, sequence_step_cb_t step_cb,
+                   void* user_data)
+{
+    memset(sequences, 0, sizeof(*sequences));
+    sequences->wheel = wheel;
+    sequences->step_cb = step_cb;
+    sequences->user_data = user_data;
+    for (size_t i = 0; i < SEQUENCE_MAX_RUNNING; i++)
+    {
+        sequences->free_stack[i] = (uint16_t)(SEQUENCE_MAX_RUNNING - 1 - i);
+    }
+    sequences->free_count = SEQUENCE_MAX_RUNNING;
+}
+
+static void release(sequence_t* sequences, sequence_run_t* run)
+{
+    run->active = false;
+    sequences->free_stack[sequences->free_count++] = (uint16_t)(run - sequences->runs);
+}
+
+static void on_step_due(wheel_timer_t* timer);
+
+// Run every step that is due now, then schedule the next one or finish
+static void run_steps(sequence_t* sequences, sequence_run_t* run)
+{
+    const sequence_step_t* steps = run->config->steps;
+
+    sequences->step_cb(run->config, &steps[run->next++], sequences->user_data);
+    while (run->next < run->end && steps[run->next].delay_ms == 0)
+    {
+        sequences->step_cb(run->config, &steps[run->next++], sequences->user_data);
+    }
+
+    if (run->next == run->end)
+    {
+        release(sequences, run);
+        return;
+    }
+    timer_wheel_schedule(sequences->wheel, &run->timer, steps[run->next].delay_ms, on_step_due,
+                         sequences);
+}
+
+static void on_step_due(wheel_timer_t* timer)
+{
+    run_steps(timer->data, (sequence_run_t*)timer);
+}
+
+bool sequence_start(sequence_t* sequences, const config_t* config, const key_binding_t* binding)
+{
+    if (!sequences->wheel || binding->action != ACTION_SEQUENCE || binding->step_count == 0 ||
+        (size_t)binding->first_step + binding->step_count > config->step_count)
+    {
+        return false;
+    }
+    if (sequences->free_count == 0)
+    {
+        debug("Too many running sequences, dropping keycode=%d\n", binding->keycode);
+        return false;
+    }
+
+    sequence_run_t* run = &sequences->runs[sequences->free_stack[--sequences->free_count]];
+    run->config = config;
+    run->next = binding->first_step;
+    run->end = (uint8_t)(binding->first_step + binding->step_count);
+    run->active = true;
+
+    uint16_t delay = config->steps[run->next].delay_ms;
+    if (delay == 0)
+    {
+        run_steps(sequences, run);
+    }
+    else
+    {
+        timer_wheel_schedule(sequences->wheel, &run->timer, delay, on_step_due, sequences);
+    }
+    return true;
+}
+
+void sequence_cancel_all(sequence_t* sequences)
+{
+    for (size_t i = 0; i < SEQUENCE_MAX_RUNNING; i++)
+    {
+        sequence_run_t* run = &sequences->runs[i];
+        if (!run->active)
+            continue;
+        timer_wheel_cancel(sequences->wheel, &run->timer);
+        release(sequences, run);
+    }
+}
+
+size_t sequence_running(const sequence_t* sequences)
+{
+    if (!sequences->wheel)
+        return 0;
+    return SEQUENCE_MAX_RUNNING - sequences->free_count;
+}
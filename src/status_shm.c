@@ -0,0 +1,137 @@
+#include "status_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "debug.h"
+
+_Static_assert(STATUS_LAYER_MAX == LAYER_NAME_MAX, "layer names must fit the status segment");
+_Static_assert(INPUT_HID == 0 && INPUT_EVDEV == 1, "status_device_t.input values");
+_Static_assert(STATUS_NAME_MAX >= MAX_PATH, "segment names must fit the status writer");
+
+bool status_shm_create(status_writer_t* writer, const char* name)
+{
+    if (writer->shm && strcmp(writer->name, name) == 0)
+        return true;
+    status_shm_destroy(writer);
+
+    // A segment left by a daemon that did not exit cleanly may have another layout
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        debugf(stderr, "Failed to create status segment %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    void* mem = MAP_FAILED;
+    if (ftruncate(fd, sizeof(status_shm_t)) == 0)
+        mem = mmap(NULL, sizeof(status_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED)
+    {
+        debugf(stderr, "Failed to map status segment %s: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    close(fd);
+
+    // The segment starts zeroed, so sequence is even and readers see an empty status until
+    // the first update; magic goes last so readers never accept a half-initialized header
+    writer->shm = mem;
+    writer->shm->version = STATUS_SHM_VERSION;
+    writer->shm->size = sizeof(status_t);
+    atomic_thread_fence(memory_order_release);
+    writer->shm->magic = STATUS_SHM_MAGIC;
+    strncpy(writer->name, name, sizeof(writer->name) - 1);
+    writer->name[sizeof(writer->name) - 1] = '\0';
+    memset(&writer->last, 0, sizeof(writer->last));
+    debug("Publishing status in shared memory %s\n", name);
+    return true;
+}
+
+bool status_shm_publish(status_writer_t* writer, status_t* status)
+{
+    if (!writer->shm)
+        return false;
+
+    // Compare without the timestamp, which differs every time
+    status->updated_ns = writer->last.updated_ns;
+    if (memcmp(status, &writer->last, sizeof(*status)) == 0)
+        return false;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    status->updated_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+
+    // The release fence keeps the copy from starting before readers can see the odd sequence;
+    // the release store keeps it from finishing after they see the even one
+    uint32_t sequence = atomic_load_explicit(&writer->shm->sequence, memory_order_relaxed);
+    atomic_store_explicit(&writer->shm->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&writer->shm->status, status, sizeof(*status));
+    atomic_store_explicit(&writer->shm->sequence, sequence + 2, memory_order_release);
+
+    writer->last = *status;
+    return true;
+}
+
+void status_shm_destroy(status_writer_t* writer)
+{
+    if (!writer->shm)
+        return;
+    munmap(writer->shm, sizeof(status_shm_t));
+    shm_unlink(writer->name);
+    writer->shm = NULL;
+    writer->name[0] = '\0';
+}
+
+const status_shm_t* status_shm_attach(const char* name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void* mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(status_shm_t))
+        mem = mmap(NULL, sizeof(status_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    const status_shm_t* shm = mem;
+    if (shm->magic != STATUS_SHM_MAGIC || shm->version != STATUS_SHM_VERSION ||
+        shm->size != sizeof(status_t))
+    {
+        munmap(mem, sizeof(status_shm_t));
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return shm;
+}
+
+bool status_shm_read(const status_shm_t* shm, status_t* status)
+{
+    for (int i = 0; i < STATUS_READ_TRIES; i++)
+    {
+        uint32_t before = atomic_load_explicit(&shm->sequence, memory_order_acquire);
+        if (before & 1)
+            continue;  // the writer is mid-update
+        memcpy(status, &shm->status, sizeof(*status));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shm->sequence, memory_order_relaxed) == before)
+            return true;
+    }
+    return false;
+}
+
+void status_shm_detach(const status_shm_t* shm)
+{
+    munmap((void*)shm, sizeof(status_shm_t));
+}
@@ -0,0 +1,271 @@
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "loop_monitor.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+static void list_init(wheel_timer_t* head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_append(wheel_timer_t* head, wheel_timer_t* timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void list_remove(wheel_timer_t* timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+// Place a timer in the lowest level whose range covers its remaining delay; returns the tick
+// at which it next needs attention: when it fires, or when its slot cascades
+static uint64_t place(timer_wheel_t* wheel, wheel_timer_t* timer)
+{
+    uint64_t delta = timer->expires > wheel->now ? timer->expires - wheel->now : 0;
+    int level = 0;
+
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    // Clamp delays beyond the top level's range; they are re-placed as they cascade
+    uint64_t max_delta = (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    uint64_t expires = delta > max_delta ? wheel->now + max_delta : timer->expires;
+    size_t slot = (expires >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+
+    list_append(&wheel->slots[level][slot], timer);
+    return (expires >> (TIMER_WHEEL_BITS * level)) << (TIMER_WHEEL_BITS * level);
+}
+
+// Earliest tick at which a slot fires or cascades; each level is only scanned up to the
+// best candidate found in the levels below it
+static uint64_t next_due(const timer_wheel_t* wheel)
+{
+    uint64_t due = UINT64_MAX;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        int shift = TIMER_WHEEL_BITS * level;
+        uint64_t base = (wheel->now >> shift) << shift;
+
+        for (uint64_t step = 1; step <= TIMER_WHEEL_SLOTS; step++)
+        {
+            uint64_t tick = base + (step << shift);
+            if (tick >= due)
+                break;
+
+            const wheel_timer_t* head = &wheel->slots[level][(tick >> shift) & SLOT_MASK];
+            if (head->next != head)
+            {
+                due = tick;
+                break;
+            }
+        }
+    }
+    return due;
+}
+
+static void on_tick(uv_timer_t* handle);
+
+// Arm the loop timer one-shot for the wheel's next due tick
+static void arm(timer_wheel_t* wheel)
+{
+    uint64_t now = uv_now(wheel->tick->loop);
+    uv_timer_start(wheel->tick, on_tick, wheel->due > now ? wheel->due - now : 0, 0);
+}
+
+static void on_tick(uv_timer_t* handle)
+{
+    timer_wheel_t* wheel = handle->data;
+    uint64_t started = loop_monitor_begin(wheel->monitor);
+    timer_wheel_advance(wheel, uv_now(handle->loop));
+    if (wheel->count > 0 && wheel->tick)
+        arm(wheel);
+    loop_monitor_end(wheel->monitor, LOOP_STAGE_TIMERS, started);
+}
+
+// Move the wheel's clock forward without firing anything. Nothing is due before wheel->due,
+// so the ticks in between need no per-tick work.
+static void skip_to(timer_wheel_t* wheel, uint64_t now_ms)
+{
+    uint64_t quiet = wheel->due - 1;
+    uint64_t target = now_ms < quiet ? now_ms : quiet;
+    if (target > wheel->now)
+        wheel->now = target;
+}
+
+bool timer_wheel_init(timer_wheel_t* wheel, uv_loop_t* loop, loop_monitor_t* monitor)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->monitor = monitor;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+
+    if (loop)
+    {
+        wheel->tick = malloc(sizeof(uv_timer_t));
+        if (!wheel->tick)
+        {
+            debug("Failed to allocate timer wheel tick");
+            return false;
+        }
+        uv_timer_init(loop, wheel->tick);
+        wheel->tick->data = wheel;
+        wheel->now = uv_now(loop);
+    }
+    return true;
+}
+
+static void on_tick_closed(uv_handle_t* handle)
+{
+    free(handle);
+}
+
+void timer_wheel_close(timer_wheel_t* wheel)
+{
+    if (wheel->tick)
+    {
+        uv_timer_stop(wheel->tick);
+        uv_close((uv_handle_t*)wheel->tick, on_tick_closed);
+        wheel->tick = NULL;
+    }
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            wheel_timer_t* head = &wheel->slots[level][slot];
+            while (head->next != head)
+            {
+                list_remove(head->next);
+            }
+        }
+    }
+    wheel->count = 0;
+}
+
+void timer_wheel_schedule(timer_wheel_t* wheel, wheel_timer_t* timer, uint64_t delay_ms,
+                          wheel_timer_cb_t callback, void* data)
+{
+    if (wheel->tick && wheel->count == 0)
+    {
+        // Idle wheels do not tick; catch up with the clock before measuring the delay. The
+        // loop's cached time may be stale if the caller blocked since the loop last woke.
+        uv_update_time(wheel->tick->loop);
+        wheel->now = uv_now(wheel->tick->loop);
+    }
+    else if (wheel->tick)
+    {
+        // The wheel only wakes when something is due; measure from the loop's time instead
+        skip_to(wheel, uv_now(wheel->tick->loop));
+    }
+
+    // The current tick's slot has already fired; the earliest a timer can run is the next tick
+    timer->expires = wheel->now + (delay_ms ? delay_ms : 1);
+    timer->callback = callback;
+    timer->data = data;
+    uint64_t due = place(wheel, timer);
+
+    if (wheel->count++ == 0 || due < wheel->due)
+    {
+        wheel->due = due;
+        if (wheel->tick)
+            arm(wheel);
+    }
+}
+
+void timer_wheel_cancel(timer_wheel_t* wheel, wheel_timer_t* timer)
+{
+    if (!timer_wheel_pending(timer))
+        return;
+
+    list_remove(timer);
+    if (--wheel->count == 0 && wheel->tick)
+    {
+        uv_timer_stop(wheel->tick);
+    }
+}
+
+// Move every timer from a higher-level slot down to where it now belongs
+static void cascade(timer_wheel_t* wheel, int level, size_t slot)
+{
+    wheel_timer_t pending;
+    wheel_timer_t* head = &wheel->slots[level][slot];
+
+    if (head->next == head)
+        return;
+
+    // Detach the whole list first; place() may append to this same slot for clamped timers
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    list_init(head);
+
+    while (pending.next != &pending)
+    {
+        wheel_timer_t* timer = pending.next;
+        list_remove(timer);
+        place(wheel, timer);
+    }
+}
+
+void timer_wheel_advance(timer_wheel_t* wheel, uint64_t now_ms)
+{
+    while (wheel->now < now_ms && wheel->count > 0)
+    {
+        skip_to(wheel, now_ms);
+        if (wheel->now == now_ms)
+            break;
+        wheel->now++;
+
+        // When a level wraps, the next level's current slot comes due
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            if (wheel->now & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1))
+                break;
+            cascade(wheel, level, (wheel->now >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK);
+        }
+
+        wheel_timer_t* head = &wheel->slots[0][wheel->now & SLOT_MASK];
+        while (head->next != head)
+        {
+            wheel_timer_t* timer = head->next;
+            list_remove(timer);
+            wheel->count--;
+            // Callbacks may schedule or cancel other timers, including this one
+            timer->callback(timer);
+        }
+
+        if (wheel->now >= wheel->due)
+            wheel->due = next_due(wheel);
+    }
+
+    if (wheel->count == 0)
+    {
+        wheel->now = now_ms > wheel->now ? now_ms : wheel->now;
+        if (wheel->tick)
+            uv_timer_stop(wheel->tick);
+    }
+}
@@ -0,0 +1,167 @@
+#include "uinput.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "debug.h"
+#include "keycodes.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define UINPUT_PATH "/dev/uinput"
+#define UINPUT_NAME "belvedere virtual keyboard"
+#define UINPUT_VENDOR 0x1209  // pid.codes vendor, test range
+#define UINPUT_PRODUCT 0x0001
+
+// A press and a release per key plus two SYN_REPORTs per stroke
+#define UINPUT_MAX_EVENTS (MAX_PAYLOAD / 2 * 3)
+#endif
+
+#ifdef __linux__
+
+static int create_device(void)
+{
+    int fd = open(UINPUT_PATH, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    // Advertise every key so any configured code can be emitted
+    bool ok = ioctl(fd, UI_SET_EVBIT, EV_KEY) == 0 && ioctl(fd, UI_SET_EVBIT, EV_SYN) == 0;
+    for (int code = 1; ok && code <= KEY_CODE_MAX; code++)
+    {
+        ok = ioctl(fd, UI_SET_KEYBIT, code) == 0;
+    }
+
+    struct uinput_setup setup = {
+        .id = {.bustype = BUS_VIRTUAL, .vendor = UINPUT_VENDOR, .product = UINPUT_PRODUCT},
+    };
+    strncpy(setup.name, UINPUT_NAME, sizeof(setup.name) - 1);
+    if (!ok || ioctl(fd, UI_DEV_SETUP, &setup) != 0 || ioctl(fd, UI_DEV_CREATE) != 0)
+    {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+bool uinput_open(uinput_t* uinput, const config_t* config)
+{
+    if (!config->key_actions || uinput->fd >= 0)
+        return true;
+
+    uinput->fd = create_device();
+    if (uinput->fd < 0)
+    {
+        debugf(stderr, "Failed to create virtual keyboard on %s: %s\n", UINPUT_PATH,
+               strerror(errno));
+        return false;
+    }
+    debug("Created virtual keyboard for key actions\n");
+    return true;
+}
+
+void uinput_cleanup(uinput_t* uinput)
+{
+    if (uinput->fd >= 0)
+    {
+        ioctl(uinput->fd, UI_DEV_DESTROY);
+        close(uinput->fd);
+        uinput->fd = -1;
+    }
+}
+
+static size_t add_event(struct input_event* events, size_t n, uint16_t type, uint16_t code,
+                        int32_t value)
+{
+    events[n] = (struct input_event){.type = type, .code = code, .value = value};
+    return n + 1;
+}
+
+int uinput_emit(uinput_t* uinput, const void* keys, size_t length)
+{
+    uint16_t codes[MAX_PAYLOAD / 2];
+    size_t count = length / sizeof(uint16_t);
+    if (count == 0 || count > sizeof(codes) / sizeof(codes[0]))
+        return -1;
+    memcpy(codes, keys, count * sizeof(uint16_t));
+
+    // The kernel timestamps events written to uinput, so they are left zero
+    struct input_event events[UINPUT_MAX_EVENTS];
+    size_t n = 0;
+    size_t stroke = 0;
+    for (size_t i = 0; i <= count; i++)
+    {
+        if (i < count && codes[i] != 0)
+            continue;
+        if (i > stroke)
+        {
+            for (size_t k = stroke; k < i; k++)
+                n = add_event(events, n, EV_KEY, codes[k], 1);
+            n = add_event(events, n, EV_SYN, SYN_REPORT, 0);
+            for (size_t k = i; k-- > stroke;)
+                n = add_event(events, n, EV_KEY, codes[k], 0);
+            n = add_event(events, n, EV_SYN, SYN_REPORT, 0);
+        }
+        stroke = i + 1;
+    }
+
+    size_t size = n * sizeof(events[0]);
+    ssize_t written;
+    if (uinput->sink)
+        written = uinput->sink(events, size);
+    else if (uinput->fd >= 0)
+        written = write(uinput->fd, events, size);
+    else
+        return -1;
+
+    if (written != (ssize_t)size)
+    {
+        debug("Failed to emit key events: %s\n", written < 0 ? strerror(errno) : "short write");
+        return -1;
+    }
+    return 0;
+}
+
+#else  // !__linux__
+
+bool uinput_open(uinput_t* uinput, const config_t* config)
+{
+    (void)uinput;  // Silence unused parameter warning
+    if (!config->key_actions)
+        return true;
+    debugf(stderr, "Key actions need Linux uinput and are disabled on this system\n");
+    return false;
+}
+
+void uinput_cleanup(uinput_t* uinput)
+{
+    (void)uinput;  // Silence unused parameter warning
+}
+
+int uinput_emit(uinput_t* uinput, const void* keys, size_t length)
+{
+    (void)uinput;  // Silence unused parameter warning
+    (void)keys;    // Silence unused parameter warning
+    (void)length;  // Silence unused parameter warning
+    return -1;
+}
+
+#endif  // __linux__
+
+void uinput_init(uinput_t* uinput)
+{
+    uinput->fd = -1;
+    uinput->sink = NULL;
+}
+
+void uinput_set_sink(uinput_t* uinput, uinput_sink_t sink)
+{
+    uinput->sink = sink;
+}
@@ -13,6 +13,9 @@
 // Global configuration
 config_t config = {0};
 
+// Receives rendered commands
+static char command[COMMAND_MAX];
+
 // Test cases
 void test_load_config_basic(void)
 {
@@ -121,6 +124,7 @@ void test_load_config_basic(void)
     // Test loading from XDG path with general section
     CU_ASSERT(load_config(NULL, &test_config) == true);
     CU_ASSERT_STRING_EQUAL(test_config.setleds_path, "/test/path/setleds");
+    free_config(&test_config);
 
     // Clean up test files
     unlink(test_config_file);
@@ -195,10 +199,16 @@ void test_load_config_sections(void)
     fprintf(f, "[general]\n");
     fprintf(f, "setleds = /custom/path/setleds\n");
     fprintf(f, "monitored_keycodes = 0x1234,5678,0xABCD\n");
+    fprintf(f, "executor = helper\n");
+    fprintf(f, "hid_reader = uring\n");
+    fprintf(f, "stall_ms = 250\n");
+    fprintf(f, "status = /belvedere\n");
     fprintf(f, "\n");
     fprintf(f, "[0x5043/0x54a3]\n");
     fprintf(f, "target = *\n");
     fprintf(f, "0x6F = +caps\n");
+    fprintf(f, "0x6F.debounce_ms = 30\n");
+    fprintf(f, "112.max_rate = 5\n");  // No such binding in this section
     fprintf(f, "\n");
     fprintf(f, "[0x0483/0x5740]\n");
     fprintf(f, "target = device2\n");
@@ -213,6 +223,10 @@ void test_load_config_sections(void)
     CU_ASSERT_EQUAL(test_config.monitored_keycodes[0], 0x1234);
     CU_ASSERT_EQUAL(test_config.monitored_keycodes[1], 5678);
     CU_ASSERT_EQUAL(test_config.monitored_keycodes[2], 0xABCD);
+    CU_ASSERT_EQUAL(test_config.executor, EXECUTOR_HELPER);
+    CU_ASSERT_EQUAL(test_config.hid_reader, HID_READER_URING);
+    CU_ASSERT_EQUAL(test_config.stall_ms, 250);
+    CU_ASSERT_STRING_EQUAL(test_config.status_name, "/belvedere");
 
     // Verify device sections
     CU_ASSERT_EQUAL(test_config.device_count, 2);
@@ -225,6 +239,8 @@ void test_load_config_sections(void)
     CU_ASSERT_EQUAL(test_config.devices[0].bindings[0].keycode, 0x6F);
     CU_ASSERT_EQUAL(test_config.devices[0].bindings[0].mode, '+');
     CU_ASSERT_STRING_EQUAL(test_config.devices[0].bindings[0].led, "caps");
+    CU_ASSERT_EQUAL(test_config.devices[0].bindings[0].debounce_ms, 30);
+    CU_ASSERT_EQUAL(test_config.devices[0].bindings[0].max_rate, 0);
 
     // Second device
     CU_ASSERT_EQUAL(test_config.devices[1].vendor, 0x0483);
@@ -235,6 +251,14 @@ void test_load_config_sections(void)
     CU_ASSERT_EQUAL(test_config.devices[1].bindings[0].mode, '-');
     CU_ASSERT_STRING_EQUAL(test_config.devices[1].bindings[0].led, "num");
 
+    // The compiled lookup agrees with the linear lookup
+    uint16_t slot;
+    CU_ASSERT_PTR_EQUAL(lookup_binding(&test_config, 0x0483, 0x5740, 111, &slot),
+                        get_binding_for_key(&test_config, 0x0483, 0x5740, 111));
+    CU_ASSERT_PTR_NULL(lookup_binding(&test_config, 0x5043, 0x54a3, 112, NULL));
+
+    free_config(&test_config);
+
     // Clean up
     unlink(test_config_file);
     rmdir(test_dir);
@@ -264,8 +288,8 @@ void test_load_config_limits(void)
         return;
     }
 
-    // Add more devices than MAX_DEVICES
-    for (int i = 0; i < MAX_CONFIG_DEVICES + 2; i++)
+    // Add more sections than MAX_SECTIONS
+    for (int i = 0; i < MAX_SECTIONS + 2; i++)
     {
         fprintf(f, "[0x%04x/0x%04x]\n", i, i);
         fprintf(f, "target = device%d\n", i);
@@ -282,17 +306,664 @@ void test_load_config_limits(void)
     CU_ASSERT(load_config(test_config_file, &test_config) == true);
 
     // Verify limits are respected
-    CU_ASSERT_EQUAL(test_config.device_count, MAX_CONFIG_DEVICES);
+    CU_ASSERT_EQUAL(test_config.device_count, MAX_SECTIONS);
     for (size_t i = 0; i < test_config.device_count; i++)
     {
         CU_ASSERT_EQUAL(test_config.devices[i].binding_count, MAX_BINDINGS);
     }
 
+    // An edit to the last section is reported as that section alone
+    f = fopen(test_config_file, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    for (int i = 0; i < MAX_SECTIONS; i++)
+    {
+        fprintf(f, "[0x%04x/0x%04x]\n", i, i);
+        fprintf(f, "target = device%d\n", i);
+        for (int j = 0; j < MAX_BINDINGS + (i == MAX_SECTIONS - 1 ? 0 : 2); j++)
+        {
+            fprintf(f, "%d = +caps\n", j);
+        }
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_FALSE(test_config.changes.layout);
+    CU_ASSERT_EQUAL(test_config.changes.sections, 1ULL << (MAX_SECTIONS - 1));
+
+    free_config(&test_config);
+
+    // One keyboard with a section in every layer reaches MAX_LAYERS
+    f = fopen(test_config_file, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fprintf(f, "[0x5043/0x54a3]\n1 = +caps\n");
+    for (int i = 1; i < MAX_LAYERS; i++)
+    {
+        fprintf(f, "[0x5043/0x54a3:layer%d]\n1 = -caps\n", i);
+    }
+    fclose(f);
+    memset(&test_config, 0, sizeof(test_config));
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_EQUAL(test_config.layer_count, MAX_LAYERS);
+    CU_ASSERT_EQUAL(test_config.device_count, MAX_LAYERS);
+    free_config(&test_config);
+
     // Clean up
     unlink(test_config_file);
     rmdir(test_dir);
 }
 
+void test_load_config_write_actions(void)
+{
+    config_t test_config = {0};
+
+    char temp_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char* test_dir = mkdtemp(temp_dir);
+    if (!test_dir)
+    {
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    char test_config_file[PATH_MAX];
+    snprintf(test_config_file, sizeof(test_config_file), "%s/test_write_actions.ini", test_dir);
+    FILE* f = fopen(test_config_file, "w");
+    if (!f)
+    {
+        rmdir(test_dir);
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "111 = fifo:/run/led.fifo caps on\\n\n");
+    fprintf(f, "112 = append:/tmp/keys.log pressed\n");
+    fprintf(f, "113 = socket:/run/led.sock toggle\n");
+    fprintf(f, "114 = fifo:/run/led.fifo caps off\\n\n");
+    fprintf(f, "115 = +num\n");
+    fclose(f);
+
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_EQUAL(test_config.devices[0].binding_count, 5);
+
+    // Bindings sharing a path share one target
+    CU_ASSERT_EQUAL(test_config.target_count, 3);
+    CU_ASSERT_EQUAL(test_config.targets[0].type, ACTION_FIFO);
+    CU_ASSERT_STRING_EQUAL(test_config.targets[0].path, "/run/led.fifo");
+    CU_ASSERT_EQUAL(test_config.targets[1].type, ACTION_APPEND);
+    CU_ASSERT_EQUAL(test_config.targets[2].type, ACTION_DATAGRAM);
+
+    const key_binding_t* b = &test_config.devices[0].bindings[0];
+    CU_ASSERT_EQUAL(b->action, ACTION_FIFO);
+    CU_ASSERT_EQUAL(b->target, 0);
+    CU_ASSERT_EQUAL(b->payload_len, 8);
+    CU_ASSERT(memcmp(b->payload, "caps on\n", 8) == 0);
+    CU_ASSERT_EQUAL(test_config.devices[0].bindings[3].target, 0);
+
+    // Write actions do not produce a command; setleds bindings still do
+    CU_ASSERT_PTR_NULL(
+        get_command_for_key(&test_config, 0x5043, 0x54a3, 112, command, sizeof(command)));
+    CU_ASSERT_EQUAL(test_config.devices[0].bindings[4].action, ACTION_SETLEDS);
+    CU_ASSERT_PTR_NOT_NULL(
+        get_command_for_key(&test_config, 0x5043, 0x54a3, 115, command, sizeof(command)));
+
+    free_config(&test_config);
+    unlink(test_config_file);
+    rmdir(test_dir);
+}
+
+void test_load_config_sequences(void)
+{
+    config_t test_config = {0};
+
+    char temp_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char* test_dir = mkdtemp(temp_dir);
+    if (!test_dir)
+    {
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    char test_config_file[PATH_MAX];
+    snprintf(test_config_file, sizeof(test_config_file), "%s/test_sequences.ini", test_dir);
+    FILE* f = fopen(test_config_file, "w");
+    if (!f)
+    {
+        rmdir(test_dir);
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "111 = seq: +scroll, 100ms, -scroll, 50, 50ms, ^caps\n");
+    fprintf(f, "112 = seq: +scroll, 100ms, bogus\n");
+    fprintf(f, "113 = seq: ^num\n");
+    fclose(f);
+
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+
+    // The invalid sequence is dropped without consuming steps
+    CU_ASSERT_EQUAL(test_config.devices[0].binding_count, 2);
+    CU_ASSERT_EQUAL(test_config.step_count, 4);
+
+    const key_binding_t* b = &test_config.devices[0].bindings[0];
+    CU_ASSERT_EQUAL(b->action, ACTION_SEQUENCE);
+    CU_ASSERT_EQUAL(b->first_step, 0);
+    CU_ASSERT_EQUAL(b->step_count, 3);
+    CU_ASSERT_EQUAL(test_config.steps[0].delay_ms, 0);
+    CU_ASSERT_EQUAL(test_config.steps[0].mode, '+');
+    CU_ASSERT_STRING_EQUAL(test_config.steps[0].led, "scroll");
+    CU_ASSERT_EQUAL(test_config.steps[1].delay_ms, 100);
+    CU_ASSERT_EQUAL(test_config.steps[1].mode, '-');
+    CU_ASSERT_EQUAL(test_config.steps[2].delay_ms, 100);  // consecutive delays add up
+    CU_ASSERT_STRING_EQUAL(test_config.steps[2].led, "caps");
+
+    b = &test_config.devices[0].bindings[1];
+    CU_ASSERT_EQUAL(b->keycode, 113);
+    CU_ASSERT_EQUAL(b->first_step, 3);
+    CU_ASSERT_EQUAL(b->step_count, 1);
+    CU_ASSERT_PTR_NULL(
+        get_command_for_key(&test_config, 0x5043, 0x54a3, 113, command, sizeof(command)));
+
+    free_config(&test_config);
+    unlink(test_config_file);
+    rmdir(test_dir);
+}
+
+void test_load_config_gestures(void)
+{
+    config_t test_config = {0};
+
+    char temp_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char* test_dir = mkdtemp(temp_dir);
+    if (!test_dir)
+    {
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    char test_config_file[PATH_MAX];
+    snprintf(test_config_file, sizeof(test_config_file), "%s/test_gestures.ini", test_dir);
+    FILE* f = fopen(test_config_file, "w");
+    if (!f)
+    {
+        rmdir(test_dir);
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "111 = +scroll\n");
+    fprintf(f, "111.hold = ^caps\n");
+    fprintf(f, "111.hold_ms = 400\n");
+    fprintf(f, "112 = -scroll\n");
+    fprintf(f, "112.double_tap = append:/tmp/taps.log double\n");
+    fprintf(f, "113.hold = ^num\n");  // no press binding for 113
+    fclose(f);
+
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_EQUAL(test_config.devices[0].binding_count, 4);
+
+    const keymap_entry_t* e = lookup_keymap_entry(&test_config, 0x5043, 0x54a3, 111, 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(e);
+    CU_ASSERT_EQUAL(e->binding, 0);
+    CU_ASSERT_EQUAL(e->hold, 1);
+    CU_ASSERT_EQUAL(e->hold_ms, 400);
+    CU_ASSERT_EQUAL(e->double_tap, KEYMAP_EMPTY);
+    CU_ASSERT_EQUAL(test_config.devices[0].bindings[1].trigger, TRIGGER_HOLD);
+    CU_ASSERT_STRING_EQUAL(test_config.devices[0].bindings[1].led, "caps");
+
+    e = lookup_keymap_entry(&test_config, 0x5043, 0x54a3, 112, 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(e);
+    CU_ASSERT_EQUAL(e->hold, KEYMAP_EMPTY);
+    CU_ASSERT_EQUAL(e->double_tap, 3);
+    CU_ASSERT_EQUAL(e->double_tap_ms, DEFAULT_DOUBLE_TAP_MS);
+    CU_ASSERT_EQUAL(test_config.devices[0].bindings[3].action, ACTION_APPEND);
+
+    // The press binding is still what plain lookups return
+    CU_ASSERT_STRING_EQUAL(
+        get_command_for_key(&test_config, 0x5043, 0x54a3, 111, command, sizeof(command)),
+        "/usr/local/bin/setleds +scroll");
+    CU_ASSERT_PTR_NULL(lookup_keymap_entry(&test_config, 0x5043, 0x54a3, 113, 0));
+
+    free_config(&test_config);
+    unlink(test_config_file);
+    rmdir(test_dir);
+}
+
+void test_load_config_modifiers_and_chords(void)
+{
+    config_t test_config = {0};
+
+    char temp_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char* test_dir = mkdtemp(temp_dir);
+    if (!test_dir)
+    {
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    char test_config_file[PATH_MAX];
+    snprintf(test_config_file, sizeof(test_config_file), "%s/test_chords.ini", test_dir);
+    FILE* f = fopen(test_config_file, "w");
+    if (!f)
+    {
+        rmdir(test_dir);
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "report = boot\n");
+    fprintf(f, "0x6F = +scroll\n");
+    fprintf(f, "ctrl+shift+0x6F = -scroll\n");
+    fprintf(f, "ctrl+0x6F.debounce_ms = 20\n");  // no ctrl-only binding
+    fprintf(f, "ctrl+shift+0x6F.debounce_ms = 30\n");
+    fprintf(f, "112&113&114 = ^caps\n");
+    fprintf(f, "hyper+115 = ^num\n");  // unknown modifier
+    fclose(f);
+
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_EQUAL(test_config.devices[0].report_format, REPORT_BOOT);
+    CU_ASSERT_EQUAL(test_config.devices[0].binding_count, 3);
+
+    const key_binding_t* b = &test_config.devices[0].bindings[1];
+    CU_ASSERT_EQUAL(b->modifiers, MOD_CTRL | MOD_SHIFT);
+    CU_ASSERT_EQUAL(b->debounce_ms, 30);
+    CU_ASSERT_EQUAL(test_config.devices[0].bindings[0].debounce_ms, 0);
+
+    const keymap_entry_t* e =
+        lookup_keymap_entry(&test_config, 0x5043, 0x54a3, 0x6F, MOD_CTRL | MOD_SHIFT);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(e);
+    CU_ASSERT_EQUAL(e->binding, 1);
+    CU_ASSERT_PTR_NULL(lookup_keymap_entry(&test_config, 0x5043, 0x54a3, 0x6F, MOD_CTRL));
+    CU_ASSERT_STRING_EQUAL(
+        get_command_for_key(&test_config, 0x5043, 0x54a3, 0x6F, command, sizeof(command)),
+        "/usr/local/bin/setleds +scroll");
+
+    // Three-key chord: any press order walks the automaton to the binding
+    b = &test_config.devices[0].bindings[2];
+    CU_ASSERT_EQUAL(b->trigger, TRIGGER_CHORD);
+    CU_ASSERT_EQUAL(b->chord_len, 2);
+    CU_ASSERT_EQUAL(test_config.layers[0].chord_count, 1);
+
+    const chord_entry_t* t = lookup_chord(&test_config, 0x5043, 0x54a3, 0, 114);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(t);
+    CU_ASSERT_EQUAL(t->binding, KEYMAP_EMPTY);
+    t = lookup_chord(&test_config, 0x5043, 0x54a3, t->next, 112);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(t);
+    t = lookup_chord(&test_config, 0x5043, 0x54a3, t->next, 113);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(t);
+    CU_ASSERT_EQUAL(t->binding, 2);
+    CU_ASSERT_PTR_NULL(lookup_chord(&test_config, 0x5043, 0x54a3, 0, 115));
+
+    free_config(&test_config);
+    unlink(test_config_file);
+    rmdir(test_dir);
+}
+
+void test_load_config_leader_sequences(void)
+{
+    config_t test_config = {0};
+
+    char temp_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char* test_dir = mkdtemp(temp_dir);
+    if (!test_dir)
+    {
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    char test_config_file[PATH_MAX];
+    snprintf(test_config_file, sizeof(test_config_file), "%s/test_leader.ini", test_dir);
+    FILE* f = fopen(test_config_file, "w");
+    if (!f)
+    {
+        rmdir(test_dir);
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "leader_timeout_ms = 500\n");
+    fprintf(f, "0x29, 0x04 = +scroll\n");
+    fprintf(f, "0x29,0x04,0x05 = -scroll\n");
+    fprintf(f, "0x29,0x04 = ^caps\n");  // duplicate: first wins
+    fprintf(f, "0x29 = ^num\n");
+    fprintf(f, "0x29,bogus = ^num\n");
+    fprintf(f, "[0x1234/0x5678]\n");
+    fprintf(f, "0x29,0x04 = ^num\n");
+    // Thousands of sequences share one trie
+    for (int i = 0; i < 4096; i++)
+    {
+        fprintf(f, "0x%x,0x%x,0x%x = ^caps\n", 0x100 + i / 256, 0x200 + (i / 16) % 16,
+                0x300 + i % 16);
+    }
+    fclose(f);
+
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_EQUAL(test_config.device_count, 2);
+    CU_ASSERT_EQUAL(test_config.devices[0].leader_timeout_ms, 500);
+    CU_ASSERT_EQUAL(test_config.devices[1].leader_timeout_ms, DEFAULT_LEADER_TIMEOUT_MS);
+    CU_ASSERT_EQUAL(test_config.devices[0].binding_count, 1);
+
+    // The shared prefix has an action and a child
+    uint32_t root = test_config.devices[0].leader_root;
+    CU_ASSERT_NOT_EQUAL_FATAL(root, LEADER_NONE);
+    CU_ASSERT_PTR_NULL(leader_action(&test_config, root));
+    uint32_t n = leader_next(&test_config, root, 0x29);
+    CU_ASSERT_NOT_EQUAL_FATAL(n, LEADER_NONE);
+    CU_ASSERT_PTR_NULL(leader_action(&test_config, n));
+    n = leader_next(&test_config, n, 0x04);
+    const key_binding_t* action = leader_action(&test_config, n);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(action);
+    CU_ASSERT_EQUAL(action->mode, '+');
+    CU_ASSERT_EQUAL(test_config.leaders.nodes[n].children, 1);
+    action = leader_action(&test_config, leader_next(&test_config, n, 0x05));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(action);
+    CU_ASSERT_EQUAL(action->mode, '-');
+    CU_ASSERT_EQUAL(leader_next(&test_config, n, 0x06), LEADER_NONE);
+
+    // Each device walks its own root
+    n = leader_next(&test_config, test_config.devices[1].leader_root, 0x29);
+    action = leader_action(&test_config, leader_next(&test_config, n, 0x04));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(action);
+    CU_ASSERT_STRING_EQUAL(action->led, "num");
+
+    int found = 0;
+    for (int i = 0; i < 4096; i++)
+    {
+        n = leader_next(&test_config, test_config.devices[1].leader_root, 0x100 + i / 256);
+        n = leader_next(&test_config, n, 0x200 + (i / 16) % 16);
+        n = leader_next(&test_config, n, 0x300 + i % 16);
+        found += leader_action(&test_config, n) != NULL;
+    }
+    CU_ASSERT_EQUAL(found, 4096);
+
+    // Reloading reuses the trie storage
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_EQUAL(test_config.leaders.action_count, 4099);
+
+    free_config(&test_config);
+    CU_ASSERT_PTR_NULL(test_config.leaders.nodes);
+    CU_ASSERT_EQUAL(leader_next(&test_config, test_config.devices[0].leader_root, 0x29),
+                    LEADER_NONE);
+
+    unlink(test_config_file);
+    rmdir(test_dir);
+}
+
+void test_load_config_layers(void)
+{
+    config_t test_config = {0};
+
+    char temp_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char* test_dir = mkdtemp(temp_dir);
+    if (!test_dir)
+    {
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    char test_config_file[PATH_MAX];
+    snprintf(test_config_file, sizeof(test_config_file), "%s/test_layers.ini", test_dir);
+    FILE* f = fopen(test_config_file, "w");
+    if (!f)
+    {
+        rmdir(test_dir);
+        CU_ASSERT_FATAL(0);  // Fail the test
+        return;
+    }
+
+    fprintf(f, "[0x5043/0x54a3:nav]\n");  // layer sections may come first
+    fprintf(f, "0x70 = -scroll\n");
+    fprintf(f, "0x72&0x73 = ^num\n");
+    fprintf(f, "0x74 = layer: ^nav\n");
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "report = boot\n");
+    fprintf(f, "0x70 = +scroll\n");
+    fprintf(f, "0x71 = ^caps\n");
+    fprintf(f, "0x72&0x73 = ^caps\n");
+    fprintf(f, "0x74 = layer:nav\n");
+    fprintf(f, "0x75 = layer:nowhere\n");
+    fprintf(f, "[0x5043/0x54a3:]\n");
+    fprintf(f, "0x76 = ^num\n");
+    fclose(f);
+
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_EQUAL(test_config.device_count, 2);
+    CU_ASSERT_EQUAL(test_config.layer_count, 2);
+    CU_ASSERT_STRING_EQUAL(test_config.layers[0].name, "base");
+    CU_ASSERT_EQUAL(find_layer(&test_config, "nav"), 1);
+    CU_ASSERT_EQUAL(find_layer(&test_config, "nowhere"), -1);
+    CU_ASSERT_EQUAL(test_config.devices[0].layer, 1);
+    CU_ASSERT_EQUAL(test_config.devices[1].layer, 0);
+
+    // Layer actions are resolved once every section is read
+    const key_binding_t* b = &test_config.devices[1].bindings[3];
+    CU_ASSERT_EQUAL(b->action, ACTION_LAYER);
+    CU_ASSERT_EQUAL(b->target, 1);
+    CU_ASSERT_EQUAL(b->mode, '=');
+    CU_ASSERT_EQUAL(test_config.devices[1].bindings[4].target, LAYER_NONE);
+    CU_ASSERT_EQUAL(test_config.devices[0].bindings[2].mode, '^');
+
+    // The base layer is active; layer sections do not change legacy lookups
+    CU_ASSERT_PTR_EQUAL(test_config.active, &test_config.layers[0]);
+    CU_ASSERT_EQUAL(lookup_binding(&test_config, 0x5043, 0x54a3, 0x70, NULL)->mode, '+');
+    CU_ASSERT_EQUAL(get_binding_for_key(&test_config, 0x5043, 0x54a3, 0x70)->mode, '+');
+    const chord_entry_t* t = lookup_chord(&test_config, 0x5043, 0x54a3, 0, 0x72);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(t);
+    t = lookup_chord(&test_config, 0x5043, 0x54a3, t->next, 0x73);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(t);
+    CU_ASSERT_STRING_EQUAL(test_config.devices[t->device].bindings[t->binding].led, "caps");
+
+    // The nav layer shadows the base bindings it redefines; the rest fall through
+    CU_ASSERT(set_layer(&test_config, 1));
+    CU_ASSERT_EQUAL(lookup_binding(&test_config, 0x5043, 0x54a3, 0x70, NULL)->mode, '-');
+    CU_ASSERT_STRING_EQUAL(lookup_binding(&test_config, 0x5043, 0x54a3, 0x71, NULL)->led, "caps");
+    CU_ASSERT_EQUAL(lookup_binding(&test_config, 0x5043, 0x54a3, 0x74, NULL)->mode, '^');
+    t = lookup_chord(&test_config, 0x5043, 0x54a3, 0, 0x73);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(t);
+    t = lookup_chord(&test_config, 0x5043, 0x54a3, t->next, 0x72);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(t);
+    CU_ASSERT_STRING_EQUAL(test_config.devices[t->device].bindings[t->binding].led, "num");
+    CU_ASSERT(set_layer(&test_config, 2) == false);
+    CU_ASSERT_PTR_EQUAL(test_config.active, &test_config.layers[1]);
+
+    // Reloading keeps the active layer
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_PTR_EQUAL(test_config.active, &test_config.layers[1]);
+    CU_ASSERT_EQUAL(lookup_binding(&test_config, 0x5043, 0x54a3, 0x70, NULL)->mode, '-');
+
+    free_config(&test_config);
+    unlink(test_config_file);
+    rmdir(test_dir);
+}
+
+void test_load_config_groups_and_wildcards(void)
+{
+    char test_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char test_config_file[PATH_MAX];
+    config_t test_config = {0};
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(test_dir));
+    snprintf(test_config_file, sizeof(test_config_file), "%s/config", test_dir);
+
+    FILE* f = fopen(test_config_file, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "group = media\n");  // groups may be defined later
+    fprintf(f, "0x70 = -scroll\n");
+    fprintf(f, "[0x5043/*]\n");
+    fprintf(f, "group = media\n");
+    fprintf(f, "[*/*]\n");
+    fprintf(f, "report = boot\n");
+    fprintf(f, "0x75 = ^num\n");
+    fprintf(f, "[group:media]\n");
+    fprintf(f, "0x70 = +scroll\n");
+    fprintf(f, "0x71 = ^caps\n");
+    fprintf(f, "[group:unused]\n");
+    fprintf(f, "0x72 = ^caps\n");
+    fclose(f);
+
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_EQUAL(test_config.device_count, 5);
+    CU_ASSERT_EQUAL(test_config.devices[1].kind, SECTION_VENDOR);
+    CU_ASSERT_EQUAL(test_config.devices[2].kind, SECTION_ANY);
+    CU_ASSERT_EQUAL(test_config.devices[3].kind, SECTION_GROUP);
+    CU_ASSERT_STRING_EQUAL(test_config.devices[3].name, "media");
+    CU_ASSERT_EQUAL(test_config.devices[0].group, 3);
+    CU_ASSERT_EQUAL(test_config.devices[1].group, 3);
+    CU_ASSERT_EQUAL(test_config.devices[2].group, KEYMAP_EMPTY);
+    CU_ASSERT_EQUAL(test_config.devices[3].refs, 2);
+    CU_ASSERT_EQUAL(test_config.devices[4].refs, 0);
+
+    // Exact sections win over vendor-wide ones, which win over the any-device section
+    CU_ASSERT_EQUAL(resolve_device(&test_config, 0x5043, 0x54a3), 0);
+    CU_ASSERT_EQUAL(resolve_device(&test_config, 0x5043, 0x0001), 1);
+    CU_ASSERT_EQUAL(resolve_device(&test_config, 0x1234, 0x54a3), 2);
+
+    // A section's own bindings shadow its group's; the rest come from the group
+    CU_ASSERT_EQUAL(lookup_binding(&test_config, 0x5043, 0x54a3, 0x70, NULL)->mode, '-');
+    CU_ASSERT_STRING_EQUAL(lookup_binding(&test_config, 0x5043, 0x54a3, 0x71, NULL)->led,
+                           "caps");
+    CU_ASSERT_EQUAL(lookup_binding(&test_config, 0x5043, 0x0001, 0x70, NULL)->mode, '+');
+    CU_ASSERT_EQUAL(get_binding_for_key(&test_config, 0x5043, 0x0001, 0x71)->mode, '^');
+    CU_ASSERT_PTR_NULL(lookup_binding(&test_config, 0x5043, 0x0001, 0x75, NULL));
+    CU_ASSERT_STRING_EQUAL(lookup_binding(&test_config, 0x1234, 0x5678, 0x75, NULL)->led, "num");
+    CU_ASSERT_PTR_NULL(lookup_binding(&test_config, 0x1234, 0x5678, 0x72, NULL));
+
+    // Every vendor-wide device shares the group's table, compiled once
+    const layer_t* base = &test_config.layers[0];
+    CU_ASSERT_EQUAL(base->tables[1], 3);
+    CU_ASSERT_EQUAL(base->tables[0], 0);
+    CU_ASSERT_PTR_EQUAL(lookup_keymap_entry(&test_config, 0x5043, 0x0001, 0x71, 0),
+                        lookup_keymap_entry(&test_config, 0x5043, 0x0002, 0x71, 0));
+    size_t entries = 0;
+    for (size_t i = 0; i < KEYMAP_SIZE; i++)
+    {
+        if (base->keymap[i].device != KEYMAP_EMPTY)
+            entries++;
+    }
+    CU_ASSERT_EQUAL(entries, 5);  // exact section 2, group 2, any-device section 1
+
+    free_config(&test_config);
+    unlink(test_config_file);
+    rmdir(test_dir);
+}
+
+void test_load_config_command_templates(void)
+{
+    char test_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char test_config_file[PATH_MAX];
+    config_t test_config = {0};
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(test_dir));
+    snprintf(test_config_file, sizeof(test_config_file), "%s/config", test_dir);
+
+    FILE* f = fopen(test_config_file, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fprintf(f, "[general]\n");
+    fprintf(f, "setleds = /bin/setleds\n");
+    fprintf(f, "[0x5043/*]\n");
+    fprintf(f, "0x70 = cmd: notify-send \"key {keycode} on {device}\" {vendor}-{product}\n");
+    fprintf(f, "0x71 = cmd: echo \\{literal\\} \"\"\n");
+    fprintf(f, "0x72 = cmd: echo {unknown}\n");
+    fprintf(f, "0x73 = cmd: echo \"unterminated\n");
+    fprintf(f, "0x74 = +caps\n");
+    fclose(f);
+
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_EQUAL(test_config.devices[0].binding_count, 3);
+    CU_ASSERT_EQUAL(test_config.template_count, 2);
+    CU_ASSERT_EQUAL(test_config.devices[0].bindings[0].action, ACTION_COMMAND);
+
+    // Placeholders take the event's device, not the section's pattern
+    const key_binding_t* b = &test_config.devices[0].bindings[0];
+    command_context_t context = {0x5043, 0x54a3, 112, 0, NULL};
+    char buf[COMMAND_MAX];
+    char* argv[COMMAND_MAX_ARGS + 1];
+    CU_ASSERT_EQUAL_FATAL(render_command(&test_config, b->target, &context, buf, sizeof(buf), argv),
+                          3);
+    CU_ASSERT_STRING_EQUAL(argv[0], "notify-send");
+    CU_ASSERT_STRING_EQUAL(argv[1], "key 112 on 5043:54a3");
+    CU_ASSERT_STRING_EQUAL(argv[2], "5043-54a3");
+    CU_ASSERT_PTR_NULL(argv[3]);
+
+    // Too small a buffer renders nothing rather than a truncated command
+    CU_ASSERT_EQUAL(render_command(&test_config, b->target, &context, buf, 20, argv), 0);
+
+    CU_ASSERT_STRING_EQUAL(
+        get_command_for_key(&test_config, 0x5043, 0x0001, 0x71, command, sizeof(command)),
+        "echo {literal} ");
+    CU_ASSERT_STRING_EQUAL(
+        get_command_for_key(&test_config, 0x5043, 0x0001, 0x74, command, sizeof(command)),
+        "/bin/setleds +caps");
+
+    // led_command replaces the setleds invocation of LED bindings
+    f = fopen(test_config_file, "a");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fprintf(f, "[general]\n");
+    fprintf(f, "led_command = ledctl --{led} {mode}\n");
+    fclose(f);
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_EQUAL(led_command_template(&test_config), 2);
+    CU_ASSERT_STRING_EQUAL(
+        get_command_for_key(&test_config, 0x5043, 0x0001, 0x74, command, sizeof(command)),
+        "ledctl --caps +");
+
+    // Templates and setleds paths that could render past COMMAND_MAX are rejected at load
+    char long_path[COMMAND_MAX];
+    memset(long_path, 'a', sizeof(long_path) - 1);
+    long_path[0] = '/';
+    long_path[COMMAND_MAX - 17] = '\0';  // one byte too long for "{setleds} {mode}{led}"
+    f = fopen(test_config_file, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fprintf(f, "[general]\n");
+    fprintf(f, "setleds = %s\n", long_path);
+    fprintf(f, "[0x5043/*]\n");
+    fprintf(f, "0x70 = cmd: echo ");
+    for (int i = 0; i < 28; i++)
+        fprintf(f, "{device}");  // 5 + 28 * 9 + 1 bytes: too long
+    fprintf(f, "\n0x71 = cmd: echo ");
+    for (int i = 0; i < 27; i++)
+        fprintf(f, "{device}");  // 5 + 27 * 9 + 1 bytes: fits
+    fprintf(f, "\n0x74 = +caps\n");
+    fclose(f);
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_STRING_EQUAL(test_config.setleds_path, DEFAULT_SETLEDS_PATH);
+    CU_ASSERT_EQUAL(test_config.devices[0].binding_count, 2);
+    CU_ASSERT_EQUAL(test_config.devices[0].bindings[0].keycode, 0x71);
+    CU_ASSERT(get_command_for_key(&test_config, 0x5043, 0xFFFF, 0x71, command, COMMAND_MAX) !=
+              NULL);
+
+    // A path that fits the built-in command still counts against templates using it, in
+    // whichever order the two are set
+    long_path[COMMAND_MAX - 18] = '\0';
+    f = fopen(test_config_file, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fprintf(f, "[general]\n");
+    fprintf(f, "led_command = {setleds} --verbose {mode}{led}\n");
+    fprintf(f, "setleds = %s\n", long_path);
+    fclose(f);
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_STRING_EQUAL(test_config.setleds_path, DEFAULT_SETLEDS_PATH);
+    CU_ASSERT_EQUAL(led_command_template(&test_config), 0);
+
+    f = fopen(test_config_file, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fprintf(f, "[general]\n");
+    fprintf(f, "setleds = %s\n", long_path);
+    fprintf(f, "led_command = {setleds} --verbose {mode}{led}\n");
+    fclose(f);
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT_STRING_EQUAL(test_config.setleds_path, long_path);
+    CU_ASSERT_EQUAL(led_command_template(&test_config), TEMPLATE_NONE);
+
+    free_config(&test_config);
+    unlink(test_config_file);
+    rmdir(test_dir);
+}
+
 void test_get_command_for_key(void)
 {
     // Set up test configuration
@@ -320,7 +991,8 @@ void test_get_command_for_key(void)
     // Test each mode/LED combination
     for (size_t i = 0; i < 3; i++)
     {
-        const char* cmd = get_command_for_key(&test_config, 0x5043, 0x54a3, 111 + i);
+        const char* cmd =
+            get_command_for_key(&test_config, 0x5043, 0x54a3, 111 + i, command, sizeof(command));
         char expected[256];
         snprintf(expected, sizeof(expected), "/usr/local/bin/setleds %s%s", modes[i], leds[i]);
         CU_ASSERT_PTR_NOT_NULL(cmd);
@@ -328,8 +1000,247 @@ void test_get_command_for_key(void)
     }
 
     // Test invalid cases
-    CU_ASSERT_PTR_NULL(get_command_for_key(&test_config, 0x5043, 0x54a3, 999));  // Invalid keycode
-    CU_ASSERT_PTR_NULL(get_command_for_key(&test_config, 0x1234, 0x5678, 111));  // Invalid device
+    CU_ASSERT_PTR_NULL(get_command_for_key(&test_config, 0x5043, 0x54a3, 999, command,
+                                           sizeof(command)));  // Invalid keycode
+    CU_ASSERT_PTR_NULL(get_command_for_key(&test_config, 0x1234, 0x5678, 111, command,
+                                           sizeof(command)));  // Invalid device
+}
+
+void test_load_config_key_actions(void)
+{
+    char test_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char test_config_file[PATH_MAX];
+    config_t test_config = {0};
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(test_dir));
+    snprintf(test_config_file, sizeof(test_config_file), "%s/config", test_dir);
+
+    FILE* f = fopen(test_config_file, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "0x70 = key: ctrl+shift+t\n");
+    fprintf(f, "0x71 = key: KEY_H i 0x1c\n");
+    fprintf(f, "0x72 = key: ctrl+nosuchkey\n");
+    fprintf(f, "0x73 = key: 0x300\n");
+    fclose(f);
+
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT(test_config.key_actions);
+    CU_ASSERT_EQUAL_FATAL(test_config.devices[0].binding_count, 2);
+
+    // Keys pressed together form one stroke; strokes are separated by 0
+    uint16_t codes[MAX_PAYLOAD / 2];
+    const key_binding_t* b = &test_config.devices[0].bindings[0];
+    CU_ASSERT_EQUAL(b->action, ACTION_KEYS);
+    CU_ASSERT_EQUAL_FATAL(b->payload_len, 3 * sizeof(uint16_t));
+    memcpy(codes, b->payload, b->payload_len);
+    CU_ASSERT(codes[0] == 29 && codes[1] == 42 && codes[2] == 20);
+
+    b = &test_config.devices[0].bindings[1];
+    CU_ASSERT_EQUAL_FATAL(b->payload_len, 5 * sizeof(uint16_t));
+    memcpy(codes, b->payload, b->payload_len);
+    CU_ASSERT(codes[0] == 35 && codes[1] == 0 && codes[2] == 23 && codes[3] == 0 &&
+              codes[4] == 28);
+
+    // Reloading without key actions no longer needs the virtual keyboard
+    f = fopen(test_config_file, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fprintf(f, "[0x5043/0x54a3]\n0x70 = +caps\n");
+    fclose(f);
+    CU_ASSERT(load_config(test_config_file, &test_config) == true);
+    CU_ASSERT(!test_config.key_actions);
+
+    free_config(&test_config);
+    unlink(test_config_file);
+    rmdir(test_dir);
+}
+
+// Replace a test configuration file's contents
+static void write_config(const char* path, const char* text)
+{
+    FILE* f = fopen(path, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fputs(text, f);
+    fclose(f);
+}
+
+void test_load_config_incremental(void)
+{
+    char test_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char test_config_file[PATH_MAX];
+    config_t test_config = {0};
+    const char* base = "[0x5043/0x54a3]\n0x70 = +scroll\n0x74 = layer: nav\n"
+                       "[0x5043/0x54a3:nav]\n0x70 = -scroll\n"
+                       "[0x1234/0x5678]\n0x71 = ^caps\n";
+    char text[1024];
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(test_dir));
+    snprintf(test_config_file, sizeof(test_config_file), "%s/config", test_dir);
+
+    // The first load builds everything
+    write_config(test_config_file, base);
+    CU_ASSERT_FATAL(load_config(test_config_file, &test_config));
+    CU_ASSERT(test_config.changes.layout);
+    CU_ASSERT(test_config.changes.devices);
+    CU_ASSERT_EQUAL(test_config.changes.sections, 0x7);
+    CU_ASSERT_EQUAL(test_config.changes.layers, 0x3);
+
+    // Reloading the same text, or only its comments and spacing, rebuilds nothing
+    CU_ASSERT(load_config(test_config_file, &test_config));
+    CU_ASSERT(!test_config.changes.layout && !test_config.changes.devices);
+    CU_ASSERT_EQUAL(test_config.changes.sections, 0);
+    CU_ASSERT_EQUAL(test_config.changes.layers, 0);
+    snprintf(text, sizeof(text), "# keyboards\n%s\n  # end\n", base);
+    write_config(test_config_file, text);
+    CU_ASSERT(load_config(test_config_file, &test_config));
+    CU_ASSERT_EQUAL(test_config.changes.layers, 0);
+
+    // An edited layer section rebuilds only its layer
+    CU_ASSERT(set_layer(&test_config, 1));
+    write_config(test_config_file, "[0x5043/0x54a3]\n0x70 = +scroll\n0x74 = layer: nav\n"
+                                   "[0x5043/0x54a3:nav]\n0x70 = ^num\n"
+                                   "[0x1234/0x5678]\n0x71 = ^caps\n");
+    CU_ASSERT(load_config(test_config_file, &test_config));
+    CU_ASSERT(!test_config.changes.layout && !test_config.changes.devices);
+    CU_ASSERT_EQUAL(test_config.changes.sections, 0x2);
+    CU_ASSERT_EQUAL(test_config.changes.layers, 0x2);
+    CU_ASSERT_PTR_EQUAL(test_config.active, &test_config.layers[1]);
+    CU_ASSERT_STRING_EQUAL(lookup_binding(&test_config, 0x5043, 0x54a3, 0x70, NULL)->led, "num");
+    CU_ASSERT_EQUAL(lookup_binding(&test_config, 0x1234, 0x5678, 0x71, NULL)->mode, '^');
+    CU_ASSERT(set_layer(&test_config, 0));
+    CU_ASSERT_EQUAL(lookup_binding(&test_config, 0x5043, 0x54a3, 0x70, NULL)->mode, '+');
+    CU_ASSERT_EQUAL(lookup_binding(&test_config, 0x5043, 0x54a3, 0x74, NULL)->target, 1);
+
+    // A base section falls through into every layer
+    write_config(test_config_file, "[0x5043/0x54a3]\n0x70 = +scroll\n0x74 = layer: nav\n"
+                                   "[0x5043/0x54a3:nav]\n0x70 = ^num\n"
+                                   "[0x1234/0x5678]\n0x71 = ^num\n");
+    CU_ASSERT(load_config(test_config_file, &test_config));
+    CU_ASSERT_EQUAL(test_config.changes.sections, 0x4);
+    CU_ASSERT_EQUAL(test_config.changes.layers, 0x3);
+    CU_ASSERT(!test_config.changes.devices);
+    CU_ASSERT_STRING_EQUAL(lookup_binding(&test_config, 0x1234, 0x5678, 0x71, NULL)->led, "num");
+
+    // Reading options change the devices but not the layout
+    write_config(test_config_file, "[0x5043/0x54a3]\n0x70 = +scroll\n0x74 = layer: nav\n"
+                                   "[0x5043/0x54a3:nav]\n0x70 = ^num\n"
+                                   "[0x1234/0x5678]\nreport = boot\n0x71 = ^num\n");
+    CU_ASSERT(load_config(test_config_file, &test_config));
+    CU_ASSERT(!test_config.changes.layout);
+    CU_ASSERT(test_config.changes.devices);
+    CU_ASSERT_EQUAL(test_config.changes.sections, 0x4);
+
+    // A new section changes the layout, so everything is rebuilt
+    write_config(test_config_file, "[0x5043/0x54a3]\n0x70 = +scroll\n0x74 = layer: nav\n"
+                                   "[0x5043/0x54a3:nav]\n0x70 = ^num\n"
+                                   "[0x1234/0x5678]\nreport = boot\n0x71 = ^num\n"
+                                   "[0x1234/*]\n0x72 = ^scroll\n");
+    CU_ASSERT(load_config(test_config_file, &test_config));
+    CU_ASSERT(test_config.changes.layout && test_config.changes.devices);
+    CU_ASSERT_EQUAL(test_config.changes.sections, 0xf);
+    CU_ASSERT_EQUAL(test_config.changes.layers, 0x3);
+    CU_ASSERT_STRING_EQUAL(lookup_binding(&test_config, 0x1234, 0x9999, 0x72, NULL)->led,
+                           "scroll");
+
+    // Layer sections that fill the template table take the command of an unchanged base
+    // section after them, which is rebuilt along with its layer
+    for (int pass = 0; pass < 2; pass++)
+    {
+        size_t len = snprintf(text, sizeof(text), "[0x5043/0x54a3]\n0x74 = layer: nav\n");
+        for (int d = 0; d < 4; d++)
+        {
+            len += snprintf(text + len, sizeof(text) - len, "[0x5043/0x%04x:nav]\n", d + 1);
+            for (int b = 0; b < MAX_BINDINGS; b++)
+            {
+                len += snprintf(text + len, sizeof(text) - len, pass ? "%d = cmd: echo\n" :
+                                "%d = +caps\n", 0x70 + b);
+            }
+        }
+        snprintf(text + len, sizeof(text) - len, "[0x1234/0x5678]\n0x71 = cmd: echo b\n");
+        write_config(test_config_file, text);
+        CU_ASSERT_FATAL(load_config(test_config_file, &test_config));
+    }
+    CU_ASSERT(!test_config.changes.layout);
+    CU_ASSERT(test_config.changes.sections & (1ULL << 5));
+    CU_ASSERT(test_config.changes.layers & 0x1);
+    CU_ASSERT_EQUAL(test_config.devices[5].binding_count, 0);
+    CU_ASSERT(set_layer(&test_config, 0));
+    CU_ASSERT_PTR_NULL(lookup_binding(&test_config, 0x1234, 0x5678, 0x71, NULL));
+
+    free_config(&test_config);
+    unlink(test_config_file);
+    rmdir(test_dir);
+}
+
+void test_load_config_fragments(void)
+{
+    char test_dir[] = "/tmp/belvedere_test_XXXXXX";
+    char test_config_file[PATH_MAX];
+    char fragment_dir[PATH_MAX];
+    char first[PATH_MAX + 16];
+    char second[PATH_MAX + 16];
+    char ignored[PATH_MAX + 16];
+    config_t test_config = {0};
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(test_dir));
+    snprintf(test_config_file, sizeof(test_config_file), "%s/config", test_dir);
+    snprintf(fragment_dir, sizeof(fragment_dir), "%s/conf.d", test_dir);
+    snprintf(first, sizeof(first), "%s/10-first.ini", fragment_dir);
+    snprintf(second, sizeof(second), "%s/20-second.ini", fragment_dir);
+    snprintf(ignored, sizeof(ignored), "%s/notes.txt", fragment_dir);
+    CU_ASSERT_FATAL(mkdir(fragment_dir, 0700) == 0);
+
+    // Fragments follow the main file in name order; each starts outside any section
+    write_config(test_config_file, "[general]\nmonitored_keycodes = 0x70\n"
+                                   "[0x5043/0x54a3]\n0x70 = +scroll\n");
+    write_config(second, "0x72 = ^num\n[0x1234/0x5678]\n0x71 = ^caps\n");
+    write_config(first, "[0x1111/0x2222]\nreport = boot\n0x70 = ^num\n");
+    write_config(ignored, "[0x3333/0x4444]\n0x70 = ^num\n");
+    CU_ASSERT_FATAL(load_config(test_config_file, &test_config));
+    CU_ASSERT_EQUAL(test_config.file_count, 3);
+    CU_ASSERT_STRING_EQUAL(test_config.fragment_dir, fragment_dir);
+    CU_ASSERT_STRING_EQUAL(test_config.files[1].path, first);
+    CU_ASSERT_EQUAL(test_config.changes.files, 0x7);
+    CU_ASSERT_EQUAL_FATAL(test_config.device_count, 3);
+    CU_ASSERT_EQUAL(test_config.devices[1].vendor, 0x1111);
+    CU_ASSERT_EQUAL(test_config.devices[1].report_format, REPORT_BOOT);
+    CU_ASSERT_EQUAL(test_config.devices[1].binding_count, 1);
+    CU_ASSERT_EQUAL(test_config.devices[2].vendor, 0x1234);
+    CU_ASSERT_EQUAL(test_config.monitored_keycodes_count, 1);
+    CU_ASSERT_STRING_EQUAL(lookup_binding(&test_config, 0x1234, 0x5678, 0x71, NULL)->led, "caps");
+
+    // Unchanged files, including one rewritten with the same text, change nothing
+    CU_ASSERT(load_config(test_config_file, &test_config));
+    CU_ASSERT_EQUAL(test_config.changes.files, 0);
+    CU_ASSERT_EQUAL(test_config.changes.sections, 0);
+    write_config(first, "[0x1111/0x2222]\nreport = boot\n0x70 = ^num\n");
+    CU_ASSERT(load_config(test_config_file, &test_config));
+    CU_ASSERT_EQUAL(test_config.changes.files, 0);
+
+    // An edited fragment changes only its own sections
+    write_config(second, "[0x1234/0x5678]\n0x71 = ^scroll\n");
+    CU_ASSERT(load_config(test_config_file, &test_config));
+    CU_ASSERT_EQUAL(test_config.changes.files, 0x4);
+    CU_ASSERT_EQUAL(test_config.changes.sections, 0x4);
+    CU_ASSERT(!test_config.changes.devices);
+    CU_ASSERT_STRING_EQUAL(lookup_binding(&test_config, 0x1234, 0x5678, 0x71, NULL)->led,
+                           "scroll");
+
+    // A removed fragment takes its sections with it
+    unlink(first);
+    CU_ASSERT(load_config(test_config_file, &test_config));
+    CU_ASSERT_EQUAL(test_config.file_count, 2);
+    CU_ASSERT_EQUAL(test_config.device_count, 2);
+    CU_ASSERT(test_config.changes.layout);
+    CU_ASSERT_EQUAL(resolve_device(&test_config, 0x1111, 0x2222), KEYMAP_EMPTY);
+
+    free_config(&test_config);
+    CU_ASSERT_EQUAL(test_config.file_count, 0);
+    unlink(second);
+    unlink(ignored);
+    rmdir(fragment_dir);
+    unlink(test_config_file);
+    rmdir(test_dir);
 }
 
 int main(void)
@@ -352,6 +1263,24 @@ int main(void)
     if ((NULL == CU_add_test(pSuite, "test_load_config_basic", test_load_config_basic)) ||
         (NULL == CU_add_test(pSuite, "test_load_config_sections", test_load_config_sections)) ||
         (NULL == CU_add_test(pSuite, "test_load_config_limits", test_load_config_limits)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_write_actions",
+                             test_load_config_write_actions)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_sequences", test_load_config_sequences)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_gestures", test_load_config_gestures)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_modifiers_and_chords",
+                             test_load_config_modifiers_and_chords)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_leader_sequences",
+                             test_load_config_leader_sequences)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_layers", test_load_config_layers)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_groups_and_wildcards",
+                             test_load_config_groups_and_wildcards)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_command_templates",
+                             test_load_config_command_templates)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_key_actions",
+                             test_load_config_key_actions)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_incremental",
+                             test_load_config_incremental)) ||
+        (NULL == CU_add_test(pSuite, "test_load_config_fragments", test_load_config_fragments)) ||
         (NULL == CU_add_test(pSuite, "test_get_command_for_key", test_get_command_for_key)))
     {
         CU_cleanup_registry();
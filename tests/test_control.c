@@ -0,0 +1,149 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <limits.h>  // for PATH_MAX
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>  // for mkdtemp, unlink, rmdir
+#include <uv.h>
+
+#include "../include/config.h"
+#include "../include/control.h"
+#include "../include/dispatch.h"
+
+static char temp_dir[] = "/tmp/belvedere_control_XXXXXX";
+static char config_file[PATH_MAX];
+static char socket_path[PATH_MAX];
+static config_t cfg;
+static dispatch_t dispatch;  // never initialized; layer switches need no loop
+static control_t control;
+
+static bool load_layers(void)
+{
+    FILE* f = fopen(config_file, "w");
+    if (!f)
+        return false;
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "1 = +scroll\n");
+    fprintf(f, "[0x5043/0x54a3:nav]\n");
+    fprintf(f, "1 = -scroll\n");
+    fclose(f);
+    return load_config(config_file, &cfg);
+}
+
+void test_control_layer_commands(void)
+{
+    char reply[CONTROL_LINE_MAX];
+    CU_ASSERT_FATAL(load_layers());
+    control_init(&control, &cfg, &dispatch, NULL);
+
+    control_execute(&control, "layers", reply, sizeof(reply));
+    CU_ASSERT_STRING_EQUAL(reply, "base nav\n");
+    control_execute(&control, "layer", reply, sizeof(reply));
+    CU_ASSERT_STRING_EQUAL(reply, "base\n");
+
+    CU_ASSERT_EQUAL(control_execute(&control, "layer nav", reply, sizeof(reply)), 3);
+    CU_ASSERT_STRING_EQUAL(reply, "ok\n");
+    CU_ASSERT_PTR_EQUAL(cfg.active, &cfg.layers[1]);
+    CU_ASSERT_EQUAL(lookup_binding(&cfg, 0x5043, 0x54a3, 1, NULL)->mode, '-');
+
+    control_execute(&control, "layer missing", reply, sizeof(reply));
+    CU_ASSERT_STRING_EQUAL(reply, "error: unknown layer missing\n");
+    CU_ASSERT_PTR_EQUAL(cfg.active, &cfg.layers[1]);
+    control_execute(&control, "reload", reply, sizeof(reply));
+    CU_ASSERT_STRING_EQUAL(reply, "error: unknown command\n");
+
+    // Names that do not fit are left out rather than cut
+    CU_ASSERT_EQUAL(control_execute(&control, "layers", reply, 8), 5);
+    CU_ASSERT_STRING_EQUAL(reply, "base\n");
+
+    control_execute(&control, "layer base", reply, sizeof(reply));
+    CU_ASSERT_PTR_EQUAL(cfg.active, &cfg.layers[0]);
+
+    // Counters come back as one line, whole, however many stages there are
+    size_t len = control_execute(&control, "stats", reply, sizeof(reply));
+    CU_ASSERT(strncmp(reply, "dispatched=", 11) == 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(reply, " lag_max_us="));
+    CU_ASSERT_PTR_NOT_NULL(strstr(reply, " stalls_dispatch="));
+    CU_ASSERT_PTR_NOT_NULL(strstr(reply, " max_reload_us="));
+    CU_ASSERT(len > 0 && reply[len - 1] == '\n');
+}
+
+typedef struct
+{
+    int status;
+    char reply[CONTROL_LINE_MAX];
+    volatile int done;
+} client_t;
+
+static void run_client(void* arg)
+{
+    client_t* client = arg;
+    client->status = control_send(socket_path, "layer nav", client->reply, sizeof(client->reply));
+    client->done = 1;
+}
+
+void test_control_socket(void)
+{
+    CU_ASSERT_FATAL(load_layers());
+    uv_loop_t* loop = uv_default_loop();
+    control_init(&control, &cfg, &dispatch, NULL);
+    CU_ASSERT_FATAL(control_listen(&control, loop, socket_path));
+
+    client_t client = {0};
+    uv_thread_t thread;
+    CU_ASSERT_FATAL(uv_thread_create(&thread, run_client, &client) == 0);
+    while (!client.done)
+    {
+        uv_run(loop, UV_RUN_NOWAIT);
+    }
+    uv_thread_join(&thread);
+
+    CU_ASSERT_EQUAL(client.status, 0);
+    CU_ASSERT_STRING_EQUAL(client.reply, "ok");
+    CU_ASSERT_PTR_EQUAL(cfg.active, &cfg.layers[1]);
+
+    control_cleanup(&control);
+    uv_run(loop, UV_RUN_NOWAIT);
+    CU_ASSERT(access(socket_path, F_OK) != 0);
+
+    // Nobody listening any more
+    CU_ASSERT_EQUAL(control_send(socket_path, "layer", client.reply, sizeof(client.reply)), -1);
+}
+
+int main(void)
+{
+    if (!mkdtemp(temp_dir))
+        return 1;
+    snprintf(config_file, sizeof(config_file), "%s/config", temp_dir);
+    snprintf(socket_path, sizeof(socket_path), "%s/control.sock", temp_dir);
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+
+    CU_pSuite pSuite = CU_add_suite("Control Tests", NULL, NULL);
+    if (NULL == pSuite)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((NULL == CU_add_test(pSuite, "test_control_layer_commands",
+                             test_control_layer_commands)) ||
+        (NULL == CU_add_test(pSuite, "test_control_socket", test_control_socket)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    unlink(config_file);
+    rmdir(temp_dir);
+    free_config(&cfg);
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -0,0 +1,813 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <limits.h>  // for PATH_MAX
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "../include/config.h"
+#include "../include/dispatch.h"
+#include "../include/executor.h"
+#include "../include/led_state.h"
+#include "../include/uinput.h"
+
+#ifdef __linux__
+#include <linux/input.h>
+#endif
+
+#define MAX_CALLS 8
+
+// The dispatch state under test, and the executor behind it
+static dispatch_t dispatch;
+static executor_t executor;
+
+// Commands captured by the test executor, joined with spaces
+static char calls[MAX_CALLS][256];
+static int call_count = 0;
+
+static int capture_executor(char* const argv[])
+{
+    if (call_count >= MAX_CALLS)
+        return -1;
+
+    char* out = calls[call_count++];
+    out[0] = '\0';
+    for (size_t i = 0; argv[i]; i++)
+    {
+        if (i > 0)
+            strcat(out, " ");
+        strcat(out, argv[i]);
+    }
+    return 0;
+}
+
+static void add_binding(config_t* cfg, uint16_t keycode, char mode, const char* led)
+{
+    device_config_t* dev = &cfg->devices[0];
+    key_binding_t* binding = &dev->bindings[dev->binding_count++];
+    memset(binding, 0, sizeof(*binding));
+    binding->keycode = keycode;
+    binding->mode = mode;
+    strncpy(binding->led, led, sizeof(binding->led) - 1);
+}
+
+static void setup_config(config_t* cfg, uint32_t coalesce_ms)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    strncpy(cfg->setleds_path, "setleds", sizeof(cfg->setleds_path) - 1);
+    cfg->coalesce_ms = coalesce_ms;
+    cfg->device_count = 1;
+    cfg->devices[0].vendor = 0x5043;
+    cfg->devices[0].product = 0x54a3;
+    add_binding(cfg, 1, '+', "scroll");
+    add_binding(cfg, 2, '-', "scroll");
+    add_binding(cfg, 3, '^', "caps");
+    add_binding(cfg, 4, '^', "num");
+    compile_config(cfg);
+}
+
+static void run_until_idle(void)
+{
+    // The coalescing timer keeps the loop alive until the window closes
+    uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+}
+
+void test_dispatch_runs_immediately_without_window(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 0);
+    call_count = 0;
+
+    CU_ASSERT(dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 3) == true);
+    CU_ASSERT(dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4) == true);
+    CU_ASSERT(dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 99) == false);
+
+    CU_ASSERT_EQUAL(call_count, 2);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds ^caps");
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds ^num");
+}
+
+void test_dispatch_coalesces_window(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 2);
+    call_count = 0;
+
+    // +scroll and -scroll cancel; caps and num merge into one invocation
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 1);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 3);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 2);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4);
+    CU_ASSERT_EQUAL(call_count, 0);
+
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 1);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds ^caps ^num");
+}
+
+void test_dispatch_coalesce_all_cancelled(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 2);
+    call_count = 0;
+
+    // Two toggles of the same LED leave it unchanged, so nothing runs
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 3);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 3);
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 0);
+
+    // A toggle after switching on resolves to off
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 1);
+    add_binding(&cfg, 5, '^', "scroll");
+    compile_config(&cfg);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 5);
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 1);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds -scroll");
+}
+
+void test_dispatch_debounce(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 0);
+    cfg.devices[0].bindings[2].debounce_ms = 50;  // ^caps
+    call_count = 0;
+
+    dispatch_stats_t before, after;
+    dispatch_get_stats(&dispatch, &before);
+
+    // A chattering switch: only the first of a quick burst fires
+    for (int i = 0; i < 5; i++)
+    {
+        dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 3);
+    }
+    CU_ASSERT_EQUAL(call_count, 1);
+
+    uint16_t slot;
+    CU_ASSERT_PTR_NOT_NULL(lookup_binding(&cfg, 0x5043, 0x54a3, 3, &slot));
+    CU_ASSERT(dispatch_get_suppressed(&dispatch, slot) >= 4);
+
+    dispatch_get_stats(&dispatch, &after);
+    CU_ASSERT_EQUAL(after.debounced - before.debounced, 4);
+
+    // Other bindings are unaffected
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4);
+    CU_ASSERT_EQUAL(call_count, 3);
+
+    // Once the switch settles the binding fires again
+    uv_sleep(60);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 3);
+    CU_ASSERT_EQUAL(call_count, 4);
+}
+
+void test_dispatch_max_rate(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 0);
+    cfg.devices[0].bindings[3].max_rate = 10;  // ^num, at most every 100ms
+    call_count = 0;
+
+    dispatch_stats_t before, after;
+    dispatch_get_stats(&dispatch, &before);
+
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4);
+    CU_ASSERT_EQUAL(call_count, 1);
+
+    dispatch_get_stats(&dispatch, &after);
+    CU_ASSERT_EQUAL(after.rate_limited - before.rate_limited, 2);
+
+    uv_sleep(110);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4);
+    CU_ASSERT_EQUAL(call_count, 2);
+}
+
+static void add_sequence_step(config_t* cfg, uint16_t delay_ms, char mode, const char* led)
+{
+    sequence_step_t* step = &cfg->steps[cfg->step_count++];
+    step->delay_ms = delay_ms;
+    step->mode = mode;
+    strncpy(step->led, led, sizeof(step->led) - 1);
+}
+
+static void add_sequence(config_t* cfg, uint16_t keycode)
+{
+    device_config_t* dev = &cfg->devices[0];
+    key_binding_t* binding = &dev->bindings[dev->binding_count++];
+    memset(binding, 0, sizeof(*binding));
+    binding->keycode = keycode;
+    binding->action = ACTION_SEQUENCE;
+    binding->first_step = (uint8_t)cfg->step_count;
+    add_sequence_step(cfg, 0, '+', "scroll");
+    add_sequence_step(cfg, 20, '-', "scroll");
+    add_sequence_step(cfg, 20, '+', "scroll");
+    binding->step_count = 3;
+    compile_config(cfg);
+}
+
+// The first step runs at once; later steps run from the loop after their delays
+void test_dispatch_sequence(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 0);
+    add_sequence(&cfg, 5);
+    call_count = 0;
+
+    uint64_t start = uv_hrtime();
+    CU_ASSERT(dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 5) == true);
+    CU_ASSERT_EQUAL(call_count, 1);
+
+    run_until_idle();
+    CU_ASSERT(uv_hrtime() - start >= 39 * 1000000ULL);  // 1ms tick granularity
+    CU_ASSERT_EQUAL(call_count, 3);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds +scroll");
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds -scroll");
+    CU_ASSERT_STRING_EQUAL(calls[2], "setleds +scroll");
+}
+
+// A reset drops the remaining steps of running sequences
+void test_dispatch_sequence_reset(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 0);
+    add_sequence(&cfg, 5);
+    call_count = 0;
+
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 5);
+    dispatch_reset(&dispatch);
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 1);
+}
+
+static void add_trigger(config_t* cfg, uint16_t keycode, trigger_t trigger, char mode,
+                        const char* led)
+{
+    add_binding(cfg, keycode, mode, led);
+    cfg->devices[0].bindings[cfg->devices[0].binding_count - 1].trigger = (uint8_t)trigger;
+}
+
+// Key 1 taps +scroll and holds ^caps; key 2 taps -scroll and double-taps ^num
+static void setup_gestures(config_t* cfg)
+{
+    setup_config(cfg, 0);
+    cfg->devices[0].bindings[0].hold_ms = 50;
+    cfg->devices[0].bindings[1].double_tap_ms = 50;
+    add_trigger(cfg, 1, TRIGGER_HOLD, '^', "caps");
+    add_trigger(cfg, 2, TRIGGER_DOUBLE_TAP, '^', "num");
+    compile_config(cfg);
+    call_count = 0;
+}
+
+void test_dispatch_tap_and_hold(void)
+{
+    config_t cfg;
+    setup_gestures(&cfg);
+
+    // A quick press and release is a tap, run on release
+    CU_ASSERT(dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, true) == true);
+    CU_ASSERT_EQUAL(call_count, 0);
+    CU_ASSERT(dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, false) == true);
+    CU_ASSERT_EQUAL(call_count, 1);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds +scroll");
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 1);
+
+    // Staying down past hold_ms runs the hold binding; the release does nothing more
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, true);  // auto-repeat is ignored
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 2);
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds ^caps");
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, false);
+    CU_ASSERT_EQUAL(call_count, 2);
+
+    // Keys without gestures still fire on press
+    CU_ASSERT(dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 3, 0, true) == true);
+    CU_ASSERT(dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 3, 0, false) == false);
+    CU_ASSERT_EQUAL(call_count, 3);
+}
+
+void test_dispatch_double_tap(void)
+{
+    config_t cfg;
+    setup_gestures(&cfg);
+
+    // Two taps inside the window run only the double-tap binding
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 2, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 2, 0, false);
+    CU_ASSERT_EQUAL(call_count, 0);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 2, 0, true);
+    CU_ASSERT_EQUAL(call_count, 1);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds ^num");
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 2, 0, false);
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 1);
+
+    // A single tap runs once the window closes
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 2, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 2, 0, false);
+    CU_ASSERT_EQUAL(call_count, 1);
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 2);
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds -scroll");
+}
+
+void test_dispatch_modifiers(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 0);
+    add_binding(&cfg, 1, '^', "num");
+    cfg.devices[0].bindings[4].modifiers = MOD_CTRL;
+    compile_config(&cfg);
+    call_count = 0;
+
+    // Left or right ctrl picks the ctrl binding; other modifiers fall back to the plain one
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0x01, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0x10, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0x02, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0x00, true);
+    CU_ASSERT_EQUAL(call_count, 4);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds ^num");
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds ^num");
+    CU_ASSERT_STRING_EQUAL(calls[2], "setleds +scroll");
+    CU_ASSERT_STRING_EQUAL(calls[3], "setleds +scroll");
+
+    // Modifier-only bindings do not match without their modifiers
+    CU_ASSERT(dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 9, 0x01, true) == false);
+}
+
+void test_dispatch_modifier_release(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 0);
+    add_trigger(&cfg, 4, TRIGGER_HOLD, '-', "scroll");
+    cfg.devices[0].bindings[3].modifiers = MOD_CTRL;
+    cfg.devices[0].bindings[3].hold_ms = 50;
+    cfg.devices[0].bindings[4].modifiers = MOD_CTRL;
+    compile_config(&cfg);
+    call_count = 0;
+
+    // ctrl and the key go up in one report: the release carries no modifiers but is still
+    // the end of the ctrl+4 tap
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 4, 0x01, true);
+    CU_ASSERT(dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 4, 0x00, false) == true);
+    CU_ASSERT_EQUAL(call_count, 1);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds ^num");
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 1);
+
+    // ctrl goes up first, then the key
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 4, 0x01, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 4, 0x00, false);
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 2);
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds ^num");
+
+    // Holding still runs the hold binding once
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 4, 0x01, true);
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 3);
+    CU_ASSERT_STRING_EQUAL(calls[2], "setleds -scroll");
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 4, 0x00, false);
+    CU_ASSERT_EQUAL(call_count, 3);
+}
+
+void test_dispatch_chords(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 0);
+    add_binding(&cfg, 3, '+', "num");  // 3&4 = +num
+    key_binding_t* chord = &cfg.devices[0].bindings[4];
+    chord->trigger = TRIGGER_CHORD;
+    chord->chord_len = 1;
+    chord->chord[0] = 4;
+    compile_config(&cfg);
+    CU_ASSERT_EQUAL(cfg.layers[0].chord_count, 1);
+    call_count = 0;
+
+    // Either order completes the chord; the single-key bindings do not run
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 4, 0, true);
+    CU_ASSERT_EQUAL(call_count, 0);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 3, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 3, 0, false);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 4, 0, false);
+    CU_ASSERT_EQUAL(call_count, 1);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds +num");
+
+    // A chord key released on its own runs its own binding
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 3, 0, true);
+    CU_ASSERT_EQUAL(call_count, 1);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 3, 0, false);
+    CU_ASSERT_EQUAL(call_count, 2);
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds ^caps");
+
+    // A key outside the chord replays the held-back key first
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 3, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, true);
+    CU_ASSERT_EQUAL(call_count, 4);
+    CU_ASSERT_STRING_EQUAL(calls[2], "setleds ^caps");
+    CU_ASSERT_STRING_EQUAL(calls[3], "setleds +scroll");
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 3, 0, false);
+    CU_ASSERT_EQUAL(call_count, 4);
+    dispatch_reset(&dispatch);
+}
+
+void test_dispatch_leader_sequences(void)
+{
+    char path[] = "/tmp/belvedere_leader_XXXXXX";
+    int fd = mkstemp(path);
+    CU_ASSERT_FATAL(fd >= 0);
+    FILE* f = fdopen(fd, "w");
+    fprintf(f, "[general]\nsetleds = setleds\n");
+    fprintf(f, "[0x5043/0x54a3]\nleader_timeout_ms = 20\n");
+    fprintf(f, "1 = +scroll\n2 = -scroll\n");
+    fprintf(f, "9,1 = ^caps\n9,1,2 = ^num\n9,3 = +num\n");
+    fclose(f);
+
+    config_t cfg = {0};
+    CU_ASSERT_FATAL(load_config(path, &cfg));
+    unlink(path);
+    call_count = 0;
+
+    // A complete sequence with no longer continuation runs at once
+    CU_ASSERT(dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 9, 0, true) == true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 9, 0, false);
+    CU_ASSERT(dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 3, 0, true) == true);
+    CU_ASSERT_EQUAL(call_count, 1);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds +num");
+
+    // An ambiguous prefix runs once the timeout passes without a continuation
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 9, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, true);
+    CU_ASSERT_EQUAL(call_count, 1);
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 2);
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds ^caps");
+
+    // ... or is superseded by the longer sequence
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 9, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 2, 0, true);
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 3);
+    CU_ASSERT_STRING_EQUAL(calls[2], "setleds ^num");
+
+    // A key that continues no sequence abandons it and runs its own binding
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 9, 0, true);
+    CU_ASSERT(dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 2, 0, true) == true);
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 4);
+    CU_ASSERT_STRING_EQUAL(calls[3], "setleds -scroll");
+
+    // Keys outside any sequence are unaffected
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, true);
+    CU_ASSERT_EQUAL(call_count, 5);
+    CU_ASSERT_STRING_EQUAL(calls[4], "setleds +scroll");
+
+    dispatch_reset(&dispatch);
+    free_config(&cfg);
+}
+
+void test_dispatch_layers(void)
+{
+    char path[] = "/tmp/belvedere_layers_XXXXXX";
+    int fd = mkstemp(path);
+    CU_ASSERT_FATAL(fd >= 0);
+    FILE* f = fdopen(fd, "w");
+    fprintf(f, "[general]\nsetleds = setleds\n");
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "1 = +scroll\n2 = ^caps\n");
+    fprintf(f, "9 = layer: ^nav\n");
+    fprintf(f, "[0x5043/0x54a3:nav]\n");
+    fprintf(f, "1 = -scroll\n");
+    fprintf(f, "8 = layer: base\n");
+    fclose(f);
+
+    config_t cfg = {0};
+    CU_ASSERT_FATAL(load_config(path, &cfg));
+    unlink(path);
+    call_count = 0;
+
+    // The layer key swaps tables; later keys resolve through the new layer
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 9, 0, true);
+    CU_ASSERT_PTR_EQUAL(cfg.active, &cfg.layers[1]);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 1, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 2, 0, true);
+    CU_ASSERT_EQUAL(call_count, 3);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds +scroll");
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds -scroll");
+    CU_ASSERT_STRING_EQUAL(calls[2], "setleds ^caps");
+
+    // Toggling from the layer itself goes back to base, as does selecting base
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 9, 0, true);
+    CU_ASSERT_PTR_EQUAL(cfg.active, &cfg.layers[0]);
+    CU_ASSERT(dispatch_set_layer(&dispatch, &cfg, 1));
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x54a3, 8, 0, true);
+    CU_ASSERT_PTR_EQUAL(cfg.active, &cfg.layers[0]);
+    CU_ASSERT(dispatch_set_layer(&dispatch, &cfg, 5) == false);
+
+    dispatch_reset(&dispatch);
+    free_config(&cfg);
+}
+
+void test_dispatch_groups(void)
+{
+    char path[] = "/tmp/belvedere_groups_XXXXXX";
+    int fd = mkstemp(path);
+    CU_ASSERT_FATAL(fd >= 0);
+    FILE* f = fdopen(fd, "w");
+    fprintf(f, "[general]\nsetleds = setleds\n");
+    fprintf(f, "[group:keys]\n");
+    fprintf(f, "1 = +scroll\n2 = ^caps\n");
+    fprintf(f, "[0x5043/*]\n");
+    fprintf(f, "group = keys\n");
+    fprintf(f, "9 = layer: ^nav\n");
+    fprintf(f, "[0x5043/*:nav]\n");
+    fprintf(f, "1 = -scroll\n");
+    fclose(f);
+
+    config_t cfg = {0};
+    CU_ASSERT_FATAL(load_config(path, &cfg));
+    unlink(path);
+    call_count = 0;
+
+    // Any product of the vendor uses the group, and the vendor-wide layer section over it
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x0001, 1, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x0001, 9, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x0002, 1, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x0002, 2, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x1234, 0x0001, 1, 0, true);
+    CU_ASSERT_EQUAL(call_count, 3);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds +scroll");
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds -scroll");
+    CU_ASSERT_STRING_EQUAL(calls[2], "setleds ^caps");
+
+    dispatch_set_layer(&dispatch, &cfg, 0);
+    dispatch_reset(&dispatch);
+    free_config(&cfg);
+}
+
+void test_dispatch_command_templates(void)
+{
+    char path[] = "/tmp/belvedere_commands_XXXXXX";
+    int fd = mkstemp(path);
+    CU_ASSERT_FATAL(fd >= 0);
+    FILE* f = fdopen(fd, "w");
+    fprintf(f, "[general]\nsetleds = setleds\ncoalesce_ms = 50\n");
+    fprintf(f, "led_command = ledctl {device} {mode}{led}\n");
+    fprintf(f, "[0x5043/*]\n");
+    fprintf(f, "1 = cmd: notify \"{keycode} from {product}\"\n");
+    fprintf(f, "2 = ^caps\n");
+    fprintf(f, "3 = seq: +num, 10ms, -num\n");
+    fclose(f);
+
+    config_t cfg = {0};
+    CU_ASSERT_FATAL(load_config(path, &cfg));
+    unlink(path);
+    call_count = 0;
+
+    // Templates run at once, even with a coalescing window, with the event's device
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x0001, 1, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x0002, 2, 0, true);
+    dispatch_key_state(&dispatch, &cfg, 0x5043, 0x0003, 3, 0, true);
+    CU_ASSERT_EQUAL(call_count, 3);
+    CU_ASSERT_STRING_EQUAL(calls[0], "notify 1 from 0001");
+    CU_ASSERT_STRING_EQUAL(calls[1], "ledctl 5043:0002 ^caps");
+    CU_ASSERT_STRING_EQUAL(calls[2], "ledctl 5043:0003 +num");
+
+    run_until_idle();
+    CU_ASSERT_EQUAL(call_count, 4);
+    CU_ASSERT_STRING_EQUAL(calls[3], "ledctl 5043:0003 -num");
+
+    dispatch_reset(&dispatch);
+    free_config(&cfg);
+}
+
+void test_dispatch_template_arguments(void)
+{
+    char dir[] = "/tmp/belvedere_arguments_XXXXXX";
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(dir));
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/config", dir);
+    FILE* f = fopen(path, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fprintf(f, "[general]\nsetleds = setleds\n");
+    fprintf(f, "[0x5043/*]\n");
+    fprintf(f, "1 = cmd: touch \"%s/{keycode} b;x\"\n", dir);
+    fclose(f);
+
+    config_t cfg = {0};
+    CU_ASSERT_FATAL(load_config(path, &cfg));
+    unlink(path);
+
+    // The default executor gets the rendered argument whole: not split, not seen by a shell
+    CU_ASSERT(executor_set_mode(&executor, EXECUTOR_SYSTEM) == true);
+    dispatch_set_executor(&dispatch, NULL);
+    CU_ASSERT(dispatch_key_state(&dispatch, &cfg, 0x5043, 0x0001, 1, 0, true));
+    dispatch_set_executor(&dispatch, capture_executor);
+
+    char whole[PATH_MAX];
+    char split[PATH_MAX];
+    snprintf(whole, sizeof(whole), "%s/1 b;x", dir);
+    snprintf(split, sizeof(split), "%s/1", dir);
+    CU_ASSERT_EQUAL(access(whole, F_OK), 0);
+    CU_ASSERT_NOT_EQUAL(access(split, F_OK), 0);
+    unlink(whole);
+    rmdir(dir);
+
+    dispatch_reset(&dispatch);
+    free_config(&cfg);
+}
+
+// LED states published to the devices
+static uint8_t published[MAX_CALLS];
+static int publish_count = 0;
+
+static void capture_leds(uint8_t state, void* user_data)
+{
+    (void)user_data;  // Silence unused parameter warning
+    if (publish_count < MAX_CALLS)
+        published[publish_count++] = state;
+}
+
+void test_dispatch_led_state(void)
+{
+    config_t cfg;
+    setup_config(&cfg, 0);
+    call_count = 0;
+    publish_count = 0;
+    led_state_reset(&dispatch.leds);
+    led_state_set_sink(&dispatch.leds, capture_leds, NULL);
+
+    // Each change is published; an operation that changes nothing is not
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 3);  // ^caps
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 1);  // +scroll
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 1);
+    CU_ASSERT_EQUAL(publish_count, 2);
+    CU_ASSERT_EQUAL(published[0], LED_CAPS);
+    CU_ASSERT_EQUAL(published[1], LED_CAPS | LED_SCROLL);
+    CU_ASSERT_EQUAL(led_state_get(&dispatch.leds), LED_CAPS | LED_SCROLL);
+
+    // A coalescing window publishes its net change once
+    setup_config(&cfg, 50);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4);  // ^num
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 3);  // ^caps
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 2);  // -scroll
+    CU_ASSERT_EQUAL(publish_count, 2);
+    run_until_idle();
+    CU_ASSERT_EQUAL(publish_count, 3);
+    CU_ASSERT_EQUAL(published[2], LED_NUM);
+
+    // Changes that cancel out within a window send nothing
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4);
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 4);
+    run_until_idle();
+    CU_ASSERT_EQUAL(publish_count, 3);
+
+    led_state_set_sink(&dispatch.leds, NULL, NULL);
+    led_state_reset(&dispatch.leds);
+    dispatch_reset(&dispatch);
+}
+
+#ifdef __linux__
+// Batches written to the fake virtual keyboard
+static struct input_event emitted[32];
+static size_t emitted_count = 0;
+static int write_count = 0;
+
+static ssize_t capture_events(const void* data, size_t length)
+{
+    write_count++;
+    emitted_count = length / sizeof(struct input_event);
+    if (emitted_count > sizeof(emitted) / sizeof(emitted[0]))
+        return -1;
+    memcpy(emitted, data, length);
+    return (ssize_t)length;
+}
+
+static bool is_event(size_t i, uint16_t type, uint16_t code, int32_t value)
+{
+    return i < emitted_count && emitted[i].type == type && emitted[i].code == code &&
+           emitted[i].value == value;
+}
+
+void test_dispatch_key_actions(void)
+{
+    char path[] = "/tmp/belvedere_keys_XXXXXX";
+    int fd = mkstemp(path);
+    CU_ASSERT_FATAL(fd >= 0);
+    FILE* f = fdopen(fd, "w");
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "1 = key: ctrl+c\n");
+    fprintf(f, "2 = key: a b\n");
+    fclose(f);
+
+    config_t cfg = {0};
+    CU_ASSERT_FATAL(load_config(path, &cfg));
+    unlink(path);
+    uinput_set_sink(&dispatch.uinput, capture_events);
+    write_count = 0;
+
+    // A chord is pressed in order and released in reverse, in one write
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 1);
+    CU_ASSERT_EQUAL(write_count, 1);
+    CU_ASSERT_EQUAL_FATAL(emitted_count, 6);
+    CU_ASSERT(is_event(0, EV_KEY, KEY_LEFTCTRL, 1));
+    CU_ASSERT(is_event(1, EV_KEY, KEY_C, 1));
+    CU_ASSERT(is_event(2, EV_SYN, SYN_REPORT, 0));
+    CU_ASSERT(is_event(3, EV_KEY, KEY_C, 0));
+    CU_ASSERT(is_event(4, EV_KEY, KEY_LEFTCTRL, 0));
+    CU_ASSERT(is_event(5, EV_SYN, SYN_REPORT, 0));
+
+    // Consecutive strokes still share the write
+    dispatch_key_event(&dispatch, &cfg, 0x5043, 0x54a3, 2);
+    CU_ASSERT_EQUAL(write_count, 2);
+    CU_ASSERT_EQUAL_FATAL(emitted_count, 8);
+    CU_ASSERT(is_event(0, EV_KEY, KEY_A, 1));
+    CU_ASSERT(is_event(2, EV_KEY, KEY_A, 0));
+    CU_ASSERT(is_event(4, EV_KEY, KEY_B, 1));
+    CU_ASSERT(is_event(7, EV_SYN, SYN_REPORT, 0));
+
+    // Without a sink or a virtual keyboard nothing is written
+    uinput_set_sink(&dispatch.uinput, NULL);
+    CU_ASSERT_EQUAL(uinput_emit(&dispatch.uinput, cfg.devices[0].bindings[0].payload,
+                                cfg.devices[0].bindings[0].payload_len),
+                    -1);
+
+    dispatch_reset(&dispatch);
+    free_config(&cfg);
+}
+#endif
+
+int main(void)
+{
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+
+    CU_pSuite pSuite = CU_add_suite("Dispatch Tests", NULL, NULL);
+    if (NULL == pSuite)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    executor_init(&executor, uv_default_loop(), NULL);
+    dispatch_init(&dispatch, uv_default_loop(), &executor, NULL);
+    dispatch_set_executor(&dispatch, capture_executor);
+
+    if ((NULL == CU_add_test(pSuite, "test_dispatch_runs_immediately_without_window",
+                             test_dispatch_runs_immediately_without_window)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_coalesces_window",
+                             test_dispatch_coalesces_window)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_coalesce_all_cancelled",
+                             test_dispatch_coalesce_all_cancelled)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_debounce", test_dispatch_debounce)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_max_rate", test_dispatch_max_rate)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_sequence", test_dispatch_sequence)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_sequence_reset",
+                             test_dispatch_sequence_reset)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_tap_and_hold", test_dispatch_tap_and_hold)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_double_tap", test_dispatch_double_tap)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_modifiers", test_dispatch_modifiers)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_modifier_release",
+                             test_dispatch_modifier_release)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_chords", test_dispatch_chords)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_leader_sequences",
+                             test_dispatch_leader_sequences)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_layers", test_dispatch_layers)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_groups", test_dispatch_groups)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_command_templates",
+                             test_dispatch_command_templates)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_template_arguments",
+                             test_dispatch_template_arguments)) ||
+        (NULL == CU_add_test(pSuite, "test_dispatch_led_state", test_dispatch_led_state)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+#ifdef __linux__
+    if (NULL == CU_add_test(pSuite, "test_dispatch_key_actions", test_dispatch_key_actions))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+#endif
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    dispatch_cleanup(&dispatch);
+    executor_cleanup(&executor);
+    uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -0,0 +1,194 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "../include/config.h"
+#include "../include/evdev_manager.h"
+#include "../include/metrics.h"
+
+// After the headers above, so its LED_ codes quietly replace led_state.h's report bits
+#include <linux/input.h>
+
+#define MAX_KEYS 8
+
+config_t config;
+static metrics_t metrics;
+static evdev_manager_t manager;
+
+// Key events delivered by the manager
+typedef struct
+{
+    uint16_t vendor_id;
+    uint8_t section;
+    uint16_t keycode;
+    uint8_t modifiers;
+    bool pressed;
+} key_event_t;
+
+static key_event_t keys[MAX_KEYS];
+static int key_count = 0;
+
+static void capture_key(uint16_t vendor_id, uint16_t product_id, uint8_t section,
+                        uint16_t keycode, uint8_t modifiers, bool pressed, void* user_data)
+{
+    (void)product_id;
+    (void)user_data;
+    if (key_count < MAX_KEYS)
+        keys[key_count++] = (key_event_t){vendor_id, section, keycode, modifiers, pressed};
+}
+
+static void send_event(int fd, uint16_t type, uint16_t code, int32_t value)
+{
+    struct input_event ev = {.type = type, .code = code, .value = value};
+    CU_ASSERT_EQUAL(write(fd, &ev, sizeof(ev)), (ssize_t)sizeof(ev));
+}
+
+static void run_loop(void)
+{
+    for (int i = 0; i < 10; i++)
+        uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+}
+
+void test_evdev_maps_key_events(void)
+{
+    int fds[2];
+    CU_ASSERT_FATAL(pipe(fds) == 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    CU_ASSERT_FATAL(evdev_manager_attach(&manager, fds[0], 0x5043, 0x54a3, 2));
+    key_count = 0;
+
+    // Kernel key codes arrive as HID usages, with the modifier byte of the held keys
+    send_event(fds[1], EV_MSC, MSC_SCAN, 0x70039);
+    send_event(fds[1], EV_KEY, KEY_LEFTSHIFT, 1);
+    send_event(fds[1], EV_KEY, KEY_CAPSLOCK, 1);
+    send_event(fds[1], EV_SYN, SYN_REPORT, 0);
+    send_event(fds[1], EV_KEY, KEY_CAPSLOCK, 2);  // autorepeat
+    send_event(fds[1], EV_KEY, KEY_CAPSLOCK, 0);
+    send_event(fds[1], EV_KEY, KEY_LEFTSHIFT, 0);
+    send_event(fds[1], EV_SYN, SYN_REPORT, 0);
+    run_loop();
+
+    CU_ASSERT_EQUAL_FATAL(key_count, 4);
+    CU_ASSERT(keys[0].vendor_id == 0x5043 && keys[0].keycode == 0xE1 && keys[0].pressed);
+    CU_ASSERT_EQUAL(keys[0].modifiers, 0x02);
+    CU_ASSERT_EQUAL(keys[0].section, 2);  // the section given when the device was attached
+    CU_ASSERT(keys[1].keycode == 0x39 && keys[1].pressed && keys[1].modifiers == 0x02);
+    CU_ASSERT(keys[2].keycode == 0x39 && !keys[2].pressed);
+    CU_ASSERT(keys[3].keycode == 0xE1 && !keys[3].pressed && keys[3].modifiers == 0);
+
+    // Events up to the report after a drop are incomplete and skipped
+    key_count = 0;
+    send_event(fds[1], EV_SYN, SYN_DROPPED, 0);
+    send_event(fds[1], EV_KEY, KEY_A, 1);
+    send_event(fds[1], EV_SYN, SYN_REPORT, 0);
+    send_event(fds[1], EV_KEY, KEY_B, 1);
+    run_loop();
+    CU_ASSERT_EQUAL_FATAL(key_count, 1);
+    CU_ASSERT_EQUAL(keys[0].keycode, 0x05);
+
+    // A device that goes away is closed without affecting the others, releasing its keys
+    key_count = 0;
+    send_event(fds[1], EV_SYN, SYN_REPORT, 0);
+    send_event(fds[1], EV_KEY, KEY_LEFTCTRL, 1);
+    send_event(fds[1], EV_SYN, SYN_REPORT, 0);
+    run_loop();
+    close(fds[1]);
+    run_loop();
+    CU_ASSERT_EQUAL_FATAL(key_count, 3);
+    CU_ASSERT(keys[1].keycode == 0xE0 || keys[2].keycode == 0xE0);
+    CU_ASSERT(keys[1].keycode == 0x05 || keys[2].keycode == 0x05);
+    CU_ASSERT(!keys[1].pressed && !keys[2].pressed && keys[2].modifiers == 0);
+
+    // A reload that moves the device's section takes effect at once
+    CU_ASSERT_FATAL(pipe(fds) == 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    CU_ASSERT_FATAL(evdev_manager_attach(&manager, fds[0], 0x5043, 0x54a3, 0));
+    memset(&config, 0, sizeof(config));
+    config.device_count = 2;
+    config.devices[0].vendor = 0x1234;
+    config.devices[1].vendor = 0x5043;
+    config.devices[1].product = 0x54a3;
+    evdev_manager_set_config(&manager, &config);
+    evdev_manager_set_config(&manager, NULL);
+    key_count = 0;
+    send_event(fds[1], EV_KEY, KEY_A, 1);
+    send_event(fds[1], EV_SYN, SYN_REPORT, 0);
+    run_loop();
+    CU_ASSERT_EQUAL_FATAL(key_count, 1);
+    CU_ASSERT_EQUAL(keys[0].section, 1);
+
+    // Shutting down releases them too
+    evdev_manager_cleanup(&manager);
+    run_loop();
+    CU_ASSERT_EQUAL_FATAL(key_count, 2);
+    CU_ASSERT(keys[1].keycode == 0x04 && !keys[1].pressed);
+    close(fds[1]);
+}
+
+void test_evdev_reload_without_sections(void)
+{
+    char path[] = "/tmp/belvedere_evdev_XXXXXX";
+    int fd = mkstemp(path);
+    CU_ASSERT_FATAL(fd >= 0);
+    FILE* f = fdopen(fd, "w");
+    fprintf(f, "[0x5043/0x54a3]\n");
+    fprintf(f, "input = evdev\n");
+    fprintf(f, "grab = true\n");
+    fprintf(f, "57 = ^caps\n");
+    fprintf(f, "[0x5262/0x4e4b]\n");
+    fprintf(f, "input = bogus\n");
+    fprintf(f, "57 = ^caps\n");
+    fclose(f);
+
+    CU_ASSERT_FATAL(load_config(path, &config));
+    unlink(path);
+    CU_ASSERT_EQUAL(config.devices[0].input, INPUT_EVDEV);
+    CU_ASSERT(config.devices[0].grab);
+    CU_ASSERT_EQUAL(config.devices[1].input, INPUT_HID);
+    CU_ASSERT(!config.devices[1].grab);
+
+    // Without a configuration there is nothing to match devices against
+    CU_ASSERT(!evdev_manager_reload(&manager));
+
+    // With no evdev sections nothing is opened, whatever /dev/input holds
+    evdev_manager_set_config(&manager, &config);
+    config.devices[0].input = INPUT_HID;
+    CU_ASSERT(evdev_manager_reload(&manager));
+    free_config(&config);
+}
+
+int main(void)
+{
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+
+    CU_pSuite pSuite = CU_add_suite("Evdev Manager Tests", NULL, NULL);
+    if (NULL == pSuite)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    evdev_manager_init(&manager, uv_default_loop(), NULL, &metrics);
+    evdev_manager_set_key_callback(&manager, capture_key, NULL);
+
+    if ((NULL == CU_add_test(pSuite, "test_evdev_maps_key_events", test_evdev_maps_key_events)) ||
+        (NULL == CU_add_test(pSuite, "test_evdev_reload_without_sections",
+                             test_evdev_reload_without_sections)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -0,0 +1,171 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>  // for access, unlink, rmdir
+#include <uv.h>
+
+#include "../include/config.h"
+#include "../include/executor.h"
+
+#define MAX_RESULTS 8
+
+static executor_t executor;
+static int results[MAX_RESULTS];
+static int result_count = 0;
+
+static void on_done(int status, uint64_t latency_ns, void* user_data)
+{
+    (void)latency_ns;  // Silence unused parameter warning
+    (void)user_data;   // Silence unused parameter warning
+    if (result_count < MAX_RESULTS)
+        results[result_count++] = status;
+}
+
+static void on_timeout(uv_timer_t* handle)
+{
+    uv_stop(handle->loop);
+}
+
+// Run the loop until `count` completions arrived or two seconds passed
+static void wait_for_results(int count)
+{
+    uv_timer_t timer;
+    uv_timer_init(uv_default_loop(), &timer);
+    uv_timer_start(&timer, on_timeout, 2000, 0);
+    while (result_count < count)
+    {
+        if (uv_run(uv_default_loop(), UV_RUN_ONCE) == 0 || !uv_is_active((uv_handle_t*)&timer))
+            break;
+    }
+    uv_timer_stop(&timer);
+    uv_close((uv_handle_t*)&timer, NULL);
+    uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+}
+
+static int has_exit_status(int code)
+{
+    for (int i = 0; i < result_count; i++)
+    {
+        if (results[i] >= 0 && WIFEXITED(results[i]) && WEXITSTATUS(results[i]) == code)
+            return 1;
+    }
+    return 0;
+}
+
+void test_executor_helper_runs_commands(void)
+{
+    result_count = 0;
+    CU_ASSERT(executor_set_mode(&executor, EXECUTOR_HELPER) == true);
+
+    char* ok[] = {"/bin/sh", "-c", "exit 0", NULL};
+    char* fail[] = {"/bin/sh", "-c", "exit 3", NULL};
+
+    // Helper mode returns immediately; statuses arrive asynchronously
+    CU_ASSERT_EQUAL(executor_run(&executor, ok), 0);
+    CU_ASSERT_EQUAL(executor_run(&executor, fail), 0);
+    wait_for_results(2);
+
+    CU_ASSERT_EQUAL(result_count, 2);
+    CU_ASSERT(has_exit_status(0));
+    CU_ASSERT(has_exit_status(3));
+}
+
+void test_executor_helper_reports_spawn_failure(void)
+{
+    result_count = 0;
+    CU_ASSERT(executor_set_mode(&executor, EXECUTOR_HELPER) == true);
+
+    char* missing[] = {"/nonexistent/belvedere-test-binary", NULL};
+    CU_ASSERT_EQUAL(executor_run(&executor, missing), 0);
+    wait_for_results(1);
+
+    CU_ASSERT_EQUAL(result_count, 1);
+    if (result_count == 1)
+    {
+        // posix_spawn either fails outright or the child exits with 127
+        CU_ASSERT(results[0] == -1 || (WIFEXITED(results[0]) && WEXITSTATUS(results[0]) == 127));
+    }
+}
+
+void test_executor_system_mode(void)
+{
+    result_count = 0;
+    CU_ASSERT(executor_set_mode(&executor, EXECUTOR_SYSTEM) == true);
+
+    char* fail[] = {"/bin/sh", "-c", "exit 4", NULL};
+    int status = executor_run(&executor, fail);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 4);
+
+    // System mode completes synchronously
+    CU_ASSERT_EQUAL(result_count, 1);
+    CU_ASSERT(has_exit_status(4));
+
+    char* missing[] = {"/nonexistent/belvedere-test-binary", NULL};
+    CU_ASSERT_EQUAL(executor_run(&executor, missing), -1);
+    CU_ASSERT_EQUAL(result_count, 2);
+}
+
+void test_executor_system_mode_arguments(void)
+{
+    CU_ASSERT(executor_set_mode(&executor, EXECUTOR_SYSTEM) == true);
+
+    // Spaces, quotes and separators are not split or interpreted again
+    char* check[] = {"/bin/sh", "-c", "[ $# -eq 1 ] && [ \"$1\" = 'a b;exit 3' ]", "sh",
+                     "a b;exit 3", NULL};
+    int status = executor_run(&executor, check);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    char dir[] = "/tmp/belvedere_executor_XXXXXX";
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(dir));
+    char path[64];
+    char single[64];
+    snprintf(path, sizeof(path), "%s/a b", dir);
+    snprintf(single, sizeof(single), "%s/a", dir);
+    char* touch[] = {"touch", path, NULL};
+    status = executor_run(&executor, touch);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CU_ASSERT_EQUAL(access(path, F_OK), 0);
+    CU_ASSERT_NOT_EQUAL(access(single, F_OK), 0);
+    unlink(path);
+    rmdir(dir);
+}
+
+int main(void)
+{
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+
+    CU_pSuite pSuite = CU_add_suite("Executor Tests", NULL, NULL);
+    if (NULL == pSuite)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    executor_init(&executor, uv_default_loop(), NULL);
+    executor_set_done_callback(&executor, on_done, NULL);
+
+    if ((NULL == CU_add_test(pSuite, "test_executor_helper_runs_commands",
+                             test_executor_helper_runs_commands)) ||
+        (NULL == CU_add_test(pSuite, "test_executor_helper_reports_spawn_failure",
+                             test_executor_helper_reports_spawn_failure)) ||
+        (NULL == CU_add_test(pSuite, "test_executor_system_mode", test_executor_system_mode)) ||
+        (NULL == CU_add_test(pSuite, "test_executor_system_mode_arguments",
+                             test_executor_system_mode_arguments)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    executor_cleanup(&executor);
+    uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -6,14 +6,17 @@
 #include <uv.h>
 #include "../include/hid_manager.h"
 #include "../include/config.h"
+#include "../include/metrics.h"
 
 // Simple test framework
 #define TEST(name) void test_##name(void)
 #define ASSERT(condition) assert(condition)
 #define TEST_RUN(name) test_##name(); printf("✓ %s passed\n", #name)
 
-// Global configuration
+// Global configuration, and the manager under test
 config_t config = {0};
+static metrics_t metrics;
+static hid_manager_t manager;
 
 // Mock HID device for testing
 typedef struct {
@@ -21,6 +24,11 @@ typedef struct {
     uint16_t product_id;
     unsigned char buffer[64];
     int buffer_size;
+    bool unplugged;  // reads fail as they do once a device is gone
+    int open_failures;  // opens to fail before one succeeds
+    int opens;
+    uint64_t open_times[8];  // uv_hrtime() of the first opens, for the backoff test
+    int reads;
 } mock_hid_device_t;
 
 // Global mock device for testing
@@ -41,8 +49,8 @@ int mock_hid_init(void) {
 }
 
 // Mock hid_exit
-void mock_hid_exit(void) {
-    // Nothing to do
+int mock_hid_exit(void) {
+    return 0;  // Nothing to do
 }
 
 // Mock hid_enumerate
@@ -74,6 +82,13 @@ void mock_hid_free_enumeration(struct hid_device_info* devs) {
 // Mock hid_open_path
 hid_device* mock_hid_open_path(const char* path) {
     (void)path;  // Silence unused parameter warning
+    if (mock_device.opens < 8)
+        mock_device.open_times[mock_device.opens] = uv_hrtime();
+    mock_device.opens++;
+    if (mock_device.open_failures > 0) {
+        mock_device.open_failures--;
+        return NULL;
+    }
     // Return a non-NULL pointer to indicate success
     return (hid_device*)1;
 }
@@ -89,12 +104,48 @@ int mock_hid_read_timeout(hid_device* device, unsigned char* data, size_t length
     (void)device;  // Silence unused parameter warning
     (void)length;  // Silence unused parameter warning
     (void)milliseconds;  // Silence unused parameter warning
+    mock_device.reads++;
+    if (mock_device.unplugged)
+        return -1;
 
     // Copy our mock buffer to the provided buffer
     memcpy(data, mock_device.buffer, mock_device.buffer_size);
     return mock_device.buffer_size;
 }
 
+// Output reports sent through the mock backend
+static int write_count = 0;
+static unsigned char last_write[8];
+
+// Mock hid_write
+int mock_hid_write(hid_device* device, const unsigned char* data, size_t length) {
+    (void)device;  // Silence unused parameter warning
+    write_count++;
+    memcpy(last_write, data, length < sizeof(last_write) ? length : sizeof(last_write));
+    return (int)length;
+}
+
+// Backend wiring the mocks into the HID manager
+static const hid_backend_t mock_backend = {
+    .init = mock_hid_init,
+    .exit = mock_hid_exit,
+    .enumerate = mock_hid_enumerate,
+    .free_enumeration = mock_hid_free_enumeration,
+    .open_path = mock_hid_open_path,
+    .close = mock_hid_close,
+    .read_timeout = mock_hid_read_timeout,
+    .write = mock_hid_write,
+};
+
+// Start a reload and run the loop until the new devices are attached
+static bool reload_and_wait(void) {
+    if (!hid_manager_reload(&manager))
+        return false;
+    while (hid_manager_reloading(&manager))
+        uv_run(uv_default_loop(), UV_RUN_ONCE);
+    return true;
+}
+
 // Test HID manager initialization
 TEST(hid_manager_init) {
     // Set up mock functions
@@ -102,10 +153,10 @@ TEST(hid_manager_init) {
     // For simplicity, we're just declaring these as external
 
     // Initialize HID manager
-    ASSERT(hid_manager_init() == true);
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
 
     // Clean up
-    hid_manager_cleanup();
+    hid_manager_cleanup(&manager);
 }
 
 // Test HID device reloading
@@ -116,54 +167,369 @@ TEST(hid_manager_reload) {
     config.devices[0].product = 0x54a3;
 
     // Initialize HID manager
-    ASSERT(hid_manager_init() == true);
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
 
     // Reload devices
-    ASSERT(hid_manager_reload() == true);
+    ASSERT(reload_and_wait() == true);
 
     // Clean up
-    hid_manager_cleanup();
+    hid_manager_cleanup(&manager);
 }
 
 // Callback function for key events
-static void test_callback(uint16_t vendor_id, uint16_t product_id, uint16_t keycode, void* user_data) {
+static void test_callback(uint16_t vendor_id, uint16_t product_id, uint8_t section,
+                          uint16_t keycode, uint8_t modifiers, bool pressed, void* user_data) {
+    (void)section;  // Silence unused parameter warning
+    (void)modifiers;  // Silence unused parameter warning
     (void)vendor_id;  // Silence unused parameter warning
     (void)product_id;  // Silence unused parameter warning
     (void)keycode;  // Silence unused parameter warning
+    (void)pressed;  // Silence unused parameter warning
     int* callback_called = (int*)user_data;
     *callback_called = 1;
 }
 
+// Records the last event for the press/release test
+static struct {
+    int count;
+    uint8_t section;
+    uint16_t keycode;
+    uint8_t modifiers;
+    bool pressed;
+} last_event;
+
+static void record_callback(uint16_t vendor_id, uint16_t product_id, uint8_t section,
+                            uint16_t keycode, uint8_t modifiers, bool pressed, void* user_data) {
+    (void)vendor_id;  // Silence unused parameter warning
+    (void)product_id;  // Silence unused parameter warning
+    (void)user_data;  // Silence unused parameter warning
+    last_event.count++;
+    last_event.section = section;
+    last_event.keycode = keycode;
+    last_event.modifiers = modifiers;
+    last_event.pressed = pressed;
+}
+
 // Test key event callback
 TEST(key_event_callback) {
     int callback_called = 0;
 
     // Set up mock device
-    mock_device.buffer[0] = 0;  // Report ID
-    mock_device.buffer[1] = 111;  // Keycode
+    mock_device.buffer[0] = 111;  // Keycode
+    mock_device.buffer[1] = 0;
     mock_device.buffer_size = 2;
 
     // Initialize HID manager
-    ASSERT(hid_manager_init() == true);
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
+
+    // Open the mock device
+    ASSERT(reload_and_wait() == true);
 
     // Set callback
-    hid_manager_set_key_callback(test_callback, &callback_called);
+    hid_manager_set_key_callback(&manager, test_callback, &callback_called);
 
     // Simulate device polling
-    hid_manager_poll();
+    hid_manager_poll(&manager);
 
     // Verify callback was called
     ASSERT(callback_called == 1);
 
     // Clean up
-    hid_manager_cleanup();
+    hid_manager_cleanup(&manager);
+}
+
+// Reports become presses and releases; repeated reports are not new events
+TEST(press_release_events) {
+    memset(&last_event, 0, sizeof(last_event));
+    last_event.section = KEYMAP_EMPTY;
+    mock_device.buffer[0] = 0;
+    mock_device.buffer_size = 2;
+
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
+    ASSERT(reload_and_wait() == true);
+    hid_manager_set_key_callback(&manager, record_callback, NULL);
+
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 0);
+
+    mock_device.buffer[0] = 111;
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 1 && last_event.keycode == 111 && last_event.pressed);
+    ASSERT(last_event.section == 0);  // the section resolved when the device was opened
+
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 1);
+
+    mock_device.buffer[0] = 0;
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 2 && last_event.keycode == 111 && !last_event.pressed);
+
+    hid_manager_cleanup(&manager);
+}
+
+// Open devices follow their section when a reload inserts another before it
+TEST(sections_follow_config) {
+    memset(&last_event, 0, sizeof(last_event));
+    mock_device.buffer[0] = 0;
+    mock_device.buffer_size = 2;
+
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
+    ASSERT(reload_and_wait() == true);
+    hid_manager_set_key_callback(&manager, record_callback, NULL);
+
+    // The configuration is replaced in place, as a reload does, before devices are reopened
+    config.devices[1] = config.devices[0];
+    config.devices[0].vendor = 0x1234;
+    config.device_count = 2;
+    hid_manager_set_config(&manager, &config);
+
+    mock_device.buffer[0] = 111;
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 1 && last_event.section == 1);
+
+    config.devices[0] = config.devices[1];
+    config.device_count = 1;
+    hid_manager_set_config(&manager, &config);
+    mock_device.buffer[0] = 0;
+    hid_manager_cleanup(&manager);
+}
+
+// Boot keyboard reports: modifiers become keys 0xE0-0xE7 and travel with every event
+TEST(boot_report_events) {
+    memset(&last_event, 0, sizeof(last_event));
+    memset(mock_device.buffer, 0, sizeof(mock_device.buffer));
+    mock_device.buffer_size = 8;
+    config.devices[0].report_format = REPORT_BOOT;
+
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
+    ASSERT(reload_and_wait() == true);
+    hid_manager_set_key_callback(&manager, record_callback, NULL);
+
+    mock_device.buffer[0] = 0x01;  // Left ctrl
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 1 && last_event.keycode == 0xE0 && last_event.pressed);
+
+    mock_device.buffer[2] = 0x04;  // A, with ctrl still down
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 2 && last_event.keycode == 0x04 && last_event.modifiers == 0x01);
+
+    mock_device.buffer[2] = 0x01;  // Rollover error: no change
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 2);
+
+    memset(mock_device.buffer, 0, 8);
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 4 && !last_event.pressed && last_event.modifiers == 0);
+
+    config.devices[0].report_format = REPORT_KEYCODE;
+    hid_manager_cleanup(&manager);
+}
+
+// A device with a base and a layer section is opened once
+TEST(layer_sections_open_once) {
+    memset(&last_event, 0, sizeof(last_event));
+    memset(mock_device.buffer, 0, sizeof(mock_device.buffer));
+    mock_device.buffer_size = 8;
+    config.device_count = 2;
+    config.devices[0].report_format = REPORT_BOOT;
+    config.devices[0].layer = 1;
+    config.devices[1] = config.devices[0];
+    config.devices[1].layer = 0;
+
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
+    ASSERT(reload_and_wait() == true);
+    hid_manager_set_key_callback(&manager, record_callback, NULL);
+
+    mock_device.buffer[2] = 0x04;
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 1 && last_event.keycode == 0x04);
+
+    config.device_count = 1;
+    config.devices[0].layer = 0;
+    config.devices[0].report_format = REPORT_KEYCODE;
+    mock_device.buffer[2] = 0;
+    hid_manager_cleanup(&manager);
+}
+
+// A vendor-wide section opens any product of its vendor, with that section's settings
+TEST(wildcard_section_opens_device) {
+    memset(&last_event, 0, sizeof(last_event));
+    memset(mock_device.buffer, 0, sizeof(mock_device.buffer));
+    mock_device.buffer_size = 8;
+    config.device_count = 1;
+    config.devices[0].kind = SECTION_VENDOR;
+    config.devices[0].product = 0;
+    config.devices[0].report_format = REPORT_BOOT;
+
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
+    ASSERT(reload_and_wait() == true);
+    hid_manager_set_key_callback(&manager, record_callback, NULL);
+
+    mock_device.buffer[2] = 0x04;
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 1 && last_event.keycode == 0x04);
+    hid_manager_cleanup(&manager);
+
+    // Another vendor's section does not match
+    memset(&last_event, 0, sizeof(last_event));
+    config.devices[0].vendor = 0x1234;
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
+    ASSERT(reload_and_wait() == true);
+    hid_manager_set_key_callback(&manager, record_callback, NULL);
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 0);
+
+    config.devices[0].kind = SECTION_DEVICE;
+    config.devices[0].vendor = 0x5043;
+    config.devices[0].product = 0x54a3;
+    config.devices[0].report_format = REPORT_KEYCODE;
+    mock_device.buffer[2] = 0;
+    hid_manager_cleanup(&manager);
+}
+
+// LED state goes only to opted-in devices, and only when it differs from what they have
+TEST(led_sync_sends_changes) {
+    config.device_count = 1;
+    config.devices[0].led_sync = false;
+    write_count = 0;
+
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
+    ASSERT(reload_and_wait() == true);
+    hid_manager_sync_leds(&manager, 0x02);
+    ASSERT(write_count == 0);
+
+    // A device opened after a sync catches up with the latest state
+    config.devices[0].led_sync = true;
+    ASSERT(reload_and_wait() == true);
+    ASSERT(write_count == 1 && last_write[0] == 0x00 && last_write[1] == 0x02);
+
+    hid_manager_sync_leds(&manager, 0x02);
+    ASSERT(write_count == 1);
+    hid_manager_sync_leds(&manager, 0x06);
+    ASSERT(write_count == 2 && last_write[1] == 0x06);
+
+    config.devices[0].led_sync = false;
+    hid_manager_cleanup(&manager);
+}
+
+// Reloading happens off the loop thread; the old devices keep working until the swap
+TEST(reload_runs_in_background) {
+    memset(&last_event, 0, sizeof(last_event));
+    mock_device.buffer[0] = 0;
+    mock_device.buffer_size = 2;
+    config.device_count = 1;
+
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
+    ASSERT(reload_and_wait() == true);
+    hid_manager_set_key_callback(&manager, record_callback, NULL);
+
+    ASSERT(hid_manager_reload(&manager) == true);
+    ASSERT(hid_manager_reloading(&manager));
+    mock_device.buffer[0] = 111;
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 1 && last_event.pressed);
+
+    // A second request while one is in flight runs after it; both leave one device open
+    mock_device.opens = 0;
+    ASSERT(hid_manager_reload(&manager) == true);
+    while (hid_manager_reloading(&manager))
+        uv_run(uv_default_loop(), UV_RUN_ONCE);
+
+    // The device kept its settings, so it stays open with its held key
+    ASSERT(mock_device.opens == 0);
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 1);
+
+    // Changed settings reopen it, and the reopened device starts with no keys held
+    config.devices[0].report_format = REPORT_BOOT;
+    mock_device.buffer_size = 8;
+    mock_device.buffer[0] = 0;
+    mock_device.buffer[2] = 111;
+    ASSERT(reload_and_wait() == true);
+    ASSERT(mock_device.opens == 1);
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 2 && last_event.keycode == 111 && last_event.pressed);
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 2);
+
+    // Cleaning up with a reload in flight drops its results
+    ASSERT(hid_manager_reload(&manager) == true);
+    hid_manager_cleanup(&manager);
+    ASSERT(!hid_manager_reloading(&manager));
+    uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 2);
+
+    config.devices[0].report_format = REPORT_KEYCODE;
+    mock_device.buffer[2] = 0;
+    mock_device.buffer_size = 2;
+}
+
+// A device whose read fails is closed and no longer polled, then reopened with backoff
+TEST(dead_device_reopens) {
+    status_device_t devices[4];
+    memset(&last_event, 0, sizeof(last_event));
+    mock_device.buffer[0] = 111;
+    mock_device.buffer_size = 2;
+    config.device_count = 1;
+
+    ASSERT(hid_manager_init(&manager, uv_default_loop(), NULL, &metrics) == true);
+    ASSERT(reload_and_wait() == true);
+    hid_manager_set_key_callback(&manager, record_callback, NULL);
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 1 && last_event.pressed);
+
+    // The held key is released when the device goes away
+    mock_device.unplugged = true;
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 2 && last_event.keycode == 111 && !last_event.pressed);
+    ASSERT(hid_manager_list_devices(&manager, devices, 4) == 0);
+    int reads = mock_device.reads;
+    hid_manager_poll(&manager);
+    ASSERT(mock_device.reads == reads);
+
+    // Failed attempts back off: 250ms before the first, then 500ms, then 1000ms
+    mock_device.unplugged = false;
+    mock_device.open_failures = 2;
+    mock_device.opens = 0;
+    uint64_t lost = uv_hrtime();
+    while (hid_manager_list_devices(&manager, devices, 4) == 0 &&
+           uv_hrtime() - lost < 5000000000ull)
+        uv_run(uv_default_loop(), UV_RUN_ONCE);
+    ASSERT(hid_manager_list_devices(&manager, devices, 4) == 1);
+    ASSERT(mock_device.opens == 3);
+    const uint64_t waits_ms[] = {250, 500, 1000};
+    uint64_t previous = lost;
+    for (int k = 0; k < 3; k++) {
+        uint64_t waited_ms = (mock_device.open_times[k] - previous) / 1000000;
+        ASSERT(waited_ms + 5 >= waits_ms[k] && waited_ms < waits_ms[k] + 200);
+        previous = mock_device.open_times[k];
+    }
+
+    // The reopened device is polled again and its key pressed anew
+    hid_manager_poll(&manager);
+    ASSERT(last_event.count == 3 && last_event.keycode == 111 && last_event.pressed);
+
+    mock_device.buffer[0] = 0;
+    hid_manager_cleanup(&manager);
+    uv_run(uv_default_loop(), UV_RUN_NOWAIT);
 }
 
 int main() {
     printf("Running HID manager tests...\n");
+    hid_manager_set_backend(&manager, &mock_backend);
+    hid_manager_set_config(&manager, &config);
     TEST_RUN(hid_manager_init);
     TEST_RUN(hid_manager_reload);
     TEST_RUN(key_event_callback);
+    TEST_RUN(press_release_events);
+    TEST_RUN(sections_follow_config);
+    TEST_RUN(boot_report_events);
+    TEST_RUN(layer_sections_open_once);
+    TEST_RUN(wildcard_section_opens_device);
+    TEST_RUN(led_sync_sends_changes);
+    TEST_RUN(reload_runs_in_background);
+    TEST_RUN(dead_device_reopens);
     printf("All HID manager tests passed!\n");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "../include/hid_uring.h"
+
+#define MAX_REPORTS 8
+#define PIPES 3
+
+// Reports delivered by the ring
+typedef struct
+{
+    size_t slot;
+    unsigned char bytes[HID_URING_REPORT_SIZE];
+    int length;
+} report_t;
+
+static hid_uring_t ring;
+static report_t reports[MAX_REPORTS];
+static int report_count = 0;
+
+static void capture_report(size_t slot, const unsigned char* report, int length,
+                           void* user_data)
+{
+    CU_ASSERT_PTR_EQUAL(user_data, &ring);
+    if (report_count >= MAX_REPORTS)
+        return;
+    reports[report_count].slot = slot;
+    reports[report_count].length = length;
+    if (report)
+        memcpy(reports[report_count].bytes, report, (size_t)length);
+    report_count++;
+}
+
+// Run the loop until the expected number of reports arrived, or give up
+static void wait_reports(int expected)
+{
+    for (int i = 0; i < 1000 && report_count < expected; i++)
+        uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+}
+
+void test_hid_uring_reads_reports(void)
+{
+    int pipes[PIPES][2];
+    int fds[PIPES];
+    for (int i = 0; i < PIPES; i++)
+    {
+        CU_ASSERT_FATAL(pipe(pipes[i]) == 0);
+        fds[i] = pipes[i][0];
+    }
+
+    report_count = 0;
+    hid_uring_init(&ring);
+    if (!hid_uring_start(&ring, uv_default_loop(), fds, PIPES, capture_report, &ring))
+    {
+        // Kernels without io_uring, or sandboxes that block it, leave devices to polling
+        printf("io_uring unavailable, skipping ");
+        for (int i = 0; i < PIPES; i++)
+        {
+            close(pipes[i][0]);
+            close(pipes[i][1]);
+        }
+        return;
+    }
+
+    // Each report comes back whole, tagged with the slot it was read from
+    const unsigned char first[] = {0x00, 0x00, 0x39, 0x00, 0x00, 0x00, 0x00, 0x00};
+    const unsigned char second[] = {0x02, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00};
+    CU_ASSERT_EQUAL(write(pipes[2][1], first, sizeof(first)), (ssize_t)sizeof(first));
+    wait_reports(1);
+    CU_ASSERT_EQUAL_FATAL(report_count, 1);
+    CU_ASSERT_EQUAL(reports[0].slot, 2);
+    CU_ASSERT_EQUAL(reports[0].length, (int)sizeof(first));
+    CU_ASSERT(memcmp(reports[0].bytes, first, sizeof(first)) == 0);
+
+    // Reads are posted again, so the same slot keeps delivering alongside the others
+    CU_ASSERT_EQUAL(write(pipes[0][1], second, sizeof(second)), (ssize_t)sizeof(second));
+    CU_ASSERT_EQUAL(write(pipes[2][1], second, sizeof(second)), (ssize_t)sizeof(second));
+    wait_reports(3);
+    CU_ASSERT_EQUAL_FATAL(report_count, 3);
+    CU_ASSERT(reports[1].slot != reports[2].slot);
+    CU_ASSERT(memcmp(reports[1].bytes, second, sizeof(second)) == 0);
+    CU_ASSERT(memcmp(reports[2].bytes, second, sizeof(second)) == 0);
+
+    // A descriptor that ends is reported once and not read again
+    close(pipes[1][1]);
+    wait_reports(4);
+    CU_ASSERT_EQUAL_FATAL(report_count, 4);
+    CU_ASSERT_EQUAL(reports[3].slot, 1);
+    CU_ASSERT_EQUAL(reports[3].length, 0);
+
+    hid_uring_stop(&ring);
+    for (int i = 0; i < PIPES; i++)
+    {
+        close(pipes[i][0]);
+        if (i != 1)
+            close(pipes[i][1]);
+    }
+    uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+}
+
+void test_hid_uring_rejects_bad_sets(void)
+{
+    int fds[HID_URING_MAX_DEVICES + 1] = {0};
+    hid_uring_init(&ring);
+    CU_ASSERT(!hid_uring_start(&ring, uv_default_loop(), fds, 0, capture_report, &ring));
+    CU_ASSERT(!hid_uring_start(&ring, uv_default_loop(), fds, HID_URING_MAX_DEVICES + 1,
+                               capture_report, &ring));
+
+    // Stopping without a ring is harmless
+    hid_uring_stop(&ring);
+    hid_uring_stop(&ring);
+}
+
+int main(void)
+{
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+
+    CU_pSuite pSuite = CU_add_suite("io_uring Reader Tests", NULL, NULL);
+    if (NULL == pSuite)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((NULL == CU_add_test(pSuite, "test_hid_uring_reads_reports",
+                             test_hid_uring_reads_reports)) ||
+        (NULL == CU_add_test(pSuite, "test_hid_uring_rejects_bad_sets",
+                             test_hid_uring_rejects_bad_sets)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+    return CU_get_error();
+}
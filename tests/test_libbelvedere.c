@@ -0,0 +1,210 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <limits.h>  // for PATH_MAX
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>  // for mkdtemp, unlink, rmdir
+
+#include "../include/libbelvedere.h"
+
+#define MAX_CALLS 8
+
+static char temp_dir[] = "/tmp/belvedere_lib_XXXXXX";
+static char config_file[PATH_MAX];
+
+// Commands captured by the test executor, joined with spaces
+static char calls[MAX_CALLS][256];
+static int call_count = 0;
+
+static int capture_executor(char* const argv[])
+{
+    if (call_count >= MAX_CALLS)
+        return -1;
+
+    char* out = calls[call_count++];
+    out[0] = '\0';
+    for (size_t i = 0; argv[i]; i++)
+    {
+        if (i > 0)
+            strcat(out, " ");
+        strcat(out, argv[i]);
+    }
+    return 0;
+}
+
+static bool write_config(bool devices)
+{
+    FILE* f = fopen(config_file, "w");
+    if (!f)
+        return false;
+    fprintf(f, "[general]\n");
+    fprintf(f, "setleds = setleds\n");
+    fprintf(f, "monitored_keycodes = 1\n");
+    if (devices)
+    {
+        fprintf(f, "[0x5043/0x54a3]\n");
+        fprintf(f, "1 = +scroll\n");
+        fprintf(f, "[0x5043/0x54a3:nav]\n");
+        fprintf(f, "1 = -scroll\n");
+    }
+    fclose(f);
+    return true;
+}
+
+void test_libbelvedere_create(void)
+{
+    belvedere_options_t options = {.config_path = config_file, .watch_config = false};
+    CU_ASSERT_FATAL(write_config(false));
+    CU_ASSERT_PTR_NULL(belvedere_create(&options));  // no devices to read
+
+    CU_ASSERT_FATAL(write_config(true));
+    belvedere_t* ctx = belvedere_create(&options);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ctx);
+    CU_ASSERT_STRING_EQUAL(belvedere_layer(ctx), "base");
+    CU_ASSERT(belvedere_poll_fd(ctx) >= 0);
+
+    // Instances share nothing: each has its own layer, counters and executor
+    belvedere_t* other = belvedere_create(&options);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(other);
+    belvedere_set_executor(other, capture_executor);
+    call_count = 0;
+    CU_ASSERT(belvedere_set_layer(other, "nav"));
+    CU_ASSERT_STRING_EQUAL(belvedere_layer(ctx), "base");
+    CU_ASSERT(belvedere_feed_key(other, 0x5043, 0x54a3, 1, 0, true));
+    CU_ASSERT_EQUAL(call_count, 1);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds -scroll");
+
+    belvedere_stats_t stats;
+    belvedere_get_stats(ctx, &stats);
+    CU_ASSERT_EQUAL(stats.dispatched, 0);
+    belvedere_get_stats(other, &stats);
+    CU_ASSERT_EQUAL(stats.dispatched, 1);
+
+    // Destroying one leaves the other running
+    belvedere_destroy(other);
+    belvedere_set_executor(ctx, capture_executor);
+    CU_ASSERT(belvedere_feed_key(ctx, 0x5043, 0x54a3, 1, 0, true));
+    CU_ASSERT_EQUAL(call_count, 2);
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds +scroll");
+    belvedere_destroy(ctx);
+}
+
+void test_libbelvedere_feed_key(void)
+{
+    belvedere_options_t options = {.config_path = config_file, .watch_config = false};
+    CU_ASSERT_FATAL(write_config(true));
+    belvedere_t* ctx = belvedere_create(&options);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ctx);
+    belvedere_set_executor(ctx, capture_executor);
+    call_count = 0;
+
+    belvedere_stats_t before;
+    belvedere_stats_t after;
+    belvedere_get_stats(ctx, &before);
+    CU_ASSERT_EQUAL(before.devices, 0);
+
+    // Events go straight to dispatch without a device behind them
+    CU_ASSERT(belvedere_feed_key(ctx, 0x5043, 0x54a3, 1, 0, true));
+    belvedere_feed_key(ctx, 0x5043, 0x54a3, 1, 0, false);
+    CU_ASSERT_FALSE(belvedere_feed_key(ctx, 0x5043, 0x54a3, 2, 0, true));
+    CU_ASSERT_EQUAL(call_count, 1);
+    CU_ASSERT_STRING_EQUAL(calls[0], "setleds +scroll");
+
+    CU_ASSERT(belvedere_set_layer(ctx, "nav"));
+    CU_ASSERT_STRING_EQUAL(belvedere_layer(ctx), "nav");
+    CU_ASSERT_FALSE(belvedere_set_layer(ctx, "missing"));
+    CU_ASSERT_STRING_EQUAL(belvedere_layer(ctx), "nav");
+    CU_ASSERT(belvedere_feed_key(ctx, 0x5043, 0x54a3, 1, 0, true));
+    CU_ASSERT_EQUAL(call_count, 2);
+    belvedere_feed_key(ctx, 0x5043, 0x54a3, 1, 0, false);
+    CU_ASSERT_STRING_EQUAL(calls[1], "setleds -scroll");
+
+    belvedere_get_stats(ctx, &after);
+    CU_ASSERT_EQUAL(after.dispatched - before.dispatched, 2);
+    CU_ASSERT_EQUAL(after.unmatched - before.unmatched, 1);
+
+    // A rejected configuration leaves the running one in place
+    CU_ASSERT_FATAL(write_config(false));
+    CU_ASSERT_FALSE(belvedere_reload(ctx, false));
+    CU_ASSERT_STRING_EQUAL(belvedere_layer(ctx), "nav");
+    CU_ASSERT(belvedere_feed_key(ctx, 0x5043, 0x54a3, 1, 0, true));
+    CU_ASSERT_EQUAL(call_count, 3);
+    CU_ASSERT_STRING_EQUAL(calls[2], "setleds -scroll");
+    belvedere_feed_key(ctx, 0x5043, 0x54a3, 1, 0, false);
+
+    CU_ASSERT_FATAL(write_config(true));
+    CU_ASSERT(belvedere_reload(ctx, false));
+    CU_ASSERT(belvedere_set_layer(ctx, "base"));
+    CU_ASSERT(belvedere_feed_key(ctx, 0x5043, 0x54a3, 1, 0, true));
+    CU_ASSERT_EQUAL(call_count, 4);
+    CU_ASSERT_STRING_EQUAL(calls[3], "setleds +scroll");
+
+    // Both reloads are counted, whatever became of them
+    belvedere_get_stats(ctx, &after);
+    CU_ASSERT_EQUAL(after.reloads - before.reloads, 1);
+    CU_ASSERT_EQUAL(after.reloads_rejected - before.reloads_rejected, 1);
+    CU_ASSERT_EQUAL(after.device_reloads, before.device_reloads);
+
+    // Nothing keeps the engine busy without devices, so polling returns at once
+    belvedere_poll(ctx);
+    belvedere_destroy(ctx);
+}
+
+void test_libbelvedere_own_loop(void)
+{
+    uv_loop_t loop;
+    CU_ASSERT_FATAL(uv_loop_init(&loop) == 0);
+    belvedere_options_t options = {.config_path = config_file, .loop = &loop};
+    CU_ASSERT_FATAL(write_config(true));
+    belvedere_t* ctx = belvedere_create(&options);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ctx);
+    belvedere_set_executor(ctx, capture_executor);
+    call_count = 0;
+
+    // The engine's handles live on the given loop, not the default one
+    CU_ASSERT_EQUAL(belvedere_poll_fd(ctx), uv_backend_fd(&loop));
+    CU_ASSERT_FALSE(uv_loop_alive(uv_default_loop()));
+    CU_ASSERT(belvedere_feed_key(ctx, 0x5043, 0x54a3, 1, 0, true));
+    CU_ASSERT_EQUAL(call_count, 1);
+    belvedere_poll(ctx);
+
+    // Destroying the instance closes every handle, so the loop can be closed
+    belvedere_destroy(ctx);
+    CU_ASSERT_EQUAL(uv_loop_close(&loop), 0);
+}
+
+int main(void)
+{
+    if (!mkdtemp(temp_dir))
+        return 1;
+    snprintf(config_file, sizeof(config_file), "%s/config", temp_dir);
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+
+    CU_pSuite pSuite = CU_add_suite("Library Tests", NULL, NULL);
+    if (NULL == pSuite)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((NULL == CU_add_test(pSuite, "test_libbelvedere_create", test_libbelvedere_create)) ||
+        (NULL == CU_add_test(pSuite, "test_libbelvedere_feed_key", test_libbelvedere_feed_key)) ||
+        (NULL == CU_add_test(pSuite, "test_libbelvedere_own_loop", test_libbelvedere_own_loop)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+
+    unlink(config_file);
+    rmdir(temp_dir);
+    return CU_get_error();
+}
@@ -0,0 +1,135 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <time.h>
+#include <uv.h>
+
+#include "../include/loop_monitor.h"
+
+#define MS 1000000ULL
+
+static loop_monitor_t monitor;
+
+static void sleep_ms(long ms)
+{
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = ms * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+// Slow the first time; the second call only stops the timer, so an iteration always follows
+// the slow one and the monitor gets to count it
+static void on_slow_timer(uv_timer_t* handle)
+{
+    static int calls = 0;
+    if (++calls == 1)
+        sleep_ms(20);
+    else
+        uv_timer_stop(handle);
+}
+
+static void on_slow_async(uv_async_t* handle)
+{
+    sleep_ms(20);
+    uv_close((uv_handle_t*)handle, NULL);
+}
+
+void test_loop_monitor_stage_stalls(void)
+{
+    uv_loop_t loop;
+    loop_stats_t before;
+    loop_stats_t after;
+    CU_ASSERT_FATAL(uv_loop_init(&loop) == 0);
+    CU_ASSERT_FATAL(loop_monitor_init(&monitor, &loop, 5));
+    loop_monitor_get_stats(&monitor, &before);
+
+    // The stall is charged to the inner stage, not to the stage that called it
+    uint64_t outer = loop_monitor_begin(&monitor);
+    uint64_t inner = loop_monitor_begin(&monitor);
+    CU_ASSERT(outer != 0 && inner != 0);
+    sleep_ms(10);
+    loop_monitor_end(&monitor, LOOP_STAGE_DISPATCH, inner);
+    loop_monitor_end(&monitor, LOOP_STAGE_HID, outer);
+
+    loop_monitor_get_stats(&monitor, &after);
+    CU_ASSERT_EQUAL(after.stalls - before.stalls, 1);
+    CU_ASSERT_EQUAL(after.stage_stalls[LOOP_STAGE_DISPATCH] -
+                        before.stage_stalls[LOOP_STAGE_DISPATCH],
+                    1);
+    CU_ASSERT_EQUAL(after.stage_stalls[LOOP_STAGE_HID], before.stage_stalls[LOOP_STAGE_HID]);
+    CU_ASSERT(after.stage_max_ns[LOOP_STAGE_DISPATCH] >= 10 * MS);
+    CU_ASSERT(after.stage_max_ns[LOOP_STAGE_HID] < 5 * MS);
+
+    // Below the threshold, or with it disabled, only the timings are kept
+    loop_monitor_set_threshold(&monitor, 0);
+    outer = loop_monitor_begin(&monitor);
+    sleep_ms(6);
+    loop_monitor_end(&monitor, LOOP_STAGE_RELOAD, outer);
+    loop_monitor_get_stats(&monitor, &after);
+    CU_ASSERT_EQUAL(after.stalls - before.stalls, 1);
+    CU_ASSERT(after.stage_max_ns[LOOP_STAGE_RELOAD] >= 6 * MS);
+    CU_ASSERT_STRING_EQUAL(loop_monitor_stage_name(LOOP_STAGE_RELOAD), "reload");
+
+    loop_monitor_cleanup(&monitor);
+    CU_ASSERT_EQUAL(loop_monitor_begin(&monitor), 0);
+    uv_run(&loop, UV_RUN_NOWAIT);
+    CU_ASSERT_EQUAL(uv_loop_close(&loop), 0);
+}
+
+void test_loop_monitor_measures_lag(void)
+{
+    uv_loop_t loop;
+    uv_timer_t timer;
+    uv_async_t async;
+    loop_stats_t before;
+    loop_stats_t after;
+    CU_ASSERT_FATAL(uv_loop_init(&loop) == 0);
+    CU_ASSERT_FATAL(loop_monitor_init(&monitor, &loop, 15));
+    loop_monitor_get_stats(&monitor, &before);
+
+    // A slow timer callback, then a slow I/O callback; the monitor's own handles do not
+    // keep the loop running once both are done
+    uv_timer_init(&loop, &timer);
+    uv_timer_start(&timer, on_slow_timer, 1, 1);
+    uv_async_init(&loop, &async, on_slow_async);
+    uv_async_send(&async);
+    uv_run(&loop, UV_RUN_DEFAULT);
+
+    loop_monitor_get_stats(&monitor, &after);
+    CU_ASSERT(after.iterations > before.iterations);
+    CU_ASSERT(after.lag_max_ns >= 20 * MS);
+    CU_ASSERT(after.busy_ns - before.busy_ns >= 20 * MS);
+    CU_ASSERT(after.slow_iterations > before.slow_iterations);
+
+    uv_close((uv_handle_t*)&timer, NULL);
+    loop_monitor_cleanup(&monitor);
+    uv_run(&loop, UV_RUN_NOWAIT);
+    CU_ASSERT_EQUAL(uv_loop_close(&loop), 0);
+}
+
+int main(void)
+{
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+
+    CU_pSuite pSuite = CU_add_suite("Loop Monitor Tests", NULL, NULL);
+    if (NULL == pSuite)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((NULL == CU_add_test(pSuite, "test_loop_monitor_stage_stalls",
+                             test_loop_monitor_stage_stalls)) ||
+        (NULL == CU_add_test(pSuite, "test_loop_monitor_measures_lag",
+                             test_loop_monitor_measures_lag)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -0,0 +1,137 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/metrics.h"
+
+static char temp_dir[] = "/tmp/belvedere_metrics_XXXXXX";
+static metrics_t metrics;
+
+// Read a whole file into buf; returns false if it cannot be read
+static bool read_file(const char* path, char* buf, size_t size)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return false;
+    size_t n = fread(buf, 1, size - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    return true;
+}
+
+void test_metrics_device_counters(void)
+{
+    metrics_reset(&metrics);
+
+    // One counter per device and input, stable across lookups
+    uint64_t* hid = metrics_device_counter(&metrics, 0x5043, 0x54a3, INPUT_HID);
+    CU_ASSERT_PTR_EQUAL(metrics_device_counter(&metrics, 0x5043, 0x54a3, INPUT_HID), hid);
+    CU_ASSERT_PTR_NOT_EQUAL(metrics_device_counter(&metrics, 0x5043, 0x54a3, INPUT_EVDEV), hid);
+    (*hid)++;
+    CU_ASSERT_EQUAL(*metrics_device_counter(&metrics, 0x5043, 0x54a3, INPUT_HID), 1);
+
+    // Past the table, devices still get somewhere to count
+    for (uint16_t i = 0; i < METRICS_MAX_DEVICES; i++)
+    {
+        CU_ASSERT_PTR_NOT_NULL(metrics_device_counter(&metrics, 0x1000, i, INPUT_HID));
+    }
+    CU_ASSERT_PTR_EQUAL(metrics_device_counter(&metrics, 0x2000, 1, INPUT_HID),
+                        metrics_device_counter(&metrics, 0x2000, 2, INPUT_HID));
+}
+
+void test_metrics_export(void)
+{
+    char path[PATH_MAX];
+    char temp[PATH_MAX + 8];
+    static char text[16384];
+    snprintf(path, sizeof(path), "%s/belvedere.prom", temp_dir);
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    metrics_reset(&metrics);
+    *metrics_device_counter(&metrics, 0x5043, 0x54a3, INPUT_HID) += 3;
+    metrics_command_done(&metrics, 0, 2000000);     // 2ms
+    metrics_command_done(&metrics, 1, 30000000);    // 30ms
+    metrics_command_done(&metrics, 0, 5000000000);  // 5s
+    metrics.reloads = 2;
+    metrics.reloads_rejected = 1;
+    metrics.device_reloads = 4;
+
+    dispatch_stats_t dispatch = {.dispatched = 7, .debounced = 4, .failed = 1};
+    loop_stats_t loop = {.stage_stalls = {[LOOP_STAGE_DISPATCH] = 5}};
+    CU_ASSERT_FATAL(metrics_export(path, &metrics, &dispatch, &loop));
+    CU_ASSERT_FATAL(read_file(path, text, sizeof(text)));
+    CU_ASSERT(access(temp, F_OK) != 0);  // renamed into place
+
+    CU_ASSERT_PTR_NOT_NULL(
+        strstr(text, "belvedere_reports_read_total{device=\"5043:54a3\",input=\"hid\"} 3\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "\nbelvedere_actions_total 7\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "\nbelvedere_actions_failed_total 1\n"));
+    CU_ASSERT_PTR_NOT_NULL(
+        strstr(text, "belvedere_events_filtered_total{reason=\"debounce\"} 4\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "\nbelvedere_commands_total 3\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "\nbelvedere_commands_failed_total 1\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "\nbelvedere_reloads_total{result=\"ok\"} 2\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "\nbelvedere_reloads_total{result=\"rejected\"} 1\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "\nbelvedere_device_reloads_total 4\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "belvedere_loop_stalls_total{stage=\"dispatch\"} 5\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "# TYPE belvedere_spawn_latency_seconds histogram\n"));
+
+    // Buckets are cumulative, with the slow command only in +Inf
+    const char* buckets[] = {
+        "{le=\"0.001\"} 0\n", "{le=\"0.0025\"} 1\n", "{le=\"0.05\"} 2\n",
+        "{le=\"1\"} 2\n",     "{le=\"+Inf\"} 3\n",
+    };
+    for (size_t i = 0; i < sizeof(buckets) / sizeof(buckets[0]); i++)
+    {
+        char line[128];
+        snprintf(line, sizeof(line), "belvedere_spawn_latency_seconds_bucket%s", buckets[i]);
+        CU_ASSERT_PTR_NOT_NULL(strstr(text, line));
+    }
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "belvedere_spawn_latency_seconds_count 3\n"));
+
+    // A directory that does not exist is reported, not created
+    char missing[PATH_MAX];
+    snprintf(missing, sizeof(missing), "%s/missing/belvedere.prom", temp_dir);
+    CU_ASSERT(!metrics_export(missing, &metrics, &dispatch, &loop));
+
+    unlink(path);
+}
+
+int main(void)
+{
+    if (!mkdtemp(temp_dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+
+    CU_pSuite pSuite = CU_add_suite("Metrics Tests", NULL, NULL);
+    if (NULL == pSuite)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((NULL == CU_add_test(pSuite, "test_metrics_device_counters",
+                             test_metrics_device_counters)) ||
+        (NULL == CU_add_test(pSuite, "test_metrics_export", test_metrics_export)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+    rmdir(temp_dir);
+    return CU_get_error();
+}
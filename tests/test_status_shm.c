@@ -0,0 +1,179 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/status_shm.h"
+
+#define WRITES 200000
+#define READERS 3
+
+static char shm_name[64];
+
+// A status whose every field is derived from n, so a torn copy is easy to spot
+static void fill_status(status_t* status, uint64_t n)
+{
+    memset(status, 0, sizeof(*status));
+    status->leds = (uint8_t)n;
+    snprintf(status->layer, sizeof(status->layer), "layer%llu", (unsigned long long)n);
+    status->dispatched = n;
+    status->unmatched = n * 2;
+    status->filtered = n * 3;
+    status->failed = n * 4;
+    status->device_count = STATUS_MAX_DEVICES;
+    for (int i = 0; i < STATUS_MAX_DEVICES; i++)
+    {
+        status->devices[i].vendor_id = (uint16_t)n;
+        status->devices[i].product_id = (uint16_t)i;
+        status->devices[i].reports = n + (uint64_t)i;
+    }
+}
+
+static bool consistent(const status_t* status)
+{
+    uint64_t n = status->dispatched;
+    status_t expected;
+    fill_status(&expected, n);
+    expected.updated_ns = status->updated_ns;
+    return memcmp(status, &expected, sizeof(expected)) == 0;
+}
+
+void test_status_shm_round_trip(void)
+{
+    status_writer_t writer = {0};
+    status_t status;
+    status_t read;
+    CU_ASSERT_PTR_NULL(status_shm_attach(shm_name));
+    CU_ASSERT_FATAL(status_shm_create(&writer, shm_name));
+
+    // Readers see an empty status until the first update
+    const status_shm_t* shm = status_shm_attach(shm_name);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(shm);
+    CU_ASSERT(status_shm_read(shm, &read));
+    CU_ASSERT_EQUAL(read.device_count, 0);
+    CU_ASSERT_EQUAL(read.updated_ns, 0);
+
+    fill_status(&status, 7);
+    CU_ASSERT(status_shm_publish(&writer, &status));
+    CU_ASSERT(status_shm_read(shm, &read));
+    CU_ASSERT_STRING_EQUAL(read.layer, "layer7");
+    CU_ASSERT_EQUAL(read.devices[3].reports, 10);
+    CU_ASSERT(read.updated_ns != 0);
+    CU_ASSERT(consistent(&read));
+
+    // An unchanged status is not written again
+    uint32_t sequence = atomic_load(&shm->sequence);
+    fill_status(&status, 7);
+    CU_ASSERT_FALSE(status_shm_publish(&writer, &status));
+    CU_ASSERT_EQUAL(atomic_load(&shm->sequence), sequence);
+
+    // Mapped readers keep the last status once the segment is removed
+    status_shm_destroy(&writer);
+    CU_ASSERT_PTR_NULL(status_shm_attach(shm_name));
+    CU_ASSERT(status_shm_read(shm, &read));
+    CU_ASSERT_EQUAL(read.dispatched, 7);
+    status_shm_detach(shm);
+    CU_ASSERT_FALSE(status_shm_publish(&writer, &status));
+}
+
+typedef struct
+{
+    const status_shm_t* shm;
+    atomic_bool* done;
+    uint64_t reads;
+    uint64_t torn;
+    uint64_t last;  // highest update seen; updates never go backwards
+    uint64_t backwards;
+} reader_t;
+
+static void* read_loop(void* arg)
+{
+    reader_t* reader = arg;
+    status_t status;
+    while (!atomic_load(reader->done))
+    {
+        // Nothing published yet, or a writer mid-update for all of our attempts
+        if (!status_shm_read(reader->shm, &status) || status.updated_ns == 0)
+            continue;
+        reader->reads++;
+        if (!consistent(&status))
+            reader->torn++;
+        if (status.dispatched < reader->last)
+            reader->backwards++;
+        reader->last = status.dispatched;
+    }
+    return NULL;
+}
+
+void test_status_shm_concurrent_reads(void)
+{
+    status_writer_t writer = {0};
+    CU_ASSERT_FATAL(status_shm_create(&writer, shm_name));
+    const status_shm_t* shm = status_shm_attach(shm_name);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(shm);
+
+    atomic_bool done = false;
+    pthread_t threads[READERS];
+    reader_t readers[READERS];
+    for (int i = 0; i < READERS; i++)
+    {
+        readers[i] = (reader_t){.shm = shm, .done = &done};
+        CU_ASSERT_FATAL(pthread_create(&threads[i], NULL, read_loop, &readers[i]) == 0);
+    }
+
+    // Rewrite every field as fast as possible while the readers copy
+    status_t status;
+    for (uint64_t n = 1; n <= WRITES; n++)
+    {
+        fill_status(&status, n);
+        status_shm_publish(&writer, &status);
+    }
+    atomic_store(&done, true);
+
+    for (int i = 0; i < READERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        CU_ASSERT(readers[i].reads > 0);
+        CU_ASSERT_EQUAL(readers[i].torn, 0);
+        CU_ASSERT_EQUAL(readers[i].backwards, 0);
+    }
+
+    status_t read;
+    CU_ASSERT(status_shm_read(shm, &read));
+    CU_ASSERT_EQUAL(read.dispatched, WRITES);
+    status_shm_detach(shm);
+    status_shm_destroy(&writer);
+}
+
+int main(void)
+{
+    snprintf(shm_name, sizeof(shm_name), "/belvedere_test_%d", (int)getpid());
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+
+    CU_pSuite pSuite = CU_add_suite("Status Segment Tests", NULL, NULL);
+    if (NULL == pSuite)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((NULL == CU_add_test(pSuite, "test_status_shm_round_trip", test_status_shm_round_trip)) ||
+        (NULL == CU_add_test(pSuite, "test_status_shm_concurrent_reads",
+                             test_status_shm_concurrent_reads)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+    return CU_get_error();
+}
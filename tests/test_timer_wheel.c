@@ -0,0 +1,182 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/timer_wheel.h"
+
+#define TIMER_COUNT 2000
+
+typedef struct
+{
+    wheel_timer_t timer;
+    uint64_t due;
+    uint64_t fired_at;
+    int fired;
+} test_timer_t;
+
+static timer_wheel_t wheel;
+static test_timer_t timers[TIMER_COUNT];
+
+static void on_fire(wheel_timer_t* timer)
+{
+    test_timer_t* t = timer->data;
+    t->fired++;
+    t->fired_at = wheel.now;
+}
+
+// Each timer fires exactly once, on its due tick, across every wheel level
+void test_timer_wheel_fires_on_time(void)
+{
+    CU_ASSERT_FATAL(timer_wheel_init(&wheel, NULL, NULL));
+    memset(timers, 0, sizeof(timers));
+
+    srand(1234);
+    for (int i = 0; i < TIMER_COUNT; i++)
+    {
+        uint64_t delay = (i % 4 == 0) ? (uint64_t)(rand() % 60)
+                       : (i % 4 == 1) ? (uint64_t)(rand() % 4000)
+                       : (i % 4 == 2) ? (uint64_t)(rand() % 250000)
+                                      : (uint64_t)(rand() % 1000000);
+        timers[i].due = wheel.now + (delay ? delay : 1);
+        timer_wheel_schedule(&wheel, &timers[i].timer, delay, on_fire, &timers[i]);
+    }
+    CU_ASSERT(wheel.count == TIMER_COUNT);
+
+    // Advance in uneven steps, as a stalled loop would
+    uint64_t now = 0;
+    while (wheel.count > 0)
+    {
+        now += 1 + (uint64_t)(rand() % 500);
+        timer_wheel_advance(&wheel, now);
+    }
+
+    for (int i = 0; i < TIMER_COUNT; i++)
+    {
+        CU_ASSERT(timers[i].fired == 1);
+        CU_ASSERT(timers[i].fired_at == timers[i].due);
+    }
+    timer_wheel_close(&wheel);
+}
+
+// Cancelled timers never fire and no longer count as pending
+void test_timer_wheel_cancel(void)
+{
+    CU_ASSERT_FATAL(timer_wheel_init(&wheel, NULL, NULL));
+    memset(timers, 0, sizeof(timers));
+
+    for (int i = 0; i < 100; i++)
+    {
+        timer_wheel_schedule(&wheel, &timers[i].timer, (uint64_t)i * 100, on_fire, &timers[i]);
+    }
+    for (int i = 0; i < 100; i += 2)
+    {
+        timer_wheel_cancel(&wheel, &timers[i].timer);
+        CU_ASSERT(!timer_wheel_pending(&timers[i].timer));
+    }
+    CU_ASSERT(wheel.count == 50);
+
+    timer_wheel_advance(&wheel, 100000);
+    for (int i = 0; i < 100; i++)
+    {
+        CU_ASSERT(timers[i].fired == (i % 2));
+    }
+    CU_ASSERT(wheel.count == 0);
+    timer_wheel_close(&wheel);
+}
+
+static void reschedule(wheel_timer_t* timer)
+{
+    test_timer_t* t = timer->data;
+    if (++t->fired < 3)
+        timer_wheel_schedule(&wheel, timer, 0, reschedule, t);
+}
+
+// A callback may reschedule its own timer; a zero delay runs on the next tick
+void test_timer_wheel_reschedule_from_callback(void)
+{
+    CU_ASSERT_FATAL(timer_wheel_init(&wheel, NULL, NULL));
+    memset(timers, 0, sizeof(timers));
+
+    timer_wheel_schedule(&wheel, &timers[0].timer, 10, reschedule, &timers[0]);
+    timer_wheel_advance(&wheel, 10);
+    CU_ASSERT(timers[0].fired == 1);
+    timer_wheel_advance(&wheel, 11);
+    CU_ASSERT(timers[0].fired == 2);
+    timer_wheel_advance(&wheel, 20);
+    CU_ASSERT(timers[0].fired == 3);
+    CU_ASSERT(wheel.count == 0);
+    timer_wheel_close(&wheel);
+}
+
+static int loop_wakeups;
+
+static void on_prepare(uv_prepare_t* handle)
+{
+    (void)handle;  // Silence unused parameter warning
+    loop_wakeups++;
+}
+
+// On a loop, the wheel sleeps until its next timer is due instead of waking every tick
+void test_timer_wheel_sleeps_until_due(void)
+{
+    uv_loop_t loop;
+    uv_prepare_t prepare;
+    CU_ASSERT_FATAL(uv_loop_init(&loop) == 0);
+    CU_ASSERT_FATAL(timer_wheel_init(&wheel, &loop, NULL));
+    memset(timers, 0, sizeof(timers));
+
+    uv_prepare_init(&loop, &prepare);
+    uv_prepare_start(&prepare, on_prepare);
+    uv_unref((uv_handle_t*)&prepare);
+    loop_wakeups = 0;
+
+    timer_wheel_schedule(&wheel, &timers[0].timer, 30, on_fire, &timers[0]);
+    timer_wheel_schedule(&wheel, &timers[1].timer, 100, on_fire, &timers[1]);
+    uint64_t started = uv_now(&loop);
+    uv_run(&loop, UV_RUN_DEFAULT);
+
+    CU_ASSERT(timers[0].fired == 1);
+    CU_ASSERT(timers[1].fired == 1);
+    CU_ASSERT(uv_now(&loop) - started >= 100);
+    CU_ASSERT(loop_wakeups < 10);
+
+    timer_wheel_close(&wheel);
+    uv_close((uv_handle_t*)&prepare, NULL);
+    uv_run(&loop, UV_RUN_DEFAULT);
+    CU_ASSERT(uv_loop_close(&loop) == 0);
+}
+
+int main(void)
+{
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        return CU_get_error();
+    }
+
+    CU_pSuite pSuite = CU_add_suite("Timer Wheel Tests", NULL, NULL);
+    if (NULL == pSuite)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if ((NULL == CU_add_test(pSuite, "test_timer_wheel_fires_on_time",
+                             test_timer_wheel_fires_on_time)) ||
+        (NULL == CU_add_test(pSuite, "test_timer_wheel_cancel", test_timer_wheel_cancel)) ||
+        (NULL == CU_add_test(pSuite, "test_timer_wheel_reschedule_from_callback",
+                             test_timer_wheel_reschedule_from_callback)) ||
+        (NULL == CU_add_test(pSuite, "test_timer_wheel_sleeps_until_due",
+                             test_timer_wheel_sleeps_until_due)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    return CU_get_error();
+}
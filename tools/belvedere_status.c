@@ -0,0 +1,125 @@
+// belvedere_status.c - print the state a running daemon publishes in shared memory
+//
+// Usage: belvedere-status [--devices] [--watch MS] [NAME]
+//
+// Reads the segment named by the daemon's `status` option (default /belvedere) without
+// talking to the daemon. Prints one line of key=value pairs; --devices adds a line per open
+// device, and --watch prints again each time the state changes, checking every MS.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/led_state.h"
+#include "../include/status_shm.h"
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "Usage: %s [--devices] [--watch MS] [NAME]\n", argv0);
+}
+
+// Comma-separated names of the LEDs in a mask, or "none"
+static const char* led_names(uint8_t leds, char* buf, size_t size)
+{
+    static const struct
+    {
+        uint8_t mask;
+        const char* name;
+    } names[] = {
+        {LED_NUM, "num"},         {LED_CAPS, "caps"}, {LED_SCROLL, "scroll"},
+        {LED_COMPOSE, "compose"}, {LED_KANA, "kana"},
+    };
+
+    size_t len = 0;
+    buf[0] = '\0';
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if ((leds & names[i].mask) && len < size)
+            len += (size_t)snprintf(buf + len, size - len, "%s%s", len ? "," : "", names[i].name);
+    }
+    return len ? buf : "none";
+}
+
+static void print_status(const status_t* status, bool devices)
+{
+    char leds[64];
+    printf("layer=%s leds=%s dispatched=%llu unmatched=%llu filtered=%llu failed=%llu "
+           "devices=%u\n",
+           status->layer[0] ? status->layer : "-", led_names(status->leds, leds, sizeof(leds)),
+           (unsigned long long)status->dispatched, (unsigned long long)status->unmatched,
+           (unsigned long long)status->filtered, (unsigned long long)status->failed,
+           status->device_count);
+
+    for (uint32_t i = 0; devices && i < status->device_count && i < STATUS_MAX_DEVICES; i++)
+    {
+        const status_device_t* dev = &status->devices[i];
+        printf("  %04x:%04x input=%s led_sync=%d leds=%s reports=%llu\n", dev->vendor_id,
+               dev->product_id, dev->input ? "evdev" : "hid", dev->led_sync,
+               led_names(dev->leds, leds, sizeof(leds)), (unsigned long long)dev->reports);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* name = STATUS_SHM_DEFAULT;
+    bool devices = false;
+    long watch_ms = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--devices") == 0)
+        {
+            devices = true;
+        }
+        else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+        {
+            watch_ms = strtol(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] != '-')
+        {
+            name = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const status_shm_t* shm = status_shm_attach(name);
+    if (!shm)
+    {
+        fprintf(stderr, "No belvedere status at %s; is the daemon running with status = %s?\n",
+                name, name);
+        return 1;
+    }
+
+    // Each check is a copy out of the mapping; only the sleep between checks enters the kernel
+    struct timespec interval = {.tv_sec = watch_ms / 1000, .tv_nsec = (watch_ms % 1000) * 1000000L};
+    status_t status;
+    bool printed = false;
+    uint64_t shown = 0;
+    do
+    {
+        if (!status_shm_read(shm, &status))
+        {
+            fprintf(stderr, "Status at %s is not settling\n", name);
+            status_shm_detach(shm);
+            return 1;
+        }
+        if (!printed || status.updated_ns != shown)
+        {
+            print_status(&status, devices);
+            printed = true;
+            shown = status.updated_ns;
+        }
+        if (watch_ms > 0)
+            nanosleep(&interval, NULL);
+    } while (watch_ms > 0);
+
+    status_shm_detach(shm);
+    return 0;
+}